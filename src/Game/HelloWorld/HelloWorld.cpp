@@ -2,6 +2,18 @@
 extern void BaseListTest();
 extern void BaseHashTest();
 extern void RezFileTest();
+extern void RezFileStressTest();
+extern void RezFileLargeTest();
+extern void RezFileMemoryTest();
+extern void RezFileCompressTest();
+extern void RezFileDedupTest();
+extern void RezFileChecksumTest();
+extern void RezFilePatchTest();
+extern void RezFileAlignTest();
+extern void RezFileIndexTest();
+extern void RezFileAsyncTest();
+extern void RezFileCopyTest();
+extern void RezFileEmulationTest();
 
 int main()
 {
@@ -0,0 +1,127 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kAlignRezFile = "RezFileAlignTest.rez";
+
+const int           kAlignNumItems = 40;
+const unsigned long kAlignThreshold = 64 * 1024;
+const unsigned long kAlignBoundary = 4096;
+
+// every fourth item is over the threshold, the rest are small and odd sized so the big ones never land on a page by chance
+static unsigned long AlignItemSize(int item)
+{
+	return ((item % 4) == 3) ? kAlignThreshold + item * 1001 : 100 + item * 37;
+}
+
+static unsigned char AlignByte(int item, unsigned long offset)
+{
+	return (unsigned char)(offset * 7 + item);
+}
+
+static int AlignCreateFile(RezMemoryImage* image)
+{
+	RezMgr mgr;
+	mgr.SetItemAlignment(kAlignThreshold, kAlignBoundary);
+	mgr.SetWriteCombine(256 * 1024);
+	if ((image != nullptr) ? !mgr.OpenMemory(image) : !mgr.Open(kAlignRezFile, false, true)) return 1;
+
+	int numErrors = 0;
+	unsigned long long padding = 0;
+	RezPos end = 0;
+	for (int i = 0; i < kAlignNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(AlignItemSize(i));
+		for (unsigned long j = 0; j < AlignItemSize(i); ++j) data[j] = AlignByte(i, j);
+		if (!item->Save()) ++numErrors;
+		item->UnLoad();
+
+		// big items start on the boundary, small ones right after the last item
+		RezPos pos = item->DirectRead_GetFileOffset();
+		if (AlignItemSize(i) >= kAlignThreshold)
+		{
+			if (((pos % kAlignBoundary) != 0) || ((end > 0) && ((pos < end) || (pos - end >= kAlignBoundary)))) ++numErrors;
+			if (end > 0) padding += pos - end;
+		}
+		else if ((end > 0) && (pos != end))
+		{
+			++numErrors;
+		}
+		end = pos + AlignItemSize(i);
+	}
+
+	RezWriteStats stats;
+	mgr.GetWriteStats(&stats);
+	if ((stats.numAligned != kAlignNumItems / 4) || (stats.bytesPadding != padding) || (padding == 0)) ++numErrors;
+
+	mgr.ForceIsSortedFlag(true);
+	if (!mgr.Close()) ++numErrors;
+	return numErrors;
+}
+
+static int AlignCheck(RezFileAccess fileAccess, unsigned long directIOThreshold, RezMemoryImage* image)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	mgr.SetDirectIOThreshold(directIOThreshold);
+	if ((image != nullptr) ? !mgr.OpenMemory(image, true, false) : !mgr.Open(kAlignRezFile)) return 1;
+
+	int numErrors = 0;
+	for (int i = 0; i < kAlignNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+		unsigned char* data = (item != nullptr) ? item->Load() : nullptr;
+		if ((data == nullptr) || (item->GetSize() != AlignItemSize(i)))
+		{
+			++numErrors;
+			continue;
+		}
+		for (unsigned long j = 0; j < AlignItemSize(i); ++j)
+		{
+			if (data[j] != AlignByte(i, j))
+			{
+				++numErrors;
+				break;
+			}
+		}
+
+		// loaded data can be changed in place, even when it is a view of a mapped file
+		if (image == nullptr) data[0] = (unsigned char)~data[0];
+		item->UnLoad();
+	}
+
+	// the directory can still be read in as one block, padding and all
+	if ((fileAccess == RezFileAccessStdio) && (image == nullptr))
+	{
+		RezItem* item = mgr.GetRootDir()->GetRez("ITEM7", mgr.StrToType("DAT"));
+		if (!mgr.GetRootDir()->Load() || (item == nullptr) || (item->Load() == nullptr) || (item->Load()[5] != AlignByte(7, 5))) ++numErrors;
+		mgr.GetRootDir()->UnLoad();
+	}
+
+	mgr.Close();
+	return numErrors;
+}
+
+void RezFileAlignTest()
+{
+	int numErrors = AlignCreateFile(nullptr);
+	numErrors += AlignCheck(RezFileAccessStdio, 0, nullptr);
+	numErrors += AlignCheck(RezFileAccessMapped, 0, nullptr);
+	numErrors += AlignCheck(RezFileAccessPositional, kAlignThreshold, nullptr);
+
+	RezMemoryImage image;
+	numErrors += AlignCreateFile(&image);
+	numErrors += AlignCheck(RezFileAccessStdio, 0, &image);
+
+	remove(kAlignRezFile);
+
+	printf("RezFileAlignTest: %d errors\n", numErrors);
+}
\ No newline at end of file
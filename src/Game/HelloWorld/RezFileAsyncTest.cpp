@@ -0,0 +1,108 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <atomic>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kAsyncRezFile = "RezFileAsyncTest.rez";
+
+// twice as many loads as RezFileAsync keeps in flight, so the queue is full while the callbacks chain more
+const int kAsyncNumFirst = 1024;
+const int kAsyncNumItems = kAsyncNumFirst * 2;
+
+static RezItem*         g_AsyncItems[kAsyncNumItems];
+static std::atomic<int> g_AsyncLoaded;
+static std::atomic<int> g_AsyncErrors;
+
+static unsigned long AsyncItemSize(int item)
+{
+	return 64 + (unsigned long)(item % 500);
+}
+
+static unsigned char AsyncByte(int item, unsigned long offset)
+{
+	return (unsigned char)(item * 13 + offset);
+}
+
+static bool AsyncCreateFile()
+{
+	RezMgr mgr;
+	if (!mgr.Open(kAsyncRezFile, false, true)) return false;
+
+	for (int i = 0; i < kAsyncNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(AsyncItemSize(i));
+		for (unsigned long j = 0; j < AsyncItemSize(i); ++j) data[j] = AsyncByte(i, j);
+		item->Save();
+		item->UnLoad();
+	}
+
+	return mgr.Close();
+}
+
+// every load of one of the first items starts the load of its partner from the reader thread
+static void AsyncLoaded(RezItem* rezItem, unsigned char* data, void* userData)
+{
+	int i = (int)(size_t)userData;
+	if ((data == nullptr) || (rezItem != g_AsyncItems[i]) || (rezItem->GetSize() != AsyncItemSize(i)) ||
+		(data[0] != AsyncByte(i, 0)) || (data[AsyncItemSize(i) - 1] != AsyncByte(i, AsyncItemSize(i) - 1)))
+	{
+		++g_AsyncErrors;
+	}
+	++g_AsyncLoaded;
+
+	if (i < kAsyncNumFirst)
+	{
+		int next = i + kAsyncNumFirst;
+		if (!g_AsyncItems[next]->LoadAsync(&AsyncLoaded, (void*)(size_t)next)) ++g_AsyncErrors;
+	}
+}
+
+void RezFileAsyncTest()
+{
+	if (!AsyncCreateFile())
+	{
+		printf("RezFileAsyncTest: unable to create %s\n", kAsyncRezFile);
+		return;
+	}
+
+	RezMgr mgr;
+	mgr.SetFileAccess(RezFileAccessAsync);
+	if (!mgr.Open(kAsyncRezFile))
+	{
+		printf("RezFileAsyncTest: unable to open %s\n", kAsyncRezFile);
+		return;
+	}
+
+	g_AsyncLoaded = 0;
+	g_AsyncErrors = 0;
+	for (int i = 0; i < kAsyncNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+		g_AsyncItems[i] = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+		if (g_AsyncItems[i] == nullptr)
+		{
+			printf("RezFileAsyncTest: %s is missing\n", name);
+			return;
+		}
+	}
+
+	for (int i = 0; i < kAsyncNumFirst; ++i)
+	{
+		if (!g_AsyncItems[i]->LoadAsync(&AsyncLoaded, (void*)(size_t)i)) ++g_AsyncErrors;
+	}
+	mgr.WaitForAsyncLoads();
+
+	int numErrors = g_AsyncErrors;
+	if (g_AsyncLoaded != kAsyncNumItems) ++numErrors;
+
+	mgr.Close();
+	remove(kAsyncRezFile);
+
+	printf("RezFileAsyncTest: %d loads, %d errors\n", (int)g_AsyncLoaded, numErrors);
+}
\ No newline at end of file
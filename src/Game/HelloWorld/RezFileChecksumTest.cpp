@@ -0,0 +1,275 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <chrono>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kChecksumRezFile = "RezFileChecksumTest.rez";
+static const char* kChecksumBenchRezFile = "RezFileChecksumBench.rez";
+
+const int           kChecksumNumItems = 12;
+const unsigned long kChecksumItemSize = 100000;
+const int           kChecksumBenchNumItems = 16;
+const unsigned long kChecksumBenchItemSize = 4 * 1024 * 1024;
+const int           kChecksumBenchRounds = 8;
+const int           kChecksumBenchTries = 3;
+
+static unsigned char ChecksumByte(int item, unsigned long offset)
+{
+	return (unsigned char)("the quick brown fox jumps over the lazy dog "[(offset + item) % 44] + ((offset / 4096) % 3));
+}
+
+// a third of the items are stored as is, a third compressed whole and a third compressed in chunks
+static unsigned long ChecksumType(RezMgr* mgr, int item)
+{
+	static const char* types[3] = { "TXT", "DAT", "MAP" };
+	return mgr->StrToType(types[item % 3]);
+}
+
+static int ChecksumCrc()
+{
+	int numErrors = 0;
+	if (RezCrc32c("123456789", 9) != 0xe3069283) ++numErrors;
+	if (RezCrc32c("", 0) != 0) ++numErrors;
+
+	// any split of the data must give the same result as doing it all at once, over every alignment
+	unsigned char data[3 * 8192 + 100];
+	for (unsigned long i = 0; i < sizeof(data); ++i) data[i] = ChecksumByte(7, i * 31);
+	unsigned int whole = RezCrc32c(data + 3, sizeof(data) - 3);
+	for (unsigned long split = 0; split < sizeof(data) - 3; split += 997)
+	{
+		if (RezCrc32c(data + 3 + split, sizeof(data) - 3 - split, RezCrc32c(data + 3, split)) != whole) ++numErrors;
+	}
+	return numErrors;
+}
+
+// returns the file position of the first byte of ITEM0, which is stored as is
+static RezPos ChecksumCreateFile()
+{
+	RezMgr mgr;
+	mgr.SetChecksums(true);
+	mgr.SetCompression(mgr.StrToType("DAT"), RezCodecLZ4, 1, 0);
+	mgr.SetCompression(mgr.StrToType("MAP"), RezCodecLZ4, 1, 16 * 1024);
+	if (!mgr.Open(kChecksumRezFile, false, true)) return 0;
+
+	bool saved = true;
+	for (int i = 0; i < kChecksumNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, ChecksumType(&mgr, i));
+		unsigned char* data = item->Create(kChecksumItemSize);
+		for (unsigned long j = 0; j < kChecksumItemSize; ++j) data[j] = ChecksumByte(i, j);
+		if (!item->Save() || !item->HasChecksum() || (item->GetChecksum() != RezCrc32c(data, kChecksumItemSize))) saved = false;
+		item->UnLoad();
+	}
+
+	RezPos pos = mgr.GetRootDir()->GetRez("ITEM0", mgr.StrToType("TXT"))->DirectRead_GetFileOffset();
+	if (!mgr.Close() || !saved) return 0;
+	return pos;
+}
+
+static int ChecksumLoadAll(RezMgr* mgr)
+{
+	int numErrors = 0;
+	for (int i = 0; i < kChecksumNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr->GetRootDir()->GetRez(name, ChecksumType(mgr, i));
+		if ((item == nullptr) || !item->HasChecksum() || (item->Load() == nullptr)) ++numErrors;
+		if (item != nullptr) item->UnLoad();
+	}
+	return numErrors;
+}
+
+static int ChecksumVerify(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	mgr.SetChecksumVerify(RezChecksumVerifyFirstLoad);
+	if (!mgr.Open(kChecksumRezFile)) return 1;
+
+	// checked the first time round only
+	int numErrors = ChecksumLoadAll(&mgr);
+	numErrors += ChecksumLoadAll(&mgr);
+
+	RezChecksumStats stats;
+	mgr.GetChecksumStats(&stats);
+	if ((stats.numVerified != kChecksumNumItems) || (stats.numFailed != 0) ||
+		(stats.bytesVerified != (unsigned long long)kChecksumNumItems * kChecksumItemSize)) ++numErrors;
+
+	// and every time from now on
+	mgr.SetChecksumVerify(RezChecksumVerifyAlways);
+	numErrors += ChecksumLoadAll(&mgr);
+	numErrors += ChecksumLoadAll(&mgr);
+
+	RezItem* items[kChecksumNumItems];
+	for (int i = 0; i < kChecksumNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+		items[i] = mgr.GetRootDir()->GetRez(name, ChecksumType(&mgr, i));
+	}
+	if (!mgr.LoadBatch(items, kChecksumNumItems)) ++numErrors;
+	for (int i = 0; i < kChecksumNumItems; ++i) items[i]->UnLoad();
+
+	mgr.GetChecksumStats(&stats);
+	if ((stats.numVerified != 4 * kChecksumNumItems) || (stats.numFailed != 0)) ++numErrors;
+
+	mgr.Close();
+	return numErrors;
+}
+
+// flips a byte of ITEM0 in the file as if the disk had
+static bool ChecksumCorrupt(RezPos pos)
+{
+	FILE* fp = fopen(kChecksumRezFile, "r+b");
+	if (fp == nullptr) return false;
+
+	bool ret = (fseek(fp, (long)pos + 1234, SEEK_SET) == 0);
+	int c = ret ? fgetc(fp) : EOF;
+	ret = ret && (c != EOF) && (fseek(fp, (long)pos + 1234, SEEK_SET) == 0) && (fputc(c ^ 0x10, fp) != EOF);
+	return (fclose(fp) == 0) && ret;
+}
+
+static int ChecksumDetect(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kChecksumRezFile)) return 1;
+
+	// nothing is checked unless asked for
+	int numErrors = 0;
+	RezItem* item = mgr.GetRootDir()->GetRez("ITEM0", mgr.StrToType("TXT"));
+	if ((item == nullptr) || (item->Load() == nullptr)) return numErrors + 1;
+	item->UnLoad();
+
+	mgr.SetChecksumVerify(RezChecksumVerifyFirstLoad);
+	if ((item->Load() != nullptr) || item->VerifyChecksum()) ++numErrors;
+
+	// the other items are still fine
+	RezItem* other = mgr.GetRootDir()->GetRez("ITEM1", mgr.StrToType("DAT"));
+	if ((other == nullptr) || (other->Load() == nullptr) || !other->VerifyChecksum()) ++numErrors;
+
+	RezChecksumStats stats;
+	mgr.GetChecksumStats(&stats);
+	if ((stats.numFailed != 2) || (stats.numVerified != 4)) ++numErrors;
+
+	mgr.Close();
+	return numErrors;
+}
+
+// MB/s of loading every item of the bench file kChecksumBenchRounds times, the best of a few tries
+static double ChecksumBenchLoad(RezChecksumVerify verify, bool direct)
+{
+	double best = 0.0;
+	for (int t = 0; t < kChecksumBenchTries; ++t)
+	{
+		RezMgr mgr;
+		mgr.SetFileAccess(RezFileAccessPositional);
+		mgr.SetChecksumVerify(verify);
+		if (direct) mgr.SetDirectIOThreshold(1);
+		if (!mgr.Open(kChecksumBenchRezFile)) return 0.0;
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < kChecksumBenchRounds; ++r)
+		{
+			for (int i = 0; i < kChecksumBenchNumItems; ++i)
+			{
+				char name[32];
+				sprintf(name, "ITEM%d", i);
+
+				RezItem* item = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+				if ((item == nullptr) || (item->Load() == nullptr))
+				{
+					mgr.Close();
+					return 0.0;
+				}
+				item->UnLoad();
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		mgr.Close();
+
+		double rate = (double)kChecksumBenchRounds * kChecksumBenchNumItems * kChecksumBenchItemSize / (1024.0 * 1024.0) / seconds;
+		if (rate > best) best = rate;
+	}
+	return best;
+}
+
+static double ChecksumBenchCrc()
+{
+	unsigned char* data = new unsigned char[kChecksumBenchItemSize];
+	for (unsigned long j = 0; j < kChecksumBenchItemSize; ++j) data[j] = ChecksumByte(0, j);
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	unsigned int sum = 0;
+	for (int r = 0; r < kChecksumBenchRounds * kChecksumBenchNumItems; ++r) sum += RezCrc32c(data, kChecksumBenchItemSize);
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	delete [] data;
+
+	// the sum keeps the loop from being thrown away
+	return (sum == 0) ? 0.0 : (double)kChecksumBenchRounds * kChecksumBenchNumItems * kChecksumBenchItemSize / (1024.0 * 1024.0) / seconds;
+}
+
+// Loads of big items read with positional I/O, which copies them out of the page cache (or off the disk with direct
+// I/O), with and without checking them. A mapped file hands out pointers without copying anything so there
+// checking an item is all the work its first Load does.
+static int ChecksumBench()
+{
+	RezMgr mgr;
+	mgr.SetChecksums(true);
+	if (!mgr.Open(kChecksumBenchRezFile, false, true)) return 1;
+	for (int i = 0; i < kChecksumBenchNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(kChecksumBenchItemSize);
+		for (unsigned long j = 0; j < kChecksumBenchItemSize; ++j) data[j] = ChecksumByte(i, j);
+		item->Save();
+		item->UnLoad();
+	}
+	if (!mgr.Close()) return 1;
+
+	double crc = ChecksumBenchCrc();
+	double cached = ChecksumBenchLoad(RezChecksumVerifyNone, false);
+	double cachedFirst = ChecksumBenchLoad(RezChecksumVerifyFirstLoad, false);
+	double cachedAlways = ChecksumBenchLoad(RezChecksumVerifyAlways, false);
+	double disk = ChecksumBenchLoad(RezChecksumVerifyNone, true);
+	double diskAlways = ChecksumBenchLoad(RezChecksumVerifyAlways, true);
+	if ((crc <= 0.0) || (cached <= 0.0) || (cachedFirst <= 0.0) || (cachedAlways <= 0.0) || (disk <= 0.0) || (diskAlways <= 0.0)) return 1;
+
+	printf("RezFileChecksumTest: RezCrc32c %.0f MB/s (%s)\n", crc, RezCrc32cIsHardware() ? "SSE 4.2" : "tables");
+	printf("RezFileChecksumTest: Load from the page cache %.0f MB/s, checked the first time %.0f MB/s (%+.1f%%), every time %.0f MB/s (%+.1f%%)\n",
+		   cached, cachedFirst, (cached / cachedFirst - 1.0) * 100.0, cachedAlways, (cached / cachedAlways - 1.0) * 100.0);
+	printf("RezFileChecksumTest: Load from the disk %.0f MB/s, checked every time %.0f MB/s (%+.1f%%)\n",
+		   disk, diskAlways, (disk / diskAlways - 1.0) * 100.0);
+	return 0;
+}
+
+void RezFileChecksumTest()
+{
+	int numErrors = ChecksumCrc();
+
+	RezPos pos = ChecksumCreateFile();
+	if (pos == 0) ++numErrors;
+
+	numErrors += ChecksumVerify(RezFileAccessMapped);
+	numErrors += ChecksumVerify(RezFileAccessStdio);
+
+	if ((pos == 0) || !ChecksumCorrupt(pos)) ++numErrors;
+	numErrors += ChecksumDetect(RezFileAccessMapped);
+	numErrors += ChecksumDetect(RezFileAccessStdio);
+
+	numErrors += ChecksumBench();
+
+	remove(kChecksumRezFile);
+	remove(kChecksumBenchRezFile);
+
+	printf("RezFileChecksumTest: %d errors\n", numErrors);
+}
\ No newline at end of file
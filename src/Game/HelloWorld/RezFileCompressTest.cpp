@@ -0,0 +1,330 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kCompressRezFile = "RezFileCompressTest.rez";
+static const char* kDictionaryRezFile = "RezFileCompressDictTest.rez";
+
+const int           kCompressNumItems = 16;
+const unsigned long kCompressItemSize = 300000;
+const unsigned long kCompressChunkSize = 16 * 1024;
+const int           kDictionaryNumItems = 200;
+
+// even items are compressed whole, odd ones in chunks
+static unsigned long CompressType(RezMgr* mgr, int item)
+{
+	return mgr->StrToType(((item & 1) == 0) ? "DAT" : "MAP");
+}
+
+// text like data that compresses well
+static unsigned char CompressByte(int item, unsigned long offset)
+{
+	static const char* words = "the quick brown fox jumps over the lazy dog ";
+	return (unsigned char)(words[(offset + item) % 44] + ((offset / 4096) % 3));
+}
+
+// noise that doesn't compress at all
+static unsigned char NoiseByte(unsigned long offset)
+{
+	unsigned int x = (unsigned int)offset;
+	x = (x ^ (x >> 16)) * 0x7feb352d;
+	x = (x ^ (x >> 15)) * 0x846ca68b;
+	return (unsigned char)(x ^ (x >> 16));
+}
+
+static bool CompressCreateFile()
+{
+	RezMgr mgr;
+	mgr.SetCompression(mgr.StrToType("DAT"), RezCodecLZ4, 9, 0);
+	mgr.SetCompression(mgr.StrToType("MAP"), RezCodecLZ4, 9, kCompressChunkSize);
+	mgr.SetCompression(mgr.StrToType("BIN"), RezCodecLZ4, 1);
+	if (!mgr.Open(kCompressRezFile, false, true)) return false;
+
+	bool saved = true;
+	for (int i = 0; i < kCompressNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, CompressType(&mgr, i));
+		unsigned char* data = item->Create(kCompressItemSize + i);
+		for (unsigned long j = 0; j < kCompressItemSize + i; ++j) data[j] = CompressByte(i, j);
+		if (!item->Save() || !item->IsCompressed()) saved = false;
+		item->UnLoad();
+	}
+
+	// asked to be compressed but stored as is because it doesn't get any smaller
+	RezItem* noise = mgr.GetRootDir()->CreateRez(100, "NOISE", mgr.StrToType("BIN"));
+	unsigned char* data = noise->Create(kCompressItemSize);
+	for (unsigned long j = 0; j < kCompressItemSize; ++j) data[j] = NoiseByte(j);
+	if (!noise->Save() || noise->IsCompressed()) saved = false;
+
+	// not set up for compression at all
+	RezItem* plain = mgr.GetRootDir()->CreateRez(101, "PLAIN", mgr.StrToType("TXT"));
+	data = plain->Create(16);
+	for (unsigned long j = 0; j < 16; ++j) data[j] = (unsigned char)j;
+	if (!plain->Save() || plain->IsCompressed()) saved = false;
+
+	// written in one go like LithRez does so the directory can be loaded whole
+	mgr.ForceIsSortedFlag(true);
+	return mgr.Close() && saved;
+}
+
+static int CompressVerifyItem(RezItem* item, int i)
+{
+	int numErrors = 0;
+	unsigned long size = kCompressItemSize + i;
+	if ((item->GetSize() != size) || !item->IsCompressed() || (item->GetStoredSize() >= size / 2)) ++numErrors;
+	if (item->GetChunkSize() != (((i & 1) == 0) ? 0 : kCompressChunkSize)) ++numErrors;
+
+	// a range in the middle, then the whole thing straight into a buffer of our own
+	std::vector<unsigned char> buf(size);
+	unsigned long offset = size / 2 + 77;
+	if (!item->Get(&buf[0], offset, 1000) || (buf[0] != CompressByte(i, offset)) || (buf[999] != CompressByte(i, offset + 999))) ++numErrors;
+	item->UnLoad();
+
+	// across several chunks, only some of the first and last one
+	offset = kCompressChunkSize - 10;
+	if (!item->Get(&buf[0], offset, 3 * kCompressChunkSize) || (buf[0] != CompressByte(i, offset)) ||
+		(buf[3 * kCompressChunkSize - 1] != CompressByte(i, offset + 3 * kCompressChunkSize - 1))) ++numErrors;
+	if (((i & 1) != 0) && item->IsLoaded()) ++numErrors;
+	item->UnLoad();
+
+	if (!item->Get(&buf[0]) || item->IsLoaded()) ++numErrors;
+	for (unsigned long j = 0; j < size; ++j)
+	{
+		if (buf[j] != CompressByte(i, j))
+		{
+			++numErrors;
+			break;
+		}
+	}
+
+	unsigned char* data = item->Load();
+	if ((data == nullptr) || (data[size - 1] != CompressByte(i, size - 1))) ++numErrors;
+	item->UnLoad();
+
+	// sequential reads and a stream see the uncompressed data too
+	unsigned char bytes[100];
+	if ((item->Read(bytes, 100, 5000) != 100) || (bytes[0] != CompressByte(i, 5000)) || (bytes[99] != CompressByte(i, 5099))) ++numErrors;
+	if ((item->Read(bytes, 100, size - 50) != 50) || (bytes[49] != CompressByte(i, size - 1))) ++numErrors;
+	item->UnLoad();
+
+	RezItemStream stream(item, 4096);
+	unsigned long streamed = 0;
+	unsigned long length;
+	const unsigned char* chunk;
+	while ((chunk = stream.NextChunk(&length)) != nullptr)
+	{
+		if ((chunk[0] != CompressByte(i, streamed)) || (chunk[length - 1] != CompressByte(i, streamed + length - 1))) ++numErrors;
+		streamed += length;
+	}
+	if ((streamed != size) || stream.Failed()) ++numErrors;
+	item->UnLoad();
+
+	return numErrors;
+}
+
+static int CompressVerify(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kCompressRezFile)) return 1;
+
+	int numErrors = 0;
+	if (mgr.GetFileFormatVersion() != 2) ++numErrors;
+
+	RezItem* items[kCompressNumItems];
+	for (int i = 0; i < kCompressNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		items[i] = mgr.GetRootDir()->GetRez(name, CompressType(&mgr, i));
+		if (items[i] == nullptr)
+		{
+			mgr.Close();
+			return numErrors + 1;
+		}
+		numErrors += CompressVerifyItem(items[i], i);
+	}
+
+	RezItem* noise = mgr.GetRootDir()->GetRez("NOISE", mgr.StrToType("BIN"));
+	RezItem* plain = mgr.GetRootDir()->GetRez("PLAIN", mgr.StrToType("TXT"));
+	if ((noise == nullptr) || noise->IsCompressed() || (noise->GetStoredSize() != kCompressItemSize)) ++numErrors;
+	if ((plain == nullptr) || plain->IsCompressed()) ++numErrors;
+	if ((noise == nullptr) || (plain == nullptr))
+	{
+		mgr.Close();
+		return numErrors;
+	}
+
+	// every item in one batch, compressed ones are decompressed out of the merged reads
+	if (!mgr.LoadBatch(items, kCompressNumItems)) ++numErrors;
+	for (int i = 0; i < kCompressNumItems; ++i)
+	{
+		unsigned char* data = items[i]->Load();
+		if ((data == nullptr) || (data[0] != CompressByte(i, 0)) || (data[kCompressItemSize + i - 1] != CompressByte(i, kCompressItemSize + i - 1))) ++numErrors;
+		items[i]->UnLoad();
+	}
+
+	// pieces of compressed and uncompressed items together
+	unsigned char piece1[64];
+	unsigned char piece2[64];
+	unsigned char piece3[16];
+	RezItemRead reads[3] =
+	{
+		{ items[3], kCompressChunkSize * 4 - 32, 64, piece1 },
+		{ noise,    1000,  64, piece2 },
+		{ plain,    0,     16, piece3 },
+	};
+	if (!mgr.ReadV(reads, 3)) ++numErrors;
+	if ((piece1[0] != CompressByte(3, kCompressChunkSize * 4 - 32)) || (piece1[63] != CompressByte(3, kCompressChunkSize * 4 + 31))) ++numErrors;
+	if ((piece2[0] != NoiseByte(1000)) || (piece2[63] != NoiseByte(1063))) ++numErrors;
+	if (piece3[15] != 15) ++numErrors;
+
+	// with the whole directory in memory compressed items are decompressed out of it
+	if (!mgr.GetRootDir()->Load()) ++numErrors;
+	for (int i = 0; i < kCompressNumItems; ++i)
+	{
+		numErrors += CompressVerifyItem(items[i], i);
+	}
+	mgr.GetRootDir()->UnLoad();
+
+	mgr.Close();
+	return numErrors;
+}
+
+// a small config record like many of the items in a game's rez files
+static unsigned long DictionaryRecord(int item, char* text)
+{
+	return (unsigned long)sprintf(text,
+		"[object%d]\nclass = StaticMesh\nfilename = models/props/crate_%d.ltb\nskin = textures/props/crate_%d.dtx\n"
+		"position = %d.0 %d.0 %d.0\nrotation = 0.0 %d.0 0.0\nscale = 1.0 1.0 1.0\nsolid = true\nvisible = true\n"
+		"gravity = false\nshadow = true\nmass = %d\nsound = sounds/props/crate_hit.wav\n",
+		item, item % 7, item % 5, (item * 13) % 1000, (item * 7) % 500, (item * 3) % 200, (item * 11) % 360, 10 + item % 50);
+}
+
+// the same records saved with a dictionary trained on them (CFG) and without one (CF2)
+static bool DictionaryCreateFile(RezPos* withDict, RezPos* withoutDict)
+{
+	RezMgr mgr;
+	mgr.SetCompression(mgr.StrToType("CFG"), RezCodecLZ4, 9);
+	mgr.SetCompression(mgr.StrToType("CF2"), RezCodecLZ4, 9);
+	if (!mgr.Open(kDictionaryRezFile, false, true)) return false;
+
+	std::vector<unsigned char> samples;
+	std::vector<size_t> sampleSizes;
+	char text[1024];
+	for (int i = 0; i < kDictionaryNumItems; ++i)
+	{
+		unsigned long length = DictionaryRecord(i, text);
+		samples.insert(samples.end(), text, text + length);
+		sampleSizes.push_back(length);
+	}
+
+	unsigned char dict[kRezDictionaryDefaultSize];
+	size_t dictSize = RezTrainDictionary(&samples[0], &sampleSizes[0], sampleSizes.size(), dict, sizeof(dict));
+	bool saved = (dictSize > 0) && mgr.SetDictionary(mgr.StrToType("CFG"), dict, (unsigned long)dictSize);
+
+	*withDict = 0;
+	*withoutDict = 0;
+	for (int i = 0; i < kDictionaryNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "OBJECT%d", i);
+		unsigned long length = DictionaryRecord(i, text);
+
+		RezItem* items[2] = { mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("CFG")), mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("CF2")) };
+		for (int j = 0; j < 2; ++j)
+		{
+			memcpy(items[j]->Create(length), text, length);
+			if (!items[j]->Save()) saved = false;
+			items[j]->UnLoad();
+		}
+		if (items[0]->GetDictionaryId() != RezDictionaryId(dict, dictSize)) saved = false;
+		if (items[1]->GetDictionaryId() != 0) saved = false;
+
+		*withDict += items[0]->GetStoredSize();
+		*withoutDict += items[1]->GetStoredSize();
+	}
+
+	return mgr.Close() && saved;
+}
+
+static int DictionaryVerify(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kDictionaryRezFile)) return 1;
+
+	int numErrors = 0;
+	RezType* dictType = mgr.GetRootDir()->GetRezType(mgr.StrToType(kRezDictionaryTypeName));
+	if ((dictType == nullptr) || (mgr.GetRootDir()->GetFirstItem(dictType) == nullptr)) ++numErrors;
+
+	char text[1024];
+	char bytes[1024];
+	for (int i = 0; i < kDictionaryNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "OBJECT%d", i);
+		unsigned long length = DictionaryRecord(i, text);
+
+		RezItem* item = mgr.GetRootDir()->GetRez(name, mgr.StrToType("CFG"));
+		if ((item == nullptr) || (item->GetSize() != length) || !item->IsCompressed() || (item->GetDictionaryId() == 0))
+		{
+			++numErrors;
+			continue;
+		}
+
+		// whole, loaded and in part
+		if (!item->Get(bytes) || (memcmp(bytes, text, length) != 0)) ++numErrors;
+		unsigned char* data = item->Load();
+		if ((data == nullptr) || (memcmp(data, text, length) != 0)) ++numErrors;
+		item->UnLoad();
+		if (!item->Get(bytes, 100, 50) || (memcmp(bytes, text + 100, 50) != 0)) ++numErrors;
+	}
+
+	mgr.Close();
+	return numErrors;
+}
+
+void RezFileCompressTest()
+{
+	if (!CompressCreateFile())
+	{
+		printf("RezFileCompressTest: unable to create %s\n", kCompressRezFile);
+		remove(kCompressRezFile);
+		return;
+	}
+
+	int numErrors = 0;
+	numErrors += CompressVerify(RezFileAccessMapped);
+	numErrors += CompressVerify(RezFileAccessStdio);
+	numErrors += CompressVerify(RezFileAccessPositional);
+
+	remove(kCompressRezFile);
+
+	// small records only get much smaller with a dictionary
+	RezPos withDict;
+	RezPos withoutDict;
+	if (!DictionaryCreateFile(&withDict, &withoutDict))
+	{
+		++numErrors;
+	}
+	else
+	{
+		if (withDict * 2 > withoutDict) ++numErrors;
+		numErrors += DictionaryVerify(RezFileAccessMapped);
+		numErrors += DictionaryVerify(RezFileAccessStdio);
+		numErrors += DictionaryVerify(RezFileAccessPositional);
+		printf("RezFileCompressTest: %d records stored in %d bytes with a dictionary, %d without\n",
+			   kDictionaryNumItems, (int)withDict, (int)withoutDict);
+	}
+	remove(kDictionaryRezFile);
+
+	printf("RezFileCompressTest: %d errors\n", numErrors);
+}
\ No newline at end of file
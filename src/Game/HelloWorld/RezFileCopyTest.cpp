@@ -0,0 +1,108 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <string.h>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kCopyRezFile = "RezFileCopyTest.rez";
+static const char* kCopyOutFile = "RezFileCopyTest.out";
+
+const int kCopyNumItems = 8;
+
+// one item bigger than the copy buffer so it can't go out in a single piece
+static unsigned long CopyItemSize(int item)
+{
+	return (item == 0) ? 3 * 1024 * 1024 + 17 : 1000 + item * 4099;
+}
+
+static unsigned char CopyByte(int item, unsigned long offset)
+{
+	return (unsigned char)(offset * 11 + (offset >> 12) + item);
+}
+
+static bool CopyCreateFile()
+{
+	RezMgr mgr;
+	if (!mgr.Open(kCopyRezFile, false, true)) return false;
+
+	for (int i = 0; i < kCopyNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(CopyItemSize(i));
+		for (unsigned long j = 0; j < CopyItemSize(i); ++j) data[j] = CopyByte(i, j);
+		item->Save();
+		item->UnLoad();
+	}
+
+	return mgr.Close();
+}
+
+static bool CopyCheckOutFile(int item)
+{
+	FILE* fp = fopen(kCopyOutFile, "rb");
+	if (fp == nullptr) return false;
+
+	bool retFlag = true;
+	unsigned long size = 0;
+	int c;
+	while ((c = fgetc(fp)) != EOF)
+	{
+		if ((size >= CopyItemSize(item)) || ((unsigned char)c != CopyByte(item, size))) retFlag = false;
+		++size;
+	}
+	fclose(fp);
+	return retFlag && (size == CopyItemSize(item));
+}
+
+// copies every item out of a file opened the way LithRez opens one (or with fileAccess) and checks what arrived
+static int CopyCheck(bool defaultAccess, RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	if (!defaultAccess) mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kCopyRezFile)) return 1;
+
+	int numErrors = 0;
+	RezCopyStats stats;
+	memset(&stats, 0, sizeof(stats));
+	unsigned long long size = 0;
+	for (int i = 0; i < kCopyNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+		if ((item == nullptr) || !item->CopyToFile(kCopyOutFile, &stats) || !CopyCheckOutFile(i)) ++numErrors;
+		size += CopyItemSize(i);
+	}
+
+	if ((stats.bytesCopied != size) || (stats.numFiles != kCopyNumItems)) ++numErrors;
+#if !defined(_WIN32)
+	// a mapped file still has its descriptor for the kernel to copy from
+	if (stats.bytesKernelCopied == 0) ++numErrors;
+#endif
+
+	mgr.Close();
+	return numErrors;
+}
+
+void RezFileCopyTest()
+{
+	if (!CopyCreateFile())
+	{
+		printf("RezFileCopyTest: unable to create %s\n", kCopyRezFile);
+		return;
+	}
+
+	int numErrors = CopyCheck(true, RezFileAccessMapped);
+	numErrors += CopyCheck(false, RezFileAccessMapped);
+	numErrors += CopyCheck(false, RezFileAccessStdio);
+	numErrors += CopyCheck(false, RezFileAccessPositional);
+
+	remove(kCopyOutFile);
+	remove(kCopyRezFile);
+
+	printf("RezFileCopyTest: %d errors\n", numErrors);
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kDedupRezFile = "RezFileDedupTest.rez";
+
+const int           kDedupNumItems = 16;
+const unsigned long kDedupItemSize = 20000;
+
+static unsigned char DedupByte(int item, unsigned long offset)
+{
+	return (unsigned char)((item * 13) + (offset * 5) + (offset >> 9));
+}
+
+// the same items in two directories, as if a texture were shared by two levels, with a background save
+// the copies are compared against data that may still be waiting to be written
+static int DedupCreateFile(unsigned long backgroundSave)
+{
+	RezMgr mgr;
+	mgr.SetDeduplicate(true);
+	mgr.SetBackgroundSave(backgroundSave);
+	if (!mgr.Open(kDedupRezFile, false, true)) return 1;
+
+	int numErrors = 0;
+	RezDir* dirs[2] = { mgr.GetRootDir()->CreateDir("LEVEL1"), mgr.GetRootDir()->CreateDir("LEVEL2") };
+	for (int i = 0; i < kDedupNumItems; ++i)
+	{
+		for (int d = 0; d < 2; ++d)
+		{
+			char name[32];
+			sprintf(name, "TEX%d", i);
+
+			RezItem* item = dirs[d]->CreateRez(i, name, mgr.StrToType("DTX"));
+			unsigned char* data = item->Create(kDedupItemSize);
+			for (unsigned long j = 0; j < kDedupItemSize; ++j) data[j] = DedupByte(i, j);
+			if (!item->Save()) ++numErrors;
+			item->UnLoad();
+		}
+	}
+
+	RezWriteStats stats;
+	mgr.GetWriteStats(&stats);
+	if ((stats.numDeduplicated != kDedupNumItems) || (stats.bytesDeduplicated != (unsigned long long)kDedupNumItems * kDedupItemSize)) ++numErrors;
+
+	RezItem* first = dirs[0]->GetRez("TEX0", mgr.StrToType("DTX"));
+	RezItem* second = dirs[1]->GetRez("TEX0", mgr.StrToType("DTX"));
+	if (first->DirectRead_GetFileOffset() != second->DirectRead_GetFileOffset()) ++numErrors;
+
+	// changing one of them in place must leave the other alone
+	unsigned char* data = first->Load();
+	data[0] ^= 0xff;
+	if (!first->Save() || (first->DirectRead_GetFileOffset() == second->DirectRead_GetFileOffset())) ++numErrors;
+	first->UnLoad();
+
+	unsigned char byte;
+	if (!second->Get(&byte, 0, 1) || (byte != DedupByte(0, 0))) ++numErrors;
+
+	if (!mgr.Close()) ++numErrors;
+	return numErrors;
+}
+
+// item changed is the one in LEVEL1 whose first byte was flipped
+static int DedupVerify(int changed)
+{
+	RezMgr mgr;
+	if (!mgr.Open(kDedupRezFile)) return 1;
+
+	int numErrors = 0;
+	for (int d = 0; d < 2; ++d)
+	{
+		RezDir* dir = mgr.GetRootDir()->GetDir((d == 0) ? "LEVEL1" : "LEVEL2");
+		if (dir == nullptr) return numErrors + 1;
+
+		for (int i = 0; i < kDedupNumItems; ++i)
+		{
+			char name[32];
+			sprintf(name, "TEX%d", i);
+
+			RezItem* item = dir->GetRez(name, mgr.StrToType("DTX"));
+			unsigned char* data = (item != nullptr) ? item->Load() : nullptr;
+			if ((data == nullptr) || (item->GetSize() != kDedupItemSize))
+			{
+				++numErrors;
+				continue;
+			}
+
+			bool flipped = (d == 0) && (i <= changed);
+			if (data[0] != (unsigned char)(flipped ? (DedupByte(i, 0) ^ 0xff) : DedupByte(i, 0))) ++numErrors;
+			for (unsigned long j = 1; j < kDedupItemSize; ++j)
+			{
+				if (data[j] != DedupByte(i, j))
+				{
+					++numErrors;
+					break;
+				}
+			}
+			item->UnLoad();
+		}
+	}
+
+	mgr.Close();
+	return numErrors;
+}
+
+// the data is shared in the file itself so a later run that changes one item mustn't write over it either
+static int DedupChangeAgain()
+{
+	RezMgr mgr;
+	if (!mgr.Open(kDedupRezFile, false)) return 1;
+
+	RezItem* item = mgr.GetRootDir()->GetRezFromPath("LEVEL1\\TEX1", mgr.StrToType("DTX"));
+	unsigned char* data = (item != nullptr) ? item->Load() : nullptr;
+	if (data == nullptr)
+	{
+		mgr.Close();
+		return 1;
+	}
+
+	data[0] ^= 0xff;
+	int numErrors = item->Save() ? 0 : 1;
+	item->UnLoad();
+
+	if (!mgr.Close()) ++numErrors;
+	return numErrors;
+}
+
+void RezFileDedupTest()
+{
+	int numErrors = DedupCreateFile(0);
+	numErrors += DedupVerify(0);
+	numErrors += DedupChangeAgain();
+	numErrors += DedupVerify(1);
+
+	numErrors += DedupCreateFile(4 * 1024 * 1024);
+	numErrors += DedupVerify(0);
+
+	remove(kDedupRezFile);
+
+	printf("RezFileDedupTest: %d errors\n", numErrors);
+}
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kEmulationDir = "RezFileEmulationTest";
+
+const int kEmulationNumDirs  = 50;
+const int kEmulationNumFiles = 200;   // in each directory
+const int kEmulationMaxOpen  = 3;
+
+static unsigned long EmulationFileSize(int dir, int file)
+{
+	return 1 + (unsigned long)((dir * 7 + file) % 300);
+}
+
+static unsigned char EmulationByte(int dir, int file, unsigned long offset)
+{
+	return (unsigned char)(dir * 31 + file * 3 + offset);
+}
+
+static void EmulationMakeDir(const char* path)
+{
+#if defined(_WIN32)
+	_mkdir(path);
+#else
+	mkdir(path, 0777);
+#endif
+}
+
+static void EmulationRemoveDir(const char* path)
+{
+#if defined(_WIN32)
+	_rmdir(path);
+#else
+	rmdir(path);
+#endif
+}
+
+static bool EmulationWriteFile(const char* path, int dir, int file)
+{
+	FILE* fp = fopen(path, "wb");
+	if (fp == nullptr) return false;
+	for (unsigned long j = 0; j < EmulationFileSize(dir, file); ++j) fputc(EmulationByte(dir, file, j), fp);
+	return (fclose(fp) == 0);
+}
+
+// DIR0 to DIRn each full of DAT files, a nested directory and a file whose extension is too long to be a type
+static bool EmulationCreateTree()
+{
+	EmulationMakeDir(kEmulationDir);
+
+	char path[256];
+	bool retFlag = true;
+	for (int d = 0; d < kEmulationNumDirs; ++d)
+	{
+		sprintf(path, "%s/DIR%d", kEmulationDir, d);
+		EmulationMakeDir(path);
+		for (int f = 0; f < kEmulationNumFiles; ++f)
+		{
+			sprintf(path, "%s/DIR%d/FILE%d.DAT", kEmulationDir, d, f);
+			if (!EmulationWriteFile(path, d, f)) retFlag = false;
+		}
+	}
+
+	sprintf(path, "%s/DIR0/SUB", kEmulationDir);
+	EmulationMakeDir(path);
+	sprintf(path, "%s/DIR0/SUB/DEEP.DAT", kEmulationDir);
+	if (!EmulationWriteFile(path, 0, 1)) retFlag = false;
+	sprintf(path, "%s/NOTES.LONGEXT", kEmulationDir);
+	if (!EmulationWriteFile(path, 1, 2)) retFlag = false;
+	return retFlag;
+}
+
+static void EmulationRemoveTree()
+{
+	char path[256];
+	for (int d = 0; d < kEmulationNumDirs; ++d)
+	{
+		for (int f = 0; f < kEmulationNumFiles; ++f)
+		{
+			sprintf(path, "%s/DIR%d/FILE%d.DAT", kEmulationDir, d, f);
+			remove(path);
+		}
+	}
+
+	sprintf(path, "%s/DIR0/SUB/DEEP.DAT", kEmulationDir);
+	remove(path);
+	sprintf(path, "%s/DIR0/SUB", kEmulationDir);
+	EmulationRemoveDir(path);
+	for (int d = 0; d < kEmulationNumDirs; ++d)
+	{
+		sprintf(path, "%s/DIR%d", kEmulationDir, d);
+		EmulationRemoveDir(path);
+	}
+	sprintf(path, "%s/NOTES.LONGEXT", kEmulationDir);
+	remove(path);
+	sprintf(path, "%s/LOOP.DAT", kEmulationDir);
+	remove(path);
+	sprintf(path, "%s/DIR0/UP", kEmulationDir);
+	remove(path);
+	EmulationRemoveDir(kEmulationDir);
+}
+
+static int EmulationCheckItem(RezItem* item, int dir, int file)
+{
+	unsigned long size = EmulationFileSize(dir, file);
+	unsigned char data[300];
+	if ((item == nullptr) || (item->GetSize() != size) || !item->Get(data, 0, size)) return 1;
+	for (unsigned long j = 0; j < size; ++j)
+	{
+		if (data[j] != EmulationByte(dir, file, j)) return 1;
+	}
+	return 0;
+}
+
+// the whole tree turns up as items, and how long it takes to read in
+static int EmulationCheckScan()
+{
+	RezMgr mgr;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	if (!mgr.Open(kEmulationDir)) return 1;
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	int numErrors = 0;
+	unsigned long dat = mgr.StrToType("DAT");
+	for (int d = 0; d < kEmulationNumDirs; ++d)
+	{
+		char name[32];
+		sprintf(name, "DIR%d", d);
+		RezDir* dir = mgr.GetRootDir()->GetDir(name);
+		if (dir == nullptr)
+		{
+			++numErrors;
+			continue;
+		}
+		for (int f = 0; f < kEmulationNumFiles; ++f)
+		{
+			sprintf(name, "FILE%d", f);
+			numErrors += EmulationCheckItem(dir->GetRez(name, dat), d, f);
+		}
+	}
+
+	numErrors += EmulationCheckItem(mgr.GetRezFromPath("DIR0\\SUB\\DEEP", dat), 0, 1);
+	numErrors += EmulationCheckItem(mgr.GetRootDir()->GetRez("NOTES.LONGEXT", 0), 1, 2);
+	mgr.Close();
+
+	printf("RezFileEmulationTest: %d files in %d directories read in %.1f ms\n", kEmulationNumDirs * kEmulationNumFiles + 2,
+		   kEmulationNumDirs + 2, seconds * 1000.0);
+	return numErrors;
+}
+
+// one file used between each of a run of others stays open the whole time
+static int EmulationCheckHandleCache()
+{
+	RezMgr mgr;
+	mgr.SetMaxOpenFilesInEmulatedDir(kEmulationMaxOpen);
+	if (!mgr.Open(kEmulationDir)) return 1;
+
+	const int numOthers = 20;
+	int numErrors = 0;
+	RezDir* dir = mgr.GetRootDir()->GetDir("DIR1");
+	if (dir == nullptr)
+	{
+		mgr.Close();
+		return 1;
+	}
+
+	unsigned long dat = mgr.StrToType("DAT");
+	RezItem* hot = dir->GetRez("FILE0", dat);
+	numErrors += EmulationCheckItem(hot, 1, 0);
+	for (int f = 1; f <= numOthers; ++f)
+	{
+		char name[32];
+		sprintf(name, "FILE%d", f);
+		numErrors += EmulationCheckItem(dir->GetRez(name, dat), 1, f);
+		numErrors += EmulationCheckItem(hot, 1, 0);
+	}
+
+	RezHandleCacheStats stats;
+	mgr.GetHandleCacheStats(&stats);
+	if ((stats.numHits != numOthers) || (stats.numMisses != numOthers + 1) ||
+		(stats.numEvictions != numOthers + 1 - kEmulationMaxOpen) || (stats.numOpen != kEmulationMaxOpen)) ++numErrors;
+
+	mgr.Close();
+	return numErrors;
+}
+
+// a link back up the tree is left alone rather than read in over and over
+static int EmulationCheckLinkLoop()
+{
+	int numErrors = 0;
+#if !defined(_WIN32)
+	char path[256];
+	sprintf(path, "%s/DIR0/UP", kEmulationDir);
+	if (symlink("..", path) != 0) return 1;
+
+	RezMgr mgr;
+	if (!mgr.Open(kEmulationDir)) ++numErrors;
+	RezDir* dir = mgr.GetRootDir()->GetDir("DIR0");
+	if ((dir == nullptr) || (dir->GetDir("UP") != nullptr)) ++numErrors;
+	numErrors += EmulationCheckItem(mgr.GetRezFromPath("DIR0\\SUB\\DEEP", mgr.StrToType("DAT")), 0, 1);
+	mgr.Close();
+	remove(path);
+#endif
+	return numErrors;
+}
+
+// a file that can't be looked at fails the open, everything else is still read in
+static int EmulationCheckErrors()
+{
+	int numErrors = 0;
+#if !defined(_WIN32)
+	char path[256];
+	sprintf(path, "%s/LOOP.DAT", kEmulationDir);
+	if (symlink("LOOP.DAT", path) != 0) return 1;
+
+	RezMgr mgr;
+	if (mgr.Open(kEmulationDir)) ++numErrors;
+	numErrors += EmulationCheckItem(mgr.GetRezFromPath("DIR3\\FILE4", mgr.StrToType("DAT")), 3, 4);
+	mgr.Close();
+	remove(path);
+#endif
+	return numErrors;
+}
+
+void RezFileEmulationTest()
+{
+	int numErrors = 0;
+	if (!EmulationCreateTree()) ++numErrors;
+
+	numErrors += EmulationCheckScan();
+	numErrors += EmulationCheckHandleCache();
+	numErrors += EmulationCheckLinkLoop();
+	numErrors += EmulationCheckErrors();
+
+	EmulationRemoveTree();
+
+	printf("RezFileEmulationTest: %d errors\n", numErrors);
+}
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kIndexRezFile = "RezFileIndexTest.rez";
+static const char* kIndexPlainRezFile = "RezFileIndexPlain.rez";
+static const char* kIndexBenchRezFile = "RezFileIndexBench.rez";
+static const char* kIndexBenchPlainRezFile = "RezFileIndexBenchPlain.rez";
+
+const int kIndexNumDirs = 4;
+const int kIndexNumItems = 40;        // DAT items in each directory, half as many CFG ones and a few MAP ones
+const int kIndexNumMaps = 3;
+const int kIndexBenchNumDirs = 200;
+const int kIndexBenchNumItems = 100;  // in each directory
+const int kIndexBenchRounds = 20;
+
+static unsigned long IndexItemSize(int dir, int item)
+{
+	return 100 + item * 13 + dir;
+}
+
+static unsigned char IndexByte(int dir, int item, unsigned long offset)
+{
+	return (unsigned char)(offset * 11 + item * 3 + dir);
+}
+
+static unsigned long IndexRecord(int dir, int item, char* text)
+{
+	return (unsigned long)sprintf(text,
+		"[object%d]\nclass = StaticMesh\nfilename = models/level%d/crate_%d.ltb\nskin = textures/props/crate_%d.dtx\n"
+		"position = %d.0 %d.0 %d.0\nsolid = true\nvisible = true\nmass = %d\n",
+		item, dir, item % 7, item % 5, (item * 13) % 1000, (item * 7) % 500, (item * 3) % 200, 10 + item % 50);
+}
+
+// a MAP item is big enough to be compressed in a few chunks
+static unsigned long IndexMapSize(int item)
+{
+	return 40000 + item * 1000;
+}
+
+static bool IndexSaveItem(RezDir* dir, const char* name, unsigned long typeId, const void* data, unsigned long size)
+{
+	RezItem* item = dir->CreateRez(0, name, typeId);
+	if (item == nullptr) return false;
+	memcpy(item->Create(size), data, size);
+	bool saved = item->Save();
+	item->UnLoad();
+	return saved;
+}
+
+// the root has a few items and LEVEL0 to LEVEL3 each have items and a PROPS directory with the same items in it
+static bool IndexCreateFile(const char* rezFile, bool pathIndex, RezMemoryImage* image)
+{
+	RezMgr mgr;
+	mgr.SetChecksums(true);
+	mgr.SetCompression(mgr.StrToType("CFG"), RezCodecLZ4, 9);
+	mgr.SetCompression(mgr.StrToType("MAP"), RezCodecLZ4, 1, 16 * 1024);
+	if (!mgr.SetPathIndex(pathIndex)) return false;
+	if ((image != nullptr) ? !mgr.OpenMemory(image) : !mgr.Open(rezFile, false, true)) return false;
+
+	std::vector<unsigned char> samples;
+	std::vector<size_t> sampleSizes;
+	char text[1024];
+	for (int i = 0; i < kIndexNumItems; ++i)
+	{
+		unsigned long length = IndexRecord(0, i, text);
+		samples.insert(samples.end(), text, text + length);
+		sampleSizes.push_back(length);
+	}
+	unsigned char dict[kRezDictionaryDefaultSize];
+	size_t dictSize = RezTrainDictionary(&samples[0], &sampleSizes[0], sampleSizes.size(), dict, sizeof(dict));
+	bool saved = (dictSize > 0) && mgr.SetDictionary(mgr.StrToType("CFG"), dict, (unsigned long)dictSize);
+
+	std::vector<unsigned char> data(IndexMapSize(kIndexNumMaps));
+	for (int i = 0; i < 3; ++i)
+	{
+		char name[32];
+		sprintf(name, "ROOT%d", i);
+		for (unsigned long j = 0; j < IndexItemSize(-1, i); ++j) data[j] = IndexByte(-1, i, j);
+		if (!IndexSaveItem(mgr.GetRootDir(), name, mgr.StrToType("DAT"), &data[0], IndexItemSize(-1, i))) saved = false;
+	}
+
+	for (int d = 0; d < kIndexNumDirs * 2; ++d)
+	{
+		char name[32];
+		sprintf(name, "LEVEL%d", d / 2);
+		RezDir* dir = mgr.GetRootDir()->GetDir(name);
+		if (dir == nullptr) dir = mgr.GetRootDir()->CreateDir(name);
+		if ((d & 1) != 0) dir = (dir != nullptr) ? dir->CreateDir("PROPS") : nullptr;
+		if (dir == nullptr) return false;
+
+		for (int i = 0; i < kIndexNumItems; ++i)
+		{
+			sprintf(name, "ITEM%d", i);
+			for (unsigned long j = 0; j < IndexItemSize(d, i); ++j) data[j] = IndexByte(d, i, j);
+			if (!IndexSaveItem(dir, name, mgr.StrToType("DAT"), &data[0], IndexItemSize(d, i))) saved = false;
+
+			if (i < kIndexNumItems / 2)
+			{
+				sprintf(name, "OBJECT%d", i);
+				unsigned long length = IndexRecord(d, i, text);
+				if (!IndexSaveItem(dir, name, mgr.StrToType("CFG"), text, length)) saved = false;
+			}
+			if (i < kIndexNumMaps)
+			{
+				sprintf(name, "MAP%d", i);
+				for (unsigned long j = 0; j < IndexMapSize(i); ++j) data[j] = (unsigned char)((j / 100) + d);
+				if (!IndexSaveItem(dir, name, mgr.StrToType("MAP"), &data[0], IndexMapSize(i))) saved = false;
+			}
+		}
+	}
+
+	mgr.ForceIsSortedFlag(true);
+	return mgr.Close() && saved;
+}
+
+static bool IndexCheckItem(RezItem* item, int dir, int i)
+{
+	if ((item == nullptr) || (item->GetSize() != IndexItemSize(dir, i)) || !item->HasChecksum()) return false;
+
+	const unsigned char* data = item->Load();
+	bool same = (data != nullptr);
+	for (unsigned long j = 0; same && (j < IndexItemSize(dir, i)); ++j) same = (data[j] == IndexByte(dir, i, j));
+	item->UnLoad();
+	return same;
+}
+
+static int IndexCheckDir(RezMgr* mgr, int d)
+{
+	int numErrors = 0;
+	char text[1024];
+	char bytes[1024];
+	for (int i = 0; i < kIndexNumItems; ++i)
+	{
+		char path[64];
+		sprintf(path, ((d & 1) != 0) ? "LEVEL%d\\PROPS\\ITEM%d" : "LEVEL%d\\ITEM%d", d / 2, i);
+		RezItem* item = mgr->GetRezFromPath(path, mgr->StrToType("DAT"));
+		if (!IndexCheckItem(item, d, i)) ++numErrors;
+
+		// any case and any separators find the same item
+		char otherPath[64];
+		sprintf(otherPath, ((d & 1) != 0) ? "/level%d/props/item%d" : "/Level%d/Item%d", d / 2, i);
+		if (mgr->GetRezFromPath(otherPath, mgr->StrToType("DAT")) != item) ++numErrors;
+
+		if (i < kIndexNumItems / 2)
+		{
+			sprintf(path, ((d & 1) != 0) ? "LEVEL%d\\PROPS\\OBJECT%d.CFG" : "LEVEL%d\\OBJECT%d.CFG", d / 2, i);
+			item = mgr->GetRezFromDosPath(path);
+			unsigned long length = IndexRecord(d, i, text);
+			if ((item == nullptr) || !item->IsCompressed() || (item->GetDictionaryId() == 0) || (item->GetSize() != length) ||
+				!item->Get(bytes) || (memcmp(bytes, text, length) != 0)) ++numErrors;
+		}
+		if (i < kIndexNumMaps)
+		{
+			sprintf(path, ((d & 1) != 0) ? "LEVEL%d\\PROPS\\MAP%d" : "LEVEL%d\\MAP%d", d / 2, i);
+			item = mgr->GetRezFromPath(path, mgr->StrToType("MAP"));
+			if ((item == nullptr) || (item->GetChunkSize() == 0) || (item->GetSize() != IndexMapSize(i)) ||
+				!item->Get(bytes, 30000, 500) || (bytes[0] != (unsigned char)(300 + d)) || (bytes[499] != (unsigned char)(304 + d))) ++numErrors;
+		}
+	}
+	return numErrors;
+}
+
+// the items and directories in the tree, counting any that turn up twice as errors
+static int IndexCountTree(RezDir* dir, int* numItems, int* numDirs)
+{
+	int numErrors = 0;
+	++*numDirs;
+	for (RezType* type = dir->GetFirstType(); type != nullptr; type = dir->GetNextType(type))
+	{
+		for (RezItem* item = dir->GetFirstItem(type); item != nullptr; item = dir->GetNextItem(item))
+		{
+			if (dir->GetRez(item->GetName(), type->GetType()) != item) ++numErrors;
+			++*numItems;
+		}
+	}
+	for (RezDir* subDir = dir->GetFirstSubDir(); subDir != nullptr; subDir = dir->GetNextSubDir(subDir))
+	{
+		if (dir->GetDir(subDir->GetDirName()) != subDir) ++numErrors;
+		numErrors += IndexCountTree(subDir, numItems, numDirs);
+	}
+	return numErrors;
+}
+
+static int IndexCheck(RezFileAccess fileAccess, RezMemoryImage* image)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	mgr.SetChecksumVerify(RezChecksumVerifyAlways);
+	if ((image != nullptr) ? !mgr.OpenMemory(image, true, false) : !mgr.Open(kIndexRezFile)) return 1;
+
+	int numErrors = 0;
+	if (mgr.GetFileFormatVersion() != 3) ++numErrors;
+
+	// looked up through the index, a directory at a time
+	for (int d = kIndexNumDirs * 2 - 1; d >= 0; d -= 2) numErrors += IndexCheckDir(&mgr, d);
+	if (!IndexCheckItem(mgr.GetRezFromPath("ROOT1", mgr.StrToType("DAT")), -1, 1)) ++numErrors;
+	if (!IndexCheckItem(mgr.GetRezFromPath("\\ROOT2", mgr.StrToType("DAT")), -1, 2)) ++numErrors;
+
+	// things that aren't there
+	if (mgr.GetRezFromPath("LEVEL1\\PROPS\\NOTHERE", mgr.StrToType("DAT")) != nullptr) ++numErrors;
+	if (mgr.GetRezFromPath("LEVEL1\\PROPS\\ITEM1", mgr.StrToType("CFG")) != nullptr) ++numErrors;
+	if (mgr.GetRezFromPath("LEVEL9\\ITEM1", mgr.StrToType("DAT")) != nullptr) ++numErrors;
+	if (mgr.GetRezFromPath("LEVEL1\\ITEM1\\ITEM1", mgr.StrToType("DAT")) != nullptr) ++numErrors;
+	if (mgr.GetRezFromDosPath("LEVEL1\\OBJECT1.DAT") != nullptr) ++numErrors;
+
+	// the rest of the directories come in around what was looked up, nothing twice
+	RezItem* item = mgr.GetRezFromPath("LEVEL2\\PROPS\\ITEM7", mgr.StrToType("DAT"));
+	int numItems = 0;
+	int numDirs = 0;
+	numErrors += IndexCountTree(mgr.GetRootDir(), &numItems, &numDirs);
+	if ((numDirs != 1 + kIndexNumDirs * 2) || (numItems != 3 + 1 + kIndexNumDirs * 2 * (kIndexNumItems + kIndexNumItems / 2 + kIndexNumMaps))) ++numErrors;
+	RezDir* dir = mgr.GetDirFromPath("LEVEL2\\PROPS");
+	if ((item == nullptr) || (dir == nullptr) || (dir->GetRez("ITEM7", mgr.StrToType("DAT")) != item)) ++numErrors;
+
+	// and everything is still found the same way once they are
+	numErrors += IndexCheckDir(&mgr, 0);
+	numErrors += IndexCheckDir(&mgr, 5);
+
+	// a sorted directory still loads in one block with items looked up before it was read in
+	if ((fileAccess == RezFileAccessStdio) && (image == nullptr))
+	{
+		dir = mgr.GetDirFromPath("LEVEL3\\PROPS");
+		if ((dir == nullptr) || !dir->Load() || !dir->IsLoaded() || !IndexCheckItem(dir->GetRez("ITEM3", mgr.StrToType("DAT")), 7, 3)) ++numErrors;
+		if (dir != nullptr) dir->UnLoad();
+	}
+
+	mgr.Close();
+	return numErrors;
+}
+
+// paths split up oddly are found (or not) the same way through the index as through the directories
+static int IndexCheckPaths()
+{
+	static const char* paths[] = { "LEVEL1\\ITEM1", "\\LEVEL1\\ITEM1", "\\\\LEVEL1\\ITEM1", "LEVEL1\\\\PROPS\\ITEM1", "LEVEL1\\PROPS\\\\ITEM1",
+								   "LEVEL1 \\PROPS\\ITEM1", "L\\ROOT1", "\\\\ROOT1", "LEVEL1\\PROPS\\", "LEVEL1\\PROPS\\ITEM1\\", "ROOT0", "X" };
+
+	RezMgr indexed;
+	RezMgr plain;
+	if (!indexed.Open(kIndexRezFile) || !plain.Open(kIndexPlainRezFile)) return 1;
+
+	int numErrors = 0;
+	for (int i = 0; i < (int)(sizeof(paths) / sizeof(paths[0])); ++i)
+	{
+		RezItem* item = indexed.GetRezFromPath(paths[i], indexed.StrToType("DAT"));
+		RezItem* plainItem = plain.GetRezFromPath(paths[i], plain.StrToType("DAT"));
+		char path[256];
+		char plainPath[256];
+		if ((item == nullptr) != (plainItem == nullptr)) ++numErrors;
+		else if ((item != nullptr) && (strcmp(item->GetPath(path, sizeof(path)), plainItem->GetPath(plainPath, sizeof(plainPath))) != 0)) ++numErrors;
+	}
+
+	indexed.Close();
+	plain.Close();
+	return numErrors;
+}
+
+// a file opened for writing keeps its index
+static int IndexCheckRewrite()
+{
+	int numErrors = 0;
+	{
+		RezMgr mgr;
+		if (!mgr.Open(kIndexRezFile, false)) return 1;
+		RezDir* dir = mgr.GetRootDir()->CreateDir("ADDED");
+		if ((dir == nullptr) || !IndexSaveItem(dir, "NEW", mgr.StrToType("DAT"), "new item", 9)) ++numErrors;
+		if (!mgr.Close()) ++numErrors;
+	}
+	{
+		RezMgr mgr;
+		if (!mgr.Open(kIndexRezFile)) return numErrors + 1;
+		RezItem* item = mgr.GetRezFromPath("ADDED\\NEW", mgr.StrToType("DAT"));
+		if ((mgr.GetFileFormatVersion() != 3) || (item == nullptr) || (item->Load() == nullptr) || (strcmp((const char*)item->Load(), "new item") != 0)) ++numErrors;
+		if (!IndexCheckItem(mgr.GetRezFromPath("LEVEL0\\ITEM3", mgr.StrToType("DAT")), 0, 3)) ++numErrors;
+		mgr.Close();
+	}
+	return numErrors;
+}
+
+// lots of small items in lots of directories, like the rez files a server opens a few dozen of at startup
+static bool IndexBenchCreate(const char* rezFile, bool pathIndex)
+{
+	RezMgr mgr;
+	mgr.SetPathIndex(pathIndex);
+	if (!mgr.Open(rezFile, false, true)) return false;
+
+	bool saved = true;
+	for (int d = 0; d < kIndexBenchNumDirs; ++d)
+	{
+		char name[32];
+		sprintf(name, "DIR%d", d);
+		RezDir* dir = mgr.GetRootDir()->CreateDir(name);
+		for (int i = 0; (dir != nullptr) && (i < kIndexBenchNumItems); ++i)
+		{
+			sprintf(name, "ITEM%d", i);
+			if (!IndexSaveItem(dir, name, mgr.StrToType("DAT"), name, 8)) saved = false;
+		}
+	}
+	return mgr.Close() && saved;
+}
+
+// seconds to open the file and look up an item kIndexBenchRounds times, the best of a few tries
+static double IndexBenchOpen(const char* rezFile)
+{
+	double best = 0.0;
+	for (int t = 0; t < 3; ++t)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < kIndexBenchRounds; ++r)
+		{
+			RezMgr mgr;
+			if (!mgr.Open(rezFile)) return 0.0;
+			RezItem* item = mgr.GetRezFromPath("DIR123\\ITEM45", mgr.StrToType("DAT"));
+			if ((item == nullptr) || (item->Load() == nullptr))
+			{
+				mgr.Close();
+				return 0.0;
+			}
+			mgr.Close();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		if ((t == 0) || (seconds < best)) best = seconds;
+	}
+	return best / kIndexBenchRounds;
+}
+
+void RezFileIndexTest()
+{
+	int numErrors = 0;
+	if (!IndexCreateFile(kIndexRezFile, true, nullptr) || !IndexCreateFile(kIndexPlainRezFile, false, nullptr))
+	{
+		printf("RezFileIndexTest: unable to create %s\n", kIndexRezFile);
+		++numErrors;
+	}
+	else
+	{
+		numErrors += IndexCheck(RezFileAccessMapped, nullptr);
+		numErrors += IndexCheck(RezFileAccessStdio, nullptr);
+		numErrors += IndexCheckPaths();
+		numErrors += IndexCheckRewrite();
+	}
+
+	RezMemoryImage image;
+	if (!IndexCreateFile(nullptr, true, &image)) ++numErrors;
+	numErrors += IndexCheck(RezFileAccessStdio, &image);
+
+	if (!IndexBenchCreate(kIndexBenchRezFile, true) || !IndexBenchCreate(kIndexBenchPlainRezFile, false)) ++numErrors;
+	double indexed = IndexBenchOpen(kIndexBenchRezFile);
+	double plain = IndexBenchOpen(kIndexBenchPlainRezFile);
+	if ((indexed == 0.0) || (plain == 0.0)) ++numErrors;
+	printf("RezFileIndexTest: opening %d items and finding one takes %.3f ms with the path index, %.3f ms reading the directories\n",
+		   kIndexBenchNumDirs * kIndexBenchNumItems, indexed * 1000.0, plain * 1000.0);
+
+	remove(kIndexRezFile);
+	remove(kIndexPlainRezFile);
+	remove(kIndexBenchRezFile);
+	remove(kIndexBenchPlainRezFile);
+
+	printf("RezFileIndexTest: %d errors\n", numErrors);
+}
\ No newline at end of file
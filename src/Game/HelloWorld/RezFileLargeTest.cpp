@@ -0,0 +1,217 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <winioctl.h>
+#endif
+
+namespace JupiterEx { namespace RezMgr {
+
+class RezMgrTestHook
+{
+public:
+	static bool ReserveSpace(RezMgr& mgr, RezPos numBytes) { return mgr.ReserveSpace(numBytes); }
+};
+
+}}
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kLargeRezFile = "RezFileLargeTest.rez";
+const RezPos        kLargeGap      = 4608ULL * 1024 * 1024;   // pushes the big item past 4 GB
+const unsigned long kLargeItemSize = 1024 * 1024;
+
+static unsigned char LargeByte(unsigned long offset)
+{
+	return (unsigned char)((offset * 13) + (offset >> 11));
+}
+
+// the gap is never written, but NTFS only leaves a hole for it if the file is marked sparse first
+static void LargeMarkSparse()
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(kLargeRezFile, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+
+	DWORD bytesReturned;
+	DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytesReturned, nullptr);
+	CloseHandle(file);
+#endif
+}
+
+static bool LargeCreateFile()
+{
+	{
+		RezMgr mgr;
+		if (!mgr.Open(kLargeRezFile, false, true)) return false;
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(0, "SMALL", mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(16);
+		for (unsigned long j = 0; j < 16; ++j) data[j] = (unsigned char)j;
+		item->Save();
+		mgr.Close();
+	}
+
+	LargeMarkSparse();
+
+	RezMgr mgr;
+	if (!mgr.Open(kLargeRezFile, false, false)) return false;
+	if (!RezMgrTestHook::ReserveSpace(mgr, kLargeGap)) return false;
+
+	RezItem* item = mgr.GetRootDir()->CreateRez(1, "BIG", mgr.StrToType("DAT"));
+	unsigned char* data = item->Create(kLargeItemSize);
+	for (unsigned long j = 0; j < kLargeItemSize; ++j) data[j] = LargeByte(j);
+	bool saved = item->Save();
+	mgr.Close();
+	return saved;
+}
+
+// walks the big item with two streams at once, one chunk at a time and one in odd sized reads
+static int LargeVerifyStream(RezItem* big)
+{
+	int numErrors = 0;
+
+	RezItemStream chunks(big, 64 * 1024);
+	RezItemStream reads(big, 48 * 1024);
+	std::vector<unsigned char> buf(5000);
+
+	unsigned long chunkOffset = 0;
+	unsigned long readOffset = 0;
+	unsigned long length;
+	const unsigned char* chunk;
+	while ((chunk = chunks.NextChunk(&length)) != nullptr)
+	{
+		for (unsigned long j = 0; j < length; ++j)
+		{
+			if (chunk[j] != LargeByte(chunkOffset + j))
+			{
+				++numErrors;
+				break;
+			}
+		}
+		chunkOffset += length;
+
+		unsigned long numRead = reads.Read(&buf[0], (unsigned long)buf.size());
+		for (unsigned long j = 0; j < numRead; ++j)
+		{
+			if (buf[j] != LargeByte(readOffset + j))
+			{
+				++numErrors;
+				break;
+			}
+		}
+		readOffset += numRead;
+	}
+	if ((chunkOffset != kLargeItemSize) || !chunks.EndOfStream() || chunks.Failed()) ++numErrors;
+	if (reads.Tell() != readOffset) ++numErrors;
+
+	// back to somewhere already passed
+	unsigned long offset = 1000;
+	if (!reads.Seek(offset)) ++numErrors;
+	if ((reads.Read(&buf[0], 100) != 100) || (buf[0] != LargeByte(offset)) || (buf[99] != LargeByte(offset + 99))) ++numErrors;
+
+	return numErrors;
+}
+
+static int LargeVerify(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kLargeRezFile)) return 1;
+
+	int numErrors = 0;
+	if (mgr.GetFileFormatVersion() != 2) ++numErrors;
+
+	RezItem* small = mgr.GetRootDir()->GetRez("SMALL", mgr.StrToType("DAT"));
+	RezItem* big = mgr.GetRootDir()->GetRez("BIG", mgr.StrToType("DAT"));
+	if ((small == nullptr) || (big == nullptr))
+	{
+		mgr.Close();
+		return numErrors + 1;
+	}
+
+	unsigned char* smallData = small->Load();
+	if ((smallData == nullptr) || (smallData[15] != 15)) ++numErrors;
+
+	if (big->DirectRead_GetFileOffset() <= 0xFFFFFFFFULL) ++numErrors;
+	if (big->GetSize() != kLargeItemSize) ++numErrors;
+
+	unsigned char* data = big->Load();
+	if (data == nullptr)
+	{
+		++numErrors;
+	}
+	else
+	{
+		for (unsigned long j = 0; j < kLargeItemSize; ++j)
+		{
+			if (data[j] != LargeByte(j))
+			{
+				++numErrors;
+				break;
+			}
+		}
+	}
+	big->UnLoad();
+
+	// a range in the middle of the item, read without loading all of it
+	std::vector<unsigned char> buf(4096);
+	unsigned long offset = kLargeItemSize / 2 + 123;
+	if (!big->Get(&buf[0], offset, (unsigned long)buf.size())) ++numErrors;
+	for (size_t j = 0; j < buf.size(); ++j)
+	{
+		if (buf[j] != LargeByte(offset + (unsigned long)j))
+		{
+			++numErrors;
+			break;
+		}
+	}
+
+	numErrors += LargeVerifyStream(big);
+
+	// a header, two blocks out of the big item and the small item's data, filled in one go
+	unsigned char header[64];
+	std::vector<unsigned char> block1(20000);
+	std::vector<unsigned char> block2(30000);
+	unsigned char smallBuf[16];
+	RezItemRead reads[4] =
+	{
+		{ big,   kLargeItemSize - 30000, 30000, &block2[0] },
+		{ big,   0,                      64,    header },
+		{ small, 0,                      16,    smallBuf },
+		{ big,   100,                    20000, &block1[0] },
+	};
+	unsigned long numFileReads = 0;
+	if (!mgr.ReadV(reads, 4, &numFileReads)) ++numErrors;
+	// the small item is still loaded and the header and the first block are close enough to go in one read,
+	// which leaves two (a mapped file copies each piece out of the view)
+	if ((fileAccess != RezFileAccessMapped) && (numFileReads != 2)) ++numErrors;
+	if ((header[0] != LargeByte(0)) || (header[63] != LargeByte(63))) ++numErrors;
+	if ((block1[0] != LargeByte(100)) || (block1[19999] != LargeByte(20099))) ++numErrors;
+	if ((block2[0] != LargeByte(kLargeItemSize - 30000)) || (block2[29999] != LargeByte(kLargeItemSize - 1))) ++numErrors;
+	if (smallBuf[15] != 15) ++numErrors;
+
+	mgr.Close();
+	return numErrors;
+}
+
+void RezFileLargeTest()
+{
+	if (!LargeCreateFile())
+	{
+		printf("RezFileLargeTest: unable to create %s\n", kLargeRezFile);
+		remove(kLargeRezFile);
+		return;
+	}
+
+	int numErrors = 0;
+	numErrors += LargeVerify(RezFileAccessMapped);
+	numErrors += LargeVerify(RezFileAccessStdio);
+	numErrors += LargeVerify(RezFileAccessPositional);
+
+	remove(kLargeRezFile);
+
+	printf("RezFileLargeTest: %d errors\n", numErrors);
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <vector>
+
+using namespace JupiterEx::RezMgr;
+
+const int           kMemoryNumItems = 64;
+const unsigned long kMemoryItemSize = 3000;
+
+static unsigned char MemoryByte(int item, unsigned long offset)
+{
+	return (unsigned char)((item * 31) + (offset * 7));
+}
+
+static bool MemoryCreate(RezMemoryImage* image)
+{
+	RezMgr mgr;
+	if (!mgr.OpenMemory(image)) return false;
+
+	RezDir* dir = mgr.GetRootDir()->CreateDir("CONFIG");
+	if (dir == nullptr) return false;
+
+	bool saved = true;
+	for (int i = 0; i < kMemoryNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = dir->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned char* data = item->Create(kMemoryItemSize + i);
+		for (unsigned long j = 0; j < kMemoryItemSize + i; ++j) data[j] = MemoryByte(i, j);
+		if (!item->Save()) saved = false;
+		item->UnLoad();
+	}
+
+	return mgr.Close() && saved;
+}
+
+static int MemoryVerify(RezMgr* mgr, const unsigned char* image, unsigned long imageSize)
+{
+	RezDir* dir = mgr->GetRootDir()->GetDir("CONFIG");
+	if (dir == nullptr) return 1;
+
+	int numErrors = 0;
+	for (int i = 0; i < kMemoryNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = dir->GetRez(name, mgr->StrToType("DAT"));
+		if ((item == nullptr) || (item->GetSize() != kMemoryItemSize + i))
+		{
+			++numErrors;
+			continue;
+		}
+
+		unsigned char* data = item->Load();
+		if (data == nullptr)
+		{
+			++numErrors;
+			continue;
+		}
+
+		// a read only image is used in place, Load hands back a pointer into it
+		if ((image != nullptr) && ((data < image) || (data >= image + imageSize))) ++numErrors;
+
+		for (unsigned long j = 0; j < kMemoryItemSize + i; ++j)
+		{
+			if (data[j] != MemoryByte(i, j))
+			{
+				++numErrors;
+				break;
+			}
+		}
+		item->UnLoad();
+	}
+
+	return numErrors;
+}
+
+void RezFileMemoryTest()
+{
+	int numErrors = 0;
+
+	RezMemoryImage image;
+	if (!MemoryCreate(&image) || (image.GetSize() == 0))
+	{
+		printf("RezFileMemoryTest: unable to create the image\n");
+		return;
+	}
+
+	// the image the RezMgr wrote, reopened read only straight from memory
+	{
+		RezMgr mgr;
+		if (mgr.OpenMemory(image.GetData(), image.GetSize()))
+		{
+			numErrors += MemoryVerify(&mgr, image.GetData(), (unsigned long)image.GetSize());
+			mgr.Close();
+		}
+		else
+		{
+			++numErrors;
+		}
+	}
+
+	// a copy the image no longer knows about, as if it had been embedded in the executable
+	{
+		std::vector<unsigned char> copy(image.GetData(), image.GetData() + image.GetSize());
+		RezMgr mgr;
+		if (mgr.OpenMemory(&copy[0], copy.size()))
+		{
+			numErrors += MemoryVerify(&mgr, &copy[0], (unsigned long)copy.size());
+			mgr.Close();
+		}
+		else
+		{
+			++numErrors;
+		}
+	}
+
+	// open the image again for writing, add an item and check everything is still there
+	{
+		RezMgr mgr;
+		if (mgr.OpenMemory(&image, false, false))
+		{
+			RezItem* item = mgr.GetRootDir()->CreateRez(1000, "EXTRA", mgr.StrToType("DAT"));
+			unsigned char* data = item->Create(16);
+			for (unsigned long j = 0; j < 16; ++j) data[j] = (unsigned char)j;
+			if (!item->Save()) ++numErrors;
+			if (!mgr.Close()) ++numErrors;
+		}
+		else
+		{
+			++numErrors;
+		}
+	}
+	{
+		RezMgr mgr;
+		if (mgr.OpenMemory(&image, true, false))
+		{
+			numErrors += MemoryVerify(&mgr, nullptr, 0);
+
+			RezItem* item = mgr.GetRootDir()->GetRez("EXTRA", mgr.StrToType("DAT"));
+			unsigned char* data = (item != nullptr) ? item->Load() : nullptr;
+			if ((data == nullptr) || (data[15] != 15)) ++numErrors;
+			mgr.Close();
+		}
+		else
+		{
+			++numErrors;
+		}
+	}
+
+	printf("RezFileMemoryTest: %d errors\n", numErrors);
+}
\ No newline at end of file
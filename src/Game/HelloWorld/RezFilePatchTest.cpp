@@ -0,0 +1,314 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <string.h>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kPatchBaseRezFile = "RezFilePatchBase.rez";
+static const char* kPatchRezFile = "RezFilePatch.rez";
+static const char* kPatchChainRezFile = "RezFilePatchChain.rez";
+static const char* kPatchWrongRezFile = "RezFilePatchWrong.rez";
+static const char* kPatchDamagedRezFile = "RezFilePatchDamaged.rez";
+static const char* kPatchCopyFile = "RezFilePatchCopy.bin";
+
+const int           kPatchNumItems = 6;
+const unsigned long kPatchItemSize = 1024 * 1024;
+
+static unsigned char PatchByte(int item, unsigned long offset)
+{
+	unsigned long x = (offset + 1) * 2654435761UL;
+	x ^= x >> 15;
+	x *= 2246822519UL;
+	return (unsigned char)((x >> 13) + item * 7);
+}
+
+// what item holds after edits patches have been made, every edit changes a few bytes in place and
+// the odd ones also drop a piece and put some new bytes in further on, so what follows moves
+static void PatchFill(unsigned char* data, int item, int edits, unsigned long* size)
+{
+	unsigned long len = 0;
+	for (unsigned long j = 0; j < kPatchItemSize; ++j)
+	{
+		for (int e = 1; e <= edits; ++e)
+		{
+			if (((e & 1) != 0) && (j == 300000UL * e + item)) j += 5000;
+		}
+		unsigned char byte = PatchByte(item, j);
+		for (int e = 1; e <= edits; ++e)
+		{
+			if ((j >= 100000UL * e + item * 1000) && (j < 100000UL * e + item * 1000 + 64)) byte ^= (unsigned char)(0x55 + e);
+		}
+		data[len++] = byte;
+		for (int e = 1; e <= edits; ++e)
+		{
+			if (((e & 1) != 0) && (j == 500000UL * e + item))
+			{
+				for (int k = 0; k < 3000; ++k) data[len++] = (unsigned char)(k * e + item);
+			}
+		}
+	}
+	*size = len;
+}
+
+static bool PatchCreateBase()
+{
+	RezMgr mgr;
+	mgr.SetChecksums(true);
+	if (!mgr.Open(kPatchBaseRezFile, false, true)) return false;
+
+	bool saved = true;
+	for (int i = 0; i < kPatchNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned long size;
+		PatchFill(item->Create(kPatchItemSize), i, 0, &size);
+		if (!item->Save()) saved = false;
+		item->UnLoad();
+	}
+	return mgr.Close() && saved;
+}
+
+// patches what the base file (with fromPatch over it if there is one) holds after edits - 1 to what it holds after
+// edits (ITEM0 stays the same and is left out), also puts in NEW as a whole item, returns the size of the patch
+static unsigned long long PatchCreate(const char* fromPatch, const char* patchFile, int edits)
+{
+	RezMgr from;
+	if (!from.Open(kPatchBaseRezFile) || ((fromPatch != nullptr) && !from.OpenAdditional(fromPatch, true))) return 0;
+
+	RezMgr mgr;
+	mgr.SetChecksums(true);
+	if (!mgr.Open(patchFile, false, true))
+	{
+		from.Close();
+		return 0;
+	}
+
+	unsigned char* data = new unsigned char[kPatchItemSize * 2];
+	bool saved = true;
+	for (int i = 1; i < kPatchNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		unsigned long size;
+		PatchFill(data, i, edits, &size);
+		RezItem* item = mgr.GetRootDir()->CreateRez(i, name, mgr.StrToType("DAT"));
+		if (!item->SaveDelta(from.GetRootDir()->GetRez(name, from.StrToType("DAT")), data, size) || !item->IsDelta()) saved = false;
+		item->UnLoad();
+	}
+
+	RezItem* item = mgr.GetRootDir()->CreateRez(kPatchNumItems, "NEW", mgr.StrToType("DAT"));
+	memcpy(item->Create(1000), "new item", 9);
+	if (!item->Save() || item->IsDelta()) saved = false;
+	item->UnLoad();
+
+	from.Close();
+	delete [] data;
+	if (!mgr.Close() || !saved) return 0;
+
+	FILE* fp = fopen(patchFile, "rb");
+	if (fp == nullptr) return 0;
+	fseek(fp, 0, SEEK_END);
+	long fileSize = ftell(fp);
+	fclose(fp);
+	return (fileSize > 0) ? (unsigned long long)fileSize : 0;
+}
+
+static int PatchCheck(RezFileAccess fileAccess, const char* patchFile, const char* chainFile, int edits)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	mgr.SetChecksumVerify(RezChecksumVerifyAlways);
+	if (!mgr.Open(kPatchBaseRezFile) || !mgr.OpenAdditional(patchFile, true)) return 1;
+	if ((chainFile != nullptr) && !mgr.OpenAdditional(chainFile, true)) return 1;
+
+	int numErrors = 0;
+	unsigned char* data = new unsigned char[kPatchItemSize * 2];
+	unsigned char* read = new unsigned char[kPatchItemSize * 2];
+	RezItem* items[kPatchNumItems];
+	for (int i = 0; i < kPatchNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		unsigned long size;
+		PatchFill(data, i, (i == 0) ? 0 : edits, &size);
+		RezItem* item = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+		items[i] = item;
+		if ((item == nullptr) || (item->GetSize() != size) || (item->IsDelta() != (i != 0)))
+		{
+			++numErrors;
+			continue;
+		}
+
+		// pieces, without loading all of it first
+		if (!item->Get(read, 123456, 70000) || (memcmp(read, data + 123456, 70000) != 0)) ++numErrors;
+		item->UnLoad();
+		if ((item->Read(read, 5000, size - 5000) != 5000) || (memcmp(read, data + size - 5000, 5000) != 0)) ++numErrors;
+		item->UnLoad();
+
+		RezItemRead reads[2] = { { nullptr, 10, 100, read }, { nullptr, size - 300, 300, read + 100 } };
+		if (!item->ReadV(reads, 2) || (memcmp(read, data + 10, 100) != 0) || (memcmp(read + 100, data + size - 300, 300) != 0)) ++numErrors;
+		if (item->IsLoaded()) ++numErrors;   // a patched item is loaded just for the call
+		item->UnLoad();
+
+		RezItemStream stream(item, 64 * 1024);
+		if ((stream.Read(read, size) != size) || !stream.EndOfStream() || (memcmp(read, data, size) != 0)) ++numErrors;
+		item->UnLoad();
+
+		// and all of it
+		const unsigned char* loaded = item->Load();
+		if ((loaded == nullptr) || (memcmp(loaded, data, size) != 0) || !item->VerifyChecksum()) ++numErrors;
+		item->UnLoad();
+	}
+
+	if (!mgr.LoadBatch(items, kPatchNumItems)) ++numErrors;
+	for (int i = 0; i < kPatchNumItems; ++i)
+	{
+		unsigned long size;
+		PatchFill(data, i, (i == 0) ? 0 : edits, &size);
+		if ((items[i] == nullptr) || !items[i]->IsLoaded() || (memcmp(items[i]->Load(), data, size) != 0)) ++numErrors;
+		if (items[i] != nullptr) items[i]->UnLoad();
+	}
+
+	unsigned long size;
+	PatchFill(data, 3, edits, &size);
+	FILE* fp = nullptr;
+	if ((items[3] == nullptr) || !items[3]->CopyToFile(kPatchCopyFile) || ((fp = fopen(kPatchCopyFile, "rb")) == nullptr) ||
+		(fread(read, 1, kPatchItemSize * 2, fp) != size) || (memcmp(read, data, size) != 0)) ++numErrors;
+	if (fp != nullptr) fclose(fp);
+	remove(kPatchCopyFile);
+
+	RezItem* item = mgr.GetRootDir()->GetRez("NEW", mgr.StrToType("DAT"));
+	if ((item == nullptr) || (item->Load() == nullptr) || (strcmp((const char*)item->Load(), "new item") != 0)) ++numErrors;
+
+	delete [] data;
+	delete [] read;
+	mgr.Close();
+	return numErrors;
+}
+
+// a delta for ITEM1 made from ITEM2
+static bool PatchCreateWrong()
+{
+	RezMgr from;
+	if (!from.Open(kPatchBaseRezFile)) return false;
+
+	RezMgr mgr;
+	if (!mgr.Open(kPatchWrongRezFile, false, true))
+	{
+		from.Close();
+		return false;
+	}
+
+	unsigned char* data = new unsigned char[kPatchItemSize * 2];
+	unsigned long size;
+	PatchFill(data, 2, 1, &size);
+	RezItem* item = mgr.GetRootDir()->CreateRez(1, "ITEM1", mgr.StrToType("DAT"));
+	bool saved = item->SaveDelta(from.GetRootDir()->GetRez("ITEM2", from.StrToType("DAT")), data, size);
+	item->UnLoad();
+
+	delete [] data;
+	from.Close();
+	return mgr.Close() && saved;
+}
+
+// a patch over data it wasn't made from fails to load rather than making something that was never there
+static int PatchCheckWrong(RezFileAccess fileAccess)
+{
+	RezMgr mgr;
+	mgr.SetFileAccess(fileAccess);
+	if (!mgr.Open(kPatchBaseRezFile) || !mgr.OpenAdditional(kPatchWrongRezFile)) return 1;
+
+	int numErrors = 0;
+	RezItem* item = mgr.GetRootDir()->GetRez("ITEM1", mgr.StrToType("DAT"));
+	if ((item == nullptr) || !item->IsDelta() || (item->Load() != nullptr)) ++numErrors;
+	unsigned char bytes[16];
+	if ((item == nullptr) || item->Get(bytes, 0, sizeof(bytes))) ++numErrors;
+
+	// without the file it patches the delta is all there is
+	RezMgr alone;
+	alone.SetFileAccess(fileAccess);
+	if (!alone.Open(kPatchWrongRezFile)) return numErrors + 1;
+	item = alone.GetRootDir()->GetRez("ITEM1", alone.StrToType("DAT"));
+	if ((item == nullptr) || !item->IsDelta() || (item->GetSize() >= kPatchItemSize) || (item->Load() == nullptr)) ++numErrors;
+
+	alone.Close();
+	mgr.Close();
+	return numErrors;
+}
+
+// a patch whose delta record claims to run past the end of its entry is turned away rather than read
+static int PatchCheckDamaged()
+{
+	FILE* fp = fopen(kPatchRezFile, "rb");
+	if (fp == nullptr) return 1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	unsigned char* file = new unsigned char[size];
+	bool read = (fread(file, 1, size, fp) == (size_t)size);
+	fclose(fp);
+
+	// the tag and size of the last delta record (the directory is written after the data)
+	long record = -1;
+	for (long i = 0; read && (i + 8 <= size); ++i)
+	{
+		unsigned int tag, recordSize;
+		memcpy(&tag, file + i, 4);
+		memcpy(&recordSize, file + i + 4, 4);
+		if ((tag == 5) && ((recordSize == 20) || (recordSize == 24))) record = i;
+	}
+
+	int numErrors = 0;
+	if (record < 0) ++numErrors;
+	else
+	{
+		unsigned int recordSize = 0x7fffffff;
+		memcpy(file + record + 4, &recordSize, 4);
+		fp = fopen(kPatchDamagedRezFile, "wb");
+		if ((fp == nullptr) || (fwrite(file, 1, size, fp) != (size_t)size)) ++numErrors;
+		if (fp != nullptr) fclose(fp);
+
+		RezMgr mgr;
+		if (!mgr.Open(kPatchBaseRezFile) || mgr.OpenAdditional(kPatchDamagedRezFile, true)) ++numErrors;
+		mgr.Close();
+	}
+
+	delete [] file;
+	remove(kPatchDamagedRezFile);
+	return numErrors;
+}
+
+void RezFilePatchTest()
+{
+	int numErrors = 0;
+	if (!PatchCreateBase()) ++numErrors;
+
+	unsigned long long patchSize = PatchCreate(nullptr, kPatchRezFile, 1);
+	if ((patchSize == 0) || (patchSize > kPatchItemSize / 32)) ++numErrors;
+	if (!PatchCreateWrong()) ++numErrors;
+
+	numErrors += PatchCheck(RezFileAccessMapped, kPatchRezFile, nullptr, 1);
+	numErrors += PatchCheck(RezFileAccessStdio, kPatchRezFile, nullptr, 1);
+	numErrors += PatchCheckWrong(RezFileAccessMapped);
+	numErrors += PatchCheckWrong(RezFileAccessStdio);
+
+	// the second patch is made against the first one over the base, and goes over both
+	if (PatchCreate(kPatchRezFile, kPatchChainRezFile, 2) == 0) ++numErrors;
+	numErrors += PatchCheck(RezFileAccessMapped, kPatchRezFile, kPatchChainRezFile, 2);
+	numErrors += PatchCheck(RezFileAccessStdio, kPatchRezFile, kPatchChainRezFile, 2);
+	numErrors += PatchCheckDamaged();
+
+	printf("RezFilePatchTest: %d items of %lu KB patched in %llu bytes\n", kPatchNumItems - 1, kPatchItemSize / 1024, patchSize);
+
+	remove(kPatchBaseRezFile);
+	remove(kPatchRezFile);
+	remove(kPatchChainRezFile);
+	remove(kPatchWrongRezFile);
+
+	printf("RezFilePatchTest: %d errors\n", numErrors);
+}
\ No newline at end of file
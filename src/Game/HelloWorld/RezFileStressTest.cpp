@@ -0,0 +1,189 @@
+#include "JupiterEx.hpp"
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+using namespace JupiterEx::RezMgr;
+
+static const char* kStressRezFile = "RezFileStressTest.rez";
+const int kStressNumItems   = 64;
+const int kStressNumThreads = 8;
+const int kStressNumReads   = 20000;
+
+static unsigned char StressByte(int item, unsigned long offset)
+{
+	return (unsigned char)((item * 131) + (offset * 7) + (offset >> 9));
+}
+
+static unsigned long StressItemSize(int item)
+{
+	return 1000 + (unsigned long)item * 3371;
+}
+
+static bool StressCreateFile()
+{
+	RezMgr mgr;
+	if (!mgr.Open(kStressRezFile, false, true)) return false;
+
+	RezDir* root = mgr.GetRootDir();
+	for (int i = 0; i < kStressNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+
+		RezItem* item = root->CreateRez(i, name, mgr.StrToType("DAT"));
+		unsigned long size = StressItemSize(i);
+		unsigned char* data = item->Create(size);
+		for (unsigned long j = 0; j < size; ++j) data[j] = StressByte(i, j);
+		item->Save();
+		item->UnLoad();
+	}
+
+	mgr.Close();
+	return true;
+}
+
+// every thread creates and saves its own items, half in the root everyone shares and half in a directory of its own
+static int StressWriteFile()
+{
+	RezMgr mgr;
+	mgr.SetBackgroundSave(1024 * 1024);
+	if (!mgr.Open(kStressRezFile, false, true)) return 1;
+
+	std::atomic<int> numErrors(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kStressNumThreads; ++t)
+	{
+		threads.push_back(std::thread([&mgr, &numErrors, t]()
+		{
+			char name[32];
+			sprintf(name, "THREAD%d", t);
+			RezDir* dir = mgr.GetRootDir()->CreateDir(name);
+			if (dir == nullptr) ++numErrors;
+
+			for (int i = 0; i < kStressNumItems; ++i)
+			{
+				sprintf(name, "T%dITEM%d", t, i);
+				RezItem* item = ((i & 1) || (dir == nullptr) ? mgr.GetRootDir() : dir)->CreateRez(i, name, mgr.StrToType("DAT"));
+				if (item == nullptr)
+				{
+					++numErrors;
+					continue;
+				}
+
+				unsigned long size = StressItemSize(i) / 8;
+				unsigned char* data = item->Create(size);
+				for (unsigned long j = 0; j < size; ++j) data[j] = StressByte(i + t, j);
+				if (!item->Save()) ++numErrors;
+				item->UnLoad();
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+	if (!mgr.Close()) ++numErrors;
+
+	if (!mgr.Open(kStressRezFile)) return numErrors + 1;
+	for (int t = 0; t < kStressNumThreads; ++t)
+	{
+		char name[32];
+		sprintf(name, "THREAD%d", t);
+		RezDir* dir = mgr.GetRootDir()->GetDir(name);
+
+		for (int i = 0; i < kStressNumItems; ++i)
+		{
+			sprintf(name, "T%dITEM%d", t, i);
+			RezDir* parent = ((i & 1) || (dir == nullptr)) ? mgr.GetRootDir() : dir;
+			RezItem* item = parent->GetRez(name, mgr.StrToType("DAT"));
+			unsigned char* data = (item != nullptr) ? item->Load() : nullptr;
+			unsigned long size = StressItemSize(i) / 8;
+			if ((data == nullptr) || (item->GetSize() != size) || (data[0] != StressByte(i + t, 0)) || (data[size - 1] != StressByte(i + t, size - 1)))
+			{
+				++numErrors;
+			}
+		}
+	}
+	mgr.Close();
+
+	return numErrors;
+}
+
+void RezFileStressTest()
+{
+	if (!StressCreateFile())
+	{
+		printf("RezFileStressTest: unable to create %s\n", kStressRezFile);
+		return;
+	}
+
+	RezMgr mgr;
+	mgr.SetFileAccess(RezFileAccessPositional);
+	if (!mgr.Open(kStressRezFile))
+	{
+		printf("RezFileStressTest: unable to open %s\n", kStressRezFile);
+		return;
+	}
+
+	// look up every item up front, the directory itself is not meant to be walked from many threads
+	RezItem* items[kStressNumItems];
+	for (int i = 0; i < kStressNumItems; ++i)
+	{
+		char name[32];
+		sprintf(name, "ITEM%d", i);
+		items[i] = mgr.GetRootDir()->GetRez(name, mgr.StrToType("DAT"));
+		if (items[i] == nullptr)
+		{
+			printf("RezFileStressTest: item %s missing\n", name);
+			mgr.Close();
+			return;
+		}
+	}
+
+	std::atomic<int> numErrors(0);
+	std::atomic<int> numReads(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kStressNumThreads; ++t)
+	{
+		threads.push_back(std::thread([&items, &numErrors, &numReads, t]()
+		{
+			unsigned int seed = 12345 + t * 7919;
+			std::vector<unsigned char> buf;
+			for (int n = 0; n < kStressNumReads; ++n)
+			{
+				seed = seed * 1103515245 + 12345;
+				int i = (seed >> 8) % kStressNumItems;
+				unsigned long size = (unsigned long)items[i]->GetSize();
+
+				seed = seed * 1103515245 + 12345;
+				unsigned long offset = (seed >> 4) % size;
+				seed = seed * 1103515245 + 12345;
+				unsigned long length = 1 + (seed >> 4) % (size - offset);
+
+				buf.resize(length);
+				if (!items[i]->Get(&buf[0], offset, length))
+				{
+					++numErrors;
+					continue;
+				}
+
+				for (unsigned long j = 0; j < length; ++j)
+				{
+					if (buf[j] != StressByte(i, offset + j))
+					{
+						++numErrors;
+						break;
+					}
+				}
+				++numReads;
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+	mgr.Close();
+	numErrors += StressWriteFile();
+	remove(kStressRezFile);
+
+	printf("RezFileStressTest: %d threads, %d reads, %d errors\n", kStressNumThreads, (int)numReads, (int)numErrors);
+}
\ No newline at end of file
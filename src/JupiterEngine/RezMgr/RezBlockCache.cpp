@@ -0,0 +1,204 @@
+#include "RezMgr/RezBlockCache.hpp"
+#include "Memory/Memory.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+namespace JupiterEx { namespace RezMgr {
+
+// -----------------------------------------------------------------------------------------
+// RezCacheBlock
+
+RezCacheBlock::RezCacheBlock()
+{
+	file_       = nullptr;
+	blockIndex_ = 0;
+	data_       = nullptr;
+	size_       = 0;
+	referenced_ = false;
+}
+
+unsigned int RezCacheBlock::HashFunc()
+{
+	return GetParentTable()->HashFunc(file_, blockIndex_);
+}
+
+// -----------------------------------------------------------------------------------------
+// RezBlockCacheTable
+
+unsigned int RezBlockCacheTable::HashFunc(BaseRezFile* file, RezPos blockIndex)
+{
+	assert(GetNumBins() > 0);
+	RezPos key = ((RezPos)(size_t)file >> 4) * 31 + blockIndex;
+	return (unsigned int)(key % GetNumBins());
+}
+
+RezCacheBlock* RezBlockCacheTable::Find(BaseRezFile* file, RezPos blockIndex)
+{
+	RezCacheBlock* block = GetFirstInBin(HashFunc(file, blockIndex));
+	while (block != nullptr)
+	{
+		if ((block->file_ == file) && (block->blockIndex_ == blockIndex)) return block;
+		block = (RezCacheBlock*)block->NextInBin();
+	}
+	return nullptr;
+}
+
+// -----------------------------------------------------------------------------------------
+// RezBlockCache
+
+RezBlockCache::RezBlockCache(unsigned long budget, unsigned long blockSize)
+{
+	assert(blockSize > 0);
+
+	blockSize_ = blockSize;
+	numBlocks_ = budget / blockSize;
+	if (numBlocks_ < kRezBlockCacheMaxBlocksPerRead) numBlocks_ = kRezBlockCacheMaxBlocksPerRead;
+	clockHand_ = 0;
+
+	LT_MEM_TRACK_ALLOC(table_ = new RezBlockCacheTable(numBlocks_), LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(blocks_ = new RezCacheBlock[numBlocks_], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(memory_ = new unsigned char[numBlocks_ * blockSize_], LT_MEM_TYPE_MISC);
+	assert((table_ != nullptr) && (blocks_ != nullptr) && (memory_ != nullptr));
+
+	for (unsigned long i = 0; i < numBlocks_; ++i) blocks_[i].data_ = memory_ + i * blockSize_;
+
+	memset(&stats_, 0, sizeof(stats_));
+	stats_.numBlocks = numBlocks_;
+	stats_.blockSize = blockSize_;
+}
+
+RezBlockCache::~RezBlockCache()
+{
+	LT_MEM_TRACK_FREE(delete table_);
+	LT_MEM_TRACK_FREE(delete [] blocks_);
+	LT_MEM_TRACK_FREE(delete [] memory_);
+}
+
+unsigned long RezBlockCache::Read(BaseRezFile* file, RezPos fileSize, RezPos pos, unsigned long size, unsigned char* data)
+{
+	assert(file != nullptr);
+	assert(data != nullptr);
+
+	unsigned char* scratch = nullptr;
+	unsigned long done = 0;
+	while (done < size)
+	{
+		RezPos curPos = pos + done;
+		RezPos blockIndex = curPos / blockSize_;
+		RezPos blockPos = blockIndex * blockSize_;
+		unsigned long offset = (unsigned long)(curPos - blockPos);
+		unsigned long num = blockSize_ - offset;
+		if (num > size - done) num = size - done;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			RezCacheBlock* block = table_->Find(file, blockIndex);
+			if ((block != nullptr) && (offset + num <= block->size_))
+			{
+				memcpy(data + done, block->data_ + offset, num);
+				block->referenced_ = true;
+				++stats_.hits;
+				done += num;
+				continue;
+			}
+		}
+
+		// not cached, read the whole block without holding the lock
+		if (blockPos >= fileSize) break;
+		unsigned long blockBytes = (fileSize - blockPos > blockSize_) ? blockSize_ : (unsigned long)(fileSize - blockPos);
+		if (offset + num > blockBytes) break;
+
+		if (scratch == nullptr)
+		{
+			LT_MEM_TRACK_ALLOC(scratch = new unsigned char[blockSize_], LT_MEM_TYPE_MISC);
+			if (scratch == nullptr) break;
+		}
+		if (file->Read(blockPos, 0, blockBytes, scratch) != blockBytes) break;
+
+		memcpy(data + done, scratch + offset, num);
+		done += num;
+
+		// another thread may have brought the same block in meanwhile, it then just gets refreshed
+		std::unique_lock<std::mutex> lock(mutex_);
+		++stats_.misses;
+		RezCacheBlock* block = table_->Find(file, blockIndex);
+		if (block == nullptr)
+		{
+			block = GetFreeBlock();
+			block->file_       = file;
+			block->blockIndex_ = blockIndex;
+			table_->Insert(block);
+		}
+		memcpy(block->data_, scratch, blockBytes);
+		block->size_       = blockBytes;
+		block->referenced_ = true;
+	}
+
+	if (scratch != nullptr) LT_MEM_TRACK_FREE(delete [] scratch);
+	return done;
+}
+
+void RezBlockCache::Invalidate(BaseRezFile* file, RezPos pos, unsigned long size)
+{
+	if (size <= 0) return;
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	RezPos lastBlock = (pos + size - 1) / blockSize_;
+	for (RezPos blockIndex = pos / blockSize_; blockIndex <= lastBlock; ++blockIndex)
+	{
+		RezCacheBlock* block = table_->Find(file, blockIndex);
+		if (block != nullptr) Remove(block);
+	}
+}
+
+void RezBlockCache::InvalidateFile(BaseRezFile* file)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (unsigned long i = 0; i < numBlocks_; ++i)
+	{
+		if (blocks_[i].file_ == file) Remove(&blocks_[i]);
+	}
+}
+
+void RezBlockCache::GetStats(RezBlockCacheStats* stats)
+{
+	assert(stats != nullptr);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	*stats = stats_;
+}
+
+// mutex_ must be held, returns a block that is not in the table
+RezCacheBlock* RezBlockCache::GetFreeBlock()
+{
+	for (;;)
+	{
+		RezCacheBlock* block = &blocks_[clockHand_];
+		clockHand_ = (clockHand_ + 1) % numBlocks_;
+
+		if (block->file_ == nullptr) return block;
+		if (block->referenced_)
+		{
+			block->referenced_ = false;
+			continue;
+		}
+
+		++stats_.evictions;
+		Remove(block);
+		return block;
+	}
+}
+
+// mutex_ must be held
+void RezBlockCache::Remove(RezCacheBlock* block)
+{
+	assert(block->file_ != nullptr);
+
+	table_->Delete(block);
+	block->file_       = nullptr;
+	block->size_       = 0;
+	block->referenced_ = false;
+}
+
+}}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Common/BaseHash.hpp"
+#include "RezMgr/RezFile.hpp"
+#include <mutex>
+
+#define kRezBlockCacheDefaultBlockSize  (32 * 1024)
+#define kRezBlockCacheMaxBlocksPerRead  4    // reads bigger than this many blocks go straight to the file
+
+namespace JupiterEx { namespace RezMgr {
+
+class RezBlockCacheTable;
+
+// counters for RezMgr::GetBlockCacheStats
+struct RezBlockCacheStats
+{
+	unsigned long long hits;       // blocks copied out of the cache
+	unsigned long long misses;     // blocks that had to be read from a file
+	unsigned long long evictions;  // blocks thrown out to make room for another
+	unsigned long numBlocks;       // blocks the budget allows for
+	unsigned long blockSize;       // bytes per block
+};
+
+// -----------------------------------------------------------------------------------------
+// RezCacheBlock
+
+class RezCacheBlock : public Common::BaseHashItem
+{
+public:
+	RezCacheBlock();
+	virtual ~RezCacheBlock() {}
+
+protected:
+	virtual unsigned int HashFunc() override;
+	RezBlockCacheTable* GetParentTable() { return (RezBlockCacheTable*)BaseHashItem::GetParentTable(); }
+
+private:
+	friend class RezBlockCache;
+	friend class RezBlockCacheTable;
+
+	BaseRezFile* file_;         // file the block belongs to, nullptr if the block is free
+	RezPos blockIndex_;         // position in the file divided by the block size
+	unsigned char* data_;
+	unsigned long size_;        // valid bytes, only less than the block size for the last block of a file
+	bool referenced_;           // used since the clock hand last went past
+};
+
+// -----------------------------------------------------------------------------------------
+// RezBlockCacheTable
+
+class RezBlockCacheTable : public Common::BaseHashTable
+{
+public:
+	RezBlockCacheTable(unsigned int numBins) : BaseHashTable(numBins) {}
+	RezCacheBlock* Find(BaseRezFile* file, RezPos blockIndex);
+	void Insert(RezCacheBlock* block) { BaseHashTable::Insert(block); }
+	void Delete(RezCacheBlock* block) { BaseHashTable::Delete(block); }
+
+protected:
+	friend class RezCacheBlock;
+	RezCacheBlock* GetFirstInBin(unsigned int bin) { return (RezCacheBlock*)BaseHashTable::GetFirstInBin(bin); }
+	unsigned int HashFunc(BaseRezFile* file, RezPos blockIndex);
+};
+
+// -----------------------------------------------------------------------------------------
+// RezBlockCache
+
+// Fixed size blocks of rez files shared by every file of a RezMgr.  The budget is split into blocks
+// up front and blocks are reused with the CLOCK algorithm, a block that has been used since the
+// hand last went past gets a second chance.  Safe to use from several threads, file reads for
+// missing blocks are done without holding the lock.
+class RezBlockCache
+{
+public:
+	RezBlockCache(unsigned long budget, unsigned long blockSize);
+	~RezBlockCache();
+
+	// reads through the cache, fileSize is needed so the last block of the file is not read past its end
+	unsigned long Read(BaseRezFile* file, RezPos fileSize, RezPos pos, unsigned long size, unsigned char* data);
+
+	void Invalidate(BaseRezFile* file, RezPos pos, unsigned long size);         // drop blocks overlapping a range
+	void InvalidateFile(BaseRezFile* file);                                    // drop every block of a file
+
+	unsigned long GetBlockSize() { return blockSize_; }
+	unsigned long GetMaxCachedRead() { return blockSize_ * kRezBlockCacheMaxBlocksPerRead; }
+	void GetStats(RezBlockCacheStats* stats);
+
+private:
+	RezCacheBlock* GetFreeBlock();
+	void Remove(RezCacheBlock* block);
+
+	std::mutex mutex_;
+	RezBlockCacheTable* table_;
+	RezCacheBlock* blocks_;
+	unsigned char* memory_;     // data for all the blocks in one allocation
+	unsigned long numBlocks_;
+	unsigned long blockSize_;
+	unsigned long clockHand_;
+	RezBlockCacheStats stats_;
+};
+
+}}
\ No newline at end of file
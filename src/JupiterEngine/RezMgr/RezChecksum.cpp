@@ -0,0 +1,312 @@
+#include "RezMgr/RezChecksum.hpp"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define REZ_CRC32C_SSE42
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define REZ_CRC32C_TARGET
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define REZ_CRC32C_TARGET __attribute__((target("sse4.2,pclmul")))
+#endif
+#endif
+
+#define kRezCrc32cPoly   0x82f63b78   // the Castagnoli polynomial, bit reversed
+#define kRezCrc32cLong   8192         // bytes each of the three crc32 streams covers at a time for big blocks
+#define kRezCrc32cShort  256          // and for what is left after those
+#define kRezCrc32cFold   8192         // bytes of each RezCrc32cBlock the carry-less multiply streams take
+#define kRezCrc32cSide   3072         // bytes each of the three crc32 streams take alongside them
+#define kRezCrc32cBlock  (kRezCrc32cFold + 3 * kRezCrc32cSide)
+
+namespace JupiterEx { namespace RezMgr {
+
+// a * b modulo the polynomial, both bit reversed like a crc (the top bit is x^0)
+static unsigned int RezGF2MulMod(unsigned int a, unsigned int b)
+{
+	unsigned int product = 0;
+	for (unsigned int m = 0x80000000; (m != 0) && (a != 0); m >>= 1)
+	{
+		if (a & m)
+		{
+			product ^= b;
+			a ^= m;
+		}
+		b = (b & 1) ? ((b >> 1) ^ kRezCrc32cPoly) : (b >> 1);
+	}
+	return product;
+}
+
+// x^n modulo the polynomial, bit reversed
+static unsigned int RezGF2PowX(unsigned int n)
+{
+	unsigned int r = 0x80000000;
+	while (n-- > 0) r = (r & 1) ? ((r >> 1) ^ kRezCrc32cPoly) : (r >> 1);
+	return r;
+}
+
+// tables and what the processor can do, filled in once before main
+class RezCrc32cTables
+{
+public:
+	RezCrc32cTables();
+
+	// what the crc of a block becomes when length zero bytes follow it, for combining the streams
+	unsigned int Shift(const unsigned int (*zeros)[256], unsigned int crc)
+	{
+		return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+	}
+
+	unsigned int slices_[8][256];       // slicing-by-8 tables
+	unsigned int longZeros_[4][256];    // Shift tables for kRezCrc32cLong bytes
+	unsigned int shortZeros_[4][256];   // for kRezCrc32cShort bytes
+	unsigned int sideZeros_[4][256];    // and for kRezCrc32cSide bytes
+	unsigned long long fold512_[2];     // carry-less multipliers that move 16 bytes of data 64 bytes on
+	unsigned long long fold128_[2];     // and 16 bytes on
+	bool hardware_;
+	bool clmul_;
+
+private:
+	void MakeZeros(unsigned int (*zeros)[256], unsigned int length);
+};
+
+RezCrc32cTables::RezCrc32cTables()
+{
+	for (unsigned int i = 0; i < 256; ++i)
+	{
+		unsigned int crc = i;
+		for (int j = 0; j < 8; ++j) crc = (crc & 1) ? ((crc >> 1) ^ kRezCrc32cPoly) : (crc >> 1);
+		slices_[0][i] = crc;
+	}
+	for (unsigned int i = 0; i < 256; ++i)
+	{
+		for (int j = 1; j < 8; ++j) slices_[j][i] = (slices_[j - 1][i] >> 8) ^ slices_[0][slices_[j - 1][i] & 0xff];
+	}
+
+	MakeZeros(longZeros_, kRezCrc32cLong);
+	MakeZeros(shortZeros_, kRezCrc32cShort);
+	MakeZeros(sideZeros_, kRezCrc32cSide);
+
+	// the low half of a 16 byte piece holds the terms 64 higher than the high half, and the product of two
+	// bit reversed values comes out one bit short of where it belongs, hence the odd looking powers
+	fold512_[0] = RezGF2PowX(512 + 31);
+	fold512_[1] = RezGF2PowX(512 - 33);
+	fold128_[0] = RezGF2PowX(128 + 31);
+	fold128_[1] = RezGF2PowX(128 - 33);
+
+	hardware_ = false;
+	clmul_ = false;
+#if defined(REZ_CRC32C_SSE42) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	hardware_ = ((info[2] & (1 << 20)) != 0);
+	clmul_ = hardware_ && ((info[2] & (1 << 1)) != 0);
+#elif defined(REZ_CRC32C_SSE42)
+	unsigned int eax, ebx, ecx, edx;
+	hardware_ = (__get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0) && ((ecx & (1 << 20)) != 0);
+	clmul_ = hardware_ && ((ecx & (1 << 1)) != 0);
+#endif
+}
+
+void RezCrc32cTables::MakeZeros(unsigned int (*zeros)[256], unsigned int length)
+{
+	unsigned int op = RezGF2PowX(8 * length);
+	for (unsigned int i = 0; i < 256; ++i)
+	{
+		zeros[0][i] = RezGF2MulMod(i, op);
+		zeros[1][i] = RezGF2MulMod(i << 8, op);
+		zeros[2][i] = RezGF2MulMod(i << 16, op);
+		zeros[3][i] = RezGF2MulMod(i << 24, op);
+	}
+}
+
+static RezCrc32cTables rezCrc32cTables;
+
+static unsigned int RezCrc32cSoftware(const unsigned char* p, size_t size, unsigned int crc)
+{
+	const unsigned int (*t)[256] = rezCrc32cTables.slices_;
+	while ((size > 0) && (((size_t)p & 7) != 0))
+	{
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+		--size;
+	}
+	while (size >= 8)
+	{
+		unsigned int lo, hi;
+		memcpy(&lo, p, sizeof(lo));
+		memcpy(&hi, p + 4, sizeof(hi));
+		lo ^= crc;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			  t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while (size > 0)
+	{
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+		--size;
+	}
+	return crc;
+}
+
+#if defined(REZ_CRC32C_SSE42)
+static inline unsigned long long RezRead64(const unsigned char* p)
+{
+	unsigned long long val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+// moves 16 bytes of data on by the distance fold was made for and adds them to the 16 bytes that are there
+REZ_CRC32C_TARGET static inline __m128i RezCrc32cFold(__m128i x, __m128i fold, __m128i next)
+{
+	__m128i lo = _mm_clmulepi64_si128(x, fold, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(x, fold, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+// crc32 instructions and carry-less multiplies run on different parts of the processor, so while four streams
+// fold the first kRezCrc32cFold bytes of the block 64 at a time with multiplies, three crc32 streams work through
+// the rest, all of them are shifted into place and combined at the end
+REZ_CRC32C_TARGET static unsigned int RezCrc32cBlock(const unsigned char* p, unsigned int crc)
+{
+	const __m128i fold512 = _mm_set_epi64x((long long)rezCrc32cTables.fold512_[1], (long long)rezCrc32cTables.fold512_[0]);
+	const __m128i fold128 = _mm_set_epi64x((long long)rezCrc32cTables.fold128_[1], (long long)rezCrc32cTables.fold128_[0]);
+
+	// the crc so far is added into the first four bytes
+	__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128((int)crc));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+
+	const unsigned char* side = p + kRezCrc32cFold;
+	unsigned long long crc0 = 0;
+	unsigned long long crc1 = 0;
+	unsigned long long crc2 = 0;
+	for (const unsigned char* f = p + 64; f < p + kRezCrc32cFold; f += 64)
+	{
+		x0 = RezCrc32cFold(x0, fold512, _mm_loadu_si128((const __m128i*)f));
+		x1 = RezCrc32cFold(x1, fold512, _mm_loadu_si128((const __m128i*)(f + 16)));
+		x2 = RezCrc32cFold(x2, fold512, _mm_loadu_si128((const __m128i*)(f + 32)));
+		x3 = RezCrc32cFold(x3, fold512, _mm_loadu_si128((const __m128i*)(f + 48)));
+
+		for (int i = 0; i < 24; i += 8)
+		{
+			crc0 = _mm_crc32_u64(crc0, RezRead64(side + i));
+			crc1 = _mm_crc32_u64(crc1, RezRead64(side + kRezCrc32cSide + i));
+			crc2 = _mm_crc32_u64(crc2, RezRead64(side + 2 * kRezCrc32cSide + i));
+		}
+		side += 24;
+	}
+	for (; side < p + kRezCrc32cFold + kRezCrc32cSide; side += 8)
+	{
+		crc0 = _mm_crc32_u64(crc0, RezRead64(side));
+		crc1 = _mm_crc32_u64(crc1, RezRead64(side + kRezCrc32cSide));
+		crc2 = _mm_crc32_u64(crc2, RezRead64(side + 2 * kRezCrc32cSide));
+	}
+
+	// the four streams come together in one 16 byte piece whose crc the crc32 instruction works out
+	x1 = RezCrc32cFold(x0, fold128, x1);
+	x2 = RezCrc32cFold(x1, fold128, x2);
+	x3 = RezCrc32cFold(x2, fold128, x3);
+	unsigned long long crcFold = _mm_crc32_u64(0, (unsigned long long)_mm_cvtsi128_si64(x3));
+	crcFold = _mm_crc32_u64(crcFold, (unsigned long long)_mm_cvtsi128_si64(_mm_unpackhi_epi64(x3, x3)));
+
+	crc = rezCrc32cTables.Shift(rezCrc32cTables.sideZeros_, (unsigned int)crcFold) ^ (unsigned int)crc0;
+	crc = rezCrc32cTables.Shift(rezCrc32cTables.sideZeros_, crc) ^ (unsigned int)crc1;
+	return rezCrc32cTables.Shift(rezCrc32cTables.sideZeros_, crc) ^ (unsigned int)crc2;
+}
+
+// the crc32 instruction takes three cycles to finish but a new one can start every cycle, so blocks are split
+// in three streams whose crcs are worked out side by side and then shifted into place and combined
+REZ_CRC32C_TARGET static unsigned int RezCrc32cHardware(const unsigned char* p, size_t size, unsigned int crc)
+{
+	unsigned long long crc0 = crc;
+	while ((size > 0) && (((size_t)p & 7) != 0))
+	{
+		crc0 = _mm_crc32_u8((unsigned int)crc0, *p++);
+		--size;
+	}
+
+	if (rezCrc32cTables.clmul_)
+	{
+		while (size >= kRezCrc32cBlock)
+		{
+			crc0 = RezCrc32cBlock(p, (unsigned int)crc0);
+			p += kRezCrc32cBlock;
+			size -= kRezCrc32cBlock;
+		}
+	}
+
+	while (size >= 3 * kRezCrc32cLong)
+	{
+		unsigned long long crc1 = 0;
+		unsigned long long crc2 = 0;
+		const unsigned char* end = p + kRezCrc32cLong;
+		do
+		{
+			crc0 = _mm_crc32_u64(crc0, RezRead64(p));
+			crc1 = _mm_crc32_u64(crc1, RezRead64(p + kRezCrc32cLong));
+			crc2 = _mm_crc32_u64(crc2, RezRead64(p + 2 * kRezCrc32cLong));
+			p += 8;
+		} while (p < end);
+		crc0 = rezCrc32cTables.Shift(rezCrc32cTables.longZeros_, (unsigned int)crc0) ^ (unsigned int)crc1;
+		crc0 = rezCrc32cTables.Shift(rezCrc32cTables.longZeros_, (unsigned int)crc0) ^ (unsigned int)crc2;
+		p += 2 * kRezCrc32cLong;
+		size -= 3 * kRezCrc32cLong;
+	}
+
+	while (size >= 3 * kRezCrc32cShort)
+	{
+		unsigned long long crc1 = 0;
+		unsigned long long crc2 = 0;
+		const unsigned char* end = p + kRezCrc32cShort;
+		do
+		{
+			crc0 = _mm_crc32_u64(crc0, RezRead64(p));
+			crc1 = _mm_crc32_u64(crc1, RezRead64(p + kRezCrc32cShort));
+			crc2 = _mm_crc32_u64(crc2, RezRead64(p + 2 * kRezCrc32cShort));
+			p += 8;
+		} while (p < end);
+		crc0 = rezCrc32cTables.Shift(rezCrc32cTables.shortZeros_, (unsigned int)crc0) ^ (unsigned int)crc1;
+		crc0 = rezCrc32cTables.Shift(rezCrc32cTables.shortZeros_, (unsigned int)crc0) ^ (unsigned int)crc2;
+		p += 2 * kRezCrc32cShort;
+		size -= 3 * kRezCrc32cShort;
+	}
+
+	while (size >= 8)
+	{
+		crc0 = _mm_crc32_u64(crc0, RezRead64(p));
+		p += 8;
+		size -= 8;
+	}
+	while (size > 0)
+	{
+		crc0 = _mm_crc32_u8((unsigned int)crc0, *p++);
+		--size;
+	}
+	return (unsigned int)crc0;
+}
+#endif
+
+unsigned int RezCrc32c(const void* data, size_t size, unsigned int crc)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+#if defined(REZ_CRC32C_SSE42)
+	if (rezCrc32cTables.hardware_) return ~RezCrc32cHardware(p, size, crc);
+#endif
+	return ~RezCrc32cSoftware(p, size, crc);
+}
+
+bool RezCrc32cIsHardware()
+{
+	return rezCrc32cTables.hardware_;
+}
+
+}}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace JupiterEx { namespace RezMgr {
+
+// CRC-32C (the Castagnoli polynomial) of size bytes, crc is what this returned for the data just before
+// them so a checksum can be worked out a piece at a time (0 to start). Processors with SSE 4.2 use its
+// crc32 instruction on three streams at once, everything else a table driven loop eight bytes at a time.
+unsigned int RezCrc32c(const void* data, size_t size, unsigned int crc = 0);
+
+// true if RezCrc32c is using the processor's crc32 instruction
+bool RezCrc32cIsHardware();
+
+}}
\ No newline at end of file
@@ -0,0 +1,470 @@
+#include "RezMgr/RezCompress.hpp"
+#include "Memory/Memory.hpp"
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+// limits of the LZ4 block format
+#define kRezLZ4MinMatch        4
+#define kRezLZ4MaxDistance     65535
+#define kRezLZ4LastLiterals    5      // the last bytes of a block are always literals
+#define kRezLZ4MatchFindLimit  12     // and no match may start this close to the end
+#define kRezLZ4HashLog         16
+#define kRezLZ4MaxChainDepth   256    // most earlier positions one search looks at (at kRezCompressMaxLevel)
+#define kRezLZ4NoPos           0xffffffff
+
+// dictionary training
+#define kRezTrainDmerSize      8      // pieces of the samples are counted this many bytes at a time
+#define kRezTrainSegmentSize   256    // and taken into the dictionary this many bytes at a time
+#define kRezTrainHashLog       20
+
+namespace JupiterEx { namespace RezMgr {
+
+static unsigned int RezRead32(const unsigned char* p)
+{
+	unsigned int val;
+	memcpy(&val, p, sizeof(val));
+	return val;
+}
+
+static unsigned int RezLZ4Hash(unsigned int sequence)
+{
+	return (sequence * 2654435761U) >> (32 - kRezLZ4HashLog);
+}
+
+// appends the part of a length that didn't fit in the token
+static bool RezLZ4PutLength(unsigned char*& op, unsigned char* opEnd, size_t length)
+{
+	while (length >= 255)
+	{
+		if (op >= opEnd) return false;
+		*op++ = 255;
+		length -= 255;
+	}
+	if (op >= opEnd) return false;
+	*op++ = (unsigned char)length;
+	return true;
+}
+
+// appends numLiterals bytes and then a match, a matchLength of 0 makes the literals only sequence that ends a block
+static bool RezLZ4PutSequence(unsigned char*& op, unsigned char* opEnd, const unsigned char* literals, size_t numLiterals,
+							  size_t offset, size_t matchLength)
+{
+	if (op >= opEnd) return false;
+	unsigned char* token = op++;
+
+	size_t matchCode = (matchLength > 0) ? matchLength - kRezLZ4MinMatch : 0;
+	*token = (unsigned char)((((numLiterals >= 15) ? 15 : numLiterals) << 4) | ((matchCode >= 15) ? 15 : matchCode));
+	if ((numLiterals >= 15) && !RezLZ4PutLength(op, opEnd, numLiterals - 15)) return false;
+
+	if ((size_t)(opEnd - op) < numLiterals) return false;
+	memcpy(op, literals, numLiterals);
+	op += numLiterals;
+
+	if (matchLength == 0) return true;
+
+	if (opEnd - op < 2) return false;
+	*op++ = (unsigned char)offset;
+	*op++ = (unsigned char)(offset >> 8);
+	if ((matchCode >= 15) && !RezLZ4PutLength(op, opEnd, matchCode - 15)) return false;
+	return true;
+}
+
+// compresses src[start, end), the bytes before start (the dictionary) are only there to be matched against
+static size_t RezCompressLZ4(int level, const unsigned char* src, size_t start, size_t end, unsigned char* dst, size_t dstCapacity)
+{
+	unsigned char* op = dst;
+	unsigned char* opEnd = dst + dstCapacity;
+	size_t anchor = start;
+	bool retFlag = true;
+
+	if (end - start > kRezLZ4MatchFindLimit)
+	{
+		// every position is chained to the last one with the same hash, the level sets how far down the chain to look
+		unsigned long depth = 1;
+		for (int i = 1; (i < level) && (depth < kRezLZ4MaxChainDepth); ++i) depth <<= 1;
+
+		unsigned int* head;
+		unsigned short* chain;
+		LT_MEM_TRACK_ALLOC(head = new unsigned int[1 << kRezLZ4HashLog], LT_MEM_TYPE_MISC);
+		LT_MEM_TRACK_ALLOC(chain = new unsigned short[kRezLZ4MaxDistance + 1], LT_MEM_TYPE_MISC);
+		assert((head != nullptr) && (chain != nullptr));
+		if ((head == nullptr) || (chain == nullptr))
+		{
+			if (head != nullptr) LT_MEM_TRACK_FREE(delete [] head);
+			if (chain != nullptr) LT_MEM_TRACK_FREE(delete [] chain);
+			return 0;
+		}
+		memset(head, 0xff, sizeof(unsigned int) << kRezLZ4HashLog);
+
+		size_t matchLimit  = end - kRezLZ4LastLiterals;
+		size_t searchLimit = end - kRezLZ4MatchFindLimit;
+		size_t inserted = 0;
+		size_t pos = start;
+		while (pos < searchLimit)
+		{
+			// positions skipped over by the last match still go in the chains
+			for (; inserted <= pos; ++inserted)
+			{
+				unsigned int hash = RezLZ4Hash(RezRead32(src + inserted));
+				unsigned int prev = head[hash];
+				chain[inserted & kRezLZ4MaxDistance] = ((prev != kRezLZ4NoPos) && (inserted - prev <= kRezLZ4MaxDistance)) ? (unsigned short)(inserted - prev) : 0;
+				head[hash] = (unsigned int)inserted;
+			}
+
+			// look back along the chain for the longest match, a position further back than the
+			// window can't be reached and its chain entry may already belong to a newer position
+			unsigned int sequence = RezRead32(src + pos);
+			size_t bestLength = 0;
+			size_t bestPos = 0;
+			size_t cand = pos;
+			unsigned long tries = depth;
+			while (tries-- > 0)
+			{
+				unsigned short delta = chain[cand & kRezLZ4MaxDistance];
+				if (delta == 0) break;
+				cand -= delta;
+				if (pos - cand > kRezLZ4MaxDistance) break;
+
+				if (RezRead32(src + cand) == sequence)
+				{
+					size_t length = kRezLZ4MinMatch;
+					while ((pos + length < matchLimit) && (src[cand + length] == src[pos + length])) ++length;
+					if (length > bestLength)
+					{
+						bestLength = length;
+						bestPos = cand;
+					}
+				}
+			}
+
+			if (bestLength < kRezLZ4MinMatch)
+			{
+				++pos;
+				continue;
+			}
+
+			if (!RezLZ4PutSequence(op, opEnd, src + anchor, pos - anchor, pos - bestPos, bestLength))
+			{
+				retFlag = false;
+				break;
+			}
+			pos += bestLength;
+			anchor = pos;
+		}
+
+		LT_MEM_TRACK_FREE(delete [] head);
+		LT_MEM_TRACK_FREE(delete [] chain);
+	}
+
+	if (!retFlag || !RezLZ4PutSequence(op, opEnd, src + anchor, end - anchor, 0, 0)) return 0;
+
+	size_t size = op - dst;
+	return (size < end - start) ? size : 0;
+}
+
+// the dictionary is the dictSize bytes that come before dst as far as matches are concerned
+static bool RezDecompressLZ4(const unsigned char* dict, size_t dictSize, const unsigned char* src, size_t srcSize,
+							 unsigned char* dst, size_t dstSize)
+{
+	const unsigned char* ip = src;
+	const unsigned char* ipEnd = src + srcSize;
+	unsigned char* op = dst;
+	unsigned char* opEnd = dst + dstSize;
+
+	while (ip < ipEnd)
+	{
+		unsigned int token = *ip++;
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= ipEnd) return false;
+				b = *ip++;
+				numLiterals += b;
+			} while (b == 255);
+		}
+		if ((numLiterals > (size_t)(ipEnd - ip)) || (numLiterals > (size_t)(opEnd - op))) return false;
+		memcpy(op, ip, numLiterals);
+		ip += numLiterals;
+		op += numLiterals;
+
+		// the last sequence has no match
+		if (ip >= ipEnd) break;
+
+		if (ipEnd - ip < 2) return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (size_t)(op - dst) + dictSize)) return false;
+
+		size_t matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= ipEnd) return false;
+				b = *ip++;
+				matchLength += b;
+			} while (b == 255);
+		}
+		matchLength += kRezLZ4MinMatch;
+		if (matchLength > (size_t)(opEnd - op)) return false;
+
+		// a match that starts in the dictionary carries on from the start of dst
+		const unsigned char* match = op - offset;
+		if (offset > (size_t)(op - dst))
+		{
+			size_t back = offset - (size_t)(op - dst);
+			size_t length = (back < matchLength) ? back : matchLength;
+			memcpy(op, dict + dictSize - back, length);
+			op += length;
+			matchLength -= length;
+			match = dst;
+		}
+
+		// a match may overlap the bytes it is making (that is how runs are stored), each copy only takes
+		// bytes that are already there and so doubles how much can be taken by the next one
+		while (matchLength > 0)
+		{
+			size_t length = (size_t)(op - match);
+			if (length > matchLength) length = matchLength;
+			memcpy(op, match, length);
+			op += length;
+			matchLength -= length;
+		}
+	}
+
+	return (op == opEnd);
+}
+
+size_t RezCompressBound(size_t srcSize)
+{
+	return srcSize + (srcSize / 255) + 16;
+}
+
+size_t RezCompress(RezCodec codec, int level, const void* src, size_t srcSize, void* dst, size_t dstCapacity,
+				   const void* dict, size_t dictSize)
+{
+	assert((src != nullptr) || (srcSize == 0));
+	assert(dst != nullptr);
+	assert((dict != nullptr) || (dictSize == 0));
+
+	if (level < 1) level = kRezCompressDefaultLevel;
+	if (level > kRezCompressMaxLevel) level = kRezCompressMaxLevel;
+
+	// only the end of a dictionary is ever in reach
+	if (dictSize > kRezLZ4MaxDistance)
+	{
+		dict = (const unsigned char*)dict + dictSize - kRezLZ4MaxDistance;
+		dictSize = kRezLZ4MaxDistance;
+	}
+
+	switch (codec)
+	{
+	case RezCodecLZ4:
+		{
+			if (dictSize == 0) return RezCompressLZ4(level, (const unsigned char*)src, 0, srcSize, (unsigned char*)dst, dstCapacity);
+
+			// the compressor works on the dictionary and the data as one run of bytes
+			unsigned char* buf;
+			LT_MEM_TRACK_ALLOC(buf = new unsigned char[dictSize + srcSize], LT_MEM_TYPE_MISC);
+			assert(buf != nullptr);
+			if (buf == nullptr) return 0;
+
+			memcpy(buf, dict, dictSize);
+			memcpy(buf + dictSize, src, srcSize);
+			size_t size = RezCompressLZ4(level, buf, dictSize, dictSize + srcSize, (unsigned char*)dst, dstCapacity);
+
+			LT_MEM_TRACK_FREE(delete [] buf);
+			return size;
+		}
+	default:
+		return 0;
+	}
+}
+
+bool RezDecompress(RezCodec codec, const void* src, size_t srcSize, void* dst, size_t dstSize, const void* dict, size_t dictSize)
+{
+	assert((src != nullptr) || (srcSize == 0));
+	assert((dst != nullptr) || (dstSize == 0));
+	assert((dict != nullptr) || (dictSize == 0));
+
+	if (dictSize > kRezLZ4MaxDistance)
+	{
+		dict = (const unsigned char*)dict + dictSize - kRezLZ4MaxDistance;
+		dictSize = kRezLZ4MaxDistance;
+	}
+
+	switch (codec)
+	{
+	case RezCodecNone:
+		if (srcSize != dstSize) return false;
+		memcpy(dst, src, dstSize);
+		return true;
+	case RezCodecLZ4:
+		return RezDecompressLZ4((const unsigned char*)dict, dictSize, (const unsigned char*)src, srcSize, (unsigned char*)dst, dstSize);
+	default:
+		return false;
+	}
+}
+
+
+// a piece of one sample chosen to go in a dictionary
+struct RezTrainSegment
+{
+	size_t offset;              // where it starts in the samples
+	size_t length;
+	unsigned long long score;   // how many samples its pieces turned up in
+};
+
+static unsigned int RezTrainHash(const unsigned char* p)
+{
+	unsigned long long val;
+	memcpy(&val, p, sizeof(val));
+	return (unsigned int)((val * 0x9e3779b97f4a7c15ULL) >> (64 - kRezTrainHashLog));
+}
+
+// a dmer only counts if it turned up in more than one sample, those that didn't are no use to the rest
+static unsigned int RezTrainScore(const unsigned int* counts, const unsigned char* p)
+{
+	unsigned int count = counts[RezTrainHash(p)];
+	return (count > 1) ? count : 0;
+}
+
+// slides a segment over one sample and keeps it in best if it scores higher than anything so far
+static void RezTrainFindSegment(const unsigned char* samples, size_t sampleOffset, size_t sampleSize, const unsigned int* counts,
+								RezTrainSegment* best)
+{
+	if (sampleSize < kRezTrainDmerSize) return;
+
+	const unsigned char* sample = samples + sampleOffset;
+	size_t length = (sampleSize < kRezTrainSegmentSize) ? sampleSize : kRezTrainSegmentSize;
+	size_t numDmers = length - kRezTrainDmerSize + 1;
+
+	unsigned long long score = 0;
+	for (size_t i = 0; i < numDmers; ++i) score += RezTrainScore(counts, sample + i);
+
+	size_t start = 0;
+	for (;;)
+	{
+		if (score > best->score)
+		{
+			best->offset = sampleOffset + start;
+			best->length = length;
+			best->score  = score;
+		}
+		if (start + length >= sampleSize) break;
+
+		score -= RezTrainScore(counts, sample + start);
+		score += RezTrainScore(counts, sample + start + numDmers);
+		++start;
+	}
+}
+
+size_t RezTrainDictionary(const void* samples, const size_t* sampleSizes, size_t numSamples, void* dict, size_t dictCapacity)
+{
+	assert((samples != nullptr) || (numSamples == 0));
+	assert((sampleSizes != nullptr) || (numSamples == 0));
+	assert(dict != nullptr);
+
+	if (dictCapacity > kRezDictionaryMaxSize) dictCapacity = kRezDictionaryMaxSize;
+
+	// the samples are split into runs of about the same size and one segment is taken from each
+	size_t numEpochs = dictCapacity / kRezTrainSegmentSize;
+	if (numEpochs > numSamples) numEpochs = numSamples;
+
+	size_t total = 0;
+	for (size_t i = 0; i < numSamples; ++i) total += sampleSizes[i];
+	if ((numEpochs == 0) || (total == 0)) return 0;
+
+	unsigned int* counts;
+	unsigned int* seenIn;
+	RezTrainSegment* segments;
+	LT_MEM_TRACK_ALLOC(counts = new unsigned int[1 << kRezTrainHashLog], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(seenIn = new unsigned int[1 << kRezTrainHashLog], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(segments = new RezTrainSegment[numEpochs], LT_MEM_TYPE_MISC);
+	assert((counts != nullptr) && (seenIn != nullptr) && (segments != nullptr));
+	if ((counts == nullptr) || (seenIn == nullptr) || (segments == nullptr))
+	{
+		if (counts != nullptr) LT_MEM_TRACK_FREE(delete [] counts);
+		if (seenIn != nullptr) LT_MEM_TRACK_FREE(delete [] seenIn);
+		if (segments != nullptr) LT_MEM_TRACK_FREE(delete [] segments);
+		return 0;
+	}
+	memset(counts, 0, sizeof(unsigned int) << kRezTrainHashLog);
+	memset(seenIn, 0, sizeof(unsigned int) << kRezTrainHashLog);
+
+	// count how many samples each dmer turns up in
+	const unsigned char* data = (const unsigned char*)samples;
+	size_t offset = 0;
+	for (size_t i = 0; i < numSamples; ++i)
+	{
+		for (size_t pos = 0; pos + kRezTrainDmerSize <= sampleSizes[i]; ++pos)
+		{
+			unsigned int hash = RezTrainHash(data + offset + pos);
+			if (seenIn[hash] == i + 1) continue;
+			seenIn[hash] = (unsigned int)(i + 1);
+			++counts[hash];
+		}
+		offset += sampleSizes[i];
+	}
+
+	// the best segment of each run goes in and its dmers stop counting so later runs pick something else
+	size_t numSegments = 0;
+	size_t sample = 0;
+	offset = 0;
+	for (size_t epoch = 0; epoch < numEpochs; ++epoch)
+	{
+		size_t epochEnd = (size_t)((unsigned long long)total * (epoch + 1) / numEpochs);
+
+		RezTrainSegment best = { 0, 0, 0 };
+		for (; (sample < numSamples) && (offset < epochEnd); offset += sampleSizes[sample++])
+		{
+			RezTrainFindSegment(data, offset, sampleSizes[sample], counts, &best);
+		}
+		if (best.score == 0) continue;
+
+		for (size_t i = 0; i + kRezTrainDmerSize <= best.length; ++i) counts[RezTrainHash(data + best.offset + i)] = 0;
+		segments[numSegments++] = best;
+	}
+
+	// the best segments go last, nearest the data, where the compressor looks first
+	std::sort(segments, segments + numSegments, [](const RezTrainSegment& a, const RezTrainSegment& b) -> bool
+	{
+		return (a.score < b.score);
+	});
+
+	size_t dictSize = 0;
+	for (size_t i = 0; i < numSegments; ++i)
+	{
+		memcpy((unsigned char*)dict + dictSize, data + segments[i].offset, segments[i].length);
+		dictSize += segments[i].length;
+	}
+
+	LT_MEM_TRACK_FREE(delete [] counts);
+	LT_MEM_TRACK_FREE(delete [] seenIn);
+	LT_MEM_TRACK_FREE(delete [] segments);
+	return dictSize;
+}
+
+unsigned int RezDictionaryId(const void* dict, size_t dictSize)
+{
+	assert((dict != nullptr) || (dictSize == 0));
+
+	// FNV-1a
+	const unsigned char* p = (const unsigned char*)dict;
+	unsigned int hash = 2166136261U;
+	for (size_t i = 0; i < dictSize; ++i)
+	{
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return (hash != 0) ? hash : 1;
+}
+
+}}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+
+#define kRezCompressDefaultLevel      1
+#define kRezCompressMaxLevel          9
+#define kRezCompressDefaultChunkSize  (64 * 1024)   // items bigger than this are compressed a chunk at a time
+#define kRezDictionaryDefaultSize     (32 * 1024)
+#define kRezDictionaryMaxSize         (64 * 1024)   // LZ4 matches reach back no further so more is never used
+
+namespace JupiterEx { namespace RezMgr {
+
+// how the data of an item is stored in the rez file, the value is written to the file so never renumber these
+enum RezCodec
+{
+	RezCodecNone = 0,   // stored as is
+	RezCodecLZ4  = 1,   // LZ4 block format, fast to decompress
+};
+
+// most bytes RezCompress can produce from srcSize bytes (only reached for data that doesn't compress)
+size_t RezCompressBound(size_t srcSize);
+
+// compresses src into dst with codec, level goes from 1 (fastest) to kRezCompressMaxLevel (smallest),
+// returns the compressed size or 0 if the data didn't get any smaller and should be stored as is.
+// A dictionary is treated as data that came just before src so matches can refer back into it,
+// the same dictionary must be given to RezDecompress.
+size_t RezCompress(RezCodec codec, int level, const void* src, size_t srcSize, void* dst, size_t dstCapacity,
+				   const void* dict = nullptr, size_t dictSize = 0);
+
+// decompresses exactly dstSize bytes, returns false if src is not valid data for codec or doesn't hold dstSize bytes
+bool RezDecompress(RezCodec codec, const void* src, size_t srcSize, void* dst, size_t dstSize,
+				   const void* dict = nullptr, size_t dictSize = 0);
+
+// builds a dictionary of at most dictCapacity bytes out of the pieces that turn up in the most samples, samples
+// holds numSamples samples one after the other and sampleSizes the size of each, returns the dictionary size
+// (0 if there isn't enough to go on), small samples of the sort of data the dictionary is for work best
+size_t RezTrainDictionary(const void* samples, const size_t* sampleSizes, size_t numSamples, void* dict, size_t dictCapacity);
+
+// hash of a dictionary's bytes that is used to find it again, never 0
+unsigned int RezDictionaryId(const void* dict, size_t dictSize);
+
+}}
\ No newline at end of file
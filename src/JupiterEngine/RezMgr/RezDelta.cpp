@@ -0,0 +1,212 @@
+#include "RezMgr/RezDelta.hpp"
+#include "Memory/Memory.hpp"
+
+#include <assert.h>
+#include <string.h>
+
+#define kRezDeltaMinMatch     16           // shortest piece of base worth a copy, and how much is hashed to find one
+#define kRezDeltaIndexStep    8            // base is indexed every this many bytes (or further apart if it is very big)
+#define kRezDeltaMinIndexLog  10
+#define kRezDeltaMaxIndexLog  22           // the index of base never has more than 4M entries (16 MB)
+#define kRezDeltaMaxIndexPos  0xfffffff0   // positions in the index are 32 bits, base past this is never copied from
+
+namespace JupiterEx { namespace RezMgr {
+
+// A delta is a run of instructions, each starting with a number that holds its length and whether it is a copy
+// from base ((length << 1) | 1) or bytes stored as is (length << 1). A copy is followed by where in base it starts
+// as the distance from the end of the last copy (zig-zag coded as it may go back, so an edit in place costs a 0),
+// stored bytes follow their instruction. Numbers are 7 bits at a time, lowest first, the top bit set on all but the last.
+
+static bool RezDeltaPutNumber(unsigned char*& op, unsigned char* opEnd, unsigned long long val)
+{
+	do
+	{
+		if (op >= opEnd) return false;
+		unsigned char byte = (unsigned char)(val & 0x7f);
+		val >>= 7;
+		*op++ = (val != 0) ? (byte | 0x80) : byte;
+	} while (val != 0);
+	return true;
+}
+
+static bool RezDeltaGetNumber(const unsigned char*& ip, const unsigned char* ipEnd, unsigned long long* val)
+{
+	*val = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (ip >= ipEnd) return false;
+		unsigned char byte = *ip++;
+		*val |= (unsigned long long)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static bool RezDeltaPutLiterals(unsigned char*& op, unsigned char* opEnd, const unsigned char* literals, size_t length)
+{
+	if (length == 0) return true;
+	if (!RezDeltaPutNumber(op, opEnd, (unsigned long long)length << 1)) return false;
+	if ((size_t)(opEnd - op) < length) return false;
+	memcpy(op, literals, length);
+	op += length;
+	return true;
+}
+
+static bool RezDeltaPutCopy(unsigned char*& op, unsigned char* opEnd, size_t from, size_t length, size_t* copyEnd)
+{
+	long long distance = (long long)from - (long long)*copyEnd;
+	unsigned long long zigzag = (distance < 0) ? (((unsigned long long)(-(distance + 1)) << 1) | 1) : ((unsigned long long)distance << 1);
+	*copyEnd = from + length;
+	return RezDeltaPutNumber(op, opEnd, ((unsigned long long)length << 1) | 1) && RezDeltaPutNumber(op, opEnd, zigzag);
+}
+
+static unsigned int RezDeltaHash(const unsigned char* p, int indexLog)
+{
+	unsigned long long a, b;
+	memcpy(&a, p, sizeof(a));
+	memcpy(&b, p + sizeof(a), sizeof(b));
+	return (unsigned int)((((a * 0x9e3779b97f4a7c15ULL) ^ b) * 0xc2b2ae3d27d4eb4fULL) >> (64 - indexLog));
+}
+
+// how many bytes a and b have the same from the start, up to maxLength
+static size_t RezDeltaMatchLength(const unsigned char* a, const unsigned char* b, size_t maxLength)
+{
+	size_t length = 0;
+	while (length + sizeof(unsigned long long) <= maxLength)
+	{
+		unsigned long long x, y;
+		memcpy(&x, a + length, sizeof(x));
+		memcpy(&y, b + length, sizeof(y));
+		if (x != y) break;
+		length += sizeof(unsigned long long);
+	}
+	while ((length < maxLength) && (a[length] == b[length])) ++length;
+	return length;
+}
+
+size_t RezDeltaBound(size_t targetSize)
+{
+	// every copy is smaller than the bytes it stands for, so the most is everything stored in one instruction
+	return targetSize + 16;
+}
+
+size_t RezDeltaEncode(const void* base, size_t baseSize, const void* target, size_t targetSize, void* dst, size_t dstCapacity)
+{
+	assert((base != nullptr) || (baseSize == 0));
+	assert((target != nullptr) || (targetSize == 0));
+	assert(dst != nullptr);
+
+	const unsigned char* src = (const unsigned char*)base;
+	const unsigned char* tgt = (const unsigned char*)target;
+	unsigned char* op = (unsigned char*)dst;
+	unsigned char* opEnd = op + dstCapacity;
+
+	// index where pieces of base start, big bases are indexed further apart so the index stays a sensible size
+	int indexLog = kRezDeltaMinIndexLog;
+	while ((indexLog < kRezDeltaMaxIndexLog) && (((size_t)1 << indexLog) < baseSize / kRezDeltaIndexStep)) ++indexLog;
+	size_t step = (baseSize + ((size_t)1 << indexLog) - 1) >> indexLog;
+	if (step < kRezDeltaIndexStep) step = kRezDeltaIndexStep;
+
+	unsigned int* index = nullptr;
+	if (baseSize >= kRezDeltaMinMatch)
+	{
+		LT_MEM_TRACK_ALLOC(index = new unsigned int[(size_t)1 << indexLog], LT_MEM_TYPE_MISC);
+		assert(index != nullptr);
+		if (index == nullptr) return 0;
+		memset(index, 0, sizeof(unsigned int) << indexLog);
+
+		// the first place a piece turns up is kept, 0 is an empty slot so positions are kept one higher
+		for (size_t pos = 0; (pos + kRezDeltaMinMatch <= baseSize) && (pos < kRezDeltaMaxIndexPos); pos += step)
+		{
+			unsigned int* slot = &index[RezDeltaHash(src + pos, indexLog)];
+			if (*slot == 0) *slot = (unsigned int)(pos + 1);
+		}
+	}
+
+	size_t copyEnd = 0;        // where in base the last copy ended
+	size_t literalStart = 0;   // first byte of target not covered by an instruction yet
+	size_t pos = 0;
+	bool retFlag = true;
+	while (retFlag && (index != nullptr) && (pos + kRezDeltaMinMatch <= targetSize))
+	{
+		// bytes changed in place leave what follows them where it was, so base just past the last copy is tried first
+		size_t from = copyEnd + (pos - literalStart);
+		bool found = (from + kRezDeltaMinMatch <= baseSize) && (memcmp(src + from, tgt + pos, kRezDeltaMinMatch) == 0);
+		if (!found)
+		{
+			unsigned int slot = index[RezDeltaHash(tgt + pos, indexLog)];
+			from = (size_t)slot - 1;
+			found = (slot != 0) && (memcmp(src + from, tgt + pos, kRezDeltaMinMatch) == 0);
+		}
+		if (!found)
+		{
+			++pos;
+			continue;
+		}
+
+		size_t maxLength = ((baseSize - from) < (targetSize - pos)) ? (baseSize - from) : (targetSize - pos);
+		size_t length = RezDeltaMatchLength(src + from, tgt + pos, maxLength);
+
+		// base is only indexed every step bytes so the match may really start a little earlier
+		while ((pos > literalStart) && (from > 0) && (src[from - 1] == tgt[pos - 1]))
+		{
+			--pos;
+			--from;
+			++length;
+		}
+
+		retFlag = RezDeltaPutLiterals(op, opEnd, tgt + literalStart, pos - literalStart) && RezDeltaPutCopy(op, opEnd, from, length, &copyEnd);
+		pos += length;
+		literalStart = pos;
+	}
+	if (retFlag) retFlag = RezDeltaPutLiterals(op, opEnd, tgt + literalStart, targetSize - literalStart);
+
+	if (index != nullptr) LT_MEM_TRACK_FREE(delete [] index);
+	return retFlag ? (size_t)(op - (unsigned char*)dst) : 0;
+}
+
+bool RezDeltaApply(const void* base, size_t baseSize, const void* delta, size_t deltaSize, void* target, size_t targetSize)
+{
+	assert((base != nullptr) || (baseSize == 0));
+	assert((delta != nullptr) || (deltaSize == 0));
+	assert((target != nullptr) || (targetSize == 0));
+
+	const unsigned char* src = (const unsigned char*)base;
+	const unsigned char* ip = (const unsigned char*)delta;
+	const unsigned char* ipEnd = ip + deltaSize;
+	unsigned char* op = (unsigned char*)target;
+	unsigned char* opEnd = op + targetSize;
+
+	unsigned long long copyEnd = 0;
+	while (ip < ipEnd)
+	{
+		unsigned long long instruction;
+		if (!RezDeltaGetNumber(ip, ipEnd, &instruction)) return false;
+
+		unsigned long long length = instruction >> 1;
+		if ((length == 0) || (length > (unsigned long long)(opEnd - op))) return false;
+
+		if ((instruction & 1) != 0)
+		{
+			// a distance that goes back past the start wraps round to something past the end of base
+			unsigned long long zigzag;
+			if (!RezDeltaGetNumber(ip, ipEnd, &zigzag)) return false;
+			unsigned long long from = ((zigzag & 1) != 0) ? (copyEnd - (zigzag >> 1) - 1) : (copyEnd + (zigzag >> 1));
+			if ((from > baseSize) || (length > baseSize - from)) return false;
+
+			memcpy(op, src + (size_t)from, (size_t)length);
+			copyEnd = from + length;
+		}
+		else
+		{
+			if (length > (unsigned long long)(ipEnd - ip)) return false;
+			memcpy(op, ip, (size_t)length);
+			ip += length;
+		}
+		op += length;
+	}
+
+	return (op == opEnd);
+}
+
+}}
\ No newline at end of file
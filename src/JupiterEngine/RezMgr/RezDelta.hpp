@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace JupiterEx { namespace RezMgr {
+
+// most bytes RezDeltaEncode can produce for targetSize bytes (only reached when nothing of base turns up in target)
+size_t RezDeltaBound(size_t targetSize);
+
+// works out how to make target out of base and writes it to dst, pieces of target that turn up anywhere in base are
+// copied from there and everything else is stored as is, so small edits to big data make a small delta.
+// Returns the size of the delta or 0 if it doesn't fit in dstCapacity.
+size_t RezDeltaEncode(const void* base, size_t baseSize, const void* target, size_t targetSize, void* dst, size_t dstCapacity);
+
+// makes exactly targetSize bytes out of base and a delta from RezDeltaEncode, returns false if the delta
+// reaches outside base or doesn't make targetSize bytes
+bool RezDeltaApply(const void* base, size_t baseSize, const void* delta, size_t deltaSize, void* target, size_t targetSize);
+
+}}
\ No newline at end of file
@@ -1,35 +1,578 @@
 #include "RezMgr/RezFile.hpp"
 #include "RezMgr/RezMgr.hpp"
+#include "RezMgr/RezBlockCache.hpp"
 #include "Memory/Memory.hpp"
 #include "Common/SafeString.hpp"
 
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define REZ_USE_IO_URING
+#endif
+#endif
+#endif
+
+#define kRezAsyncQueueDepth  256   // reads kept in flight by RezFileAsync
+#define kRezAsyncNumThreads  4     // reader threads used when io_uring is not available
+
+#define kRezDirectAlignment  4096           // covers the sector size of every disk we care about
+#define kRezDirectChunkSize  (1024 * 1024)  // size of each pooled bounce buffer
+#define kRezDirectPoolSize   4              // bounce buffers kept around between reads
+
+#define kRezCopyBufferSize   (1024 * 1024)  // buffer for the parts of CopyToFile the kernel can't do
+#define kRezKernelCopyChunk  0x40000000     // most asked of one copy_file_range or sendfile call
+
+#define kRezReadVMaxRun      0x40000000     // most bytes one preadv call is asked for
+#define kRezReadVMaxPieces   64             // most buffers (gaps included) handed to one preadv call
+#define kRezReadVMaxMerged   0x100000       // most bytes read into a buffer of its own and copied out by BaseRezFile::ReadV
+
+#if !defined(_WIN32) && !defined(IOV_MAX)
+#define IOV_MAX  16                         // the least POSIX allows
+#endif
 
 namespace JupiterEx { namespace RezMgr {
 
+//------------------------------------------------------------------------------------------
+// RezDirectReader
+
+static unsigned char* RezAlignedAlloc(unsigned long size)
+{
+#if defined(_WIN32)
+	return (unsigned char*)_aligned_malloc(size, kRezDirectAlignment);
+#else
+	void* p = nullptr;
+	if (posix_memalign(&p, kRezDirectAlignment, size) != 0) return nullptr;
+	return (unsigned char*)p;
+#endif
+}
+
+static void RezAlignedFree(unsigned char* p)
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+// A second handle on a rez file opened so reads skip the page cache.  Direct reads have to start, end
+// and land on aligned boundaries, so unaligned heads and tails are read in aligned pieces into bounce
+// buffers from a small pool and only the bytes asked for are copied out, aligned runs of the caller's
+// own buffer are read into it directly.
+class RezDirectReader
+{
+public:
+	RezDirectReader();
+	~RezDirectReader();
+
+	bool Open(const char* filename);
+	unsigned long Read(RezPos pos, unsigned long size, unsigned char* data);
+
+private:
+	long ReadAligned(RezPos pos, unsigned long size, unsigned char* data);
+	unsigned char* GetBuffer();
+	void PutBuffer(unsigned char* buffer);
+
+#if defined(_WIN32)
+	HANDLE handle_;
+#else
+	int fd_;
+#endif
+	std::mutex poolMutex_;
+	std::vector<unsigned char*> pool_;
+};
+
+RezDirectReader::RezDirectReader()
+{
+#if defined(_WIN32)
+	handle_ = INVALID_HANDLE_VALUE;
+#else
+	fd_ = -1;
+#endif
+}
+
+RezDirectReader::~RezDirectReader()
+{
+#if defined(_WIN32)
+	if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_);
+#else
+	if (fd_ >= 0) close(fd_);
+#endif
+	for (size_t i = 0; i < pool_.size(); ++i) RezAlignedFree(pool_[i]);
+}
+
+bool RezDirectReader::Open(const char* filename)
+{
+	if (filename == nullptr) return false;
+
+#if defined(_WIN32)
+	handle_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+	return (handle_ != INVALID_HANDLE_VALUE);
+#elif defined(O_DIRECT)
+	fd_ = open(filename, O_RDONLY | O_DIRECT);
+	return (fd_ >= 0);
+#elif defined(F_NOCACHE)
+	fd_ = open(filename, O_RDONLY);
+	if ((fd_ >= 0) && (fcntl(fd_, F_NOCACHE, 1) != 0))
+	{
+		close(fd_);
+		fd_ = -1;
+	}
+	return (fd_ >= 0);
+#else
+	return false;
+#endif
+}
+
+unsigned long RezDirectReader::Read(RezPos pos, unsigned long size, unsigned char* data)
+{
+	unsigned char* buffer = nullptr;
+	unsigned long done = 0;
+	while (done < size)
+	{
+		RezPos curPos = pos + done;
+		unsigned long left = size - done;
+		unsigned long head = (unsigned long)(curPos % kRezDirectAlignment);
+
+		// aligned in the file and in memory, read whole blocks straight into the caller's buffer
+		if ((head == 0) && (((size_t)(data + done) % kRezDirectAlignment) == 0) && (left >= kRezDirectAlignment))
+		{
+			unsigned long num = left - (left % kRezDirectAlignment);
+			long ret = ReadAligned(curPos, num, data + done);
+			if (ret <= 0) break;
+			done += (unsigned long)ret;
+			if ((unsigned long)ret < num) break;
+			continue;
+		}
+
+		if (buffer == nullptr)
+		{
+			buffer = GetBuffer();
+			if (buffer == nullptr) break;
+		}
+
+		unsigned long want = head + left;
+		want = (want + kRezDirectAlignment - 1) - ((want + kRezDirectAlignment - 1) % kRezDirectAlignment);
+		if (want > kRezDirectChunkSize) want = kRezDirectChunkSize;
+
+		long ret = ReadAligned(curPos - head, want, buffer);
+		if (ret <= (long)head) break;
+
+		unsigned long num = (unsigned long)ret - head;
+		if (num > left) num = left;
+		memcpy(data + done, buffer + head, num);
+		done += num;
+		if ((unsigned long)ret < want) break;
+	}
+
+	if (buffer != nullptr) PutBuffer(buffer);
+	return done;
+}
+
+// returns the bytes read, which is only short of size at the end of the file, or -1 if nothing could be read
+long RezDirectReader::ReadAligned(RezPos pos, unsigned long size, unsigned char* data)
+{
+	unsigned long done = 0;
+	while (done < size)
+	{
+#if defined(_WIN32)
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset     = (DWORD)(pos + done);
+		overlapped.OffsetHigh = (DWORD)((pos + done) >> 32);
+
+		DWORD ret = 0;
+		if (!ReadFile(handle_, data + done, size - done, &ret, &overlapped))
+		{
+			if (GetLastError() == ERROR_HANDLE_EOF) break;
+			return (done > 0) ? (long)done : -1;
+		}
+#else
+		ssize_t ret = pread(fd_, data + done, size - done, (off_t)(pos + done));
+		if (ret < 0) return (done > 0) ? (long)done : -1;
+#endif
+		if (ret == 0) break;
+		done += (unsigned long)ret;
+
+		// a short read that doesn't end on a block boundary is the end of the file
+		if ((done % kRezDirectAlignment) != 0) break;
+	}
+	return (long)done;
+}
+
+unsigned char* RezDirectReader::GetBuffer()
+{
+	{
+		std::unique_lock<std::mutex> lock(poolMutex_);
+		if (!pool_.empty())
+		{
+			unsigned char* buffer = pool_.back();
+			pool_.pop_back();
+			return buffer;
+		}
+	}
+	return RezAlignedAlloc(kRezDirectChunkSize);
+}
+
+void RezDirectReader::PutBuffer(unsigned char* buffer)
+{
+	{
+		std::unique_lock<std::mutex> lock(poolMutex_);
+		if (pool_.size() < kRezDirectPoolSize)
+		{
+			pool_.push_back(buffer);
+			return;
+		}
+	}
+	RezAlignedFree(buffer);
+}
+
+// guards the lazy opening of every file's direct reader, only taken on ReadDirect
+static std::mutex s_directReaderMutex;
+
 //------------------------------------------------------------------------------------------
 // BaseRezFile
 
 BaseRezFile::BaseRezFile(RezMgr* rezMgr)
 {
-	assert(rezMgr_ != nullptr);
+	assert(rezMgr != nullptr);
 	rezMgr_ = rezMgr;
+	directReader_ = nullptr;
+	directTried_ = false;
+	memset(&writeStats_, 0, sizeof(writeStats_));
 }
 
 BaseRezFile::~BaseRezFile()
 {
+	if (directReader_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete directReader_);
+		directReader_ = nullptr;
+	}
 	rezMgr_ = nullptr;
 }
 
+unsigned long BaseRezFile::ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+
+	RezDirectReader* directReader;
+	{
+		std::unique_lock<std::mutex> lock(s_directReaderMutex);
+		if (!directTried_)
+		{
+			directTried_ = true;
+			LT_MEM_TRACK_ALLOC(directReader_ = new RezDirectReader, LT_MEM_TYPE_MISC);
+			if ((directReader_ != nullptr) && !directReader_->Open(GetFileName()))
+			{
+				LT_MEM_TRACK_FREE(delete directReader_);
+				directReader_ = nullptr;
+			}
+		}
+		directReader = directReader_;
+	}
+
+	unsigned long done = 0;
+	if (directReader != nullptr) done = directReader->Read(itemPos + itemOffset, size, (unsigned char*)data);
+	if (done < size) done += Read(itemPos, itemOffset + done, size - done, (unsigned char*)data + done);
+	return done;
+}
+
+bool BaseRezFile::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+							RezReadCallback callback, void* userData)
+{
+	assert(callback != nullptr);
+	callback(userData, Read(itemPos, itemOffset, size, data));
+	return true;
+}
+
+void BaseRezFile::GetWriteStats(RezWriteStats* stats)
+{
+	assert(stats != nullptr);
+	stats->bytesWritten  += writeStats_.bytesWritten;
+	stats->numWrites     += writeStats_.numWrites;
+	stats->numFileWrites += writeStats_.numFileWrites;
+	stats->numFileSeeks  += writeStats_.numFileSeeks;
+}
+
+// copies a piece at a time through one buffer, or straight out of the view of files that can be mapped
+static bool RezCopyBuffered(BaseRezFile* rezFile, RezPos itemPos, RezPos itemOffset, RezPos size, FILE* out, RezCopyStats* stats)
+{
+	unsigned char* buffer = nullptr;
+	bool retFlag = true;
+
+	RezPos done = 0;
+	while (done < size)
+	{
+		unsigned long length = ((size - done) > kRezCopyBufferSize) ? kRezCopyBufferSize : (unsigned long)(size - done);
+
+		unsigned char* data = rezFile->MapData(itemPos, itemOffset + done, length);
+		if (data == nullptr)
+		{
+			if (buffer == nullptr)
+			{
+				LT_MEM_TRACK_ALLOC(buffer = new unsigned char[kRezCopyBufferSize], LT_MEM_TYPE_MISC);
+				assert(buffer != nullptr);
+				if (buffer == nullptr)
+				{
+					retFlag = false;
+					break;
+				}
+			}
+			if (rezFile->Read(itemPos, itemOffset + done, length, buffer) != length)
+			{
+				retFlag = false;
+				break;
+			}
+			data = buffer;
+		}
+
+		if (fwrite(data, 1, length, out) != length)
+		{
+			retFlag = false;
+			break;
+		}
+		done += length;
+	}
+
+	if (buffer != nullptr) LT_MEM_TRACK_FREE(delete [] buffer);
+	if (stats != nullptr) stats->bytesCopied += done;
+	return retFlag;
+}
+
+#if !defined(_WIN32)
+// has the kernel copy from fd to outFd (at its current position) without the data coming up into user
+// space, returns how much was copied before it stopped, which is 0 where it can't be done at all
+static RezPos RezKernelCopy(int fd, RezPos pos, RezPos size, int outFd)
+{
+	RezPos done = 0;
+#if defined(__linux__)
+	bool useCopyRange = true;
+	while (done < size)
+	{
+		size_t length = ((size - done) > kRezKernelCopyChunk) ? kRezKernelCopyChunk : (size_t)(size - done);
+		ssize_t ret = -1;
+
+#if defined(__NR_copy_file_range)
+		if (useCopyRange)
+		{
+			loff_t inPos = (loff_t)(pos + done);
+			ret = syscall(__NR_copy_file_range, fd, &inPos, outFd, nullptr, length, 0);
+			if ((ret < 0) && (errno == EINTR)) continue;
+
+			// older kernels refuse to copy between file systems (EXDEV) or don't have it at all (ENOSYS)
+			if (ret < 0) useCopyRange = false;
+		}
+#endif
+		if (ret < 0)
+		{
+			off_t inPos = (off_t)(pos + done);
+			ret = sendfile(outFd, fd, &inPos, length);
+			if ((ret < 0) && (errno == EINTR)) continue;
+		}
+
+		if (ret <= 0) break;
+		done += (RezPos)ret;
+	}
+#endif
+	return done;
+}
+
+// CopyToFile for files with a descriptor, whatever the kernel doesn't copy is finished through a buffer
+static bool RezCopyFromFd(BaseRezFile* rezFile, int fd, RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+	int outFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (outFd < 0) return false;
+
+	RezPos done = RezKernelCopy(fd, itemPos + itemOffset, size, outFd);
+	if (stats != nullptr)
+	{
+		stats->bytesCopied       += done;
+		stats->bytesKernelCopied += done;
+	}
+
+	bool retFlag = true;
+	if (done < size)
+	{
+		// the stream carries on from wherever the kernel left the descriptor
+		FILE* out = fdopen(outFd, "wb");
+		if (out == nullptr)
+		{
+			close(outFd);
+			return false;
+		}
+		retFlag = RezCopyBuffered(rezFile, itemPos, itemOffset + done, size - done, out, stats);
+		if (fclose(out) != 0) retFlag = false;
+	}
+	else if (close(outFd) != 0)
+	{
+		retFlag = false;
+	}
+
+	if (retFlag && (stats != nullptr)) ++stats->numFiles;
+	return retFlag;
+}
+#endif
+
+bool BaseRezFile::ReadV(RezFileRead* reads, unsigned long numReads, unsigned long maxGap, unsigned long* numFileReads)
+{
+	assert((reads != nullptr) || (numReads == 0));
+
+	// a mapped file copies each piece straight out of its view, reading them together would only copy them twice
+	bool merge = !IsMapped();
+	bool retFlag = true;
+	unsigned char* runBuffer = nullptr;
+	unsigned long runCapacity = 0;
+
+	unsigned long first = 0;
+	while (first < numReads)
+	{
+		if (reads[first].size <= 0)
+		{
+			++first;
+			continue;
+		}
+
+		// grow the run while the next piece starts at or a little past the end of it
+		RezPos runPos = reads[first].pos;
+		RezPos runEnd = runPos + reads[first].size;
+		unsigned long numPieces = 1;
+		unsigned long last = first + 1;
+		while (merge && (last < numReads))
+		{
+			RezFileRead* next = &reads[last];
+			if (next->size <= 0)
+			{
+				++last;
+				continue;
+			}
+			if ((next->pos < runEnd) || (next->pos - runEnd > maxGap)) break;
+			if ((next->pos + next->size) - runPos > kRezReadVMaxMerged) break;
+
+			runEnd = next->pos + next->size;
+			++numPieces;
+			++last;
+		}
+
+		if (numPieces == 1)
+		{
+			if (Read(runPos, 0, reads[first].size, reads[first].data) != reads[first].size) retFlag = false;
+			if (numFileReads != nullptr) ++(*numFileReads);
+			first = last;
+			continue;
+		}
+
+		// the whole run goes into one buffer, gaps and all, and the pieces are copied out of it
+		unsigned long runSize = (unsigned long)(runEnd - runPos);
+		if (runCapacity < runSize)
+		{
+			if (runBuffer != nullptr) LT_MEM_TRACK_FREE(delete [] runBuffer);
+			LT_MEM_TRACK_ALLOC(runBuffer = new unsigned char[runSize], LT_MEM_TYPE_MISC);
+			runCapacity = (runBuffer != nullptr) ? runSize : 0;
+			if (runBuffer == nullptr)
+			{
+				// no memory for it, read the pieces one at a time instead
+				merge = false;
+				continue;
+			}
+		}
+
+		if (Read(runPos, 0, runSize, runBuffer) != runSize)
+		{
+			retFlag = false;
+		}
+		else
+		{
+			for (unsigned long i = first; i < last; ++i)
+			{
+				if (reads[i].size > 0) memcpy(reads[i].data, runBuffer + (size_t)(reads[i].pos - runPos), reads[i].size);
+			}
+		}
+		if (numFileReads != nullptr) ++(*numFileReads);
+		first = last;
+	}
+
+	if (runBuffer != nullptr) LT_MEM_TRACK_FREE(delete [] runBuffer);
+	return retFlag;
+}
+
+bool BaseRezFile::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+	assert(filename != nullptr);
+
+	FILE* out = fopen(filename, "wb");
+	if (out == nullptr) return false;
+
+	bool retFlag = RezCopyBuffered(this, itemPos, itemOffset, size, out, stats);
+	if (fclose(out) != 0) retFlag = false;
+
+	if (retFlag && (stats != nullptr)) ++stats->numFiles;
+	return retFlag;
+}
+
 //------------------------------------------------------------------------------------------
 // RezFile
 
+// fseek/ftell only take a long, which is 32 bits on Windows
+static int RezSeek(FILE* file, RezPos pos, int origin)
+{
+#if defined(_WIN32)
+	return _fseeki64(file, (__int64)pos, origin);
+#else
+	return fseeko(file, (off_t)pos, origin);
+#endif
+}
+
+static RezPos RezTell(FILE* file)
+{
+#if defined(_WIN32)
+	__int64 pos = _ftelli64(file);
+#else
+	off_t pos = ftello(file);
+#endif
+	return (pos < 0) ? REZ_SEEKPOS_ERROR : (RezPos)pos;
+}
+
 RezFile::RezFile(RezMgr* rezMgr) : BaseRezFile(rezMgr)
 {
 	file_ = nullptr;
 	filename_ = nullptr;
 	lastSeekPos_ = REZ_SEEKPOS_ERROR;
+	lastWasWrite_ = false;
 }
 
 RezFile::~RezFile()
@@ -38,7 +581,7 @@ RezFile::~RezFile()
 	if (filename_ != nullptr) delete [] filename_;
 }
 
-unsigned long RezFile::Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
+unsigned long RezFile::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
 {
 	assert(file_ != nullptr);
 	assert(data != nullptr);
@@ -46,10 +589,11 @@ unsigned long RezFile::Read(unsigned long itemPos, unsigned long itemOffset, uns
 
 	if (size <= 0) return 0;
 
-	unsigned long seekPos = itemPos + itemOffset;
-	if (lastSeekPos_ != seekPos)
+	// a stream opened for update has to seek between a write and a read even if the position is right
+	RezPos seekPos = itemPos + itemOffset;
+	if ((lastSeekPos_ != seekPos) || lastWasWrite_)
 	{
-		while (fseek(file_, seekPos, SEEK_SET) != 0)
+		while (RezSeek(file_, seekPos, SEEK_SET) != 0)
 		{
 			if (!rezMgr_->DiskError())
 			{
@@ -60,6 +604,8 @@ unsigned long RezFile::Read(unsigned long itemPos, unsigned long itemOffset, uns
 		}
 	}
 
+	lastWasWrite_ = false;
+
 	unsigned long ret;
 	while ((ret = fread(data, 1, size, file_)) != size)
 	{
@@ -75,36 +621,50 @@ unsigned long RezFile::Read(unsigned long itemPos, unsigned long itemOffset, uns
 	return ret;
 }
 
-unsigned long RezFile::Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
+unsigned long RezFile::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
 {
 	assert(file_ != nullptr);
 	assert(data != nullptr);
 	assert(readOnly_ != true);
 	assert(rezMgr_ != nullptr);
 
-	lastSeekPos_ = REZ_SEEKPOS_ERROR;
-
 	if (size <= 0) return 0;
 
-	while (fseek(file_, itemPos+itemOffset, SEEK_SET) != 0)
+	++writeStats_.numWrites;
+	writeStats_.bytesWritten += size;
+
+	// only seek if the write doesn't carry on from the last one
+	RezPos seekPos = itemPos + itemOffset;
+	if ((lastSeekPos_ != seekPos) || !lastWasWrite_)
 	{
-		if (!rezMgr_->DiskError())
+		++writeStats_.numFileSeeks;
+		while (RezSeek(file_, seekPos, SEEK_SET) != 0)
 		{
-			assert(false && "fseek() failed");
-			return 0;
+			if (!rezMgr_->DiskError())
+			{
+				lastSeekPos_ = REZ_SEEKPOS_ERROR;
+				assert(false && "fseek() failed");
+				return 0;
+			}
 		}
 	}
 
+	lastWasWrite_ = true;
+
 	unsigned long ret;
+	++writeStats_.numFileWrites;
 	while ((ret = fwrite(data, 1, size, file_)) != size)
 	{
+		++writeStats_.numFileWrites;
 		if (!rezMgr_->DiskError())
 		{
+			lastSeekPos_ = REZ_SEEKPOS_ERROR;
 			assert(false && "fwrite() failed!");
 			return 0;
 		}
 	}
 
+	lastSeekPos_ = seekPos + ret;
 	return ret;
 }
 
@@ -239,167 +799,2289 @@ const char* RezFile::GetFileName()
 	return filename_;
 }
 
-//------------------------------------------------------------------------------------------
-// RezFileDirectoryEmulation
-
-RezFileDirectoryEmulation::RezFileDirectoryEmulation(RezMgr* rezMgr, int maxOpenFiles) : BaseRezFile(rezMgr)
-{
-	assert(maxOpenFiles > 0);
-	numOpenFiles_ = 0;
-	maxOpenFiles_ = maxOpenFiles;
-	readOnly_     = true;
-	createNew_    = false;
-}
-
-RezFileDirectoryEmulation::~RezFileDirectoryEmulation()
+RezPos RezFile::GetFileSize()
 {
-	RezFileSingleFile *it;
+	if (file_ == nullptr) return 0;
 
-	while ((it = openFiles_.GetFirst()) != nullptr)
-	{
-		delete it;
-	}
+	lastSeekPos_ = REZ_SEEKPOS_ERROR;
+	if (RezSeek(file_, 0, SEEK_END) != 0) return 0;
 
-	while ((it = closedFiles_.GetFirst()) != nullptr)
-	{
-		delete it;
-	}
+	RezPos size = RezTell(file_);
+	return (size == REZ_SEEKPOS_ERROR) ? 0 : size;
 }
 
-unsigned long RezFileDirectoryEmulation::Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
+bool RezFile::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
 {
-	assert(false && "this should never be called");
-	return 0;
-}
+#if defined(_WIN32)
+	return BaseRezFile::CopyToFile(itemPos, itemOffset, size, filename, stats);
+#else
+	assert(file_ != nullptr);
+	if (file_ == nullptr) return false;
 
-unsigned long RezFileDirectoryEmulation::Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
-{
-	assert(false && "this should never be called");
-	return 0;
+	// the kernel copies from the descriptor, so anything still in the stream's buffer must get there first,
+	// the copy reads at its own offset and leaves the stream's position alone
+	if (!readOnly_ && (fflush(file_) != 0)) return false;
+	return RezCopyFromFd(this, fileno(file_), itemPos, itemOffset, size, filename, stats);
+#endif
 }
 
-bool RezFileDirectoryEmulation::Open(const char* filename, bool readOnly, bool createNew)
-{
-	readOnly_  = readOnly;
-	createNew_ = createNew;
-	return true;
-}
+//------------------------------------------------------------------------------------------
+// RezFileMapped
 
-bool RezFileDirectoryEmulation::Close()
+RezFileMapped::RezFileMapped(RezMgr* rezMgr) : BaseRezFile(rezMgr)
 {
-	RezFileSingleFile* it;
-	while ((it = openFiles_.GetFirst()) != nullptr)
-	{
-		it->ReallyClose();
-	}
-	return true;
+	filename_ = nullptr;
+	view_     = nullptr;
+	viewSize_ = 0;
+#if !defined(_WIN32)
+	fd_       = -1;
+#endif
 }
 
-bool RezFileDirectoryEmulation::Flush()
+RezFileMapped::~RezFileMapped()
 {
-	return true;
+	Close();
 }
 
-bool RezFileDirectoryEmulation::VerifyFileOpen()
+unsigned long RezFileMapped::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
 {
-	return true;
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+
+	unsigned char* src = MapData(itemPos, itemOffset, size);
+	if (src == nullptr) return 0;
+
+	memcpy(data, src, size);
+	return size;
 }
 
-const char* RezFileDirectoryEmulation::GetFileName()
+unsigned long RezFileMapped::Write(RezPos /*itemPos*/, RezPos /*itemOffset*/, unsigned long /*size*/, void* /*data*/)
 {
-	return nullptr;
+	assert(false && "mapped rez files are read only");
+	return 0;
 }
 
-//------------------------------------------------------------------------------------------
-// RezFileSingleFile
-
-RezFileSingleFile::RezFileSingleFile(RezMgr* rezMgr, const char* filename, RezFileDirectoryEmulation* dirEmulation) : BaseRezFile(rezMgr)
+bool RezFileMapped::Open(const char* filename, bool readOnly, bool createNew)
 {
 	assert(filename != nullptr);
-	assert(dirEmulation != nullptr);
 
-	dirEmulation_ = dirEmulation;
-	file_ = nullptr;
+	// only read only access is supported, the caller falls back to RezFile for anything else
+	if (!readOnly || createNew) return false;
 
-	LT_MEM_TRACK_ALLOC(filename_ = new char[strlen(filename)+1], LT_MEM_TYPE_MISC);
-	assert(filename_ != nullptr);
-	strcpy(filename_, filename);
+	Close();
 
-	dirEmulation_->closedFiles_.Insert(this);
-}
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
 
-RezFileSingleFile::~RezFileSingleFile()
-{
-	if (file_ != nullptr) ReallyClose();
-	if (filename_ != nullptr) { LT_MEM_TRACK_FREE(delete [] filename_); }
-	dirEmulation_->closedFiles_.Delete(this);
+	// a 32 bit process can't map more than a couple of GB, RezMgr falls back to RezFile for those
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || ((unsigned long long)fileSize.QuadPart != (size_t)fileSize.QuadPart))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// the view keeps the section alive, so both handles can be closed as soon as it is mapped.
+	// It is mapped copy on write because callers may change the data Load hands back, the file is never touched
+	if (fileSize.QuadPart > 0)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (mapping != NULL)
+		{
+			view_ = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		if (view_ == nullptr)
+		{
+			CloseHandle(file);
+			return false;
+		}
+	}
+	CloseHandle(file);
+
+	viewSize_ = (RezPos)fileSize.QuadPart;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size != (size_t)st.st_size)
+	{
+		close(fd);
+		return false;
+	}
+
+	// copy on write, callers may change the data Load hands back but the file is never touched
+	if (st.st_size > 0)
+	{
+		void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+		view_ = (unsigned char*)view;
+	}
+	fd_ = fd;
+
+	viewSize_ = (RezPos)st.st_size;
+#endif
+
+	size_t length = strlen(filename) + 1;
+	LT_MEM_TRACK_ALLOC(filename_ = new char[length], LT_MEM_TYPE_MISC);
+	if (filename_ != nullptr)
+	{
+		LTStrCpy(filename_, filename, length);
+	}
+
+	return true;
+}
+
+bool RezFileMapped::Close()
+{
+	if (view_ != nullptr)
+	{
+#if defined(_WIN32)
+		UnmapViewOfFile(view_);
+#else
+		munmap(view_, (size_t)viewSize_);
+#endif
+		view_ = nullptr;
+	}
+	viewSize_ = 0;
+
+#if !defined(_WIN32)
+	if (fd_ >= 0)
+	{
+		close(fd_);
+		fd_ = -1;
+	}
+#endif
+
+	if (filename_ == nullptr)
+	{
+		return false;
+	}
+
+	LT_MEM_TRACK_FREE(delete [] filename_);
+	filename_ = nullptr;
+	return true;
+}
+
+bool RezFileMapped::Flush()
+{
+	return true;
+}
+
+bool RezFileMapped::VerifyFileOpen()
+{
+	return (filename_ != nullptr);
+}
+
+const char* RezFileMapped::GetFileName()
+{
+	return filename_;
+}
+
+unsigned char* RezFileMapped::MapData(RezPos itemPos, RezPos itemOffset, unsigned long size)
+{
+	RezPos pos = itemPos + itemOffset;
+	if (view_ == nullptr) return nullptr;
+	if ((pos > viewSize_) || (size > viewSize_ - pos))
+	{
+		assert(false && "read past the end of the mapped file");
+		return nullptr;
+	}
+	return view_ + pos;
+}
+
+bool RezFileMapped::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+#if defined(_WIN32)
+	return BaseRezFile::CopyToFile(itemPos, itemOffset, size, filename, stats);
+#else
+	if (fd_ < 0) return false;
+	return RezCopyFromFd(this, fd_, itemPos, itemOffset, size, filename, stats);
+#endif
+}
+
+//------------------------------------------------------------------------------------------
+// RezMemoryImage
+
+RezMemoryImage::RezMemoryImage()
+{
+	data_     = nullptr;
+	size_     = 0;
+	capacity_ = 0;
+}
+
+RezMemoryImage::~RezMemoryImage()
+{
+	Clear();
+}
+
+void RezMemoryImage::Clear()
+{
+	if (data_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] data_);
+		data_ = nullptr;
+	}
+	size_     = 0;
+	capacity_ = 0;
+}
+
+// makes room for at least size bytes, doubling so a file written in many small pieces isn't copied every time
+bool RezMemoryImage::Grow(RezPos size)
+{
+	if (size <= capacity_) return true;
+
+	RezPos capacity = (capacity_ < 64 * 1024) ? 64 * 1024 : capacity_;
+	while (capacity < size) capacity *= 2;
+	if ((RezPos)(size_t)capacity != capacity) return false;
+
+	unsigned char* data;
+	LT_MEM_TRACK_ALLOC(data = new unsigned char[(size_t)capacity], LT_MEM_TYPE_MISC);
+	assert(data != nullptr);
+	if (data == nullptr) return false;
+
+	if (data_ != nullptr)
+	{
+		memcpy(data, data_, (size_t)size_);
+		LT_MEM_TRACK_FREE(delete [] data_);
+	}
+	data_     = data;
+	capacity_ = capacity;
+	return true;
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileMemory
+
+RezFileMemory::RezFileMemory(RezMgr* rezMgr, const void* data, RezPos size) : BaseRezFile(rezMgr)
+{
+	assert((data != nullptr) || (size == 0));
+	data_     = (const unsigned char*)data;
+	size_     = size;
+	image_    = nullptr;
+	opened_   = false;
+	readOnly_ = true;
+}
+
+RezFileMemory::RezFileMemory(RezMgr* rezMgr, RezMemoryImage* image) : BaseRezFile(rezMgr)
+{
+	assert(image != nullptr);
+	data_     = nullptr;
+	size_     = 0;
+	image_    = image;
+	opened_   = false;
+	readOnly_ = true;
+}
+
+RezFileMemory::~RezFileMemory()
+{
+	Close();
+}
+
+unsigned long RezFileMemory::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+
+	RezPos pos = itemPos + itemOffset;
+	RezPos fileSize = GetFileSize();
+	if (!opened_ || (pos > fileSize) || (size > fileSize - pos))
+	{
+		assert(false && "read past the end of the memory file");
+		return 0;
+	}
+
+	const unsigned char* src = (image_ != nullptr) ? image_->data_ : data_;
+	memcpy(data, src + (size_t)pos, size);
+	return size;
+}
+
+unsigned long RezFileMemory::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+	assert(opened_ && !readOnly_);
+
+	if (size <= 0) return 0;
+	if (!opened_ || readOnly_) return 0;
+
+	// writing past the end leaves zeroes in the gap, like a file would
+	RezPos pos = itemPos + itemOffset;
+	if (!image_->Grow(pos + size)) return 0;
+	if (pos > image_->size_) memset(image_->data_ + (size_t)image_->size_, 0, (size_t)(pos - image_->size_));
+
+	memcpy(image_->data_ + (size_t)pos, data, size);
+	if (pos + size > image_->size_) image_->size_ = pos + size;
+
+	++writeStats_.numWrites;
+	writeStats_.bytesWritten += size;
+	return size;
+}
+
+bool RezFileMemory::Open(const char* /*filename*/, bool readOnly, bool createNew)
+{
+	if (createNew && readOnly) return false;
+
+	// a caller's buffer can only be read
+	if ((image_ == nullptr) && !readOnly) return false;
+
+	if (createNew) image_->Clear();
+
+	opened_   = true;
+	readOnly_ = readOnly;
+	return true;
+}
+
+bool RezFileMemory::Close()
+{
+	if (!opened_) return false;
+	opened_ = false;
+	return true;
+}
+
+bool RezFileMemory::Flush()
+{
+	return opened_;
+}
+
+bool RezFileMemory::VerifyFileOpen()
+{
+	return opened_;
+}
+
+const char* RezFileMemory::GetFileName()
+{
+	return kRezMemoryFileName;
+}
+
+unsigned char* RezFileMemory::MapData(RezPos itemPos, RezPos itemOffset, unsigned long size)
+{
+	// an image being written may move when it grows, so only read only files hand out pointers
+	if (!IsMapped()) return nullptr;
+
+	RezPos pos = itemPos + itemOffset;
+	RezPos fileSize = GetFileSize();
+	if ((pos > fileSize) || (size > fileSize - pos))
+	{
+		assert(false && "read past the end of the memory file");
+		return nullptr;
+	}
+
+	const unsigned char* src = (image_ != nullptr) ? image_->data_ : data_;
+	return (unsigned char*)src + (size_t)pos;
+}
+
+RezPos RezFileMemory::GetFileSize()
+{
+	return (image_ != nullptr) ? image_->size_ : size_;
+}
+
+unsigned long RezFileMemory::ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	// there is no page cache to stay out of
+	return Read(itemPos, itemOffset, size, data);
+}
+
+//------------------------------------------------------------------------------------------
+// RezFilePositional
+
+RezFilePositional::RezFilePositional(RezMgr* rezMgr) : BaseRezFile(rezMgr)
+{
+#if defined(_WIN32)
+	handle_ = INVALID_HANDLE_VALUE;
+#else
+	fd_ = -1;
+#endif
+	filename_ = nullptr;
+	readOnly_ = true;
+}
+
+RezFilePositional::~RezFilePositional()
+{
+	Close();
+}
+
+unsigned long RezFilePositional::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+	assert(rezMgr_ != nullptr);
+
+	if (size <= 0) return 0;
+
+	// nothing here touches shared state, the offset travels with every call
+	RezPos seekPos = itemPos + itemOffset;
+	unsigned char* dest = (unsigned char*)data;
+	unsigned long done = 0;
+	while (done < size)
+	{
+#if defined(_WIN32)
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset     = (DWORD)(seekPos + done);
+		overlapped.OffsetHigh = (DWORD)((seekPos + done) >> 32);
+
+		DWORD ret = 0;
+		if (!ReadFile((HANDLE)handle_, dest + done, size - done, &ret, &overlapped)) ret = 0;
+#else
+		ssize_t ret = pread(fd_, dest + done, size - done, (off_t)(seekPos + done));
+		if (ret < 0) ret = 0;
+#endif
+		if (ret == 0)
+		{
+			if (!rezMgr_->DiskError())
+			{
+				assert(false && "positional read failed!");
+				return 0;
+			}
+			continue;
+		}
+		done += (unsigned long)ret;
+	}
+
+	return done;
+}
+
+unsigned long RezFilePositional::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+	assert(readOnly_ != true);
+	assert(rezMgr_ != nullptr);
+
+	if (size <= 0) return 0;
+
+	++writeStats_.numWrites;
+	writeStats_.bytesWritten += size;
+
+	RezPos seekPos = itemPos + itemOffset;
+	unsigned char* src = (unsigned char*)data;
+	unsigned long done = 0;
+	while (done < size)
+	{
+		++writeStats_.numFileWrites;
+#if defined(_WIN32)
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset     = (DWORD)(seekPos + done);
+		overlapped.OffsetHigh = (DWORD)((seekPos + done) >> 32);
+
+		DWORD ret = 0;
+		if (!WriteFile((HANDLE)handle_, src + done, size - done, &ret, &overlapped)) ret = 0;
+#else
+		ssize_t ret = pwrite(fd_, src + done, size - done, (off_t)(seekPos + done));
+		if (ret < 0) ret = 0;
+#endif
+		if (ret == 0)
+		{
+			if (!rezMgr_->DiskError())
+			{
+				assert(false && "positional write failed!");
+				return 0;
+			}
+			continue;
+		}
+		done += (unsigned long)ret;
+	}
+
+	return done;
+}
+
+bool RezFilePositional::Open(const char* filename, bool readOnly, bool createNew)
+{
+	assert(filename != nullptr);
+
+	if (createNew && readOnly) return false;
+
+	Close();
+
+	while (true)
+	{
+#if defined(_WIN32)
+		DWORD access = readOnly ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+		DWORD creation = createNew ? CREATE_ALWAYS : OPEN_EXISTING;
+		handle_ = CreateFileA(filename, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, creation, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (handle_ != INVALID_HANDLE_VALUE) break;
+#else
+		int flags = readOnly ? O_RDONLY : O_RDWR;
+		if (createNew) flags |= O_CREAT | O_TRUNC;
+		fd_ = open(filename, flags, 0644);
+		if (fd_ >= 0) break;
+#endif
+		if (!rezMgr_->DiskError()) return false;
+	}
+
+	readOnly_ = readOnly;
+
+	size_t length = strlen(filename) + 1;
+	LT_MEM_TRACK_ALLOC(filename_ = new char[length], LT_MEM_TYPE_MISC);
+	if (filename_ != nullptr)
+	{
+		LTStrCpy(filename_, filename, length);
+	}
+
+	return true;
+}
+
+bool RezFilePositional::Close()
+{
+	if (filename_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] filename_);
+		filename_ = nullptr;
+	}
+
+#if defined(_WIN32)
+	if (handle_ == INVALID_HANDLE_VALUE) return false;
+	bool ret = (CloseHandle((HANDLE)handle_) != 0);
+	handle_ = INVALID_HANDLE_VALUE;
+#else
+	if (fd_ < 0) return false;
+	bool ret = (close(fd_) == 0);
+	fd_ = -1;
+#endif
+
+	return ret;
+}
+
+bool RezFilePositional::Flush()
+{
+	// there is no user space buffering, everything written is already in the OS's hands
+	return VerifyFileOpen();
+}
+
+bool RezFilePositional::VerifyFileOpen()
+{
+#if defined(_WIN32)
+	return (handle_ != INVALID_HANDLE_VALUE);
+#else
+	return (fd_ >= 0);
+#endif
+}
+
+const char* RezFilePositional::GetFileName()
+{
+	return filename_;
+}
+
+RezPos RezFilePositional::GetFileSize()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER fileSize;
+	if ((handle_ == INVALID_HANDLE_VALUE) || !GetFileSizeEx((HANDLE)handle_, &fileSize)) return 0;
+	return (RezPos)fileSize.QuadPart;
+#else
+	struct stat st;
+	if ((fd_ < 0) || (fstat(fd_, &st) != 0)) return 0;
+	return (RezPos)st.st_size;
+#endif
+}
+
+bool RezFilePositional::ReadV(RezFileRead* reads, unsigned long numReads, unsigned long maxGap, unsigned long* numFileReads)
+{
+#if defined(_WIN32)
+	// ReadFileScatter only works on unbuffered handles with page sized pieces, so read them one at a time
+	return BaseRezFile::ReadV(reads, numReads, maxGap, numFileReads);
+#else
+	assert((reads != nullptr) || (numReads == 0));
+	assert(rezMgr_ != nullptr);
+
+	bool retFlag = true;
+	unsigned char* gapBuffer = nullptr;   // bytes between pieces are read into here and thrown away
+	struct iovec iov[kRezReadVMaxPieces];
+
+	unsigned long first = 0;
+	while (first < numReads)
+	{
+		if (reads[first].size <= 0)
+		{
+			++first;
+			continue;
+		}
+
+		// grow the run while the next piece starts at or a little past the end of it
+		RezPos runPos = reads[first].pos;
+		RezPos runEnd = runPos + reads[first].size;
+		int numPieces = 0;
+		iov[numPieces].iov_base = reads[first].data;
+		iov[numPieces].iov_len  = reads[first].size;
+		++numPieces;
+
+		unsigned long last = first + 1;
+		while ((last < numReads) && (numPieces + 2 <= kRezReadVMaxPieces) && (numPieces + 2 <= IOV_MAX))
+		{
+			RezFileRead* next = &reads[last];
+			if (next->size <= 0)
+			{
+				++last;
+				continue;
+			}
+			if (next->pos < runEnd) break;
+			RezPos gap = next->pos - runEnd;
+			if (gap > maxGap) break;
+			if ((next->pos + next->size) - runPos > kRezReadVMaxRun) break;
+
+			if (gap > 0)
+			{
+				if (gapBuffer == nullptr)
+				{
+					LT_MEM_TRACK_ALLOC(gapBuffer = new unsigned char[maxGap], LT_MEM_TYPE_MISC);
+					assert(gapBuffer != nullptr);
+					if (gapBuffer == nullptr) break;
+				}
+				iov[numPieces].iov_base = gapBuffer;
+				iov[numPieces].iov_len  = (size_t)gap;
+				++numPieces;
+			}
+			iov[numPieces].iov_base = next->data;
+			iov[numPieces].iov_len  = next->size;
+			++numPieces;
+
+			runEnd = next->pos + next->size;
+			++last;
+		}
+
+		// the kernel may stop short, carry on from the piece it stopped in
+		struct iovec* piece = iov;
+		RezPos pos = runPos;
+		while (numPieces > 0)
+		{
+			ssize_t ret = preadv(fd_, piece, numPieces, (off_t)pos);
+			if (numFileReads != nullptr) ++(*numFileReads);
+			if (ret <= 0)
+			{
+				if ((ret < 0) && (errno == EINTR)) continue;
+				if (!rezMgr_->DiskError())
+				{
+					assert(false && "vectored read failed!");
+					retFlag = false;
+					break;
+				}
+				continue;
+			}
+
+			pos += (RezPos)ret;
+			size_t done = (size_t)ret;
+			while ((numPieces > 0) && (done >= piece->iov_len))
+			{
+				done -= piece->iov_len;
+				++piece;
+				--numPieces;
+			}
+			if (numPieces > 0)
+			{
+				piece->iov_base = (unsigned char*)piece->iov_base + done;
+				piece->iov_len -= done;
+			}
+		}
+
+		first = last;
+	}
+
+	if (gapBuffer != nullptr) LT_MEM_TRACK_FREE(delete [] gapBuffer);
+	return retFlag;
+#endif
+}
+
+bool RezFilePositional::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+#if defined(_WIN32)
+	return BaseRezFile::CopyToFile(itemPos, itemOffset, size, filename, stats);
+#else
+	if (fd_ < 0) return false;
+	return RezCopyFromFd(this, fd_, itemPos, itemOffset, size, filename, stats);
+#endif
+}
+
+//------------------------------------------------------------------------------------------
+// RezAsyncEngine
+
+class RezAsyncRead : public Common::BaseListItem<RezAsyncRead>
+{
+public:
+	RezPos pos_;                    // file position of the first byte
+	unsigned char*     data_;       // destination buffer
+	unsigned long      size_;       // total bytes wanted
+	unsigned long      done_;       // bytes read so far (the kernel may return short reads)
+	RezReadCallback    callback_;
+	void*              userData_;
+#if defined(REZ_USE_IO_URING)
+	struct iovec       iov_;
+#endif
+};
+
+class RezAsyncReadList : public Common::BaseList<RezAsyncRead>
+{
+};
+
+// Keeps up to kRezAsyncQueueDepth reads in flight for one RezFileAsync.  With io_uring every read
+// is a submission queue entry and a single thread reaps completions, otherwise a pool of threads
+// pulls requests off a queue and does plain positional reads.
+class RezAsyncEngine
+{
+public:
+	RezAsyncEngine(RezFilePositional* rezFile, int fd);
+	~RezAsyncEngine();
+
+	bool Submit(RezAsyncRead* request);
+	bool IsUsingIoUring() { return usingIoUring_; }
+
+private:
+	bool Start(RezAsyncRead* request);
+	void Finish(RezAsyncRead* request);
+	void PoolThread();
+	bool IsEngineThread();
+
+	RezFilePositional*       rezFile_;
+	std::mutex               mutex_;
+	std::condition_variable  cond_;
+	RezAsyncReadList         queue_;
+	RezAsyncReadList         waiting_;          // reads a callback asked for while every slot was taken
+	unsigned long            numInFlight_;
+	unsigned long            numInCallback_;    // finished reads whose callback is still running
+	unsigned long            maxInFlight_;
+	bool                     stopping_;
+	bool                     usingIoUring_;
+	std::vector<std::thread> threads_;
+
+#if defined(REZ_USE_IO_URING)
+	bool StartUring(int fd);
+	void StopUring();
+	bool UringQueue(RezAsyncRead* request, unsigned char opcode);
+	void UringThread();
+	void UringFail();
+
+	RezAsyncReadList ringReads_;   // reads the kernel has, finished with nothing read if the ring stops working
+	bool           ringFailed_;    // io_uring_enter failed on the completion thread, every read goes to the pool from then on
+	int            ringFd_;
+	int            fileFd_;
+	unsigned char* sqRing_;
+	size_t         sqRingSize_;
+	unsigned char* cqRing_;
+	size_t         cqRingSize_;
+	io_uring_sqe*  sqes_;
+	size_t         sqesSize_;
+	unsigned*      sqHead_;
+	unsigned*      sqTail_;
+	unsigned*      sqMask_;
+	unsigned*      sqArray_;
+	unsigned*      cqHead_;
+	unsigned*      cqTail_;
+	unsigned*      cqMask_;
+	io_uring_cqe*  cqes_;
+#endif
+};
+
+RezAsyncEngine::RezAsyncEngine(RezFilePositional* rezFile, int fd)
+{
+	assert(rezFile != nullptr);
+
+	rezFile_      = rezFile;
+	numInFlight_   = 0;
+	numInCallback_ = 0;
+	maxInFlight_   = kRezAsyncQueueDepth;
+	stopping_     = false;
+	usingIoUring_ = false;
+
+#if defined(REZ_USE_IO_URING)
+	ringFailed_   = false;
+	usingIoUring_ = StartUring(fd);
+	if (usingIoUring_)
+	{
+		threads_.push_back(std::thread(&RezAsyncEngine::UringThread, this));
+		return;
+	}
+#endif
+
+	for (int i = 0; i < kRezAsyncNumThreads; ++i)
+	{
+		threads_.push_back(std::thread(&RezAsyncEngine::PoolThread, this));
+	}
+}
+
+RezAsyncEngine::~RezAsyncEngine()
+{
+	// let everything in flight finish, nobody may be left holding a pointer into a closed file
+	// (a callback can still start more reads, so wait for those too)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while ((numInFlight_ > 0) || (numInCallback_ > 0) || (waiting_.GetFirst() != nullptr)) cond_.wait(lock);
+		stopping_ = true;
+	}
+	cond_.notify_all();
+
+#if defined(REZ_USE_IO_URING)
+	if (usingIoUring_)
+	{
+		// a nop with no request attached wakes the completion thread up and tells it to quit
+		std::unique_lock<std::mutex> lock(mutex_);
+		UringQueue(nullptr, IORING_OP_NOP);
+	}
+#endif
+
+	for (size_t i = 0; i < threads_.size(); ++i) threads_[i].join();
+
+#if defined(REZ_USE_IO_URING)
+	if (usingIoUring_) StopUring();
+#endif
+}
+
+bool RezAsyncEngine::Submit(RezAsyncRead* request)
+{
+	assert(request != nullptr);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (stopping_) return false;
+
+	// cap the number of reads in flight so neither the rings nor the queue grow without bound, except
+	// on our own threads (a callback starting another read), those can't wait on a slot they may be
+	// holding up so the read waits its turn in waiting_ instead
+	if (numInFlight_ >= maxInFlight_)
+	{
+		if (IsEngineThread())
+		{
+			waiting_.InsertLast(request);
+			return true;
+		}
+		while (numInFlight_ >= maxInFlight_) cond_.wait(lock);
+	}
+
+	if (!Start(request)) return false;
+	lock.unlock();
+	cond_.notify_all();
+	return true;
+}
+
+// mutex_ must be held, returns false if the ring wouldn't take the read
+bool RezAsyncEngine::Start(RezAsyncRead* request)
+{
+#if defined(REZ_USE_IO_URING)
+	if (usingIoUring_ && !ringFailed_)
+	{
+		if (!UringQueue(request, IORING_OP_READV)) return false;
+		ringReads_.InsertLast(request);
+		++numInFlight_;
+		return true;
+	}
+#endif
+
+	queue_.InsertLast(request);
+	++numInFlight_;
+	return true;
+}
+
+void RezAsyncEngine::Finish(RezAsyncRead* request)
+{
+	// give the slot back before the callback runs so a callback that starts another read never waits on itself
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		--numInFlight_;
+		++numInCallback_;
+
+		// (if the ring won't take it the completion thread finds it again once it has stopped using the ring)
+		RezAsyncRead* next = waiting_.GetFirst();
+		if (next != nullptr)
+		{
+			waiting_.Delete(next);
+			if (!Start(next)) waiting_.InsertFirst(next);
+		}
+	}
+	cond_.notify_all();
+
+	request->callback_(request->userData_, (request->done_ == request->size_) ? request->done_ : 0);
+	LT_MEM_TRACK_FREE(delete request);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		--numInCallback_;
+	}
+	cond_.notify_all();
+}
+
+// mutex_ must be held, threads_ doesn't change once the constructor is done
+bool RezAsyncEngine::IsEngineThread()
+{
+	std::thread::id id = std::this_thread::get_id();
+	for (size_t i = 0; i < threads_.size(); ++i)
+	{
+		if (threads_[i].get_id() == id) return true;
+	}
+	return false;
+}
+
+void RezAsyncEngine::PoolThread()
+{
+	while (true)
+	{
+		RezAsyncRead* request;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			while ((queue_.GetFirst() == nullptr) && !stopping_) cond_.wait(lock);
+			request = queue_.GetFirst();
+			if (request == nullptr) return;
+			queue_.Delete(request);
+		}
+
+		request->done_ = rezFile_->RezFilePositional::Read(request->pos_, 0, request->size_, request->data_);
+		Finish(request);
+	}
+}
+
+#if defined(REZ_USE_IO_URING)
+
+bool RezAsyncEngine::StartUring(int fd)
+{
+	ringFd_  = -1;
+	fileFd_  = fd;
+	sqRing_  = nullptr;
+	cqRing_  = nullptr;
+	sqes_    = nullptr;
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ringFd_ = (int)syscall(__NR_io_uring_setup, kRezAsyncQueueDepth, &params);
+	if (ringFd_ < 0) return false;
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqRingSize_ > sqRingSize_) sqRingSize_ = cqRingSize_;
+		cqRingSize_ = sqRingSize_;
+	}
+
+	void* ptr = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+	{
+		StopUring();
+		return false;
+	}
+	sqRing_ = (unsigned char*)ptr;
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cqRing_ = sqRing_;
+	}
+	else
+	{
+		ptr = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED)
+		{
+			StopUring();
+			return false;
+		}
+		cqRing_ = (unsigned char*)ptr;
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+	ptr = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+	{
+		StopUring();
+		return false;
+	}
+	sqes_ = (io_uring_sqe*)ptr;
+
+	sqHead_  = (unsigned*)(sqRing_ + params.sq_off.head);
+	sqTail_  = (unsigned*)(sqRing_ + params.sq_off.tail);
+	sqMask_  = (unsigned*)(sqRing_ + params.sq_off.ring_mask);
+	sqArray_ = (unsigned*)(sqRing_ + params.sq_off.array);
+	cqHead_  = (unsigned*)(cqRing_ + params.cq_off.head);
+	cqTail_  = (unsigned*)(cqRing_ + params.cq_off.tail);
+	cqMask_  = (unsigned*)(cqRing_ + params.cq_off.ring_mask);
+	cqes_    = (io_uring_cqe*)(cqRing_ + params.cq_off.cqes);
+
+	// one slot is kept back for the nop that shuts the completion thread down
+	maxInFlight_ = params.sq_entries - 1;
+	return true;
+}
+
+void RezAsyncEngine::StopUring()
+{
+	if (sqes_ != nullptr) munmap(sqes_, sqesSize_);
+	if ((cqRing_ != nullptr) && (cqRing_ != sqRing_)) munmap(cqRing_, cqRingSize_);
+	if (sqRing_ != nullptr) munmap(sqRing_, sqRingSize_);
+	if (ringFd_ >= 0) close(ringFd_);
+
+	sqes_   = nullptr;
+	cqRing_ = nullptr;
+	sqRing_ = nullptr;
+	ringFd_ = -1;
+}
+
+// mutex_ must be held, the submission ring only has one producer at a time.  Returns false if
+// io_uring_enter failed, on the completion thread that also stops the ring being used
+bool RezAsyncEngine::UringQueue(RezAsyncRead* request, unsigned char opcode)
+{
+	// without SQPOLL the kernel consumes entries during io_uring_enter, so with at most
+	// maxInFlight_ reads outstanding there is always a free slot here
+	unsigned tail  = *sqTail_;
+	unsigned index = tail & *sqMask_;
+	assert(tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) <= *sqMask_);
+
+	io_uring_sqe* sqe = &sqes_[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = opcode;
+	sqe->user_data = (unsigned long long)(size_t)request;
+	if (request != nullptr)
+	{
+		request->iov_.iov_base = request->data_ + request->done_;
+		request->iov_.iov_len  = request->size_ - request->done_;
+
+		sqe->fd   = fileFd_;
+		sqe->off  = request->pos_ + request->done_;
+		sqe->addr = (unsigned long long)(size_t)&request->iov_;
+		sqe->len  = 1;
+	}
+
+	sqArray_[index] = index;
+	__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, ringFd_, 1, 0, 0, nullptr, 0) < 0)
+	{
+		if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+		{
+			// the kernel never took the entry, so it can be taken back
+			__atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+			if (IsEngineThread()) ringFailed_ = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+void RezAsyncEngine::UringThread()
+{
+	while (true)
+	{
+		if (syscall(__NR_io_uring_enter, ringFd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+		{
+			if (errno == EINTR) continue;
+
+			// nothing more will come out of the ring
+			UringFail();
+			return;
+		}
+
+		unsigned head = *cqHead_;
+		unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+			RezAsyncRead* request = (RezAsyncRead*)(size_t)cqe->user_data;
+			int result = cqe->res;
+
+			++head;
+			__atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+			// the shutdown nop, everything else has already finished
+			if (request == nullptr) return;
+
+			if (result > 0)
+			{
+				request->done_ += (unsigned long)result;
+				if (request->done_ < request->size_)
+				{
+					// short read, go back for the rest (if the ring won't take it the read fails)
+					std::lock_guard<std::mutex> lock(mutex_);
+					if (UringQueue(request, IORING_OP_READV)) continue;
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				ringReads_.Delete(request);
+			}
+			Finish(request);
+		}
+
+		bool failed;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			failed = ringFailed_;
+		}
+		if (failed)
+		{
+			UringFail();
+			return;
+		}
+	}
+}
+
+// the ring has stopped working, the reads it still has are finished with nothing read (they may never
+// come back out of it) and this thread carries on as a pool thread for every read from now on
+void RezAsyncEngine::UringFail()
+{
+	while (true)
+	{
+		RezAsyncRead* request;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			ringFailed_ = true;
+
+			// reads that were waiting for a slot the ring wouldn't take
+			while ((numInFlight_ < maxInFlight_) && (waiting_.GetFirst() != nullptr))
+			{
+				RezAsyncRead* next = waiting_.GetFirst();
+				waiting_.Delete(next);
+				Start(next);
+			}
+
+			request = ringReads_.GetFirst();
+			if (request != nullptr) ringReads_.Delete(request);
+		}
+		if (request == nullptr) break;
+
+		request->done_ = 0;
+		Finish(request);
+	}
+	cond_.notify_all();
+
+	PoolThread();
+}
+
+#endif
+
+//------------------------------------------------------------------------------------------
+// RezFileAsync
+
+RezFileAsync::RezFileAsync(RezMgr* rezMgr) : RezFilePositional(rezMgr)
+{
+	engine_ = nullptr;
+}
+
+RezFileAsync::~RezFileAsync()
+{
+	Close();
+}
+
+bool RezFileAsync::Open(const char* filename, bool readOnly, bool createNew)
+{
+	if (!RezFilePositional::Open(filename, readOnly, createNew)) return false;
+
+#if defined(_WIN32)
+	LT_MEM_TRACK_ALLOC(engine_ = new RezAsyncEngine(this, -1), LT_MEM_TYPE_MISC);
+#else
+	LT_MEM_TRACK_ALLOC(engine_ = new RezAsyncEngine(this, fd_), LT_MEM_TYPE_MISC);
+#endif
+	assert(engine_ != nullptr);
+	return true;
+}
+
+bool RezFileAsync::Close()
+{
+	if (engine_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete engine_);
+		engine_ = nullptr;
+	}
+
+	return RezFilePositional::Close();
+}
+
+bool RezFileAsync::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+							 RezReadCallback callback, void* userData)
+{
+	assert(data != nullptr);
+	assert(callback != nullptr);
+
+	if (engine_ == nullptr) return false;
+
+	if (size <= 0)
+	{
+		callback(userData, 0);
+		return true;
+	}
+
+	RezAsyncRead* request;
+	LT_MEM_TRACK_ALLOC(request = new RezAsyncRead, LT_MEM_TYPE_MISC);
+	if (request == nullptr) return false;
+
+	request->pos_      = itemPos + itemOffset;
+	request->data_     = (unsigned char*)data;
+	request->size_     = size;
+	request->done_     = 0;
+	request->callback_ = callback;
+	request->userData_ = userData;
+
+	if (!engine_->Submit(request))
+	{
+		LT_MEM_TRACK_FREE(delete request);
+		return false;
+	}
+	return true;
+}
+
+bool RezFileAsync::IsUsingIoUring()
+{
+	return (engine_ != nullptr) && engine_->IsUsingIoUring();
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileLayer
+
+RezFileLayer::RezFileLayer(RezMgr* rezMgr, BaseRezFile* inner) : BaseRezFile(rezMgr)
+{
+	assert(inner != nullptr);
+	inner_ = inner;
+}
+
+RezFileLayer::~RezFileLayer()
+{
+	if (inner_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete inner_);
+		inner_ = nullptr;
+	}
+}
+
+unsigned long RezFileLayer::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	return inner_->Read(itemPos, itemOffset, size, data);
+}
+
+unsigned long RezFileLayer::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	return inner_->Write(itemPos, itemOffset, size, data);
+}
+
+bool RezFileLayer::Open(const char* filename, bool readOnly, bool createNew)
+{
+	return inner_->Open(filename, readOnly, createNew);
+}
+
+bool RezFileLayer::Close()
+{
+	return inner_->Close();
+}
+
+bool RezFileLayer::Flush()
+{
+	return inner_->Flush();
+}
+
+bool RezFileLayer::VerifyFileOpen()
+{
+	return inner_->VerifyFileOpen();
+}
+
+const char* RezFileLayer::GetFileName()
+{
+	return inner_->GetFileName();
+}
+
+unsigned char* RezFileLayer::MapData(RezPos itemPos, RezPos itemOffset, unsigned long size)
+{
+	return inner_->MapData(itemPos, itemOffset, size);
+}
+
+bool RezFileLayer::IsMapped()
+{
+	return inner_->IsMapped();
+}
+
+bool RezFileLayer::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+							 RezReadCallback callback, void* userData)
+{
+	return inner_->ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+}
+
+RezPos RezFileLayer::GetFileSize()
+{
+	return inner_->GetFileSize();
+}
+
+unsigned long RezFileLayer::ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	// direct reads skip every cache, layers included
+	return inner_->ReadDirect(itemPos, itemOffset, size, data);
+}
+
+bool RezFileLayer::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+	// copies go from the file itself, nothing they read is worth keeping in a cache
+	return inner_->CopyToFile(itemPos, itemOffset, size, filename, stats);
+}
+
+void RezFileLayer::GetReadAheadStats(RezReadAheadStats* stats)
+{
+	inner_->GetReadAheadStats(stats);
+}
+
+void RezFileLayer::GetWriteStats(RezWriteStats* stats)
+{
+	inner_->GetWriteStats(stats);
+}
+
+//------------------------------------------------------------------------------------------
+// RezReadAheadEngine
+
+#define kRezReadAheadEmpty    0
+#define kRezReadAheadPending  1
+#define kRezReadAheadReady    2
+
+// one window of the file read ahead of the caller
+struct RezReadAheadBuffer
+{
+	unsigned char* data_;
+	unsigned long capacity_;
+	RezPos pos_;
+	unsigned long size_;       // bytes asked for while pending, bytes actually read once ready
+	unsigned long used_;       // bytes handed out to callers so far
+	int state_;
+};
+
+// Does the work for one RezFileReadAhead.  Two buffers are kept, cur_ is the window the caller is
+// reading out of and next_ is the window after it, which the background thread fills in while the
+// caller works through cur_.  All reads of the inner file go through ioMutex_ because the inner
+// file (RezFile in particular) may not allow two reads at once.
+class RezReadAheadEngine
+{
+public:
+	RezReadAheadEngine(BaseRezFile* file, RezPos fileSize, unsigned long minWindow, unsigned long maxWindow);
+	~RezReadAheadEngine();
+
+	unsigned long Read(RezPos pos, unsigned long size, unsigned char* data);
+	unsigned long Write(RezPos pos, unsigned long size, unsigned char* data);
+	void GetStats(RezReadAheadStats* stats);
+
+private:
+	void ReaderThread();
+	void StartPrefetch(RezPos pos);
+	void Retire(RezReadAheadBuffer* buffer);
+
+	BaseRezFile* file_;
+	RezPos fileSize_;
+	unsigned long minWindow_;
+	unsigned long maxWindow_;
+	unsigned long window_;
+	RezPos lastEnd_;
+
+	RezReadAheadBuffer cur_;
+	RezReadAheadBuffer next_;
+	RezReadAheadStats stats_;
+
+	std::mutex mutex_;
+	std::mutex ioMutex_;
+	std::condition_variable cond_;
+	std::thread thread_;
+	bool stopping_;
+};
+
+RezReadAheadEngine::RezReadAheadEngine(BaseRezFile* file, RezPos fileSize, unsigned long minWindow, unsigned long maxWindow)
+{
+	assert(file != nullptr);
+	assert((minWindow > 0) && (minWindow <= maxWindow));
+
+	file_      = file;
+	fileSize_  = fileSize;
+	minWindow_ = minWindow;
+	maxWindow_ = maxWindow;
+	window_    = minWindow;
+	lastEnd_   = REZ_SEEKPOS_ERROR;
+	stopping_  = false;
+
+	memset(&cur_, 0, sizeof(cur_));
+	memset(&next_, 0, sizeof(next_));
+	memset(&stats_, 0, sizeof(stats_));
+
+	thread_ = std::thread(&RezReadAheadEngine::ReaderThread, this);
+}
+
+RezReadAheadEngine::~RezReadAheadEngine()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		stopping_ = true;
+		cond_.notify_all();
+	}
+	thread_.join();
+
+	Retire(&cur_);
+	Retire(&next_);
+	if (cur_.data_ != nullptr) LT_MEM_TRACK_FREE(delete [] cur_.data_);
+	if (next_.data_ != nullptr) LT_MEM_TRACK_FREE(delete [] next_.data_);
+}
+
+unsigned long RezReadAheadEngine::Read(RezPos pos, unsigned long size, unsigned char* data)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	bool sequential = (pos == lastEnd_);
+	lastEnd_ = pos + size;
+
+	// copy out whatever is already (or about to be) in the read-ahead buffers
+	unsigned long done = 0;
+	while (done < size)
+	{
+		RezPos curPos = pos + done;
+		if ((cur_.state_ == kRezReadAheadReady) && (curPos >= cur_.pos_) && (curPos < cur_.pos_ + cur_.size_))
+		{
+			unsigned long num = (unsigned long)(cur_.pos_ + cur_.size_ - curPos);
+			if (num > size - done) num = size - done;
+			memcpy(data + done, cur_.data_ + (curPos - cur_.pos_), num);
+
+			// first use of a prefetched window, it paid off so read further ahead next time
+			if ((cur_.used_ == 0) && (window_ < maxWindow_))
+			{
+				window_ = (window_ * 2 > maxWindow_) ? maxWindow_ : window_ * 2;
+			}
+			cur_.used_ += num;
+			stats_.usedBytes += num;
+			done += num;
+		}
+		else if ((next_.state_ != kRezReadAheadEmpty) && (curPos >= next_.pos_) && (curPos < next_.pos_ + next_.size_))
+		{
+			while (next_.state_ == kRezReadAheadPending) cond_.wait(lock);
+
+			RezReadAheadBuffer tmp = cur_;
+			Retire(&tmp);
+			cur_ = next_;
+			next_ = tmp;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (done > 0) ++stats_.numHits;
+
+	unsigned long retVal = done;
+	if (done < size)
+	{
+		++stats_.numMisses;
+
+		// the rest comes straight from the file without holding the lock, so readers that hit the
+		// buffers don't wait behind it (the buffers may have moved on by the time it is taken again)
+		lock.unlock();
+		{
+			std::unique_lock<std::mutex> ioLock(ioMutex_);
+			retVal += file_->Read(pos + done, 0, size - done, data + done);
+		}
+		lock.lock();
+	}
+
+	// keep the window after this one coming for a sequential reader, once it is half way through
+	// the current window, or straight away if it has run past the read-ahead buffers altogether
+	if (sequential && (next_.state_ == kRezReadAheadEmpty))
+	{
+		RezPos end = pos + size;
+		if ((cur_.state_ == kRezReadAheadReady) && (end >= cur_.pos_) && (end <= cur_.pos_ + cur_.size_))
+		{
+			if (end - cur_.pos_ >= cur_.size_ / 2) StartPrefetch(cur_.pos_ + cur_.size_);
+		}
+		else
+		{
+			StartPrefetch(end);
+		}
+	}
+
+	return retVal;
+}
+
+unsigned long RezReadAheadEngine::Write(RezPos pos, unsigned long size, unsigned char* data)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// wait for the background read so it can't bring back stale data, then drop both windows
+	while (next_.state_ == kRezReadAheadPending) cond_.wait(lock);
+	Retire(&cur_);
+	Retire(&next_);
+	lastEnd_ = REZ_SEEKPOS_ERROR;
+
+	unsigned long ret;
+	{
+		std::unique_lock<std::mutex> ioLock(ioMutex_);
+		ret = file_->Write(pos, 0, size, data);
+	}
+	if (pos + ret > fileSize_) fileSize_ = pos + ret;
+	return ret;
+}
+
+void RezReadAheadEngine::GetStats(RezReadAheadStats* stats)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	stats->prefetchedBytes += stats_.prefetchedBytes;
+	stats->usedBytes       += stats_.usedBytes;
+	stats->wastedBytes     += stats_.wastedBytes;
+	stats->numPrefetches   += stats_.numPrefetches;
+	stats->numHits         += stats_.numHits;
+	stats->numMisses       += stats_.numMisses;
+	if (window_ > stats->windowSize) stats->windowSize = window_;
+}
+
+// mutex_ must be held and next_ must be empty
+void RezReadAheadEngine::StartPrefetch(RezPos pos)
+{
+	assert(next_.state_ == kRezReadAheadEmpty);
+
+	if (pos >= fileSize_) return;
+
+	unsigned long size = (fileSize_ - pos > window_) ? window_ : (unsigned long)(fileSize_ - pos);
+
+	if (next_.capacity_ < size)
+	{
+		if (next_.data_ != nullptr) LT_MEM_TRACK_FREE(delete [] next_.data_);
+		LT_MEM_TRACK_ALLOC(next_.data_ = new unsigned char[size], LT_MEM_TYPE_MISC);
+		next_.capacity_ = (next_.data_ != nullptr) ? size : 0;
+		if (next_.data_ == nullptr) return;
+	}
+
+	next_.pos_   = pos;
+	next_.size_  = size;
+	next_.used_  = 0;
+	next_.state_ = kRezReadAheadPending;
+	cond_.notify_all();
+}
+
+// mutex_ must be held, counts whatever was never used as wasted and shrinks the window if most of it was
+void RezReadAheadEngine::Retire(RezReadAheadBuffer* buffer)
+{
+	assert(buffer->state_ != kRezReadAheadPending);
+
+	if (buffer->state_ == kRezReadAheadReady)
+	{
+		unsigned long used = (buffer->used_ > buffer->size_) ? buffer->size_ : buffer->used_;
+		stats_.wastedBytes += buffer->size_ - used;
+		if ((used < buffer->size_ / 2) && (window_ > minWindow_))
+		{
+			window_ = (window_ / 2 < minWindow_) ? minWindow_ : window_ / 2;
+		}
+	}
+	buffer->state_ = kRezReadAheadEmpty;
+	buffer->size_  = 0;
+	buffer->used_  = 0;
+}
+
+void RezReadAheadEngine::ReaderThread()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;)
+	{
+		while (!stopping_ && (next_.state_ != kRezReadAheadPending)) cond_.wait(lock);
+		if (next_.state_ != kRezReadAheadPending) return;
+
+		// nobody else touches next_ while it is pending, so its buffer can be filled in without the lock
+		RezPos pos = next_.pos_;
+		unsigned long size = next_.size_;
+		unsigned char* data = next_.data_;
+		lock.unlock();
+
+		unsigned long ret;
+		{
+			std::unique_lock<std::mutex> ioLock(ioMutex_);
+			ret = file_->Read(pos, 0, size, data);
+		}
+
+		lock.lock();
+		next_.size_  = ret;
+		next_.state_ = kRezReadAheadReady;
+		++stats_.numPrefetches;
+		stats_.prefetchedBytes += ret;
+		cond_.notify_all();
+	}
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileReadAhead
+
+RezFileReadAhead::RezFileReadAhead(RezMgr* rezMgr, BaseRezFile* inner, unsigned long minWindow, unsigned long maxWindow) : RezFileLayer(rezMgr, inner)
+{
+	engine_    = nullptr;
+	minWindow_ = minWindow;
+	maxWindow_ = maxWindow;
+}
+
+RezFileReadAhead::~RezFileReadAhead()
+{
+	Close();
+}
+
+unsigned long RezFileReadAhead::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+	if (engine_ == nullptr) return inner_->Read(itemPos, itemOffset, size, data);
+	return engine_->Read(itemPos + itemOffset, size, (unsigned char*)data);
+}
+
+unsigned long RezFileReadAhead::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+	if (engine_ == nullptr) return inner_->Write(itemPos, itemOffset, size, data);
+	return engine_->Write(itemPos + itemOffset, size, (unsigned char*)data);
+}
+
+bool RezFileReadAhead::Open(const char* filename, bool readOnly, bool createNew)
+{
+	Close();
+
+	if (!inner_->Open(filename, readOnly, createNew)) return false;
+
+	// mapped files are already as fast as it gets, and without a file size there is no telling where to stop
+	RezPos fileSize = inner_->GetFileSize();
+	if (inner_->IsMapped() || (fileSize == 0)) return true;
+
+	LT_MEM_TRACK_ALLOC(engine_ = new RezReadAheadEngine(inner_, fileSize, minWindow_, maxWindow_), LT_MEM_TYPE_MISC);
+	assert(engine_ != nullptr);
+	return true;
+}
+
+bool RezFileReadAhead::Close()
+{
+	if (engine_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete engine_);
+		engine_ = nullptr;
+	}
+
+	return inner_->Close();
+}
+
+bool RezFileReadAhead::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+								 RezReadCallback callback, void* userData)
+{
+	// the inner file's own asynchronous path would read behind the engine's back, so go through Read
+	if (engine_ != nullptr) return BaseRezFile::ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+	return inner_->ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+}
+
+void RezFileReadAhead::GetReadAheadStats(RezReadAheadStats* stats)
+{
+	if (engine_ != nullptr) engine_->GetStats(stats);
+	inner_->GetReadAheadStats(stats);
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileBlockCache
+
+RezFileBlockCache::RezFileBlockCache(RezMgr* rezMgr, BaseRezFile* inner, RezBlockCache* cache) : RezFileLayer(rezMgr, inner)
+{
+	assert(cache != nullptr);
+	cache_    = cache;
+	fileSize_ = 0;
+}
+
+RezFileBlockCache::~RezFileBlockCache()
+{
+	Close();
+}
+
+unsigned long RezFileBlockCache::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+	if ((fileSize_ == 0) || (size > cache_->GetMaxCachedRead())) return inner_->Read(itemPos, itemOffset, size, data);
+	return cache_->Read(inner_, fileSize_, itemPos + itemOffset, size, (unsigned char*)data);
+}
+
+unsigned long RezFileBlockCache::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	if (fileSize_ != 0) cache_->Invalidate(inner_, itemPos + itemOffset, size);
+	return inner_->Write(itemPos, itemOffset, size, data);
+}
+
+bool RezFileBlockCache::Open(const char* filename, bool readOnly, bool createNew)
+{
+	Close();
+
+	if (!inner_->Open(filename, readOnly, createNew)) return false;
+
+	// mapped files are in the page cache already
+	fileSize_ = inner_->IsMapped() ? 0 : inner_->GetFileSize();
+	return true;
+}
+
+bool RezFileBlockCache::Close()
+{
+	// the inner file's address is the cache key, so nothing of it may outlive the close
+	if (fileSize_ != 0) cache_->InvalidateFile(inner_);
+	fileSize_ = 0;
+
+	return inner_->Close();
+}
+
+bool RezFileBlockCache::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+								  RezReadCallback callback, void* userData)
+{
+	if ((fileSize_ != 0) && (size <= cache_->GetMaxCachedRead())) return BaseRezFile::ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+	return inner_->ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileWriteCombine
+
+RezFileWriteCombine::RezFileWriteCombine(RezMgr* rezMgr, BaseRezFile* inner, unsigned long bufferSize) : RezFileLayer(rezMgr, inner)
+{
+	assert(bufferSize > 0);
+	buffer_     = nullptr;
+	bufferSize_ = bufferSize;
+	bufferUsed_ = 0;
+	bufferPos_  = 0;
+}
+
+RezFileWriteCombine::~RezFileWriteCombine()
+{
+	if (bufferUsed_ > 0) FlushBuffer();
+	if (buffer_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] buffer_);
+		buffer_ = nullptr;
+	}
+}
+
+bool RezFileWriteCombine::FlushBuffer()
+{
+	if (bufferUsed_ == 0) return true;
+
+	unsigned long used = bufferUsed_;
+	bufferUsed_ = 0;
+	return (inner_->Write(bufferPos_, 0, used, buffer_) == used);
+}
+
+unsigned long RezFileWriteCombine::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	// reads of anything else don't need to wait for the buffer
+	RezPos pos = itemPos + itemOffset;
+	if ((bufferUsed_ > 0) && (pos < bufferPos_ + bufferUsed_) && (pos + size > bufferPos_)) FlushBuffer();
+	return inner_->Read(itemPos, itemOffset, size, data);
+}
+
+unsigned long RezFileWriteCombine::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+
+	++writeStats_.numWrites;
+	writeStats_.bytesWritten += size;
+
+	if (buffer_ == nullptr)
+	{
+		LT_MEM_TRACK_ALLOC(buffer_ = new unsigned char[bufferSize_], LT_MEM_TYPE_MISC);
+		assert(buffer_ != nullptr);
+		if (buffer_ == nullptr) return inner_->Write(itemPos, itemOffset, size, data);
+	}
+
+	// add to the buffer if the write starts inside it or right at its end and still fits
+	RezPos pos = itemPos + itemOffset;
+	if ((bufferUsed_ > 0) && (pos >= bufferPos_) && (pos <= bufferPos_ + bufferUsed_) && (pos + size <= bufferPos_ + bufferSize_))
+	{
+		unsigned long offset = (unsigned long)(pos - bufferPos_);
+		memcpy(buffer_ + offset, data, size);
+		if (offset + size > bufferUsed_) bufferUsed_ = offset + size;
+		return size;
+	}
+
+	// the position jumped (or the buffer is full), write out what there is and start again
+	if (!FlushBuffer()) return 0;
+
+	// anything as big as the buffer gains nothing from being copied into it
+	if (size >= bufferSize_) return inner_->Write(itemPos, itemOffset, size, data);
+
+	memcpy(buffer_, data, size);
+	bufferPos_  = pos;
+	bufferUsed_ = size;
+	return size;
+}
+
+bool RezFileWriteCombine::Open(const char* filename, bool readOnly, bool createNew)
+{
+	Close();
+	return inner_->Open(filename, readOnly, createNew);
+}
+
+bool RezFileWriteCombine::Close()
+{
+	bool ret = FlushBuffer();
+	if (buffer_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] buffer_);
+		buffer_ = nullptr;
+	}
+
+	if (!inner_->Close()) ret = false;
+	return ret;
+}
+
+bool RezFileWriteCombine::Flush()
+{
+	bool ret = FlushBuffer();
+	if (!inner_->Flush()) ret = false;
+	return ret;
+}
+
+unsigned char* RezFileWriteCombine::MapData(RezPos itemPos, RezPos itemOffset, unsigned long size)
+{
+	FlushBuffer();
+	return inner_->MapData(itemPos, itemOffset, size);
+}
+
+bool RezFileWriteCombine::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+									RezReadCallback callback, void* userData)
+{
+	FlushBuffer();
+	return inner_->ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+}
+
+RezPos RezFileWriteCombine::GetFileSize()
+{
+	FlushBuffer();
+	return inner_->GetFileSize();
+}
+
+unsigned long RezFileWriteCombine::ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	FlushBuffer();
+	return inner_->ReadDirect(itemPos, itemOffset, size, data);
+}
+
+bool RezFileWriteCombine::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+	FlushBuffer();
+	return inner_->CopyToFile(itemPos, itemOffset, size, filename, stats);
+}
+
+void RezFileWriteCombine::GetWriteStats(RezWriteStats* stats)
+{
+	// the inner file only sees the combined writes, the caller's own writes are counted here
+	RezWriteStats innerStats;
+	memset(&innerStats, 0, sizeof(innerStats));
+	inner_->GetWriteStats(&innerStats);
+
+	stats->bytesWritten  += writeStats_.bytesWritten;
+	stats->numWrites     += writeStats_.numWrites;
+	stats->numFileWrites += innerStats.numFileWrites;
+	stats->numFileSeeks  += innerStats.numFileSeeks;
 }
 
-unsigned long RezFileSingleFile::Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
+//------------------------------------------------------------------------------------------
+// RezBackgroundWriter
+
+// one write waiting for the background thread, the data is a copy owned by the queue
+class RezQueuedWrite : public Common::BaseListItem<RezQueuedWrite>
 {
-	assert(data != nullptr);
-	assert(dirEmulation_ != nullptr);
-	assert(dirEmulation_->rezMgr_ != nullptr);
+public:
+	RezPos         pos_;
+	unsigned long  size_;
+	unsigned char* data_;
+};
 
-	if (size <= 0) return 0;
+class RezQueuedWriteList : public Common::BaseList<RezQueuedWrite>
+{
+};
 
-	if (file_ == nullptr) ReallyOpen();
+// Does the work for one RezFileBackgroundWrite.  Writes stay at the head of the queue until they are
+// done so Wait can tell when the file has caught up, and every use of the inner file goes through
+// ioMutex_ because it (RezFile in particular) may not allow two threads in at once.
+class RezBackgroundWriter
+{
+public:
+	RezBackgroundWriter(BaseRezFile* file, unsigned long maxQueued);
+	~RezBackgroundWriter();
+
+	bool Write(RezPos pos, unsigned long size, void* data);
+	bool Wait();   // returns false if a write failed since the last Wait
+
+	// copies size bytes at pos out of the newest queued write that overlaps them, returns false if that write
+	// doesn't hold them all (pending is set) or none overlaps them (the file already has the latest bytes)
+	bool ReadQueued(RezPos pos, unsigned long size, void* data, bool* pending);
+	std::mutex& GetIoMutex() { return ioMutex_; }
+
+private:
+	void WriterThread();
+
+	BaseRezFile* file_;
+	unsigned long maxQueued_;
+	unsigned long queuedBytes_;    // bytes waiting, including the write in progress
+	RezQueuedWriteList queue_;
+	bool failed_;
+	bool stopping_;
+
+	std::mutex mutex_;
+	std::mutex ioMutex_;
+	std::condition_variable cond_;
+	std::thread thread_;
+};
+
+RezBackgroundWriter::RezBackgroundWriter(BaseRezFile* file, unsigned long maxQueued)
+{
+	assert(file != nullptr);
+	assert(maxQueued > 0);
+
+	file_        = file;
+	maxQueued_   = maxQueued;
+	queuedBytes_ = 0;
+	failed_      = false;
+	stopping_    = false;
+
+	thread_ = std::thread(&RezBackgroundWriter::WriterThread, this);
+}
 
-	while (fseek(file_, itemOffset, SEEK_SET) != 0)
+RezBackgroundWriter::~RezBackgroundWriter()
+{
+	// the thread writes out everything still queued before it stops
 	{
-		if (dirEmulation_->rezMgr_->DiskError())
-		{
-			assert(false);
-			return 0;
-		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		stopping_ = true;
+		cond_.notify_all();
 	}
+	thread_.join();
+}
 
-	unsigned long ret;
-	while ((ret = fread(data, 1, size, file_)) != size)
+bool RezBackgroundWriter::Write(RezPos pos, unsigned long size, void* data)
+{
+	RezQueuedWrite* request;
+	LT_MEM_TRACK_ALLOC(request = new RezQueuedWrite, LT_MEM_TYPE_MISC);
+	assert(request != nullptr);
+	if (request == nullptr) return false;
+
+	LT_MEM_TRACK_ALLOC(request->data_ = new unsigned char[size], LT_MEM_TYPE_MISC);
+	assert(request->data_ != nullptr);
+	if (request->data_ == nullptr)
 	{
-		if (dirEmulation_->rezMgr_->DiskError())
-		{
-			assert(false);
-			return 0;
-		}
+		LT_MEM_TRACK_FREE(delete request);
+		return false;
 	}
+	memcpy(request->data_, data, size);
+	request->pos_  = pos;
+	request->size_ = size;
+
+	// queue first and then wait for room, so writes made while the queue is full keep their order
+	std::unique_lock<std::mutex> lock(mutex_);
+	queue_.InsertLast(request);
+	queuedBytes_ += size;
+	cond_.notify_all();
+
+	while ((queuedBytes_ > maxQueued_) && (queue_.GetFirst() != request)) cond_.wait(lock);
+	return true;
+}
+
+bool RezBackgroundWriter::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (queue_.GetFirst() != nullptr) cond_.wait(lock);
 
+	bool ret = !failed_;
+	failed_ = false;
 	return ret;
 }
 
-unsigned long RezFileSingleFile::Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data)
+bool RezBackgroundWriter::ReadQueued(RezPos pos, unsigned long size, void* data, bool* pending)
 {
-	assert(data != nullptr);
-	assert(dirEmulation_ != nullptr);
-	assert(dirEmulation_->readOnly_ != true);
-	assert(dirEmulation_->rezMgr_ != nullptr);
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (RezQueuedWrite* request = queue_.GetLast(); request != nullptr; request = request->Prev())
+	{
+		if ((request->pos_ >= pos + size) || (request->pos_ + request->size_ <= pos)) continue;
 
-	if (size <= 0) return 0;
+		*pending = (request->pos_ > pos) || (request->pos_ + request->size_ < pos + size);
+		if (*pending) return false;
+
+		memcpy(data, request->data_ + (size_t)(pos - request->pos_), size);
+		return true;
+	}
 
-	if (file_ == nullptr) ReallyOpen();
+	*pending = false;
+	return false;
+}
 
-	while (fseek(file_, itemOffset, SEEK_SET) != 0)
+void RezBackgroundWriter::WriterThread()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
 	{
-		if (!dirEmulation_->rezMgr_->DiskError())
+		while ((queue_.GetFirst() == nullptr) && !stopping_) cond_.wait(lock);
+
+		RezQueuedWrite* request = queue_.GetFirst();
+		if (request == nullptr) break;
+
+		lock.unlock();
+		bool ok;
 		{
-			assert(false);
-			return 0;
+			std::lock_guard<std::mutex> ioLock(ioMutex_);
+			ok = (file_->Write(request->pos_, 0, request->size_, request->data_) == request->size_);
 		}
+		lock.lock();
+
+		queue_.Delete(request);
+		queuedBytes_ -= request->size_;
+		if (!ok) failed_ = true;
+		cond_.notify_all();
+
+		LT_MEM_TRACK_FREE(delete [] request->data_);
+		LT_MEM_TRACK_FREE(delete request);
 	}
+}
 
-	unsigned long ret;
-	while ((ret = fwrite(data, 1, size, file_)) != size)
+//------------------------------------------------------------------------------------------
+// RezFileBackgroundWrite
+
+RezFileBackgroundWrite::RezFileBackgroundWrite(RezMgr* rezMgr, BaseRezFile* inner, unsigned long maxQueued) : RezFileLayer(rezMgr, inner)
+{
+	writer_    = nullptr;
+	maxQueued_ = maxQueued;
+}
+
+RezFileBackgroundWrite::~RezFileBackgroundWrite()
+{
+	if (writer_ != nullptr)
 	{
-		if (dirEmulation_->rezMgr_->DiskError())
-		{
-			assert(false);
-			return 0;
-		}
+		LT_MEM_TRACK_FREE(delete writer_);
+		writer_ = nullptr;
+	}
+}
+
+unsigned long RezFileBackgroundWrite::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	if (writer_ == nullptr) return inner_->Read(itemPos, itemOffset, size, data);
+	if (size <= 0) return 0;
+
+	// bytes still in the queue are read from there (RezItem::Save compares new data against what it just saved),
+	// the queue only has to be emptied first when a queued write holds just part of them
+	bool pending;
+	if (writer_->ReadQueued(itemPos + itemOffset, size, data, &pending)) return size;
+	if (pending) writer_->Wait();
+
+	std::lock_guard<std::mutex> lock(writer_->GetIoMutex());
+	return inner_->Read(itemPos, itemOffset, size, data);
+}
+
+unsigned long RezFileBackgroundWrite::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+
+	if (size <= 0) return 0;
+	if (writer_ == nullptr) return inner_->Write(itemPos, itemOffset, size, data);
+
+	// errors only show up once the write is made, Flush and Close report them
+	return writer_->Write(itemPos + itemOffset, size, data) ? size : 0;
+}
+
+bool RezFileBackgroundWrite::Open(const char* filename, bool readOnly, bool createNew)
+{
+	Close();
+
+	if (!inner_->Open(filename, readOnly, createNew)) return false;
+	if (readOnly) return true;
+
+	LT_MEM_TRACK_ALLOC(writer_ = new RezBackgroundWriter(inner_, maxQueued_), LT_MEM_TYPE_MISC);
+	assert(writer_ != nullptr);
+	return true;
+}
+
+bool RezFileBackgroundWrite::Close()
+{
+	bool ret = true;
+	if (writer_ != nullptr)
+	{
+		ret = writer_->Wait();
+		LT_MEM_TRACK_FREE(delete writer_);
+		writer_ = nullptr;
 	}
 
+	if (!inner_->Close()) ret = false;
+	return ret;
+}
+
+bool RezFileBackgroundWrite::Flush()
+{
+	if (writer_ == nullptr) return inner_->Flush();
+
+	bool ret = writer_->Wait();
+	std::lock_guard<std::mutex> lock(writer_->GetIoMutex());
+	if (!inner_->Flush()) ret = false;
 	return ret;
 }
 
+bool RezFileBackgroundWrite::VerifyFileOpen()
+{
+	if (writer_ == nullptr) return inner_->VerifyFileOpen();
+
+	writer_->Wait();
+	std::lock_guard<std::mutex> lock(writer_->GetIoMutex());
+	return inner_->VerifyFileOpen();
+}
+
+unsigned char* RezFileBackgroundWrite::MapData(RezPos itemPos, RezPos itemOffset, unsigned long size)
+{
+	if (writer_ != nullptr) writer_->Wait();
+	return inner_->MapData(itemPos, itemOffset, size);
+}
+
+bool RezFileBackgroundWrite::ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+									   RezReadCallback callback, void* userData)
+{
+	// Read does the waiting
+	if (writer_ != nullptr) return BaseRezFile::ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+	return inner_->ReadAsync(itemPos, itemOffset, size, data, callback, userData);
+}
+
+RezPos RezFileBackgroundWrite::GetFileSize()
+{
+	if (writer_ == nullptr) return inner_->GetFileSize();
+
+	writer_->Wait();
+	std::lock_guard<std::mutex> lock(writer_->GetIoMutex());
+	return inner_->GetFileSize();
+}
+
+unsigned long RezFileBackgroundWrite::ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	if (writer_ != nullptr) writer_->Wait();
+	return inner_->ReadDirect(itemPos, itemOffset, size, data);
+}
+
+bool RezFileBackgroundWrite::CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats)
+{
+	if (writer_ == nullptr) return inner_->CopyToFile(itemPos, itemOffset, size, filename, stats);
+
+	writer_->Wait();
+	std::lock_guard<std::mutex> lock(writer_->GetIoMutex());
+	return inner_->CopyToFile(itemPos, itemOffset, size, filename, stats);
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileDirectoryEmulation
+
+RezFileDirectoryEmulation::RezFileDirectoryEmulation(RezMgr* rezMgr, int maxOpenFiles) : BaseRezFile(rezMgr)
+{
+	assert(maxOpenFiles > 0);
+	numOpenFiles_ = 0;
+	maxOpenFiles_ = (maxOpenFiles > 0) ? maxOpenFiles : 1;
+	readOnly_     = true;
+	createNew_    = false;
+	memset(&handleStats_, 0, sizeof(handleStats_));
+}
+
+RezFileDirectoryEmulation::~RezFileDirectoryEmulation()
+{
+	RezFileSingleFile *it;
+
+	while ((it = openFiles_.GetFirst()) != nullptr)
+	{
+		delete it;
+	}
+
+	while ((it = closedFiles_.GetFirst()) != nullptr)
+	{
+		delete it;
+	}
+}
+
+unsigned long RezFileDirectoryEmulation::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(false && "this should never be called");
+	return 0;
+}
+
+unsigned long RezFileDirectoryEmulation::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(false && "this should never be called");
+	return 0;
+}
+
+bool RezFileDirectoryEmulation::Open(const char* filename, bool readOnly, bool createNew)
+{
+	readOnly_  = readOnly;
+	createNew_ = createNew;
+	return true;
+}
+
+bool RezFileDirectoryEmulation::Close()
+{
+	RezFileSingleFile* it;
+	while ((it = openFiles_.GetFirst()) != nullptr)
+	{
+		it->ReallyClose();
+	}
+	return true;
+}
+
+bool RezFileDirectoryEmulation::Flush()
+{
+	return true;
+}
+
+bool RezFileDirectoryEmulation::VerifyFileOpen()
+{
+	return true;
+}
+
+const char* RezFileDirectoryEmulation::GetFileName()
+{
+	return nullptr;
+}
+
+void RezFileDirectoryEmulation::GetHandleCacheStats(RezHandleCacheStats* stats)
+{
+	assert(stats != nullptr);
+	stats->numHits      += handleStats_.numHits;
+	stats->numMisses    += handleStats_.numMisses;
+	stats->numEvictions += handleStats_.numEvictions;
+	stats->numOpen      += (unsigned long)numOpenFiles_;
+}
+
+//------------------------------------------------------------------------------------------
+// RezFileSingleFile
+
+RezFileSingleFile::RezFileSingleFile(RezMgr* rezMgr, const char* filename, RezFileDirectoryEmulation* dirEmulation) : BaseRezFile(rezMgr)
+{
+	assert(filename != nullptr);
+	assert(dirEmulation != nullptr);
+
+	dirEmulation_ = dirEmulation;
+	file_ = nullptr;
+	created_ = false;
+
+	LT_MEM_TRACK_ALLOC(filename_ = new char[strlen(filename)+1], LT_MEM_TYPE_MISC);
+	assert(filename_ != nullptr);
+	strcpy(filename_, filename);
+
+	dirEmulation_->closedFiles_.Insert(this);
+}
+
+RezFileSingleFile::~RezFileSingleFile()
+{
+	if (file_ != nullptr) ReallyClose();
+	if (filename_ != nullptr) { LT_MEM_TRACK_FREE(delete [] filename_); }
+	dirEmulation_->closedFiles_.Delete(this);
+}
+
+unsigned long RezFileSingleFile::Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+	assert(dirEmulation_ != nullptr);
+
+	if (size <= 0) return 0;
+
+	// each file is an item of its own, so only the offset in it matters
+	if (!ReallyOpen()) return 0;
+	return file_->Read(0, itemOffset, size, data);
+}
+
+unsigned long RezFileSingleFile::Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data)
+{
+	assert(data != nullptr);
+	assert(dirEmulation_ != nullptr);
+	assert(dirEmulation_->readOnly_ != true);
+
+	if (size <= 0) return 0;
+
+	if (!ReallyOpen()) return 0;
+	return file_->Write(0, itemOffset, size, data);
+}
+
 bool RezFileSingleFile::Open(const char* filename, bool readOnly, bool createNew)
 {
 	assert(false && "this should never be called");
@@ -419,12 +3101,7 @@ bool RezFileSingleFile::Flush()
 	if (file_ == nullptr)
 		return true;
 
-	bool ret;
-	while ((ret = (fflush(file_) == 0)) == false)
-	{
-		if (!dirEmulation_->rezMgr_->DiskError()) return false;
-	}
-	return ret;
+	return file_->Flush();
 }
 
 bool RezFileSingleFile::VerifyFileOpen()
@@ -438,36 +3115,46 @@ bool RezFileSingleFile::ReallyOpen()
 	assert(filename_ != nullptr);
 	assert(dirEmulation_ != nullptr);
 	assert(dirEmulation_->rezMgr_ != nullptr);
-	
+
+	// an open file moves to the front on every use, so the one closed to make room is the least recently used
 	if (file_ != nullptr)
+	{
+		if (dirEmulation_->openFiles_.GetFirst() != this)
+		{
+			dirEmulation_->openFiles_.Delete(this);
+			dirEmulation_->openFiles_.InsertFirst(this);
+		}
+		++dirEmulation_->handleStats_.numHits;
 		return true;
+	}
 
-	// check if we need to close another file because we have too many open
-	if (dirEmulation_->numOpenFiles_ > dirEmulation_->maxOpenFiles_)
+	++dirEmulation_->handleStats_.numMisses;
+
+	if (dirEmulation_->createNew_ && dirEmulation_->readOnly_) return false;
+
+	// close the least recently used files until there is room for this one, a file that fails to close has
+	// still given up its handle so the next one along goes too if need be, the limit is never passed
+	while (dirEmulation_->numOpenFiles_ >= dirEmulation_->maxOpenFiles_)
 	{
 		RezFileSingleFile *oneFile = dirEmulation_->openFiles_.GetLast();
 		assert(oneFile != nullptr);
-		if (oneFile != nullptr) oneFile->ReallyClose();
+		if (oneFile == nullptr) return false;
+		oneFile->ReallyClose();
+		++dirEmulation_->handleStats_.numEvictions;
 	}
 
-	do
-	{
-		if (dirEmulation_->createNew_)
-		{
-			if (dirEmulation_->readOnly_) return false;
-			else file_ = fopen(filename_, "w+b");
-		}
-		else
-		{
-			if (dirEmulation_->readOnly_) file_ = fopen(filename_, "rb");
-			else file_ = fopen(filename_, "r+b");
-		}
+	LT_MEM_TRACK_ALLOC(file_ = new RezFilePositional(rezMgr_), LT_MEM_TYPE_MISC);
+	assert(file_ != nullptr);
+	if (file_ == nullptr) return false;
 
-		if (file_ == nullptr)
-		{
-			if (dirEmulation_->rezMgr_->DiskError()) return false;
-		}
-	} while (file_ == nullptr);
+	bool createNew = dirEmulation_->createNew_ && !created_;
+	if (!file_->Open(filename_, dirEmulation_->readOnly_, createNew))
+	{
+		LT_MEM_TRACK_FREE(delete file_);
+		file_ = nullptr;
+		return false;
+	}
+	if (createNew) created_ = true;
 
 	dirEmulation_->closedFiles_.Delete(this);
 	dirEmulation_->openFiles_.InsertFirst(this);
@@ -479,22 +3166,18 @@ bool RezFileSingleFile::ReallyOpen()
 bool RezFileSingleFile::ReallyClose()
 {
 	assert(dirEmulation_ != nullptr);
-	assert(dirEmulation_->rezMgr_ != nullptr);
 
 	if (file_ == nullptr)
-return true;
+		return true;
 
-	bool ret;
-	while ((ret = (fclose(file_) == 0)) == false)
-	{
-		if (!dirEmulation_->rezMgr_->DiskError()) return false;
-	}
+	bool ret = file_->Close();
+	LT_MEM_TRACK_FREE(delete file_);
+	file_ = nullptr;
 
 	dirEmulation_->numOpenFiles_ -= 1;
 	dirEmulation_->openFiles_.Delete(this);
 	dirEmulation_->closedFiles_.Insert(this);
 
-	file_ = nullptr;
 	return ret;
 }
 
@@ -3,13 +3,78 @@
 #include <stdio.h>
 #include "Common/BaseList.hpp"
 
-#define REZ_SEEKPOS_ERROR 0xFFFFFFFF
+// positions and sizes within a rez file, 64 bit so archives can be bigger than 4 GB
+typedef unsigned long long RezPos;
+
+#define REZ_SEEKPOS_ERROR ((RezPos)-1)
+#define REZ_MAX_V1_POS    0xFFFFFFFFULL   // largest position a version 1 rez file can hold
+
+#define kRezWriteCombineDefaultSize  (1024 * 1024)
+#define kRezMemoryFileName           "<memory>"   // name given to rez files opened with RezMgr::OpenMemory
 
 namespace JupiterEx { namespace RezMgr {
 
 class RezMgr;
 class BaseRezFile;
 class RezFileSingleFile;
+class RezAsyncEngine;
+class RezReadAheadEngine;
+class RezBlockCache;
+class RezDirectReader;
+class RezBackgroundWriter;
+
+// called when an asynchronous read finishes, bytesRead is 0 if the read failed
+typedef void (*RezReadCallback)(void* userData, unsigned long bytesRead);
+
+// read-ahead counters, RezMgr::GetReadAheadStats adds these up over all of its files
+struct RezReadAheadStats
+{
+	unsigned long long prefetchedBytes; // bytes read ahead of the caller
+	unsigned long long usedBytes;       // prefetched bytes later handed to a caller
+	unsigned long long wastedBytes;     // prefetched bytes thrown away without being used
+	unsigned long numPrefetches;        // number of background reads issued
+	unsigned long numHits;              // reads served (at least partly) from prefetched data
+	unsigned long numMisses;            // reads that had to go to the file for some of their data
+	unsigned long windowSize;           // largest current read-ahead window
+};
+
+// write counters, RezMgr::GetWriteStats adds these up over all of its files
+struct RezWriteStats
+{
+	unsigned long long bytesWritten;    // bytes handed to Write
+	unsigned long numWrites;            // Write calls made on the file
+	unsigned long numFileWrites;        // writes that reached the operating system (fwrite, pwrite or WriteFile)
+	unsigned long numFileSeeks;         // seeks that reached the operating system
+	unsigned long long bytesDeduplicated; // bytes RezItem::Save didn't write because they were already in the file (see RezMgr::SetDeduplicate)
+	unsigned long numDeduplicated;      // items saved that way
+	unsigned long long bytesPadding;    // zeroes RezItem::Save wrote to start items on a boundary (see RezMgr::SetItemAlignment)
+	unsigned long numAligned;           // items that were started on one
+};
+
+// handle cache counters for directory emulation, RezMgr::GetHandleCacheStats adds these up over all of its files
+struct RezHandleCacheStats
+{
+	unsigned long numHits;              // reads and writes that found their file already open
+	unsigned long numMisses;            // reads and writes that had to open their file
+	unsigned long numEvictions;         // files closed to make room for another one
+	unsigned long numOpen;              // files open right now
+};
+
+// one piece of a vectored read, see BaseRezFile::ReadV
+struct RezFileRead
+{
+	RezPos pos;            // file position of the first byte
+	unsigned long size;    // bytes wanted
+	void* data;            // where they go
+};
+
+// extraction counters, RezItem::CopyToFile adds into these
+struct RezCopyStats
+{
+	unsigned long long bytesCopied;       // bytes written to the new files
+	unsigned long long bytesKernelCopied; // the part of them the kernel copied without it coming through a buffer
+	unsigned long numFiles;               // files written
+};
 
 class BaseRezFileList : public Common::BaseList<BaseRezFile>
 {
@@ -28,16 +93,196 @@ public:
 	BaseRezFile(RezMgr* rezMgr);
 	virtual ~BaseRezFile();
 
-	virtual unsigned long Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) = 0;
-	virtual unsigned long Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) = 0;
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) = 0;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) = 0;
 	virtual bool Open(const char* filename, bool readOnly, bool createNew) = 0;
 	virtual bool Close() = 0;
 	virtual bool Flush() = 0;
 	virtual bool VerifyFileOpen() = 0;
 	virtual const char* GetFileName() = 0;
 
+	// returns a pointer straight into a read-only view of the file, or nullptr if this
+	// kind of file can't hand out direct pointers (callers must then fall back to Read)
+	virtual unsigned char* MapData(RezPos /*itemPos*/, RezPos /*itemOffset*/, unsigned long /*size*/) { return nullptr; }
+	virtual bool IsMapped() { return false; }
+
+	// queues a read and returns at once, callback is called (possibly from another thread) when it is done
+	// files without an asynchronous path just do the read right away and call back before returning
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData);
+
+	// size of the underlying file, 0 if this kind of file can't tell
+	virtual RezPos GetFileSize() { return 0; }
+
+	// reads past the page cache (O_DIRECT, FILE_FLAG_NO_BUFFERING or F_NOCACHE) through a second handle on
+	// GetFileName(), meant for very large items in read only files, anything that can't be read that way
+	// (file systems without direct I/O support for instance) is read with Read instead
+	virtual unsigned long ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data);
+
+	// fills several buffers from the file at once, reads must be sorted by pos. Pieces that are next to each other,
+	// or at most maxGap bytes apart, are read with one call, straight into the buffers on files with vectored
+	// positional reads (preadv) and into a buffer of their own that they are copied out of everywhere else (mapped
+	// files copy each piece out of the view). Adds the number of reads that reached the file to numFileReads
+	virtual bool ReadV(RezFileRead* reads, unsigned long numReads, unsigned long maxGap, unsigned long* numFileReads);
+
+	// writes size bytes of the file from itemPos + itemOffset into a new file called filename (replacing it if
+	// it is there), copied inside the kernel where the system and file allow it (copy_file_range, or sendfile
+	// on older Linux kernels) and through a bounded buffer everywhere else, adds what it did into stats if not null
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats);
+
+	// adds this file's read-ahead counters into stats, files without read-ahead add nothing
+	virtual void GetReadAheadStats(RezReadAheadStats* /*stats*/) { }
+
+	// adds this file's handle cache counters into stats, only directory emulation has one
+	virtual void GetHandleCacheStats(RezHandleCacheStats* /*stats*/) { }
+
+	// adds this file's write counters into stats
+	virtual void GetWriteStats(RezWriteStats* stats);
+
 protected:
 	RezMgr* rezMgr_;
+	RezWriteStats writeStats_;   // kept up to date by files that write
+
+private:
+	RezDirectReader* directReader_;
+	bool directTried_;
+};
+
+// Base for files that sit on top of another file and add something to it, everything is passed
+// through to the inner file by default. The layer owns the inner file and deletes it with itself.
+class RezFileLayer : public BaseRezFile
+{
+public:
+	RezFileLayer(RezMgr* rezMgr, BaseRezFile* inner);
+	virtual ~RezFileLayer();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual bool VerifyFileOpen() override;
+	virtual const char* GetFileName() override;
+	virtual unsigned char* MapData(RezPos itemPos, RezPos itemOffset, unsigned long size) override;
+	virtual bool IsMapped() override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+	virtual RezPos GetFileSize() override;
+	virtual unsigned long ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
+	virtual void GetReadAheadStats(RezReadAheadStats* stats) override;
+	virtual void GetWriteStats(RezWriteStats* stats) override;
+
+	BaseRezFile* GetInner() { return inner_; }
+
+protected:
+	BaseRezFile* inner_;
+};
+
+// Watches for reads that pick up where the last one stopped and, once a caller is reading sequentially,
+// reads the next window of the file on a background thread.  The window doubles each time a prefetch
+// gets used and halves each time one is thrown away mostly unused.  Only used for read only files.
+class RezFileReadAhead : public RezFileLayer
+{
+public:
+	RezFileReadAhead(RezMgr* rezMgr, BaseRezFile* inner, unsigned long minWindow, unsigned long maxWindow);
+	virtual ~RezFileReadAhead();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+	virtual void GetReadAheadStats(RezReadAheadStats* stats) override;
+
+private:
+	RezReadAheadEngine* engine_;
+	unsigned long minWindow_;
+	unsigned long maxWindow_;
+};
+
+// Sends small reads through the RezMgr's shared block cache so parsers that read a header and then seek
+// around inside a big item only go to the disk once per block.  Reads bigger than a few blocks (whole
+// item loads) go straight through so they don't push everything else out of the cache.
+class RezFileBlockCache : public RezFileLayer
+{
+public:
+	RezFileBlockCache(RezMgr* rezMgr, BaseRezFile* inner, RezBlockCache* cache);
+	virtual ~RezFileBlockCache();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+
+private:
+	RezBlockCache* cache_;
+	RezPos fileSize_;          // 0 if the file is not being cached
+};
+
+// Collects writes into one buffer for as long as each picks up where the last one stopped (or lands
+// inside what is buffered already) and hands them to the inner file in one big write, so the many
+// small writes of RezDir::WriteDirBlock cost a handful of seeks and writes instead of one of each per
+// field.  Anything that reads, maps or sizes the file writes out the buffer first.  Only used for files
+// opened for writing, and like RezFile only one thread may use it at a time.
+class RezFileWriteCombine : public RezFileLayer
+{
+public:
+	RezFileWriteCombine(RezMgr* rezMgr, BaseRezFile* inner, unsigned long bufferSize);
+	virtual ~RezFileWriteCombine();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual unsigned char* MapData(RezPos itemPos, RezPos itemOffset, unsigned long size) override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+	virtual RezPos GetFileSize() override;
+	virtual unsigned long ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
+	virtual void GetWriteStats(RezWriteStats* stats) override;
+
+private:
+	bool FlushBuffer();
+
+	unsigned char* buffer_;
+	unsigned long bufferSize_;
+	unsigned long bufferUsed_;  // bytes in buffer_ waiting to be written, 0 if none
+	RezPos bufferPos_;          // file position of the first byte in buffer_
+};
+
+// Copies every write into a queue and returns, a background thread hands them to the inner file one
+// at a time in the order they were made so callers saving items don't wait for the disk.  Anything
+// that reads, flushes, sizes or closes the file waits for the queue to empty first.  Write may be
+// called from several threads, and blocks once more than maxQueued bytes are waiting.  Only used for
+// files opened for writing.
+class RezFileBackgroundWrite : public RezFileLayer
+{
+public:
+	RezFileBackgroundWrite(RezMgr* rezMgr, BaseRezFile* inner, unsigned long maxQueued);
+	virtual ~RezFileBackgroundWrite();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual bool VerifyFileOpen() override;
+	virtual unsigned char* MapData(RezPos itemPos, RezPos itemOffset, unsigned long size) override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+	virtual RezPos GetFileSize() override;
+	virtual unsigned long ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
+
+private:
+	RezBackgroundWriter* writer_;
+	unsigned long maxQueued_;
 };
 
 class RezFile : public BaseRezFile
@@ -46,19 +291,155 @@ public:
 	RezFile(RezMgr* rezMgr);
 	virtual ~RezFile();
 
-	virtual unsigned long Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
-	virtual unsigned long Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
 	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
 	virtual bool Close() override;
 	virtual bool Flush() override;
 	virtual bool VerifyFileOpen() override;
 	virtual const char* GetFileName() override;
+	virtual RezPos GetFileSize() override;
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
 
 private:
 	FILE *file_;
 	char *filename_;
 	bool readOnly_;
-	unsigned long lastSeekPos_;
+	RezPos lastSeekPos_;   // where the stream is after the last read or write, REZ_SEEKPOS_ERROR if not known
+	bool lastWasWrite_;    // the stream needs a seek between a write and a read (or the other way around)
+};
+
+// Maps the whole file read-only, Read is a memcpy out of the view and MapData hands out
+// pointers into it so loaded items share the page cache instead of being copied to the heap.
+class RezFileMapped : public BaseRezFile
+{
+public:
+	RezFileMapped(RezMgr* rezMgr);
+	virtual ~RezFileMapped();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual bool VerifyFileOpen() override;
+	virtual const char* GetFileName() override;
+	virtual unsigned char* MapData(RezPos itemPos, RezPos itemOffset, unsigned long size) override;
+	virtual bool IsMapped() override { return (filename_ != nullptr); }
+	virtual RezPos GetFileSize() override { return viewSize_; }
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
+
+private:
+	char *filename_;
+	unsigned char *view_;
+	RezPos viewSize_;
+#if !defined(_WIN32)
+	int fd_;   // kept open for CopyToFile, the kernel copies from it instead of the data going through the view
+#endif
+};
+
+// The bytes of a rez file kept in memory, a RezFileMemory opened for writing grows it as it goes.  The
+// image belongs to the caller and outlives the RezMgr, so once that is closed the finished file can be
+// saved somewhere or opened again.
+class RezMemoryImage
+{
+public:
+	RezMemoryImage();
+	~RezMemoryImage();
+
+	unsigned char* GetData() { return data_; }
+	RezPos GetSize() { return size_; }
+	void Clear();
+
+private:
+	friend class RezFileMemory;
+
+	RezMemoryImage(const RezMemoryImage&);              // not copyable
+	RezMemoryImage& operator=(const RezMemoryImage&);
+
+	bool Grow(RezPos size);
+
+	unsigned char* data_;
+	RezPos size_;
+	RezPos capacity_;
+};
+
+// A rez file that lives in memory, either a caller's buffer opened read only (an archive embedded in
+// the executable for instance) which is never copied, or a RezMemoryImage that can also be written.
+// Read only files hand out pointers straight into the buffer through MapData like RezFileMapped.
+class RezFileMemory : public BaseRezFile
+{
+public:
+	RezFileMemory(RezMgr* rezMgr, const void* data, RezPos size);  // data must stay around until the file is closed
+	RezFileMemory(RezMgr* rezMgr, RezMemoryImage* image);
+	virtual ~RezFileMemory();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual bool VerifyFileOpen() override;
+	virtual const char* GetFileName() override;
+	virtual unsigned char* MapData(RezPos itemPos, RezPos itemOffset, unsigned long size) override;
+	virtual bool IsMapped() override { return opened_ && readOnly_; }
+	virtual RezPos GetFileSize() override;
+	virtual unsigned long ReadDirect(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+
+private:
+	const unsigned char* data_;   // the caller's buffer, nullptr when the file is an image
+	RezPos size_;
+	RezMemoryImage* image_;
+	bool opened_;
+	bool readOnly_;
+};
+
+// Reads and writes with positional I/O (pread/pwrite, or ReadFile/WriteFile with an explicit offset)
+// so there is no shared seek position, any number of threads may read through it at the same time.
+class RezFilePositional : public BaseRezFile
+{
+public:
+	RezFilePositional(RezMgr* rezMgr);
+	virtual ~RezFilePositional();
+
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool Flush() override;
+	virtual bool VerifyFileOpen() override;
+	virtual const char* GetFileName() override;
+	virtual RezPos GetFileSize() override;
+	virtual bool ReadV(RezFileRead* reads, unsigned long numReads, unsigned long maxGap, unsigned long* numFileReads) override;
+	virtual bool CopyToFile(RezPos itemPos, RezPos itemOffset, RezPos size, const char* filename, RezCopyStats* stats) override;
+
+protected:
+#if defined(_WIN32)
+	void* handle_;
+#else
+	int fd_;
+#endif
+	char *filename_;
+	bool readOnly_;
+};
+
+// Positional file that keeps many reads in flight at once, through io_uring where the kernel
+// supports it and through a small pool of reader threads everywhere else.
+class RezFileAsync : public RezFilePositional
+{
+public:
+	RezFileAsync(RezMgr* rezMgr);
+	virtual ~RezFileAsync();
+
+	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
+	virtual bool Close() override;
+	virtual bool ReadAsync(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data,
+						   RezReadCallback callback, void* userData) override;
+
+	bool IsUsingIoUring();
+
+private:
+	RezAsyncEngine* engine_;
 };
 
 class RezFileDirectoryEmulation : public BaseRezFile
@@ -67,23 +448,25 @@ public:
 	RezFileDirectoryEmulation(RezMgr* rezMgr, int maxOpenFiles);
 	virtual ~RezFileDirectoryEmulation();
 
-	virtual unsigned long Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
-	virtual unsigned long Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
 	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
 	virtual bool Close() override;
 	virtual bool Flush() override;
 	virtual bool VerifyFileOpen() override;
 	virtual const char* GetFileName() override;
+	virtual void GetHandleCacheStats(RezHandleCacheStats* stats) override;
 
 private:
 	friend class RezFileSingleFile;
 
-	RezFileSingleFileList openFiles_;
+	RezFileSingleFileList openFiles_;     // most recently used first, the last one is closed when room is needed
 	RezFileSingleFileList closedFiles_;
 	int numOpenFiles_;
 	int maxOpenFiles_;
 	bool readOnly_;
 	bool createNew_;
+	RezHandleCacheStats handleStats_;
 };
 
 class RezFileSingleFile : public BaseRezFile
@@ -92,8 +475,8 @@ public:
 	RezFileSingleFile(RezMgr *rezMgr, const char *filename, RezFileDirectoryEmulation *dirEmulation);
 	virtual ~RezFileSingleFile();
 
-	virtual unsigned long Read(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
-	virtual unsigned long Write(unsigned long itemPos, unsigned long itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Read(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
+	virtual unsigned long Write(RezPos itemPos, RezPos itemOffset, unsigned long size, void* data) override;
 	virtual bool Open(const char* filename, bool readOnly, bool createNew) override;
 	virtual bool Close() override;
 	virtual bool Flush() override;
@@ -106,7 +489,8 @@ private:
 	bool ReallyOpen();
 	bool ReallyClose();
 	char* filename_;
-	FILE* file_;
+	RezFilePositional* file_;   // only while the file is open
+	bool created_;              // a new file is only truncated the first time it is opened
 	RezFileDirectoryEmulation* dirEmulation_;
 };
 
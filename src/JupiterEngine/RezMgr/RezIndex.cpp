@@ -0,0 +1,159 @@
+#include "RezMgr/RezIndex.hpp"
+#include "Memory/Memory.hpp"
+
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+#define kRezIndexBucketSize  4            // keys to a displacement on average, fewer makes a bigger table that builds faster
+#define kRezIndexMaxTries    0xffffffff   // displacements tried for a bucket before giving up
+
+namespace JupiterEx { namespace RezMgr {
+
+// Hash and displace: each key's hash picks a bucket, and each bucket a displacement that sends all of its keys
+// to slots no other key has. Buckets are placed biggest first while there are plenty of free slots, so looking
+// a key up is two table reads and finding the displacements takes a few tries per bucket.
+
+static unsigned long long RezIndexMix(unsigned long long h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+// maps the top 32 bits of h onto 0 to range - 1 without a divide
+static unsigned long RezIndexRange(unsigned long long h, unsigned long range)
+{
+	return (unsigned long)(((h >> 32) * (unsigned long long)range) >> 32);
+}
+
+unsigned long long RezIndexHash(const char* path, size_t length, unsigned long typeId)
+{
+	assert((path != nullptr) || (length == 0));
+
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < length; ++i)
+	{
+		h ^= (unsigned char)toupper((unsigned char)path[i]);
+		h *= 0x100000001b3ULL;
+	}
+	return RezIndexMix(h ^ ((unsigned long long)typeId << 32) ^ length);
+}
+
+unsigned long RezIndexNumBuckets(unsigned long numKeys)
+{
+	return (numKeys + kRezIndexBucketSize - 1) / kRezIndexBucketSize + 1;
+}
+
+static unsigned long RezIndexBucket(unsigned long long hash, unsigned long numBuckets)
+{
+	return RezIndexRange(hash, numBuckets);
+}
+
+unsigned long RezIndexSlot(unsigned long long hash, const unsigned int* displacements, unsigned long numBuckets, unsigned long numKeys)
+{
+	assert(numKeys > 0);
+	unsigned int displacement = displacements[RezIndexBucket(hash, numBuckets)];
+	return RezIndexRange(RezIndexMix(hash + displacement * 0x9e3779b97f4a7c15ULL), numKeys);
+}
+
+bool RezIndexBuild(const unsigned long long* hashes, unsigned long numKeys, unsigned int* displacements, unsigned long* slots)
+{
+	assert((hashes != nullptr) || (numKeys == 0));
+	assert(displacements != nullptr);
+
+	unsigned long numBuckets = RezIndexNumBuckets(numKeys);
+	memset(displacements, 0, sizeof(unsigned int) * numBuckets);
+	if (numKeys == 0) return true;
+
+	// keys sorted by bucket (and by hash within one, so the same hash twice is easy to spot)
+	unsigned long* order;
+	unsigned char* used;
+	unsigned long* bucketOrder;
+	LT_MEM_TRACK_ALLOC(order = new unsigned long[numKeys], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(used = new unsigned char[numKeys], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(bucketOrder = new unsigned long[numBuckets + 1], LT_MEM_TYPE_MISC);
+	assert((order != nullptr) && (used != nullptr) && (bucketOrder != nullptr));
+
+	for (unsigned long i = 0; i < numKeys; ++i) order[i] = i;
+	std::sort(order, order + numKeys, [=](unsigned long a, unsigned long b)
+	{
+		unsigned long bucketA = RezIndexBucket(hashes[a], numBuckets);
+		unsigned long bucketB = RezIndexBucket(hashes[b], numBuckets);
+		return (bucketA != bucketB) ? (bucketA < bucketB) : (hashes[a] < hashes[b]);
+	});
+
+	bool retFlag = true;
+	for (unsigned long i = 1; i < numKeys; ++i)
+	{
+		if (hashes[order[i]] == hashes[order[i - 1]]) retFlag = false;
+	}
+
+	// where each bucket's keys start in order, then the buckets biggest first
+	unsigned long* bucketStart;
+	LT_MEM_TRACK_ALLOC(bucketStart = new unsigned long[numBuckets + 1], LT_MEM_TYPE_MISC);
+	assert(bucketStart != nullptr);
+	unsigned long k = 0;
+	for (unsigned long b = 0; b <= numBuckets; ++b)
+	{
+		while ((k < numKeys) && (RezIndexBucket(hashes[order[k]], numBuckets) < b)) ++k;
+		bucketStart[b] = k;
+	}
+	for (unsigned long b = 0; b < numBuckets; ++b) bucketOrder[b] = b;
+	std::stable_sort(bucketOrder, bucketOrder + numBuckets, [=](unsigned long a, unsigned long b)
+	{
+		return (bucketStart[a + 1] - bucketStart[a]) > (bucketStart[b + 1] - bucketStart[b]);
+	});
+
+	memset(used, 0, numKeys);
+	unsigned long bucketSlots[64];
+	for (unsigned long i = 0; retFlag && (i < numBuckets); ++i)
+	{
+		unsigned long b = bucketOrder[i];
+		unsigned long first = bucketStart[b];
+		unsigned long count = bucketStart[b + 1] - first;
+		if (count == 0) break;
+
+		// a bucket that big means the hashes are no good
+		if (count > sizeof(bucketSlots) / sizeof(bucketSlots[0]))
+		{
+			retFlag = false;
+			break;
+		}
+
+		bool placed = false;
+		for (unsigned long long d = 0; !placed && (d <= kRezIndexMaxTries); ++d)
+		{
+			displacements[b] = (unsigned int)d;
+			unsigned long numPlaced = 0;
+			while (numPlaced < count)
+			{
+				unsigned long slot = RezIndexSlot(hashes[order[first + numPlaced]], displacements, numBuckets, numKeys);
+				if (used[slot] != 0) break;
+				used[slot] = 1;
+				bucketSlots[numPlaced++] = slot;
+			}
+			placed = (numPlaced == count);
+
+			// take back the slots of a try that didn't work
+			if (!placed)
+			{
+				for (unsigned long j = 0; j < numPlaced; ++j) used[bucketSlots[j]] = 0;
+			}
+		}
+		if (!placed) retFlag = false;
+		for (unsigned long j = 0; placed && (j < count); ++j) slots[order[first + j]] = bucketSlots[j];
+	}
+
+	LT_MEM_TRACK_FREE(delete [] bucketStart);
+	LT_MEM_TRACK_FREE(delete [] bucketOrder);
+	LT_MEM_TRACK_FREE(delete [] used);
+	LT_MEM_TRACK_FREE(delete [] order);
+	return retFlag;
+}
+
+}}
\ No newline at end of file
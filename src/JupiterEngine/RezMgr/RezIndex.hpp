@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace JupiterEx { namespace RezMgr {
+
+// hash of a full path (directories and name joined by '\\', upper and lower case hash the same) and a type
+unsigned long long RezIndexHash(const char* path, size_t length, unsigned long typeId);
+
+// how many displacements RezIndexBuild needs for numKeys keys
+unsigned long RezIndexNumBuckets(unsigned long numKeys);
+
+// works out a minimal perfect hash of numKeys different hashes from RezIndexHash, every one of them goes to its own
+// slot from 0 to numKeys - 1. Fills in displacements (RezIndexNumBuckets of them) and the slot of each key.
+// Returns false if two of the hashes are the same.
+bool RezIndexBuild(const unsigned long long* hashes, unsigned long numKeys, unsigned int* displacements, unsigned long* slots);
+
+// the slot a hash goes to (only means anything for the keys the displacements were built from, anything
+// else lands on some slot that holds another key)
+unsigned long RezIndexSlot(unsigned long long hash, const unsigned int* displacements, unsigned long numBuckets, unsigned long numKeys);
+
+}}
\ No newline at end of file
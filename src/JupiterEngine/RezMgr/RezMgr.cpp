@@ -1,18 +1,44 @@
 #include "RezMgr/RezMgr.hpp"
+#include "RezMgr/RezIndex.hpp"
 #include "Memory/Memory.hpp"
 #include "Common/SafeString.hpp"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
-#include <io.h>
+#include <stdio.h>
+#include <ctype.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#define kRezEmulationMaxPath        4096          // longest path directory emulation copes with
+#define kRezEmulationDirBufferSize  (256 * 1024)  // getdents64 buffer for each directory being walked
+#define kRezChunkReadSize           (1024 * 1024) // most compressed chunks read in one go, see RezItem::ReadChunks
+#define kRezChecksumReadSize        (256 * 1024)  // pieces items being checked are read in, see RezReadFully
+#define kRezDosNameSize             (_MAX_FNAME+1+_MAX_EXT+1)  // longest name RezSplitDosName makes (including 0 terminator)
 
 namespace JupiterEx { namespace RezMgr {
 
-// file format data structures
+// file format data structures, version 1 has 32 bit positions and sizes and version 2 has 64 bit ones, version 3 is
+// version 2 with a path index
 #pragma pack(1)
 struct FileMainHeaderStruct
 {
@@ -25,19 +51,71 @@ struct FileMainHeaderStruct
 	char CR3;
 	char LF3;
 	char EOF1;
-	unsigned long FileFormatVersion;   // the file format verison number, only 1 is possible here right now
-	unsigned long RootDirPos;          // Position of the root directory struct in the file
-	unsigned long RootDirSize;         // Size of root directory
-	unsigned long RootDirTime;         // Time root dir was last updated
-	unsigned long NextWritePos;        // Position of first directory in the file
-	unsigned long Time;                // Time resource file was last updated
-	unsigned long LargestKeyAry;       // Size of the largest key array in the resource file
-	unsigned long LargestDirNameSize;  // Size of the largest directory name in the resource file (including 0 terminator)
-	unsigned long LargestRezNameSize;  // Size of the largest resource name in the resource file (include '\0')
-	unsigned long LargestCommentSize;  // Size of the largest comment in the resrouce file (include '\0')
+	unsigned int  FileFormatVersion;   // the file format verison number, 1 for this header
+	unsigned int  RootDirPos;          // Position of the root directory struct in the file
+	unsigned int  RootDirSize;         // Size of root directory
+	unsigned int  RootDirTime;         // Time root dir was last updated
+	unsigned int  NextWritePos;        // Position of first directory in the file
+	unsigned int  Time;                // Time resource file was last updated
+	unsigned int  LargestKeyAry;       // Size of the largest key array in the resource file
+	unsigned int  LargestDirNameSize;  // Size of the largest directory name in the resource file (including 0 terminator)
+	unsigned int  LargestRezNameSize;  // Size of the largest resource name in the resource file (include '\0')
+	unsigned int  LargestCommentSize;  // Size of the largest comment in the resrouce file (include '\0')
 	unsigned char IsSorted;
 };
 
+// same as FileMainHeaderStruct up to FileFormatVersion so the version can be read before knowing which one it is
+struct FileMainHeaderStructV2
+{
+	char CR1;
+	char LF1;
+	char FileType[RezMgrUserTitleSize];
+	char CR2;
+	char LF2;
+	char UserTitle[RezMgrUserTitleSize];
+	char CR3;
+	char LF3;
+	char EOF1;
+	unsigned int       FileFormatVersion;   // the file format verison number, 2 for this header
+	unsigned long long RootDirPos;          // Position of the root directory struct in the file
+	unsigned long long RootDirSize;         // Size of root directory
+	unsigned int       RootDirTime;         // Time root dir was last updated
+	unsigned long long NextWritePos;        // Position of first directory in the file
+	unsigned int       Time;                // Time resource file was last updated
+	unsigned int       LargestKeyAry;       // Size of the largest key array in the resource file
+	unsigned int       LargestDirNameSize;  // Size of the largest directory name in the resource file (including 0 terminator)
+	unsigned int       LargestRezNameSize;  // Size of the largest resource name in the resource file (include '\0')
+	unsigned int       LargestCommentSize;  // Size of the largest comment in the resrouce file (include '\0')
+	unsigned char      IsSorted;
+};
+
+// same as FileMainHeaderStructV2 with where the path index is after it, the directories are the version 2 ones
+struct FileMainHeaderStructV3
+{
+	char CR1;
+	char LF1;
+	char FileType[RezMgrUserTitleSize];
+	char CR2;
+	char LF2;
+	char UserTitle[RezMgrUserTitleSize];
+	char CR3;
+	char LF3;
+	char EOF1;
+	unsigned int       FileFormatVersion;   // the file format verison number, 3 for this header
+	unsigned long long RootDirPos;          // Position of the root directory struct in the file
+	unsigned long long RootDirSize;         // Size of root directory
+	unsigned int       RootDirTime;         // Time root dir was last updated
+	unsigned long long NextWritePos;        // Position of first directory in the file
+	unsigned int       Time;                // Time resource file was last updated
+	unsigned int       LargestKeyAry;       // Size of the largest key array in the resource file
+	unsigned int       LargestDirNameSize;  // Size of the largest directory name in the resource file (including 0 terminator)
+	unsigned int       LargestRezNameSize;  // Size of the largest resource name in the resource file (include '\0')
+	unsigned int       LargestCommentSize;  // Size of the largest comment in the resrouce file (include '\0')
+	unsigned char      IsSorted;
+	unsigned long long IndexPos;            // Position of the FileRezIndexHeader of the path index
+	unsigned long long IndexSize;           // Size of the whole path index
+};
+
 enum FileDirEntryType
 {
 	ResourceEntry  = 0,
@@ -46,49 +124,406 @@ enum FileDirEntryType
 
 struct FileDirEntryDirHeader
 {
-	unsigned long Pos;    // File position of dir entry
-	unsigned long Size;   // Size of directory data
-	unsigned long Time;   // Last time anything in directory was modified
+	unsigned int Pos;     // File position of dir entry
+	unsigned int Size;    // Size of directory data
+	unsigned int Time;    // Last time anything in directory was modified
 	// char Name[];       // Name of this directory
 };
 
 struct FileDirEntryRezHeader
 {
-	unsigned long Pos;       // File position of dir entry
-	unsigned long Size;      // Size of directory data
-	unsigned long Time;      // Last time this resource was modified
-	unsigned long ID;        // Resource ID number
-	unsigned long Type;      // Type of resource this is
-	unsigned long NumKeys;   // The number of keys to read in for this resource
+	unsigned int Pos;        // File position of dir entry
+	unsigned int Size;       // Size of directory data
+	unsigned int Time;       // Last time this resource was modified
+	unsigned int ID;         // Resource ID number
+	unsigned int Type;       // Type of resource this is
+	unsigned int NumKeys;    // The number of keys to read in for this resource
 	// char Name[];          // The name of this resource
 	// char Comment[];       // The comment data for this resource
-	// unsigned long Keys[]; // The key values for this resource
+	// unsigned int Keys[];  // The key values for this resource
+};
+
+struct FileDirEntryDirHeaderV2
+{
+	unsigned long long Pos;    // File position of dir entry
+	unsigned long long Size;   // Size of directory data
+	unsigned int       Time;   // Last time anything in directory was modified
+	// char Name[];            // Name of this directory
+};
+
+struct FileDirEntryRezHeaderV2
+{
+	unsigned long long Pos;        // File position of dir entry
+	unsigned long long Size;       // Size of directory data
+	unsigned int       Time;       // Last time this resource was modified
+	unsigned int       ID;         // Resource ID number
+	unsigned int       Type;       // Type of resource this is
+	unsigned int       NumKeys;    // The number of keys to read in for this resource
+	unsigned int       ExtraSize;  // Size of the extra records that follow
+	// FileRezExtraHeader Extra[]; // Tagged records with anything else known about this resource
+	// char Name[];                // The name of this resource
+	// char Comment[];             // The comment data for this resource
+	// unsigned int Keys[];        // The key values for this resource
+};
+
+// a record in the extra data of a version 2 resource entry, readers skip any tag they don't know
+struct FileRezExtraHeader
+{
+	unsigned int Tag;    // What the record holds
+	unsigned int Size;   // Size of the record data following this header
+};
+
+// tags of the extra records
+#define kRezExtraCompression  1   // FileRezExtraCompression, the entry's Size is what the compressed data takes in the file
+
+struct FileRezExtraCompression
+{
+	unsigned int       Codec;  // RezCodec the data is compressed with
+	unsigned long long Size;   // Size of the data once it is decompressed
+};
+
+#define kRezExtraChunks  2   // FileRezExtraChunks, the compressed data is in chunks that follow an index of where each starts
+
+struct FileRezExtraChunks
+{
+	unsigned int ChunkSize;    // Size of each chunk once it is decompressed (the last one may be smaller)
+};
+
+#define kRezExtraDictionary  3   // FileRezExtraDictionary, the data is compressed against a dictionary kept in another item
+
+struct FileRezExtraDictionary
+{
+	unsigned int Id;           // RezDictionaryId of the dictionary, its item is in the root directory named after this in hex
+};
+
+#define kRezExtraChecksum  4   // FileRezExtraChecksum, a checksum of the resource's data
+
+struct FileRezExtraChecksum
+{
+	unsigned int Crc32c;       // RezCrc32c of the data once it is decompressed
+};
+
+#define kRezExtraDelta  5   // FileRezExtraDelta, the data (once decompressed) is a RezDeltaEncode delta from the item of the same name in a file opened before
+
+struct FileRezExtraDelta
+{
+	unsigned long long Size;       // Size of the data once the delta is applied
+	unsigned long long BaseSize;   // Size of the item the delta is from
+	unsigned int       BaseCrc32c; // RezCrc32c of that item's data
+};
+
+// the path index (see RezMgr::SetPathIndex) starts on an 8 byte boundary and everything in it is fixed size and lines
+// up on its own size so it can be used where it is in a mapped file, offsets are from the start of the index
+#define kRezIndexMagic     0x58444e49   // "INDX"
+#define kRezIndexNoParent  0xffffffff   // the parent of the root directory
+
+struct FileRezIndexHeader
+{
+	unsigned int       Magic;           // kRezIndexMagic
+	unsigned int       NumItems;        // FileRezIndexItem entries, one for each slot of the perfect hash
+	unsigned int       NumDirs;         // FileRezIndexDir entries, the root directory first and every directory before the ones in it
+	unsigned int       NumBuckets;      // displacements of the perfect hash, see RezIndexBuild
+	unsigned long long DirsOffset;
+	unsigned long long ItemsOffset;
+	unsigned long long BucketsOffset;   // unsigned int displacements
+	unsigned long long StringsOffset;   // names and paths, each with a 0 after it
+	unsigned long long StringsSize;
+};
+
+struct FileRezIndexDir
+{
+	unsigned long long Pos;       // File position of the directory block
+	unsigned long long Size;      // Size of the directory block
+	unsigned int       Time;      // Last time anything in directory was modified
+	unsigned int       Parent;    // Entry of the directory this one is in, kRezIndexNoParent for the root
+	unsigned int       Name;      // Offset of the name in the strings
+	unsigned int       Pad;
+};
+
+// flags of an item in the path index
+#define kRezIndexChecksum  0x1   // Checksum holds a checksum of the data
+#define kRezIndexDelta     0x2   // the data is a delta, the Delta fields say what of
+
+struct FileRezIndexItem
+{
+	unsigned long long Pos;                // File position of the stored data
+	unsigned long long StoredSize;         // Size of the stored data
+	unsigned long long Size;               // Size of the data once it is decompressed
+	unsigned long long DeltaSize;          // FileRezExtraDelta
+	unsigned long long DeltaBaseSize;
+	unsigned int       DeltaBaseCrc32c;
+	unsigned int       Time;               // Last time this resource was modified
+	unsigned int       Type;               // Type of resource this is
+	unsigned int       Dir;                // Entry of the directory it is in
+	unsigned int       Path;               // Offset in the strings of the directories and name joined by '\\', what the perfect hash is of
+	unsigned int       PathLength;
+	unsigned int       NameLength;         // the name is the end of the path
+	unsigned int       Codec;              // FileRezExtraCompression, FileRezExtraChunks and FileRezExtraDictionary
+	unsigned int       ChunkSize;
+	unsigned int       DictionaryId;
+	unsigned int       Checksum;           // FileRezExtraChecksum
+	unsigned int       Flags;              // kRezIndexChecksum and kRezIndexDelta
 };
 
 struct FileDirEntryHeader
 {
-	unsigned long Type;
+	unsigned int Type;
 	union
 	{
-		FileDirEntryRezHeader Rez;
-		FileDirEntryDirHeader Dir;
+		FileDirEntryRezHeader   Rez;
+		FileDirEntryDirHeader   Dir;
+		FileDirEntryRezHeaderV2 RezV2;
+		FileDirEntryDirHeaderV2 DirV2;
 	};
 };
 #pragma pack()
 
+// reads the main header of any file format version into the version 3 layout, without a path index for the older ones
+static bool ReadMainHeader(BaseRezFile* rezFile, FileMainHeaderStructV3* header)
+{
+	FileMainHeaderStruct headerV1;
+	if (rezFile->Read(0, 0, sizeof(headerV1), &headerV1) != sizeof(headerV1)) return false;
+
+	assert(headerV1.CR1 == 0x0d);
+	assert(headerV1.LF2 == 0x0a);
+	assert(headerV1.EOF1 == 0x1a);
+	if (headerV1.CR1 != 0x0d) return false;
+	if (headerV1.LF2 != 0x0a) return false;
+	if (headerV1.EOF1 != 0x1a) return false;
+
+	header->IndexPos  = 0;
+	header->IndexSize = 0;
+	if (headerV1.FileFormatVersion == 3)
+	{
+		return (rezFile->Read(0, 0, sizeof(*header), header) == sizeof(*header));
+	}
+	if (headerV1.FileFormatVersion == 2)
+	{
+		return (rezFile->Read(0, 0, sizeof(FileMainHeaderStructV2), header) == sizeof(FileMainHeaderStructV2));
+	}
+	if (headerV1.FileFormatVersion != 1) return false;
+
+	memcpy(header, &headerV1, offsetof(FileMainHeaderStruct, FileFormatVersion));
+	header->FileFormatVersion  = headerV1.FileFormatVersion;
+	header->RootDirPos         = headerV1.RootDirPos;
+	header->RootDirSize        = headerV1.RootDirSize;
+	header->RootDirTime        = headerV1.RootDirTime;
+	header->NextWritePos       = headerV1.NextWritePos;
+	header->Time               = headerV1.Time;
+	header->LargestKeyAry      = headerV1.LargestKeyAry;
+	header->LargestDirNameSize = headerV1.LargestDirNameSize;
+	header->LargestRezNameSize = headerV1.LargestRezNameSize;
+	header->LargestCommentSize = headerV1.LargestCommentSize;
+	header->IsSorted           = headerV1.IsSorted;
+	return true;
+}
+
+// directory blocks are only byte aligned so values are copied out rather than dereferenced in place
+static unsigned long ReadU32(unsigned char*& curr)
+{
+	unsigned int val;
+	memcpy(&val, curr, sizeof(val));
+	curr += sizeof(val);
+	return val;
+}
+
+static RezPos ReadU64(unsigned char*& curr)
+{
+	unsigned long long val;
+	memcpy(&val, curr, sizeof(val));
+	curr += sizeof(val);
+	return val;
+}
+
+// steps over a nul terminated string that has to end before end, returns nullptr (leaving curr alone) if it doesn't
+static char* ReadString(unsigned char*& curr, unsigned char* end)
+{
+	unsigned char* nul = (unsigned char*)memchr(curr, 0, (size_t)(end - curr));
+	if (nul == nullptr) return nullptr;
+
+	char* str = (char*)curr;
+	curr = nul + 1;
+	return str;
+}
+
+// size of a name in a directory block, names are written with their 0 terminator and missing ones as just that
+static size_t DirEntryNameSize(const char* name)
+{
+	return (name == nullptr) ? 1 : strlen(name) + 1;
+}
+
+static void DirEntryAppend(unsigned char*& curr, const void* data, size_t size)
+{
+	memcpy(curr, data, size);
+	curr += size;
+}
+
+static void DirEntryAppendName(unsigned char*& curr, const char* name)
+{
+	if (name == nullptr) *curr++ = '\0';
+	else DirEntryAppend(curr, name, strlen(name) + 1);
+}
+
+static void RezStrUpr(char* s)
+{
+	for (; *s != '\0'; ++s) *s = (char)toupper((unsigned char)*s);
+}
+
+// a piece of RezMgr::ReadV on its way to the file that holds it
+struct RezPendingRead
+{
+	BaseRezFile* rezFile;
+	RezFileRead read;
+};
+
+// state carried through an asynchronous item load
+struct RezAsyncLoad
+{
+	RezItem*        rezItem;
+	unsigned char*  data;
+	RezLoadCallback callback;
+	void*           userData;
+};
+
+// largest transfer handed to a single BaseRezFile::Read or Write, bigger ones are split up
+// (the size of one call is an unsigned long which is only 32 bits on Windows)
+const unsigned long kRezMaxTransfer = 0x40000000;
+
+static bool RezFitsInMemory(RezPos size)
+{
+	return ((RezPos)(size_t)size == size);
+}
+
+// if checksum is not null the data is read a piece at a time and each piece is added to the checksum while it is still in the cache
+static bool RezReadFully(BaseRezFile* rezFile, RezPos itemPos, RezPos size, unsigned char* data, bool direct, unsigned int* checksum = nullptr)
+{
+	unsigned long maxLength = (checksum != nullptr) ? kRezChecksumReadSize : kRezMaxTransfer;
+	RezPos done = 0;
+	while (done < size)
+	{
+		unsigned long length = ((size - done) > maxLength) ? maxLength : (unsigned long)(size - done);
+		unsigned char* dest = data + (size_t)done;
+		unsigned long ret = direct ? rezFile->ReadDirect(itemPos, done, length, dest) : rezFile->Read(itemPos, done, length, dest);
+		if (ret != length) return false;
+		if (checksum != nullptr) *checksum = RezCrc32c(dest, length, *checksum);
+		done += length;
+	}
+	return true;
+}
+
+static bool RezWriteFully(BaseRezFile* rezFile, RezPos itemPos, RezPos size, unsigned char* data)
+{
+	RezPos done = 0;
+	while (done < size)
+	{
+		unsigned long length = ((size - done) > kRezMaxTransfer) ? kRezMaxTransfer : (unsigned long)(size - done);
+		if (rezFile->Write(itemPos, done, length, data + (size_t)done) != length) return false;
+		done += length;
+	}
+	return true;
+}
+
+// writes the gap in front of an aligned item rather than leaving a hole, so writes still follow on from each other
+static bool RezWriteZeros(BaseRezFile* rezFile, RezPos pos, RezPos size)
+{
+	static unsigned char zeros[kRezDefaultItemAlignment];
+	RezPos done = 0;
+	while (done < size)
+	{
+		unsigned long length = ((size - done) > sizeof(zeros)) ? (unsigned long)sizeof(zeros) : (unsigned long)(size - done);
+		if (rezFile->Write(pos, done, length, zeros) != length) return false;
+		done += length;
+	}
+	return true;
+}
+
+// the stored data of a chunked item starts with an index of where each chunk starts (and where the last one ends)
+// as 64 bit offsets from the start of the stored data, a chunk that is as big as its data is stored as is
+static RezPos RezChunkIndexSize(RezPos size, unsigned long chunkSize)
+{
+	return (((size + chunkSize - 1) / chunkSize) + 1) * sizeof(unsigned long long);
+}
+
+static RezPos RezCompressChunksBound(RezPos size, unsigned long chunkSize)
+{
+	return RezChunkIndexSize(size, chunkSize) + ((size + chunkSize - 1) / chunkSize) * RezCompressBound(chunkSize);
+}
+
+// compresses data a chunk at a time into dst, returns the stored size or 0 if it didn't get any smaller
+static RezPos RezCompressChunks(RezCodec codec, int level, unsigned long chunkSize, const unsigned char* data, RezPos size,
+								unsigned char* dst, RezPos dstCapacity, const unsigned char* dict, unsigned long dictSize)
+{
+	RezPos numChunks = (size + chunkSize - 1) / chunkSize;
+	RezPos storedPos = RezChunkIndexSize(size, chunkSize);
+	for (RezPos i = 0; i < numChunks; ++i)
+	{
+		memcpy(dst + (size_t)(i * sizeof(unsigned long long)), &storedPos, sizeof(storedPos));
+
+		RezPos chunkPos = i * chunkSize;
+		unsigned long chunkLength = ((size - chunkPos) > chunkSize) ? chunkSize : (unsigned long)(size - chunkPos);
+		if (storedPos + RezCompressBound(chunkLength) > dstCapacity) return 0;
+
+		size_t length = RezCompress(codec, level, data + (size_t)chunkPos, chunkLength, dst + (size_t)storedPos, (size_t)(dstCapacity - storedPos),
+									dict, dictSize);
+		if (length == 0)
+		{
+			memcpy(dst + (size_t)storedPos, data + (size_t)chunkPos, chunkLength);
+			length = chunkLength;
+		}
+		storedPos += length;
+	}
+	memcpy(dst + (size_t)(numChunks * sizeof(unsigned long long)), &storedPos, sizeof(storedPos));
+
+	return (storedPos < size) ? storedPos : 0;
+}
+
+// hash of an item's stored data that RezItem::Save looks for duplicates by
+static unsigned long long RezDataHash(const unsigned char* data, RezPos size)
+{
+	unsigned long long hash = 0x9e3779b97f4a7c15ULL ^ size;
+	RezPos i = 0;
+	for (; i + sizeof(unsigned long long) <= size; i += sizeof(unsigned long long))
+	{
+		unsigned long long val;
+		memcpy(&val, data + (size_t)i, sizeof(val));
+		hash ^= val * 0x87c37b91114253d5ULL;
+		hash = ((hash << 31) | (hash >> 33)) * 0x4cf5ad432745937fULL;
+	}
+	for (; i < size; ++i) hash = (hash ^ data[(size_t)i]) * 0x100000001b3ULL;
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// dictionaries are kept in the root directory in items named after their RezDictionaryId
+static void RezDictionaryName(unsigned int id, char* name)
+{
+	sprintf(name, "%08X", id);
+}
+
 //------------------------------------------------------------------------------------------
 // RezItem
 
 RezItem::RezItem()
 {
-	rezFile_   = nullptr;
-	parentDir_ = nullptr;
-	name_      = nullptr;
+	rezFile_    = nullptr;
+	parentDir_  = nullptr;
+	name_       = nullptr;
+	chunkIndex_ = nullptr;
+	dictionaryId_ = 0;
+	checksum_ = 0;
+	hasChecksum_ = false;
+	checksumVerified_ = false;
+	hasDelta_ = false;
+	deltaData_ = nullptr;
+	deltaBase_ = nullptr;
 	hashByName_.SetRezItem(this);
 }
 
 void RezItem::InitRezItem(RezDir* parentDir, const char* name, unsigned long id, RezType* type, const char* desc,
-					unsigned long size, unsigned long filePos, unsigned long time, unsigned long numKeys,
+					RezPos size, RezPos filePos, unsigned long time, unsigned long numKeys,
 					unsigned long* keyArray, BaseRezFile* rezFile)
 {
 	assert(parentDir != nullptr);
@@ -110,10 +545,25 @@ void RezItem::InitRezItem(RezDir* parentDir, const char* name, unsigned long id,
 	type_ = type;
 
 	size_ = size;
+	storedSize_ = size;
+	codec_ = RezCodecNone;
+	chunkSize_ = 0;
+	chunkIndex_ = nullptr;
+	dictionaryId_ = 0;
+	checksum_ = 0;
+	hasChecksum_ = false;
+	checksumVerified_ = false;
+	hasDelta_ = false;
+	deltaTargetSize_ = 0;
+	deltaBaseSize_ = 0;
+	deltaBaseChecksum_ = 0;
+	deltaData_ = nullptr;
+	deltaBase_ = nullptr;
 	filePos_ = filePos;
 	time_ = time;
 
 	data_ = nullptr;
+	dataMapped_ = false;
 	currPos_ = 0;
 
 	hashByName_.SetRezItem(this);
@@ -123,19 +573,21 @@ void RezItem::TermRezItem()
 {
 	if (name_ != nullptr) delete [] name_;
 
-	if (parentDir_ != nullptr)
+	// data_ never points into the directory's memBlock_ (compressed items loaded from one have their own copy)
+	if ((data_ != nullptr) && !dataMapped_)
 	{
-		if (parentDir_->memBlock_ == nullptr)
-		{
-			if (data_ != nullptr)
-			{
-				delete [] data_;
-			}
-		}
+		delete [] data_;
 	}
-	else if (data_ != nullptr)
+	if (chunkIndex_ != nullptr) delete [] chunkIndex_;
+
+	// an item that replaced its base from a patch owns the delta and the base
+	if (deltaData_ != nullptr)
 	{
-		delete [] data_;
+		RezMgr* rezMgr = parentDir_->rezMgr_;
+		deltaData_->TermRezItem();
+		rezMgr->DeAllocateRezItem(deltaData_);
+		deltaBase_->TermRezItem();
+		rezMgr->DeAllocateRezItem(deltaBase_);
 	}
 
 	name_ = nullptr;
@@ -143,7 +595,22 @@ void RezItem::TermRezItem()
 
 	time_ = 0;
 	size_ = 0;
+	storedSize_ = 0;
+	codec_ = RezCodecNone;
+	chunkSize_ = 0;
+	chunkIndex_ = nullptr;
+	dictionaryId_ = 0;
+	checksum_ = 0;
+	hasChecksum_ = false;
+	checksumVerified_ = false;
+	hasDelta_ = false;
+	deltaTargetSize_ = 0;
+	deltaBaseSize_ = 0;
+	deltaBaseChecksum_ = 0;
+	deltaData_ = nullptr;
+	deltaBase_ = nullptr;
 	data_ = nullptr;
+	dataMapped_ = false;
 
 	parentDir_ = nullptr;
 	filePos_ = 0;
@@ -207,10 +674,14 @@ unsigned char* RezItem::Load()
 	assert(parentDir_ != nullptr);
 	assert(rezFile_ != nullptr);
 
+	// an item from a patch is put together from the delta and the item it replaced
+	if (deltaData_ != nullptr) return LoadPatched();
+
 	// check if the whole directory is in memory already
-	if (parentDir_->memBlock_ != nullptr)
+	if ((parentDir_->memBlock_ != nullptr) && (codec_ == RezCodecNone))
 	{
-		return parentDir_->memBlock_ + filePos_ - parentDir_->itemsPos_;
+		unsigned char* data = parentDir_->memBlock_ + filePos_ - parentDir_->itemsPos_;
+		return VerifyLoaded(data) ? data : nullptr;
 	}
 
 	// check if the data is already in memory
@@ -218,27 +689,175 @@ unsigned char* RezItem::Load()
 
 	// allocate memory for the data
 	if (size_ == 0) return nullptr;
-	LT_MEM_TRACK_ALLOC(data_ = new unsigned char[size_], LT_MEM_TYPE_MISC);
+	if (!RezFitsInMemory(size_)) return nullptr;
+
+	// compressed data is decompressed into memory of its own
+	if (codec_ != RezCodecNone)
+	{
+		LT_MEM_TRACK_ALLOC(data_ = new unsigned char[(size_t)size_], LT_MEM_TYPE_MISC);
+		assert(data_ != nullptr);
+		if (data_ == nullptr) return nullptr;
+
+		if (!ReadCompressed(data_) || !VerifyLoaded(data_))
+		{
+			LT_MEM_TRACK_FREE(delete [] data_);
+			data_ = nullptr;
+		}
+		return data_;
+	}
+
+	// if the file is mapped just point straight into the view, nothing gets copied
+	// (unless the item is big enough that it should stay out of the page cache)
+	bool direct = UseDirectIO();
+	if (!direct && ((RezPos)(unsigned long)size_ == size_))
+	{
+		data_ = rezFile_->MapData(filePos_, 0, (unsigned long)size_);
+		if (data_ != nullptr)
+		{
+			if (!VerifyLoaded(data_))
+			{
+				data_ = nullptr;
+				return nullptr;
+			}
+			dataMapped_ = true;
+			return data_;
+		}
+	}
+
+	LT_MEM_TRACK_ALLOC(data_ = new unsigned char[(size_t)size_], LT_MEM_TYPE_MISC);
 	assert(data_ != nullptr);
 	if (data_ == nullptr) return nullptr;
 
 	// load in the data from disk
 	assert(parentDir_->rezMgr_ != nullptr);
-	if (rezFile_->Read(filePos_, 0, size_, data_) != size_)
+	bool verify = MustVerify();
+	unsigned int checksum = 0;
+	if (!RezReadFully(rezFile_, filePos_, size_, data_, direct, verify ? &checksum : nullptr) || (verify && !CountVerified(checksum)))
 	{
-		delete [] data_;
+		LT_MEM_TRACK_FREE(delete [] data_);
 		data_ = nullptr;
 	}
 
 	return data_;
 }
 
+unsigned char* RezItem::LoadPatched()
+{
+	assert(deltaData_ != nullptr);
+	assert(deltaBase_ != nullptr);
+
+	if (data_ != nullptr) return data_;
+	if (size_ == 0) return nullptr;
+	if (!RezFitsInMemory(size_)) return nullptr;
+
+	// the delta and the base are only needed while the data is put together (but the base
+	// is left alone if it was loaded before the patch was opened and is still in use)
+	bool baseLoaded = deltaBase_->IsLoaded();
+	const unsigned char* delta = deltaData_->Load();
+	const unsigned char* base = deltaBase_->Load();
+
+	// the patch has to be for the data that is actually there
+	bool retFlag = (delta != nullptr) && (base != nullptr) && (deltaBase_->size_ == deltaData_->deltaBaseSize_);
+	if (retFlag)
+	{
+		unsigned int baseChecksum = deltaBase_->hasChecksum_ ? deltaBase_->checksum_ : RezCrc32c(base, (size_t)deltaBase_->size_);
+		retFlag = (baseChecksum == deltaData_->deltaBaseChecksum_);
+	}
+
+	if (retFlag)
+	{
+		LT_MEM_TRACK_ALLOC(data_ = new unsigned char[(size_t)size_], LT_MEM_TYPE_MISC);
+		assert(data_ != nullptr);
+		retFlag = (data_ != nullptr) && RezDeltaApply(base, (size_t)deltaBase_->size_, delta, (size_t)deltaData_->size_, data_, (size_t)size_);
+		if (!retFlag && (data_ != nullptr))
+		{
+			LT_MEM_TRACK_FREE(delete [] data_);
+			data_ = nullptr;
+		}
+	}
+
+	deltaData_->UnLoad();
+	if (!baseLoaded) deltaBase_->UnLoad();
+	return data_;
+}
+
+bool RezItem::LoadAsync(RezLoadCallback callback, void* userData)
+{
+	assert(parentDir_ != nullptr);
+	assert(rezFile_ != nullptr);
+	assert(callback != nullptr);
+
+	// anything already in memory (or mapped) is done right away on this thread, as is anything
+	// too big to go out as a single request and anything that has to be decompressed or patched
+	if ((parentDir_->memBlock_ != nullptr) || (data_ != nullptr) || (size_ == 0) || rezFile_->IsMapped() || (size_ > kRezMaxTransfer) ||
+		(codec_ != RezCodecNone) || (deltaData_ != nullptr))
+	{
+		callback(this, Load(), userData);
+		return true;
+	}
+
+	RezAsyncLoad* load;
+	LT_MEM_TRACK_ALLOC(load = new RezAsyncLoad, LT_MEM_TYPE_MISC);
+	assert(load != nullptr);
+	if (load == nullptr) return false;
+
+	LT_MEM_TRACK_ALLOC(load->data = new unsigned char[(size_t)size_], LT_MEM_TYPE_MISC);
+	assert(load->data != nullptr);
+	if (load->data == nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete load);
+		return false;
+	}
+	load->rezItem  = this;
+	load->callback = callback;
+	load->userData = userData;
+
+	RezMgr* rezMgr = parentDir_->rezMgr_;
+	rezMgr->BeginAsyncLoad();
+	if (!rezFile_->ReadAsync(filePos_, 0, (unsigned long)size_, load->data, &RezItem::OnAsyncLoadDone, load))
+	{
+		LT_MEM_TRACK_FREE(delete [] load->data);
+		LT_MEM_TRACK_FREE(delete load);
+		rezMgr->EndAsyncLoad();
+		return false;
+	}
+
+	return true;
+}
+
+void RezItem::OnAsyncLoadDone(void* userData, unsigned long bytesRead)
+{
+	RezAsyncLoad* load = (RezAsyncLoad*)userData;
+	RezItem* rezItem = load->rezItem;
+	RezMgr* rezMgr = rezItem->parentDir_->rezMgr_;
+
+	unsigned char* data = nullptr;
+	if ((bytesRead == rezItem->size_) && rezItem->VerifyLoaded(load->data))
+	{
+		// the same item may have been loaded twice at once, the first one to finish wins
+		std::lock_guard<std::mutex> lock(rezMgr->asyncMutex_);
+		if (rezItem->data_ == nullptr)
+		{
+			rezItem->data_ = load->data;
+			load->data = nullptr;
+		}
+		data = rezItem->data_;
+	}
+
+	if (load->data != nullptr) LT_MEM_TRACK_FREE(delete [] load->data);
+	load->callback(rezItem, data, load->userData);
+	LT_MEM_TRACK_FREE(delete load);
+
+	rezMgr->EndAsyncLoad();
+}
+
 bool RezItem::UnLoad()
 {
 	if (data_ != nullptr)
 	{
-		delete [] data_;
+		if (!dataMapped_) delete [] data_;
 		data_ = nullptr;
+		dataMapped_ = false;
 	}
 	return true;
 }
@@ -246,16 +865,27 @@ bool RezItem::UnLoad()
 bool RezItem::IsLoaded()
 {
 	assert(parentDir_ != nullptr);
-	if (parentDir_->memBlock_ != nullptr) return true;
+	if ((parentDir_->memBlock_ != nullptr) && (codec_ == RezCodecNone)) return true;
 	else return (data_ != nullptr);
 }
 
 bool RezItem::Get(unsigned char* bytes)
 {
-	return (Get(bytes, 0, size_));
+	// a compressed item that isn't in memory is decompressed straight into bytes
+	if ((codec_ != RezCodecNone) && (data_ == nullptr)) return ReadCompressed(bytes);
+
+	// items too big for one Get are copied a piece at a time
+	RezPos offset = 0;
+	while (offset < size_)
+	{
+		unsigned long length = ((size_ - offset) > kRezMaxTransfer) ? kRezMaxTransfer : (unsigned long)(size_ - offset);
+		if (!Get(bytes + (size_t)offset, offset, length)) return false;
+		offset += length;
+	}
+	return true;
 }
 
-bool RezItem::Get(unsigned char* bytes, unsigned long startOffset, unsigned long length)
+bool RezItem::Get(unsigned char* bytes, RezPos startOffset, unsigned long length)
 {
 	assert(parentDir_ != nullptr);
 	assert(rezFile_ != nullptr);
@@ -264,22 +894,28 @@ bool RezItem::Get(unsigned char* bytes, unsigned long startOffset, unsigned long
 	assert(length <= size_ - startOffset);
 
 	// Check if the whole directory is in memory already and just copy it if it is
-	if (parentDir_->memBlock_ != nullptr)
+	if ((parentDir_->memBlock_ != nullptr) && (codec_ == RezCodecNone))
 	{
-		memcpy(bytes, parentDir_->memBlock_ + filePos_ + startOffset - parentDir_->itemsPos_, length);
+		memcpy(bytes, parentDir_->memBlock_ + (size_t)(filePos_ + startOffset - parentDir_->itemsPos_), length);
 		return true;
 	}
 
-	// Check if this resource is in memory already and just copy it if so
-	if (data_ != nullptr)
+	// Check if this resource is in memory already and just copy it if so (data compressed whole can
+	// only be decompressed whole so reading any part of it loads all of it)
+	if ((data_ != nullptr) || (MustLoadWhole() && (Load() != nullptr)))
 	{
-		memcpy(bytes, data_ + startOffset, length);
+		memcpy(bytes, data_ + (size_t)startOffset, length);
 		return true;
 	}
 
+	// chunked data only needs the chunks the range overlaps (and what is left is stored as is)
+	if (MustLoadWhole()) return false;
+	if (codec_ != RezCodecNone) return ReadChunks(bytes, startOffset, length);
+
 	// Load this part of the resource from disk
 	assert(parentDir_->rezMgr_ != nullptr);
-	if (rezFile_->Read(filePos_, startOffset, length, bytes) != length)
+	unsigned long ret = UseDirectIO() ? rezFile_->ReadDirect(filePos_, startOffset, length, bytes) : rezFile_->Read(filePos_, startOffset, length, bytes);
+	if (ret != length)
 	{
 		return false;
 	}
@@ -287,49 +923,411 @@ bool RezItem::Get(unsigned char* bytes, unsigned long startOffset, unsigned long
 	return true;
 }
 
-bool RezItem::Seek(unsigned long offset)
+bool RezItem::Seek(RezPos offset)
 {
 	currPos_ = offset;
 	return true;
 }
 
-unsigned long RezItem::Read(unsigned char* bytes, unsigned long length, unsigned long seekPos)
+unsigned long RezItem::Read(unsigned char* bytes, unsigned long length, RezPos seekPos)
+{
+	return ReadData(bytes, length, seekPos, UseDirectIO());
+}
+
+unsigned long RezItem::ReadDirect(unsigned char* bytes, unsigned long length, RezPos seekPos)
+{
+	return ReadData(bytes, length, seekPos, true);
+}
+
+bool RezItem::ReadV(RezItemRead* reads, unsigned long numReads)
 {
 	assert(parentDir_ != nullptr);
-	assert(bytes != nullptr);
-	assert(rezFile_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+	assert((reads != nullptr) || (numReads == 0));
 
-	// do seek if necessary
-	if (seekPos != REZ_SEEKPOS_ERROR) Seek(seekPos);
+	for (unsigned long i = 0; i < numReads; ++i) reads[i].rezItem = this;
+	return parentDir_->rezMgr_->ReadV(reads, numReads);
+}
 
-	// check if we are already past the end of the file
-	if (currPos_ > size_) return 0;
+bool RezItem::CopyToFile(const char* filename, RezCopyStats* stats)
+{
+	assert(parentDir_ != nullptr);
+	assert(rezFile_ != nullptr);
+	assert(filename != nullptr);
 
-	// truncate length if necessary
-	if ((length + currPos_) > size_) length = size_ - currPos_;
+	// data that is already in memory (and items that are empty) is written straight out, compressed (or
+	// patched) data has to be made on the way so it is streamed through memory and can't go through the kernel
+	unsigned char* memoryData = GetMemoryData();
+	if ((memoryData == nullptr) && (size_ > 0) && (codec_ == RezCodecNone) && (deltaData_ == nullptr)) return rezFile_->CopyToFile(filePos_, 0, size_, filename, stats);
 
-	// if length is zero just return
-	if (length <= 0) return 0;
+	FILE* fp = fopen(filename, "wb");
+	if (fp == nullptr) return false;
 
-	// Check if the whole directory is in memory already and just copy it if it is
-	if (parentDir_->memBlock_ != nullptr)
+	bool retFlag = true;
+	if ((memoryData != nullptr) || (size_ == 0))
 	{
-		memcpy(bytes, parentDir_->memBlock_ + filePos_ + currPos_ - parentDir_->itemsPos_, length);
-		currPos_ += length;
-		return length;
+		retFlag = (size_ == 0) || (fwrite(memoryData, 1, (size_t)size_, fp) == size_);
 	}
-
-	// Check if this resource is in memory already and just copy it if so
-	if (data_ != nullptr)
+	else
+	{
+		RezItemStream stream(this);
+		unsigned long length;
+		const unsigned char* chunk;
+		while (retFlag && ((chunk = stream.NextChunk(&length)) != nullptr)) retFlag = (fwrite(chunk, 1, length, fp) == length);
+		if (stream.Failed() || !stream.EndOfStream()) retFlag = false;
+
+		// data compressed whole (or patched) was loaded by the stream
+		if (MustLoadWhole()) UnLoad();
+	}
+	if (fclose(fp) != 0) retFlag = false;
+
+	if (retFlag && (stats != nullptr))
+	{
+		stats->bytesCopied += size_;
+		++stats->numFiles;
+	}
+	return retFlag;
+}
+
+unsigned char* RezItem::GetMemoryData()
+{
+	assert(parentDir_ != nullptr);
+	if ((parentDir_->memBlock_ != nullptr) && (codec_ == RezCodecNone)) return parentDir_->memBlock_ + (size_t)(filePos_ - parentDir_->itemsPos_);
+	return data_;
+}
+
+bool RezItem::ReadCompressed(unsigned char* bytes)
+{
+	assert(parentDir_ != nullptr);
+	assert(rezFile_ != nullptr);
+	assert(codec_ != RezCodecNone);
+
+	// chunked data is decompressed a piece at a time so it never has to be read in all at once
+	if (chunkSize_ > 0)
+	{
+		RezPos offset = 0;
+		while (offset < size_)
+		{
+			unsigned long length = ((size_ - offset) > kRezMaxTransfer) ? kRezMaxTransfer : (unsigned long)(size_ - offset);
+			if (!ReadChunks(bytes + (size_t)offset, offset, length)) return false;
+			offset += length;
+		}
+		return true;
+	}
+
+	// Save only compresses whole items that fit in a single transfer
+	if ((size_ > kRezMaxTransfer) || (storedSize_ > kRezMaxTransfer)) return false;
+
+	// the compressed data is used where it is if the directory is in memory or the file is mapped
+	unsigned char* buf = nullptr;
+	const unsigned char* stored = GetStoredData(0, (unsigned long)storedSize_);
+	if (stored == nullptr)
+	{
+		LT_MEM_TRACK_ALLOC(buf = new unsigned char[(size_t)storedSize_], LT_MEM_TYPE_MISC);
+		assert(buf != nullptr);
+		if (buf == nullptr) return false;
+
+		if (!RezReadFully(rezFile_, filePos_, storedSize_, buf, false))
+		{
+			LT_MEM_TRACK_FREE(delete [] buf);
+			return false;
+		}
+		stored = buf;
+	}
+
+	bool ret = Decompress(codec_, stored, (size_t)storedSize_, bytes, (size_t)size_);
+	assert(ret);
+
+	if (buf != nullptr) LT_MEM_TRACK_FREE(delete [] buf);
+	return ret;
+}
+
+bool RezItem::ReadChunks(unsigned char* bytes, RezPos startOffset, unsigned long length)
+{
+	assert(chunkSize_ > 0);
+	assert(length > 0);
+
+	if (!LoadChunkIndex()) return false;
+
+	RezPos first = startOffset / chunkSize_;
+	RezPos last  = (startOffset + length - 1) / chunkSize_;
+	RezPos endOffset = startOffset + length;
+
+	unsigned char* buf = nullptr;      // compressed chunks that had to be read
+	unsigned long bufSize = 0;
+	unsigned char* chunk = nullptr;    // a chunk only part of which is wanted
+	bool retFlag = true;
+
+	RezPos i = first;
+	while (retFlag && (i <= last))
+	{
+		// the chunks are next to each other in the file so as many as fit in kRezChunkReadSize are read at once
+		RezPos groupEnd = i + 1;
+		while ((groupEnd <= last) && (chunkIndex_[groupEnd + 1] - chunkIndex_[i] <= kRezChunkReadSize)) ++groupEnd;
+
+		RezPos storedPos = chunkIndex_[i];
+		unsigned long storedLength = (unsigned long)(chunkIndex_[groupEnd] - storedPos);
+		const unsigned char* stored = GetStoredData(storedPos, storedLength);
+		if (stored == nullptr)
+		{
+			if (storedLength > bufSize)
+			{
+				if (buf != nullptr) LT_MEM_TRACK_FREE(delete [] buf);
+				LT_MEM_TRACK_ALLOC(buf = new unsigned char[storedLength], LT_MEM_TYPE_MISC);
+				assert(buf != nullptr);
+				bufSize = (buf != nullptr) ? storedLength : 0;
+			}
+
+			unsigned long ret = 0;
+			if (buf != nullptr) ret = UseDirectIO() ? rezFile_->ReadDirect(filePos_, storedPos, storedLength, buf) : rezFile_->Read(filePos_, storedPos, storedLength, buf);
+			if (ret != storedLength)
+			{
+				retFlag = false;
+				break;
+			}
+			stored = buf;
+		}
+
+		for (; retFlag && (i < groupEnd); ++i)
+		{
+			RezPos chunkPos = i * chunkSize_;
+			unsigned long chunkLength = ((size_ - chunkPos) > chunkSize_) ? chunkSize_ : (unsigned long)(size_ - chunkPos);
+			const unsigned char* src = stored + (size_t)(chunkIndex_[i] - storedPos);
+			unsigned long srcLength = (unsigned long)(chunkIndex_[i + 1] - chunkIndex_[i]);
+			RezCodec codec = (srcLength == chunkLength) ? RezCodecNone : codec_;
+
+			// chunks wanted whole are decompressed straight into bytes
+			RezPos from = (startOffset > chunkPos) ? startOffset : chunkPos;
+			RezPos to = (endOffset < chunkPos + chunkLength) ? endOffset : chunkPos + chunkLength;
+			if ((from == chunkPos) && (to == chunkPos + chunkLength))
+			{
+				retFlag = Decompress(codec, src, srcLength, bytes + (size_t)(chunkPos - startOffset), chunkLength);
+				continue;
+			}
+
+			if (chunk == nullptr)
+			{
+				LT_MEM_TRACK_ALLOC(chunk = new unsigned char[chunkSize_], LT_MEM_TYPE_MISC);
+				assert(chunk != nullptr);
+				if (chunk == nullptr)
+				{
+					retFlag = false;
+					break;
+				}
+			}
+			retFlag = Decompress(codec, src, srcLength, chunk, chunkLength);
+			if (retFlag) memcpy(bytes + (size_t)(from - startOffset), chunk + (size_t)(from - chunkPos), (size_t)(to - from));
+		}
+	}
+	assert(retFlag);
+
+	if (buf != nullptr) LT_MEM_TRACK_FREE(delete [] buf);
+	if (chunk != nullptr) LT_MEM_TRACK_FREE(delete [] chunk);
+	return retFlag;
+}
+
+bool RezItem::DecompressStored(const unsigned char* stored, unsigned char* bytes)
+{
+	if (chunkSize_ == 0) return Decompress(codec_, stored, (size_t)storedSize_, bytes, (size_t)size_);
+
+	RezPos numChunks = (size_ + chunkSize_ - 1) / chunkSize_;
+	for (RezPos i = 0; i < numChunks; ++i)
+	{
+		unsigned long long offsets[2];
+		memcpy(offsets, stored + (size_t)(i * sizeof(unsigned long long)), sizeof(offsets));
+		if ((offsets[0] > offsets[1]) || (offsets[1] > storedSize_)) return false;
+
+		RezPos chunkPos = i * chunkSize_;
+		unsigned long chunkLength = ((size_ - chunkPos) > chunkSize_) ? chunkSize_ : (unsigned long)(size_ - chunkPos);
+		unsigned long srcLength = (unsigned long)(offsets[1] - offsets[0]);
+		RezCodec codec = (srcLength == chunkLength) ? RezCodecNone : codec_;
+		if (!Decompress(codec, stored + (size_t)offsets[0], srcLength, bytes + (size_t)chunkPos, chunkLength)) return false;
+	}
+	return true;
+}
+
+bool RezItem::Decompress(RezCodec codec, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize)
+{
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+
+	// raw chunks of a chunked item don't need the dictionary
+	const unsigned char* dict = nullptr;
+	unsigned long dictSize = 0;
+	if ((codec != RezCodecNone) && (dictionaryId_ != 0) && !parentDir_->rezMgr_->GetDictionary(dictionaryId_, &dict, &dictSize)) return false;
+
+	return RezDecompress(codec, src, srcSize, dst, dstSize, dict, dictSize);
+}
+
+bool RezItem::LoadChunkIndex()
+{
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+	assert(chunkSize_ > 0);
+
+	// several threads may be reading parts of the same item
+	std::lock_guard<std::mutex> lock(parentDir_->rezMgr_->chunkIndexMutex_);
+	if (chunkIndex_ != nullptr) return true;
+
+	RezPos numChunks = (size_ + chunkSize_ - 1) / chunkSize_;
+	RezPos indexSize = RezChunkIndexSize(size_, chunkSize_);
+	if ((indexSize > storedSize_) || (indexSize > kRezMaxTransfer)) return false;
+
+	RezPos* index;
+	LT_MEM_TRACK_ALLOC(index = new RezPos[(size_t)numChunks + 1], LT_MEM_TYPE_MISC);
+	assert(index != nullptr);
+	if (index == nullptr) return false;
+
+	const unsigned char* stored = GetStoredData(0, (unsigned long)indexSize);
+	bool retFlag;
+	if (stored != nullptr)
+	{
+		memcpy(index, stored, (size_t)indexSize);
+		retFlag = true;
+	}
+	else
+	{
+		retFlag = (rezFile_->Read(filePos_, 0, (unsigned long)indexSize, index) == indexSize);
+	}
+
+	// the chunks must follow the index in order and end at the end of the stored data
+	if (retFlag && ((index[0] != indexSize) || (index[numChunks] != storedSize_))) retFlag = false;
+	for (RezPos i = 0; retFlag && (i < numChunks); ++i)
+	{
+		if ((index[i + 1] < index[i]) || (index[i + 1] - index[i] > RezCompressBound(chunkSize_))) retFlag = false;
+	}
+	assert(retFlag);
+
+	if (!retFlag)
+	{
+		LT_MEM_TRACK_FREE(delete [] index);
+		return false;
+	}
+
+	chunkIndex_ = index;
+	return true;
+}
+
+const unsigned char* RezItem::GetStoredData(RezPos storedOffset, unsigned long length)
+{
+	assert(parentDir_ != nullptr);
+	assert(rezFile_ != nullptr);
+
+	if (parentDir_->memBlock_ != nullptr) return parentDir_->memBlock_ + (size_t)(filePos_ + storedOffset - parentDir_->itemsPos_);
+	return rezFile_->MapData(filePos_, storedOffset, length);
+}
+
+bool RezItem::VerifyChecksum()
+{
+	assert(parentDir_ != nullptr);
+
+	// a patched item is as good as the delta and the item it was made from
+	if (deltaData_ != nullptr) return deltaData_->VerifyChecksum() && deltaBase_->VerifyChecksum();
+	if (!hasChecksum_) return true;
+
+	// anything not already in memory is streamed through so even items too big to load can be checked
+	unsigned char* memoryData = GetMemoryData();
+	if (memoryData != nullptr) return CountVerified(RezCrc32c(memoryData, (size_t)size_));
+
+	RezItemStream stream(this);
+	unsigned int checksum = 0;
+	unsigned long length;
+	const unsigned char* chunk;
+	while ((chunk = stream.NextChunk(&length)) != nullptr) checksum = RezCrc32c(chunk, length, checksum);
+	bool read = !stream.Failed() && stream.EndOfStream();
+
+	// data compressed whole was loaded by the stream
+	if (MustLoadWhole()) UnLoad();
+	return read && CountVerified(checksum);
+}
+
+bool RezItem::MustVerify()
+{
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+
+	RezChecksumVerify verify = parentDir_->rezMgr_->checksumVerify_;
+	if (!hasChecksum_ || (verify == RezChecksumVerifyNone)) return false;
+	return !checksumVerified_ || (verify == RezChecksumVerifyAlways);
+}
+
+bool RezItem::VerifyLoaded(const unsigned char* data)
+{
+	return !MustVerify() || CountVerified(RezCrc32c(data, (size_t)size_));
+}
+
+bool RezItem::CountVerified(unsigned int checksum)
+{
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+
+	RezMgr* rezMgr = parentDir_->rezMgr_;
+	bool matched = (checksum == checksum_);
+
+	std::lock_guard<std::mutex> lock(rezMgr->checksumMutex_);
+	if (matched) checksumVerified_ = true;
+	rezMgr->checksumStats_.bytesVerified += size_;
+	++rezMgr->checksumStats_.numVerified;
+	if (!matched) ++rezMgr->checksumStats_.numFailed;
+	return matched;
+}
+
+bool RezItem::UseDirectIO()
+{
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+
+	RezMgr* rezMgr = parentDir_->rezMgr_;
+	return (rezMgr->directIOThreshold_ > 0) && (size_ >= rezMgr->directIOThreshold_) && rezMgr->readOnly_;
+}
+
+unsigned long RezItem::ReadData(unsigned char* bytes, unsigned long length, RezPos seekPos, bool direct)
+{
+	assert(parentDir_ != nullptr);
+	assert(bytes != nullptr);
+	assert(rezFile_ != nullptr);
+
+	// do seek if necessary
+	if (seekPos != REZ_SEEKPOS_ERROR) Seek(seekPos);
+
+	// check if we are already past the end of the file
+	if (currPos_ > size_) return 0;
+
+	// truncate length if necessary
+	if ((length + currPos_) > size_) length = (unsigned long)(size_ - currPos_);
+
+	// if length is zero just return
+	if (length <= 0) return 0;
+
+	// Check if the whole directory is in memory already and just copy it if it is
+	if ((parentDir_->memBlock_ != nullptr) && (codec_ == RezCodecNone))
+	{
+		memcpy(bytes, parentDir_->memBlock_ + (size_t)(filePos_ + currPos_ - parentDir_->itemsPos_), length);
+		currPos_ += length;
+		return length;
+	}
+
+	// Check if this resource is in memory already and just copy it if so (data compressed whole is loaded whole)
+	if ((data_ != nullptr) || (MustLoadWhole() && (Load() != nullptr)))
+	{
+		memcpy(bytes, data_ + (size_t)currPos_, length);
+		currPos_ += length;
+		return length;
+	}
+
+	// chunked data only needs the chunks the range overlaps (and what is left is stored as is)
+	if (MustLoadWhole()) return 0;
+	if (codec_ != RezCodecNone)
 	{
-		memcpy(bytes, data_ + currPos_, length);
+		if (!ReadChunks(bytes, currPos_, length)) return 0;
 		currPos_ += length;
 		return length;
 	}
 
 	// Load from disk
 	assert(parentDir_->rezMgr_ != nullptr);
-	if (rezFile_->Read(filePos_, currPos_, length, bytes) == length)
+	unsigned long ret = direct ? rezFile_->ReadDirect(filePos_, currPos_, length, bytes) : rezFile_->Read(filePos_, currPos_, length, bytes);
+	if (ret == length)
 	{
 		currPos_ += length;
 		return length;
@@ -351,26 +1349,43 @@ char RezItem::GetChar()
 	return ch;
 }
 
-unsigned char* RezItem::Create(unsigned long size)
+unsigned char* RezItem::Create(RezPos size)
 {
 	assert(parentDir_ != nullptr);
 	assert(parentDir_->rezMgr_ != nullptr);
 	assert(parentDir_->rezMgr_->readOnly_ != true);
 
-	unsigned long oldSize = size_;
+	RezPos oldSize = storedSize_;
 
 	UnLoad();
 
+	// other threads may be creating or saving items in the same directory
+	std::lock_guard<std::mutex> lock(parentDir_->rezMgr_->saveMutex_);
+
 	// make sure parent does not have resources in memory (if so remove them)
 	assert(parentDir_ != nullptr);
 	if (parentDir_->memBlock_ != nullptr) parentDir_->UnLoad();
 
-	// allocate the new memory and set the new size member
+	// allocate the new memory and set the new size member (Save decides whether it is compressed)
 	size_ = size;
-	LT_MEM_TRACK_ALLOC(data_ = new unsigned char[size_], LT_MEM_TYPE_MISC);
+	storedSize_ = size;
+	codec_ = RezCodecNone;
+	chunkSize_ = 0;
+	dictionaryId_ = 0;
+	hasChecksum_ = false;
+	checksumVerified_ = false;
+	hasDelta_ = false;
+	if (chunkIndex_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] chunkIndex_);
+		chunkIndex_ = nullptr;
+	}
+	assert(RezFitsInMemory(size_));
+	LT_MEM_TRACK_ALLOC(data_ = new unsigned char[(size_t)size_], LT_MEM_TYPE_MISC);
 	assert(data_ != nullptr);
 
 	// mark this resource as not exiting in the resource file yet
+	if (filePos_ != 0) parentDir_->rezMgr_->ReleaseStoredData(filePos_);
 	filePos_ = 0;
 
 	// update the directory items size in the parent directory
@@ -395,37 +1410,201 @@ bool RezItem::Save()
 
 	if (size_ <= 0) return true;
 
-	// if this resource has never been saved
-	if (filePos_ == 0)
+	RezMgr* rezMgr = parentDir_->rezMgr_;
+
+	// the checksum is of the data as Load hands it out, before it is compressed
+	bool checksums = rezMgr->checksums_;
+	unsigned int checksum = checksums ? RezCrc32c(data_, (size_t)size_) : 0;
+
+	// compress the data if its type is set up for it (before taking the lock so other threads can save meanwhile),
+	// items bigger than a chunk are compressed a chunk at a time and data that doesn't get any smaller is stored as is
+	RezCodec codec;
+	int level;
+	unsigned long chunkSize;
+	rezMgr->GetCompression(GetType(), &codec, &level, &chunkSize);
+	if (size_ <= chunkSize) chunkSize = 0;
+
+	// small items of a type with a dictionary are compressed against it
+	unsigned int dictionaryId = (codec != RezCodecNone) ? rezMgr->GetDictionaryId(GetType()) : 0;
+	const unsigned char* dict = nullptr;
+	unsigned long dictSize = 0;
+	if ((dictionaryId != 0) && !rezMgr->GetDictionary(dictionaryId, &dict, &dictSize)) dictionaryId = 0;
+
+	RezPos bound = (chunkSize > 0) ? RezCompressChunksBound(size_, chunkSize) : (RezPos)RezCompressBound((size_t)size_);
+	unsigned char* stored = data_;
+	RezPos storedSize = size_;
+	unsigned char* compressed = nullptr;
+	if ((codec != RezCodecNone) && ((chunkSize > 0) ? RezFitsInMemory(bound) : (size_ <= kRezMaxTransfer)))
 	{
-		// mark resource file as not sorted
-		parentDir_->rezMgr_->isSorted_ = false;
+		LT_MEM_TRACK_ALLOC(compressed = new unsigned char[(size_t)bound], LT_MEM_TYPE_MISC);
+		assert(compressed != nullptr);
 
-		// write out the data
-		if (rezFile_->Write(parentDir_->rezMgr_->nextWritePos_, 0, size_, data_) != size_)
+		RezPos compressedSize = 0;
+		if ((compressed != nullptr) && (chunkSize > 0)) compressedSize = RezCompressChunks(codec, level, chunkSize, data_, size_, compressed, bound, dict, dictSize);
+		else if (compressed != nullptr) compressedSize = RezCompress(codec, level, data_, (size_t)size_, compressed, (size_t)bound, dict, dictSize);
+		if (compressedSize > 0)
 		{
-			assert(false);
-			return false;
+			stored = compressed;
+			storedSize = compressedSize;
+		}
+		else
+		{
+			codec = RezCodecNone;
 		}
+	}
+	else
+	{
+		codec = RezCodecNone;
+	}
+
+	// the same bytes may already be in the file, they are hashed before taking the lock like the compression
+	unsigned long long hash = rezMgr->deduplicate_ ? RezDataHash(stored, storedSize) : 0;
+
+	// items may be saved from several threads at once, each one gets its place in the file under the
+	// lock so the writes are made (or queued for the background writer) in file order
+	std::lock_guard<std::mutex> lock(rezMgr->saveMutex_);
 
-		filePos_ = parentDir_->rezMgr_->nextWritePos_;
-		parentDir_->rezMgr_->nextWritePos_ += size_;
+	bool retFlag = true;
+	RezPos sharedPos = rezMgr->deduplicate_ ? rezMgr->FindStoredData(hash, stored, storedSize) : 0;
+	if (sharedPos != 0)
+	{
+		// nothing to write, the item uses the copy that is already there
+		if (sharedPos != filePos_)
+		{
+			if (filePos_ != 0) rezMgr->ReleaseStoredData(filePos_);
+			filePos_ = sharedPos;
+			rezMgr->AddStoredData(filePos_, storedSize);
+			rezMgr->isSorted_ = false;
+		}
+		rezMgr->bytesDeduplicated_ += storedSize;
+		++rezMgr->numDeduplicated_;
 	}
 	else
 	{
-		// write out the data
-		if (rezFile_->Write(filePos_, 0, size_, data_) != size_)
+		// the old data is no longer this item's, but other items may still be using it
+		if (filePos_ != 0) rezMgr->ReleaseStoredData(filePos_);
+
+		// if this resource has never been saved (or no longer fits where it was)
+		if ((filePos_ == 0) || (storedSize > storedSize_) || rezMgr->IsStoredDataInUse(filePos_))
 		{
-			assert(false);
-			return false;
+			// mark resource file as not sorted
+			rezMgr->isSorted_ = false;
+
+			// big items may have to start on the next boundary
+			RezPos padding = 0;
+			if ((rezMgr->alignItemSize_ > 0) && (storedSize >= rezMgr->alignItemSize_))
+			{
+				padding = (rezMgr->alignBoundary_ - (rezMgr->nextWritePos_ & (rezMgr->alignBoundary_ - 1))) & (rezMgr->alignBoundary_ - 1);
+			}
+
+			// write out the data
+			if (((padding > 0) && !RezWriteZeros(rezFile_, rezMgr->nextWritePos_, padding)) ||
+				!RezWriteFully(rezFile_, rezMgr->nextWritePos_ + padding, storedSize, stored))
+			{
+				assert(false);
+				retFlag = false;
+			}
+			else
+			{
+				filePos_ = rezMgr->nextWritePos_ + padding;
+				rezMgr->nextWritePos_ += padding + storedSize;
+				if ((rezMgr->alignItemSize_ > 0) && (storedSize >= rezMgr->alignItemSize_))
+				{
+					rezMgr->bytesPadding_ += padding;
+					++rezMgr->numAligned_;
+				}
+			}
+		}
+		else
+		{
+			// write out the data
+			if (!RezWriteFully(rezFile_, filePos_, storedSize, stored))
+			{
+				assert(false);
+				retFlag = false;
+			}
+		}
+
+		if (retFlag)
+		{
+			rezMgr->AddStoredData(filePos_, storedSize);
+			if (rezMgr->deduplicate_) rezMgr->SetStoredDataHash(filePos_, hash);
+		}
+		else if (filePos_ != 0)
+		{
+			rezMgr->AddStoredData(filePos_, storedSize_);
 		}
 	}
 
+	if (compressed != nullptr) LT_MEM_TRACK_FREE(delete [] compressed);
+	if (!retFlag) return false;
+
+	parentDir_->itemsSize_ += storedSize;
+	parentDir_->itemsSize_ -= storedSize_;
+	storedSize_ = storedSize;
+	codec_ = codec;
+	chunkSize_ = (codec != RezCodecNone) ? chunkSize : 0;
+	dictionaryId_ = (codec != RezCodecNone) ? dictionaryId : 0;
+	if (chunkIndex_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] chunkIndex_);
+		chunkIndex_ = nullptr;
+	}
+	if (codec != RezCodecNone) rezMgr->hasCompressedItems_ = true;
+	checksum_ = checksum;
+	hasChecksum_ = checksums;
+	checksumVerified_ = checksums;
+	if (checksums) rezMgr->hasChecksums_ = true;
+
 	MarkCurTime();
 
 	return true;
 }
 
+bool RezItem::SaveDelta(RezItem* base, const unsigned char* data, RezPos size)
+{
+	assert(base != nullptr);
+	assert((data != nullptr) || (size == 0));
+	assert(parentDir_ != nullptr);
+	assert(parentDir_->rezMgr_ != nullptr);
+
+	if ((base->GetSize() == 0) || (size == 0) || !RezFitsInMemory(RezDeltaBound((size_t)size))) return false;
+
+	// base is usually in the file being patched, which whoever is making the patch has open for reading
+	bool baseLoaded = base->IsLoaded();
+	const unsigned char* baseData = base->Load();
+	if (baseData == nullptr) return false;
+
+	// the checksum lets the patch make sure it is put over the same data it was made from
+	RezPos baseSize = base->GetSize();
+	unsigned int baseChecksum = base->HasChecksum() ? base->GetChecksum() : RezCrc32c(baseData, (size_t)baseSize);
+
+	size_t bound = RezDeltaBound((size_t)size);
+	unsigned char* delta;
+	LT_MEM_TRACK_ALLOC(delta = new unsigned char[bound], LT_MEM_TYPE_MISC);
+	assert(delta != nullptr);
+	size_t deltaSize = (delta != nullptr) ? RezDeltaEncode(baseData, (size_t)baseSize, data, (size_t)size, delta, bound) : 0;
+	if (!baseLoaded) base->UnLoad();
+
+	if ((deltaSize == 0) || (deltaSize >= size))
+	{
+		if (delta != nullptr) LT_MEM_TRACK_FREE(delete [] delta);
+		return false;
+	}
+
+	// the delta is saved like any other data so it is compressed if the type is set up for it
+	memcpy(Create(deltaSize), delta, deltaSize);
+	LT_MEM_TRACK_FREE(delete [] delta);
+
+	hasDelta_ = true;
+	deltaTargetSize_ = size;
+	deltaBaseSize_ = baseSize;
+	deltaBaseChecksum_ = baseChecksum;
+	parentDir_->rezMgr_->hasDeltas_ = true;
+
+	return Save();
+}
+
 void RezItem::MarkCurTime()
 {
 	assert(parentDir_ != nullptr);
@@ -439,44 +1618,190 @@ void RezItem::MarkCurTime()
 }
 
 //------------------------------------------------------------------------------------------
-// RezType
+// RezItemStream
 
-RezType::RezType(unsigned long typeId, RezDir* parentDir, unsigned int nByNameNumHashBins) :
-	hashTableByName_(nByNameNumHashBins)
+RezItemStream::RezItemStream(RezItem* rezItem, unsigned long chunkSize)
 {
-	typeId_ = typeId;
-	hashElementType_.SetRezType(this);
-	parentDir_ = parentDir;
+	assert(rezItem != nullptr);
+	assert(chunkSize > 0);
+
+	rezItem_     = rezItem;
+	chunkSize_   = chunkSize;
+	buffer_      = nullptr;
+	chunk_       = nullptr;
+	chunkPos_    = 0;
+	chunkLength_ = 0;
+	chunkUsed_   = 0;
+	failed_      = false;
 }
 
-RezType::~RezType()
+RezItemStream::~RezItemStream()
 {
-	// remove all of the items in the ByName hash table and delete the objects
+	if (buffer_ != nullptr)
 	{
-		RezItemHashByName* item = hashTableByName_.GetFirst();
-		RezItemHashByName* toDel = nullptr;
-		while (item != nullptr)
-		{
-			toDel = item;
-			item = item->Next();
-			hashTableByName_.Delete(toDel);
-			assert(toDel->GetRezItem() != nullptr);
-			toDel->GetRezItem()->TermRezItem();
-			parentDir_->rezMgr_->DeAllocateRezItem(toDel->GetRezItem());
-		}
+		LT_MEM_TRACK_FREE(delete [] buffer_);
+		buffer_ = nullptr;
 	}
-
-	typeId_ = 0;
-	hashElementType_.SetRezType(nullptr);
 }
 
-//------------------------------------------------------------------------------------------
-// RezDir
-
-RezDir::RezDir(RezMgr* rezMgr, RezDir* parentDir, const char* dirName, unsigned long dirPos,
-		unsigned long dirSize, unsigned long time, unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins) :
-	hashTableSubDirs_(nDirNumHashBins),
-	hashTableTypes_(nTypeNumHashBins)
+const unsigned char* RezItemStream::NextChunk(unsigned long* length)
+{
+	assert(length != nullptr);
+	*length = 0;
+
+	// whatever Read left of the current chunk comes first
+	if ((chunkUsed_ >= chunkLength_) && !FillChunk()) return nullptr;
+
+	const unsigned char* data = chunk_ + chunkUsed_;
+	*length = chunkLength_ - chunkUsed_;
+	chunkUsed_ = chunkLength_;
+	return data;
+}
+
+unsigned long RezItemStream::Read(void* bytes, unsigned long length)
+{
+	assert(bytes != nullptr);
+
+	unsigned long done = 0;
+	while (done < length)
+	{
+		if ((chunkUsed_ >= chunkLength_) && !FillChunk()) break;
+
+		unsigned long count = chunkLength_ - chunkUsed_;
+		if (count > length - done) count = length - done;
+		memcpy((unsigned char*)bytes + done, chunk_ + chunkUsed_, count);
+		chunkUsed_ += count;
+		done += count;
+	}
+	return done;
+}
+
+bool RezItemStream::Seek(RezPos offset)
+{
+	if (offset > rezItem_->size_) return false;
+
+	// stay in the current chunk if we can so seeking back a little doesn't read it again
+	if ((chunk_ != nullptr) && (offset >= chunkPos_) && (offset <= chunkPos_ + chunkLength_))
+	{
+		chunkUsed_ = (unsigned long)(offset - chunkPos_);
+		return true;
+	}
+
+	chunk_       = nullptr;
+	chunkPos_    = offset;
+	chunkLength_ = 0;
+	chunkUsed_   = 0;
+	return true;
+}
+
+bool RezItemStream::EndOfStream()
+{
+	return (Tell() >= rezItem_->size_);
+}
+
+bool RezItemStream::FillChunk()
+{
+	RezItem* rezItem = rezItem_;
+	assert(rezItem->parentDir_ != nullptr);
+	assert(rezItem->rezFile_ != nullptr);
+
+	RezPos pos = chunkPos_ + chunkLength_;
+	if (pos >= rezItem->size_) return false;
+
+	unsigned long length = ((rezItem->size_ - pos) > chunkSize_) ? chunkSize_ : (unsigned long)(rezItem->size_ - pos);
+
+	chunk_       = nullptr;
+	chunkPos_    = pos;
+	chunkLength_ = 0;
+	chunkUsed_   = 0;
+
+	// data that is already in memory is used where it is, data compressed whole can only be decompressed
+	// whole so streaming it loads all of it (chunked data is decompressed by Get a chunk at a time)
+	unsigned char* memoryData = rezItem->GetMemoryData();
+	if ((memoryData == nullptr) && rezItem->MustLoadWhole())
+	{
+		memoryData = rezItem->Load();
+		if (memoryData == nullptr)
+		{
+			failed_ = true;
+			return false;
+		}
+	}
+
+	if (memoryData != nullptr)
+	{
+		chunk_ = memoryData + (size_t)pos;
+	}
+	else if (rezItem->rezFile_->IsMapped() && !rezItem->IsCompressed())
+	{
+		chunk_ = rezItem->rezFile_->MapData(rezItem->filePos_, pos, length);
+	}
+
+	if (chunk_ == nullptr)
+	{
+		if (buffer_ == nullptr)
+		{
+			LT_MEM_TRACK_ALLOC(buffer_ = new unsigned char[chunkSize_], LT_MEM_TYPE_MISC);
+			assert(buffer_ != nullptr);
+			if (buffer_ == nullptr)
+			{
+				failed_ = true;
+				return false;
+			}
+		}
+
+		// Get reads at an offset without moving the item's own seek position
+		if (!rezItem->Get(buffer_, pos, length))
+		{
+			failed_ = true;
+			return false;
+		}
+		chunk_ = buffer_;
+	}
+
+	chunkLength_ = length;
+	return true;
+}
+
+//------------------------------------------------------------------------------------------
+// RezType
+
+RezType::RezType(unsigned long typeId, RezDir* parentDir, unsigned int nByNameNumHashBins) :
+	hashTableByName_(nByNameNumHashBins)
+{
+	typeId_ = typeId;
+	hashElementType_.SetRezType(this);
+	parentDir_ = parentDir;
+}
+
+RezType::~RezType()
+{
+	// remove all of the items in the ByName hash table and delete the objects
+	{
+		RezItemHashByName* item = hashTableByName_.GetFirst();
+		RezItemHashByName* toDel = nullptr;
+		while (item != nullptr)
+		{
+			toDel = item;
+			item = item->Next();
+			hashTableByName_.Delete(toDel);
+			assert(toDel->GetRezItem() != nullptr);
+			toDel->GetRezItem()->TermRezItem();
+			parentDir_->rezMgr_->DeAllocateRezItem(toDel->GetRezItem());
+		}
+	}
+
+	typeId_ = 0;
+	hashElementType_.SetRezType(nullptr);
+}
+
+//------------------------------------------------------------------------------------------
+// RezDir
+
+RezDir::RezDir(RezMgr* rezMgr, RezDir* parentDir, const char* dirName, RezPos dirPos,
+		RezPos dirSize, unsigned long time, unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins) :
+	hashTableSubDirs_(nDirNumHashBins),
+	hashTableTypes_(nTypeNumHashBins)
 {
 	assert(rezMgr_ != nullptr);
 	assert(dirName_ != nullptr);
@@ -549,7 +1874,8 @@ RezItem* RezDir::GetRez(const char* rezName, unsigned long rezTypeId)
 	return rezType->hashTableByName_.Find(rezName, !GetParentMgr()->GetLowerCasedUsed());
 }
 
-RezItem* RezDir::GetRezFromDosName(const char* rezNameDOS)
+// splits an old style dos file name into the name (fname has room for kRezDosNameSize chars) and the type in its extension
+static unsigned long RezSplitDosName(RezMgr* rezMgr, const char* rezNameDOS, char* fname)
 {
 	assert(rezNameDOS != nullptr);
 
@@ -558,7 +1884,6 @@ RezItem* RezDir::GetRezFromDosName(const char* rezNameDOS)
 
 	char drive[_MAX_DRIVE+1];
 	char dir[_MAX_DIR+1];
-	char fname[_MAX_FNAME+1+_MAX_EXT+1];
 	char ext[_MAX_EXT+1];
 	_splitpath(rezNameDOS, drive, dir, fname, ext);
 
@@ -576,7 +1901,7 @@ RezItem* RezDir::GetRezFromDosName(const char* rezNameDOS)
 		{
 			strcpy(sExt, &ext[1]);
 			_strupr(sExt);
-			rezTypeId = rezMgr_->StrToType(sExt);
+			rezTypeId = rezMgr->StrToType(sExt);
 		}
 		else
 		{
@@ -584,6 +1909,16 @@ RezItem* RezDir::GetRezFromDosName(const char* rezNameDOS)
 		}
 	}
 
+	return rezTypeId;
+}
+
+RezItem* RezDir::GetRezFromDosName(const char* rezNameDOS)
+{
+	assert(rezNameDOS != nullptr);
+
+	char fname[kRezDosNameSize];
+	unsigned long rezTypeId = RezSplitDosName(rezMgr_, rezNameDOS, fname);
+
 	return GetRez(fname, rezTypeId);
 }
 
@@ -591,23 +1926,66 @@ bool RezDir::Load(bool loadAllSubDirs)
 {
 	if (memBlock_ != nullptr) return true;
 
-	// if the file is not sorted then we cannot load it by directory (actually we could but it would take more effort)
-	// we also can't do this if we have loaded more than 1 rez file
-	if ((rezMgr_->isSorted_ == false) || (rezMgr_->numRezFiles_ > 1))
+	// if the file is mapped there is nothing to copy, every item just points into the view
+	// so it doesn't matter whether the data is sorted or not
+	if (rezMgr_->primaryRezFile_->IsMapped())
 	{
-		return false;
+		RezType *rezType = GetFirstType();
+		while (rezType != nullptr)
+		{
+			RezItem *rezItem = GetFirstItem(rezType);
+			while (rezItem != nullptr)
+			{
+				rezItem->Load();
+				rezItem = GetNextItem(rezItem);
+			}
+			rezType = GetNextType(rezType);
+		}
 	}
-
-	// if the data size is 0 then we don't need to do anything
-	if (itemsSize_ > 0)
+	else
 	{
-		LT_MEM_TRACK_ALLOC(memBlock_ = new unsigned char[itemsSize_], LT_MEM_TYPE_MISC);
-		assert(memBlock_ != nullptr);
-		if (memBlock_ != nullptr)
+		// if the file is not sorted then we cannot load it by directory (actually we could but it would take more effort)
+		// we also can't do this if we have loaded more than 1 rez file
+		if ((rezMgr_->isSorted_ == false) || (rezMgr_->numRezFiles_ > 1))
+		{
+			return false;
+		}
+
+		// items that share data (see RezMgr::SetDeduplicate) may use data that isn't next to the rest of the directory's,
+		// but the zeroes in front of aligned items (see RezMgr::SetItemAlignment) are only ever less than the boundary
+		// the item starts on, which is a power of 2 its position is a multiple of
+		RezPos itemsEnd = itemsPos_;
+		RezPos padding = 0;
+		RezType *rezType = GetFirstType();
+		while (rezType != nullptr)
+		{
+			RezItem *rezItem = GetFirstItem(rezType);
+			while (rezItem != nullptr)
+			{
+				if ((rezItem->storedSize_ > 0) && (rezItem->filePos_ + rezItem->storedSize_ > itemsEnd)) itemsEnd = rezItem->filePos_ + rezItem->storedSize_;
+				if (rezItem->storedSize_ > 0)
+				{
+					RezPos boundary = rezItem->filePos_ & (~rezItem->filePos_ + 1);
+					padding += ((boundary - 1) < rezItem->storedSize_) ? (boundary - 1) : rezItem->storedSize_;
+				}
+				rezItem = GetNextItem(rezItem);
+			}
+			rezType = GetNextType(rezType);
+		}
+		if (itemsEnd - itemsPos_ > itemsSize_ + padding) return false;
+
+		// if the data size is 0 then we don't need to do anything
+		RezPos size = itemsEnd - itemsPos_;
+		if ((size > 0) && RezFitsInMemory(size))
 		{
-			assert(rezMgr_ != nullptr);
-			assert(itemsPos_ > 0);
-			rezMgr_->primaryRezFile_->Read(itemsPos_, 0, itemsSize_, memBlock_);
+			LT_MEM_TRACK_ALLOC(memBlock_ = new unsigned char[(size_t)size], LT_MEM_TYPE_MISC);
+			assert(memBlock_ != nullptr);
+			if (memBlock_ != nullptr)
+			{
+				assert(rezMgr_ != nullptr);
+				assert(itemsPos_ > 0);
+				RezReadFully(rezMgr_->primaryRezFile_, itemsPos_, size, memBlock_, false);
+			}
 		}
 	}
 
@@ -729,6 +2107,9 @@ RezDir* RezDir::CreateDir(const char* dirName)
 	assert(dirName != nullptr);
 	assert(rezMgr_ != nullptr);
 
+	// other threads may be creating directories or items too
+	std::lock_guard<std::mutex> lock(rezMgr_->saveMutex_);
+
 	// make sure directory does not already exist
 	RezDir* dir = hashTableSubDirs_.Find(dirName, !GetParentMgr()->GetLowerCasedUsed());
 	assert(dir == nullptr);
@@ -752,6 +2133,9 @@ RezItem* RezDir::CreateRez(unsigned long rezId, const char* rezName, unsigned lo
 	assert(rezMgr_ != nullptr);
 	assert(rezMgr_->readOnly_ == false);
 
+	// other threads may be creating directories or items too
+	std::lock_guard<std::mutex> lock(rezMgr_->saveMutex_);
+
 	RezType* type = GetOrMakeType(rezTypeId);
 	assert(type != nullptr);
 
@@ -794,23 +2178,31 @@ bool RezDir::RemoveRezInternal(RezType* rezType, RezItem* rezItem)
 {
 	assert(rezItem != nullptr);
 
-	// update the directory items size
-	itemsSize_ -= rezItem->size_;
-
-	// remove from hash tables
-	rezType->hashTableByName_.Delete(&rezItem->hashByName_);
+	DetachRezInternal(rezType, rezItem);
 
 	// delete item
 	rezItem->TermRezItem();
 	rezMgr_->DeAllocateRezItem(rezItem);
 
+	return true;
+}
+
+void RezDir::DetachRezInternal(RezType* rezType, RezItem* rezItem)
+{
+	assert(rezItem != nullptr);
+
+	// update the directory items size
+	itemsSize_ -= rezItem->storedSize_;
+	if ((rezItem->filePos_ != 0) && (rezItem->rezFile_ == rezMgr_->primaryRezFile_)) rezMgr_->ReleaseStoredData(rezItem->filePos_);
+
+	// remove from hash tables
+	rezType->hashTableByName_.Delete(&rezItem->hashByName_);
+
 	// mark data as not sorted
 	rezMgr_->isSorted_ = false;
-
-	return true;
 }
 
-bool RezDir::ReadAllDirs(BaseRezFile* rezFile, unsigned long pos, unsigned long size, bool overwriteItems)
+bool RezDir::ReadAllDirs(BaseRezFile* rezFile, RezPos pos, RezPos size, unsigned long version, bool overwriteItems)
 {
 	assert(pos > 0);
 
@@ -832,7 +2224,7 @@ bool RezDir::ReadAllDirs(BaseRezFile* rezFile, unsigned long pos, unsigned long
 
 	// read in this directory
 	bool retFlag = true;
-	if (ReadDirBlock(rezFile, pos, size, overwriteItems))
+	if (ReadDirBlock(rezFile, pos, size, version, overwriteItems))
 	{
 		RezDirHash* it = hashTableSubDirs_.GetFirst();
 		while (it != nullptr)
@@ -841,7 +2233,7 @@ bool RezDir::ReadAllDirs(BaseRezFile* rezFile, unsigned long pos, unsigned long
 			assert(rezDir != nullptr);
 			if (rezDir->dirPos_ != 0)
 			{
-				if (!rezDir->ReadAllDirs(rezFile, rezDir->dirPos_, rezDir->dirSize_, overwriteItems))
+				if (!rezDir->ReadAllDirs(rezFile, rezDir->dirPos_, rezDir->dirSize_, version, overwriteItems))
 				{
 					retFlag = false;
 				}
@@ -857,47 +2249,69 @@ bool RezDir::ReadAllDirs(BaseRezFile* rezFile, unsigned long pos, unsigned long
 	return retFlag;
 }
 
-bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long size, bool overwriteItems)
+bool RezDir::ReadDirBlock(BaseRezFile* rezFile, RezPos pos, RezPos size, unsigned long version, bool overwriteItems)
 {
 	assert(pos > 0);
 
 	itemsSize_ = 0;
 	itemsPos_  = REZ_SEEKPOS_ERROR;
-	unsigned long lastItemPos = 0;
-	unsigned long lastItemSize = 0;
+	RezPos lastItemPos = 0;
+	RezPos lastItemSize = 0;
+
+	if (!RezFitsInMemory(size)) return false;
+	if (pos < rezMgr_->headerSize_) rezMgr_->headerSize_ = pos;
 
 	unsigned char* buf;
-	LT_MEM_TRACK_ALLOC(buf = new unsigned char[size], LT_MEM_TYPE_MISC);
+	LT_MEM_TRACK_ALLOC(buf = new unsigned char[(size_t)size], LT_MEM_TYPE_MISC);
 	assert(buf != nullptr);
 	if (buf == nullptr) return false;
 
-	if (rezFile->Read(pos, 0, size, buf) != size)
+	if (!RezReadFully(rezFile, pos, size, buf, false))
 	{
 		LT_MEM_TRACK_FREE(delete [] buf);
 		return false;
 	}
 
-	// process all data in directory block
+	// process all data in directory block (a patch opened over the file may be damaged, anything that would
+	// read past the end of the block fails the whole read)
 	unsigned char* curr = buf;
-	unsigned char* end  = buf + size;
+	unsigned char* end  = buf + (size_t)size;
+	bool corrupt = false;
 	while (curr < end)
 	{
-		if ((*(unsigned long*)curr) == DirectoryEntry)
+		if ((size_t)(end - curr) < 4)
 		{
-			curr += sizeof(unsigned long);
+			corrupt = true;
+			break;
+		}
 
+		unsigned long entryType = ReadU32(curr);
+		if (entryType == DirectoryEntry)
+		{
 			// variables to store data read in
-			unsigned long pos;
-			unsigned long size;
+			RezPos pos;
+			RezPos size;
 			unsigned long time;
 			char* dirName;
 
-			pos  = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			size = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			time = (*(unsigned long*)curr); curr += sizeof(unsigned long);
+			// position, size and time
+			size_t fieldsSize = (version >= 2) ? 8 + 8 + 4 : 4 + 4 + 4;
+			if ((size_t)(end - curr) < fieldsSize)
+			{
+				corrupt = true;
+				break;
+			}
 
-			dirName = (char*)curr;
-			curr += strlen(dirName)+1;
+			pos  = (version >= 2) ? ReadU64(curr) : ReadU32(curr);
+			size = (version >= 2) ? ReadU64(curr) : ReadU32(curr);
+			time = ReadU32(curr);
+
+			dirName = ReadString(curr, end);
+			if (dirName == nullptr)
+			{
+				corrupt = true;
+				break;
+			}
 
 			// make sure this dir doesn't already exist if it does we don't need to add it again
 			RezDir* rezDir = hashTableSubDirs_.Find(dirName, !GetParentMgr()->GetLowerCasedUsed());
@@ -918,11 +2332,10 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 		else
 		{
 			// a resource item entry
-			assert((*(unsigned long*)curr) == ResourceEntry);
-			curr += sizeof(unsigned long);
+			assert(entryType == ResourceEntry);
 
-			unsigned long pos;
-			unsigned long size;
+			RezPos pos;
+			RezPos size;
 			unsigned long time;
 			unsigned long id;
 			unsigned long rezTypeId;
@@ -931,22 +2344,113 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 			char* rezDesc;
 			unsigned long* keyArray;
 
-			pos       = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			size      = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			time      = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			id        = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			rezTypeId = (*(unsigned long*)curr); curr += sizeof(unsigned long);
-			numKeys   = (*(unsigned long*)curr); curr += sizeof(unsigned long);
+			// position, size, time, id, type, number of keys and (from version 2) the size of the extra records
+			size_t fieldsSize = (version >= 2) ? 8 + 8 + 4 * 5 : 4 + 4 + 4 * 4;
+			if ((size_t)(end - curr) < fieldsSize)
+			{
+				corrupt = true;
+				break;
+			}
+
+			pos       = (version >= 2) ? ReadU64(curr) : ReadU32(curr);
+			size      = (version >= 2) ? ReadU64(curr) : ReadU32(curr);
+			time      = ReadU32(curr);
+			id        = ReadU32(curr);
+			rezTypeId = ReadU32(curr);
+			numKeys   = ReadU32(curr);
+
+			// pick out the extra records we know about and skip the rest
+			unsigned long codec = RezCodecNone;
+			unsigned long chunkSize = 0;
+			unsigned long dictionaryId = 0;
+			unsigned long checksum = 0;
+			bool hasChecksum = false;
+			FileRezExtraDelta delta;
+			bool hasDelta = false;
+			RezPos storedSize = size;
+			if (version >= 2)
+			{
+				unsigned long extraSize = ReadU32(curr);
+				if (extraSize > (size_t)(end - curr))
+				{
+					corrupt = true;
+					break;
+				}
+
+				unsigned char* extraEnd = curr + extraSize;
+				while ((size_t)(extraEnd - curr) >= sizeof(FileRezExtraHeader))
+				{
+					unsigned long tag = ReadU32(curr);
+					unsigned long recordSize = ReadU32(curr);
+					if (recordSize > (size_t)(extraEnd - curr))
+					{
+						corrupt = true;
+						break;
+					}
+					unsigned char* record = curr;
+					curr += recordSize;
+
+					if ((tag == kRezExtraCompression) && (recordSize >= sizeof(FileRezExtraCompression)))
+					{
+						codec = ReadU32(record);
+						size = ReadU64(record);
+					}
+					else if ((tag == kRezExtraChunks) && (recordSize >= sizeof(FileRezExtraChunks)))
+					{
+						chunkSize = ReadU32(record);
+					}
+					else if ((tag == kRezExtraDictionary) && (recordSize >= sizeof(FileRezExtraDictionary)))
+					{
+						dictionaryId = ReadU32(record);
+					}
+					else if ((tag == kRezExtraChecksum) && (recordSize >= sizeof(FileRezExtraChecksum)))
+					{
+						checksum = ReadU32(record);
+						hasChecksum = true;
+					}
+					else if ((tag == kRezExtraDelta) && (recordSize >= sizeof(FileRezExtraDelta)))
+					{
+						delta.Size = ReadU64(record);
+						delta.BaseSize = ReadU64(record);
+						delta.BaseCrc32c = ReadU32(record);
+						hasDelta = true;
+					}
+				}
+				if (corrupt) break;
+				curr = extraEnd;
+			}
 
-			rezName = (char*)curr;
-			curr += strlen(rezName)+1;
+			rezName = ReadString(curr, end);
+			rezDesc = (rezName != nullptr) ? ReadString(curr, end) : nullptr;
+			if ((rezDesc == nullptr) || (numKeys > (size_t)(end - curr) / 4))
+			{
+				corrupt = true;
+				break;
+			}
+			if (rezDesc[0] == '\0') rezDesc = nullptr;
 
 			RezType* rezType = GetOrMakeType(rezTypeId);
 			assert(rezType != nullptr);
 
+			// a delta in a file opened over another one replaces the item it was made from whatever overwriteItems
+			// says, without that item there is nothing to apply it to (the primary file has nothing under it so
+			// its deltas are just items like any other)
 			bool skipThisItem = false;
+			RezItem* baseItem = nullptr;
 			RezItem* dupNameItem = rezType->hashTableByName_.Find(rezName);
-			if (dupNameItem != nullptr)
+			if (hasDelta && (rezFile != rezMgr_->primaryRezFile_))
+			{
+				if (dupNameItem != nullptr)
+				{
+					DetachRezInternal(rezType, dupNameItem);
+					baseItem = dupNameItem;
+				}
+				else
+				{
+					skipThisItem = true;
+				}
+			}
+			else if (dupNameItem != nullptr)
 			{
 				if (overwriteItems)
 				{
@@ -958,9 +2462,13 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 				}
 			}
 
-			rezDesc = (char*)curr;
-			curr += strlen(rezDesc)+1;
-			if (rezDesc[0] == '\0') rezDesc = nullptr;
+			// an item looked up through the path index before the directories were read in is this entry, it stays
+			// as it is but is still part of the directory's data
+			RezItem* countItem = nullptr;
+			if (skipThisItem && (dupNameItem != nullptr) && (dupNameItem->rezFile_ == rezFile) && (dupNameItem->filePos_ == pos))
+			{
+				countItem = dupNameItem;
+			}
 
 			if (numKeys > 0)
 			{
@@ -968,8 +2476,7 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 				assert(keyArray != nullptr);
 				for (unsigned int i = 0; i < numKeys; ++i)
 				{
-					keyArray[i] = *(unsigned long*)curr;
-					curr += sizeof(unsigned long);
+					keyArray[i] = ReadU32(curr);
 				}
 			}
 			else
@@ -982,15 +2489,49 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 				RezItem *rezItem = rezMgr_->AllocateRezItem();
 				assert(rezItem != nullptr);
 				rezItem->InitRezItem(this, rezName, id, rezType, rezDesc, size, pos, time, numKeys, keyArray, rezFile);
+				rezItem->storedSize_ = storedSize;
+				rezItem->codec_ = (RezCodec)codec;
+				rezItem->chunkSize_ = (codec != RezCodecNone) ? chunkSize : 0;
+				rezItem->dictionaryId_ = (codec != RezCodecNone) ? (unsigned int)dictionaryId : 0;
+				rezItem->checksum_ = (unsigned int)checksum;
+				rezItem->hasChecksum_ = hasChecksum;
+				rezItem->hasDelta_ = hasDelta;
+				if (hasDelta)
+				{
+					rezItem->deltaTargetSize_ = delta.Size;
+					rezItem->deltaBaseSize_ = delta.BaseSize;
+					rezItem->deltaBaseChecksum_ = delta.BaseCrc32c;
+				}
+				if (codec != RezCodecNone) rezMgr_->hasCompressedItems_ = true;
+				if (hasChecksum) rezMgr_->hasChecksums_ = true;
+				if (hasDelta) rezMgr_->hasDeltas_ = true;
+
+				// the delta itself is kept out of the directory and the item in its place makes the data out of it and the base
+				if (baseItem != nullptr)
+				{
+					RezItem* deltaItem = rezItem;
+					rezItem = rezMgr_->AllocateRezItem();
+					assert(rezItem != nullptr);
+					rezItem->InitRezItem(this, rezName, id, rezType, rezDesc, delta.Size, pos, time, numKeys, keyArray, rezFile);
+					rezItem->storedSize_ = deltaItem->storedSize_;
+					rezItem->deltaData_ = deltaItem;
+					rezItem->deltaBase_ = baseItem;
+				}
 			
 				rezType->hashTableByName_.Insert(&rezItem->hashByName_);
+				countItem = rezItem;
+			}
 
-				itemsSize_ += rezItem->size_;
-				if (rezItem->filePos_ < itemsPos_) itemsPos_ = rezItem->filePos_;
-				if (rezItem->filePos_ > lastItemPos)
+			if (countItem != nullptr)
+			{
+				itemsSize_ += countItem->storedSize_;
+				if ((countItem->storedSize_ > 0) && (rezFile == rezMgr_->primaryRezFile_)) rezMgr_->AddStoredData(countItem->filePos_, countItem->storedSize_);
+				if (countItem->filePos_ < itemsPos_) itemsPos_ = countItem->filePos_;
+				if ((countItem->storedSize_ > 0) && (countItem->filePos_ < rezMgr_->headerSize_)) rezMgr_->headerSize_ = countItem->filePos_;
+				if (countItem->filePos_ > lastItemPos)
 				{
-					lastItemPos  = rezItem->filePos_;
-					lastItemSize = rezItem->size_;
+					lastItemPos  = countItem->filePos_;
+					lastItemSize = countItem->storedSize_;
 				}
 			}
 
@@ -1001,8 +2542,8 @@ bool RezDir::ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long
 		}
 	}
 
-	delete [] buf;
-	return true;
+	LT_MEM_TRACK_FREE(delete [] buf);
+	return !corrupt;
 }
 
 RezType* RezDir::GetOrMakeType(unsigned long rezTypeId)
@@ -1037,6 +2578,10 @@ RezMgr::RezMgr()
 	lastTimeModified_ = 0;
 	mustReWriteDirs_ = false;
 	fileFormatVersion_ = 0;
+	hasCompressedItems_ = false;
+	hasChecksums_ = false;
+	hasDeltas_ = false;
+	headerSize_ = 0;
 	largestKeyArray_ = 0;
 	largestDirNameSize_ = 0;
 	largestRezNameSize_ = 0;
@@ -1044,6 +2589,41 @@ RezMgr::RezMgr()
 	isSorted_ = 0;
 	filename_ = nullptr;
 	maxOpenFilesInEmulatedDir_ = 3;
+	fileAccess_ = RezFileAccessMapped;
+	numAsyncLoads_ = 0;
+	batchReadGap_ = 64 * 1024;
+	batchReadMaxSize_ = 4 * 1024 * 1024;
+	readAheadMinWindow_ = 64 * 1024;
+	readAheadMaxWindow_ = 0;
+	blockCache_ = nullptr;
+	blockCacheBudget_ = 0;
+	blockCacheBlockSize_ = kRezBlockCacheDefaultBlockSize;
+	directIOThreshold_ = 0;
+	writeCombineSize_ = kRezWriteCombineDefaultSize;
+	backgroundSaveQueue_ = 0;
+	memset(&closedWriteStats_, 0, sizeof(closedWriteStats_));
+	numCompression_ = 0;
+	defaultCodec_ = RezCodecNone;
+	defaultLevel_ = kRezCompressDefaultLevel;
+	defaultChunkSize_ = kRezCompressDefaultChunkSize;
+	numTypeDictionaries_ = 0;
+	numDictionaries_ = 0;
+	dictionaryTypeId_ = StrToType(kRezDictionaryTypeName);
+	deduplicate_ = false;
+	bytesDeduplicated_ = 0;
+	numDeduplicated_ = 0;
+	alignItemSize_ = 0;
+	alignBoundary_ = kRezDefaultItemAlignment;
+	bytesPadding_ = 0;
+	numAligned_ = 0;
+	checksums_ = false;
+	checksumVerify_ = RezChecksumVerifyNone;
+	memset(&checksumStats_, 0, sizeof(checksumStats_));
+	pathIndex_ = false;
+	openFromIndex_ = true;
+	index_ = nullptr;
+	indexBuffer_ = nullptr;
+	dirsRead_ = true;
 	dirSeparators_ = nullptr;
 	lowerCaseUsed_ = false;
 	byNameNumHashBins_ = kDefaultByNameNumHashBins;
@@ -1072,6 +2652,12 @@ RezMgr::~RezMgr()
 		delete rezFile;
 	}
 
+	if (blockCache_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete blockCache_);
+		blockCache_ = nullptr;
+	}
+
 	if (rootDir_ != nullptr)
 	{
 		delete rootDir_;
@@ -1101,6 +2687,10 @@ RezMgr::~RezMgr()
 	lastTimeModified_ = 0;
 	mustReWriteDirs_  = false;
 	fileFormatVersion_ = 1;
+	hasCompressedItems_ = false;
+	hasChecksums_ = false;
+	hasDeltas_ = false;
+	headerSize_ = 0;
 	largestKeyArray_ = 0;
 	largestDirNameSize_ = 0;
 	largestRezNameSize_ = 0;
@@ -1154,31 +2744,83 @@ bool RezMgr::Open(const char* filename, bool readOnly, bool createNew)
 		LT_MEM_TRACK_ALLOC(rootDir_ = new RezDir(this, nullptr, "", 0, 0, GetCurTime(), dirNumHashBins_, typeNumHashBins_), LT_MEM_TYPE_MISC);
 		assert(rootDir_ != nullptr);
 
-		// read in data from directory and all sub directories
-		ReadEmulationDirectory(rezFile, rootDir_, filename_, false);
-		return true;
+		// read in data from directory and all sub directories, anything that couldn't be read fails the open
+		// (what could be read is still there)
+		return ReadEmulationDirectory(rezFile, rootDir_, filename_, false);
 	}
 
-	// create a new RezFile object
-	RezFile* rezFile;
-	LT_MEM_TRACK_ALLOC(rezFile = new RezFile(this), LT_MEM_TYPE_MISC);
-	assert(rezFile != nullptr);
+	// create and open the low level file object
+	BaseRezFile* rezFile = OpenRezFile(filename, readOnly, createNew);
 	if (rezFile == nullptr)
 	{
 		delete [] filename_;
 		filename_ = nullptr;
 		return false;
 	}
-	primaryRezFile_ = rezFile;
+
+	return OpenPrimary(rezFile, createNew);
+}
+
+bool RezMgr::OpenMemory(const void* data, RezPos size)
+{
+	assert(data != nullptr);
+
+	RezFileMemory* rezFile;
+	LT_MEM_TRACK_ALLOC(rezFile = new RezFileMemory(this, data, size), LT_MEM_TYPE_MISC);
+	assert(rezFile != nullptr);
+	if (rezFile == nullptr) return false;
+
+	return OpenMemoryFile(rezFile, true, false);
+}
+
+bool RezMgr::OpenMemory(RezMemoryImage* image, bool readOnly, bool createNew)
+{
+	assert(image != nullptr);
+	assert(!(readOnly && createNew));
+
+	RezFileMemory* rezFile;
+	LT_MEM_TRACK_ALLOC(rezFile = new RezFileMemory(this, image), LT_MEM_TYPE_MISC);
+	assert(rezFile != nullptr);
+	if (rezFile == nullptr) return false;
+
+	return OpenMemoryFile(rezFile, readOnly, createNew);
+}
+
+bool RezMgr::OpenMemoryFile(RezFileMemory* rezFile, bool readOnly, bool createNew)
+{
+	readOnly_ = readOnly;
+
+	// there is no file behind it, the name is only there for anything that wants to print it
+	if (filename_ != nullptr) delete [] filename_;
+	LT_MEM_TRACK_ALLOC(filename_ = new char[strlen(kRezMemoryFileName)+1], LT_MEM_TYPE_MISC);
+	assert(filename_ != nullptr);
+	strcpy(filename_, kRezMemoryFileName);
+
+	// no layers on top, there is nothing for read ahead, caching or write combining to save
+	if (!rezFile->Open(filename_, readOnly, createNew))
+	{
+		LT_MEM_TRACK_FREE(delete rezFile);
+		delete [] filename_;
+		filename_ = nullptr;
+		return false;
+	}
 	rezFilesList_.Insert(rezFile);
 	++numRezFiles_;
 
-	if (!rezFile->Open(filename, readOnly, createNew)) return false;
+	return OpenPrimary(rezFile, createNew);
+}
+
+// takes over a just opened file as the primary file, and either starts a new one or reads its directories
+bool RezMgr::OpenPrimary(BaseRezFile* rezFile, bool createNew)
+{
+	primaryRezFile_ = rezFile;
 	fileOpened_ = true;
 
 	if (createNew)
 	{
-		nextWritePos_ = sizeof(FileMainHeaderStruct);
+		// leave room for the biggest header so the file can still become version 2 if it grows past 4 GB or get a path index
+		headerSize_ = sizeof(FileMainHeaderStructV3);
+		nextWritePos_ = headerSize_;
 		mustReWriteDirs_ = true;
 
 		LT_MEM_TRACK_ALLOC(rootDir_ = new RezDir(this, nullptr, "", 0, 0, GetCurTime(), dirNumHashBins_, typeNumHashBins_), LT_MEM_TYPE_MISC);
@@ -1186,9 +2828,10 @@ bool RezMgr::Open(const char* filename, bool readOnly, bool createNew)
 	}
 	else
 	{
-		FileMainHeaderStruct header;
-		rezFile->Read(0, 0, sizeof(header), &header);
+		FileMainHeaderStructV3 header;
+		if (!ReadMainHeader(rezFile, &header)) return false;
 
+		headerSize_          = header.NextWritePos;
 		nextWritePos_        = header.NextWritePos;
 		rootDirPos_          = header.RootDirPos;
 		rootDirSize_         = header.RootDirSize;
@@ -1209,18 +2852,14 @@ bool RezMgr::Open(const char* filename, bool readOnly, bool createNew)
 			userTitle_[i] = '\0';
 		}
 
-		assert(header.CR1 == 0x0d);
-		assert(header.LF2 == 0x0a);
-		assert(header.EOF1 == 0x1a);
-		if (header.CR1 != 0x0d) return false;
-		if (header.LF2 != 0x0a) return false;
-		if (header.EOF1 != 0x1a) return false;
-		if (fileFormatVersion_ != 1) return false;
-
 		LT_MEM_TRACK_ALLOC(rootDir_ = new RezDir(this, nullptr, "", rootDirPos_, rootDirSize_, rootDirTime_, dirNumHashBins_, typeNumHashBins_), LT_MEM_TYPE_MISC);
 		assert(rootDir_ != nullptr);
 
-		rootDir_->ReadAllDirs(rezFile, rootDirPos_, rootDirSize_, false);
+		// a file opened for writing keeps its path index, a read only one can use it instead of reading the directories
+		if (header.IndexSize > 0) pathIndex_ = true;
+		if ((header.IndexSize > 0) && readOnly_ && openFromIndex_ && OpenIndex(header.IndexPos, header.IndexSize)) return true;
+
+		rootDir_->ReadAllDirs(rezFile, rootDirPos_, rootDirSize_, fileFormatVersion_, false);
 	}
 
 	return true;
@@ -1237,6 +2876,9 @@ bool RezMgr::OpenAdditional(const char* filename, bool overwriteItems)
 
 	if (readOnly_ == false) return false;
 
+	// items in this file go over the ones in the directories, so they all have to be there first
+	ReadIndexedDirs();
+
 	// by definition nothing is sorted anymore because we have multiple files
 	isSorted_ = false;
 
@@ -1262,48 +2904,133 @@ bool RezMgr::OpenAdditional(const char* filename, bool overwriteItems)
 		if (!rezFile->Open(filename, readOnly, createNew)) return false;
 		fileOpened_ = true;
 
-		ReadEmulationDirectory(rezFile, rootDir_, filename_, overwriteItems);
-		return true;
+		return ReadEmulationDirectory(rezFile, rootDir_, filename_, overwriteItems);
 	}
 
-	RezFile* rezFile;
-	LT_MEM_TRACK_ALLOC(rezFile = new RezFile(this), LT_MEM_TYPE_MISC);
-	assert(rezFile != nullptr);
+	BaseRezFile* rezFile = OpenRezFile(filename, readOnly, createNew);
 	if (rezFile == nullptr)
 	{
 		delete [] filename_;
 		filename_ = nullptr;
 		return false;
 	}
-	rezFilesList_.Insert(rezFile);
-	++numRezFiles_;
 
-	if (!rezFile->Open(filename, readOnly, createNew)) return false;
-
-	FileMainHeaderStruct header;
-	rezFile->Read(0, 0, sizeof(header), &header);
+	FileMainHeaderStructV3 header;
+	if (!ReadMainHeader(rezFile, &header)) return false;
 
 	if (header.LargestKeyAry > largestKeyArray_) largestKeyArray_ = header.LargestKeyAry;
 	if (header.LargestDirNameSize > largestDirNameSize_) largestDirNameSize_ = header.LargestDirNameSize;
 	if (header.LargestRezNameSize > largestRezNameSize_) largestRezNameSize_ = header.LargestRezNameSize;
 	if (header.LargestCommentSize > largestCommentSize_) largestCommentSize_ = header.LargestCommentSize;
 
-	assert(header.CR1 == 0x0d);
-	assert(header.LF2 == 0x0a);
-	assert(header.EOF1 == 0x1a);
-	assert(header.FileFormatVersion == 1);
-
-	rootDir_->ReadAllDirs(rezFile, header.RootDirPos, header.RootDirSize, overwriteItems);
-	return true;
+	return rootDir_->ReadAllDirs(rezFile, header.RootDirPos, header.RootDirSize, header.FileFormatVersion, overwriteItems);
 }
 
-bool RezMgr::ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, const char* paramPath, bool overwriteItems)
+BaseRezFile* RezMgr::OpenRezFile(const char* filename, bool readOnly, bool createNew)
 {
-	assert(rezDir != nullptr);
-	assert(this != nullptr);
+	BaseRezFile* rezFile = nullptr;
+
+	// try to map read only files first, anything that can't be mapped (or is opened for writing) uses RezFile
+	if (readOnly && (fileAccess_ == RezFileAccessMapped))
+	{
+		LT_MEM_TRACK_ALLOC(rezFile = new RezFileMapped(this), LT_MEM_TYPE_MISC);
+		assert(rezFile != nullptr);
+		if ((rezFile != nullptr) && !rezFile->Open(filename, readOnly, createNew))
+		{
+			delete rezFile;
+			rezFile = nullptr;
+		}
+	}
+
+	if (rezFile == nullptr)
+	{
+		if (fileAccess_ == RezFileAccessPositional)
+		{
+			LT_MEM_TRACK_ALLOC(rezFile = new RezFilePositional(this), LT_MEM_TYPE_MISC);
+		}
+		else if (fileAccess_ == RezFileAccessAsync)
+		{
+			LT_MEM_TRACK_ALLOC(rezFile = new RezFileAsync(this), LT_MEM_TYPE_MISC);
+		}
+		else
+		{
+			LT_MEM_TRACK_ALLOC(rezFile = new RezFile(this), LT_MEM_TYPE_MISC);
+		}
+		assert(rezFile != nullptr);
+		if (rezFile == nullptr) return nullptr;
+
+		// asynchronous files already keep the disk busy on their own
+		if (readOnly && (readAheadMaxWindow_ > 0) && (fileAccess_ != RezFileAccessAsync))
+		{
+			unsigned long minWindow = (readAheadMinWindow_ < readAheadMaxWindow_) ? readAheadMinWindow_ : readAheadMaxWindow_;
+			BaseRezFile* readAhead;
+			LT_MEM_TRACK_ALLOC(readAhead = new RezFileReadAhead(this, rezFile, minWindow, readAheadMaxWindow_), LT_MEM_TYPE_MISC);
+			assert(readAhead != nullptr);
+			if (readAhead != nullptr) rezFile = readAhead;
+		}
+
+		if (readOnly && (blockCacheBudget_ > 0))
+		{
+			if (blockCache_ == nullptr)
+			{
+				LT_MEM_TRACK_ALLOC(blockCache_ = new RezBlockCache(blockCacheBudget_, blockCacheBlockSize_), LT_MEM_TYPE_MISC);
+				assert(blockCache_ != nullptr);
+			}
+			if (blockCache_ != nullptr)
+			{
+				BaseRezFile* cached;
+				LT_MEM_TRACK_ALLOC(cached = new RezFileBlockCache(this, rezFile, blockCache_), LT_MEM_TYPE_MISC);
+				assert(cached != nullptr);
+				if (cached != nullptr) rezFile = cached;
+			}
+		}
+
+		if (!readOnly && (writeCombineSize_ > 0))
+		{
+			BaseRezFile* combined;
+			LT_MEM_TRACK_ALLOC(combined = new RezFileWriteCombine(this, rezFile, writeCombineSize_), LT_MEM_TYPE_MISC);
+			assert(combined != nullptr);
+			if (combined != nullptr) rezFile = combined;
+		}
+
+		if (!readOnly && (backgroundSaveQueue_ > 0))
+		{
+			BaseRezFile* background;
+			LT_MEM_TRACK_ALLOC(background = new RezFileBackgroundWrite(this, rezFile, backgroundSaveQueue_), LT_MEM_TYPE_MISC);
+			assert(background != nullptr);
+			if (background != nullptr) rezFile = background;
+		}
+
+		if (!rezFile->Open(filename, readOnly, createNew))
+		{
+			delete rezFile;
+			return nullptr;
+		}
+	}
+
+	rezFilesList_.Insert(rezFile);
+	++numRezFiles_;
+	return rezFile;
+}
+
+#if !defined(_WIN32)
+// links are followed, so a directory remembers the ones above it and a link back up to one of them is left alone
+struct RezMgr::RezEmulationDirId
+{
+	dev_t dev;
+	ino_t ino;
+	const RezEmulationDirId* parent;
+};
+#endif
+
+bool RezMgr::ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, const char* paramPath, bool overwriteItems)
+{
+	assert(rezDir != nullptr);
+	assert(this != nullptr);
 	assert(paramPath != nullptr);
 	assert(fileOpened_);
 
+#if defined(_WIN32)
 	// figure out the path to this dir with added backslash
 	char path[_MAX_DRIVE+_MAX_DIR+_MAX_FNAME+_MAX_EXT+5];
 	strcpy(path, paramPath);
@@ -1314,6 +3041,7 @@ bool RezMgr::ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation,
 	strcpy(findPath, path);
 	strcat(findPath, "*.*");
 
+	bool retFlag = true;
 	_finddata_t fileInfo;
 	long findHandle = _findfirst(findPath, &fileInfo);
 	if (findHandle >= 0)
@@ -1341,10 +3069,11 @@ bool RezMgr::ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation,
 				if (newDir == nullptr)
 				{
 					assert(false);
+					retFlag = false;
 					continue;
 				}
 
-				ReadEmulationDirectory(rezFileEmulation, newDir, pathName, overwriteItems);
+				if (!ReadEmulationDirectory(rezFileEmulation, newDir, pathName, overwriteItems)) retFlag = false;
 			}
 			else
 			{
@@ -1352,267 +3081,1298 @@ bool RezMgr::ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation,
 				strcpy(fileName, path);
 				strcat(fileName, fileInfo.name);
 
-				char drive[_MAX_DRIVE+1];
-				char dir[_MAX_DIR+1];
-				char fname[_MAX_FNAME+1+_MAX_EXT+1];
-				char ext[_MAX_EXT+1];
-				_splitpath(fileName, drive, dir, fname, ext);
+				if (!AddEmulationFile(rezFileEmulation, rezDir, fileName, fileInfo.name, fileInfo.size, (unsigned long)fileInfo.time_write, overwriteItems)) retFlag = false;
+			}
+		} while (_findnext(findHandle, &fileInfo) == 0);
 
-				char rezName[_MAX_DRIVE+_MAX_DIR+_MAX_FNAME+_MAX_EXT+5];
-				assert(strlen(fname) < _MAX_DRIVE+_MAX_DIR+_MAX_FNAME+_MAX_EXT+5);
-				strcpy(rezName, fname);
-				_strupr(rezName);
+		_findclose(findHandle);
+	}
 
-				// figure out the ID for this file (if name is all digits use it as ID number, otherwise
-				// assign a number)
-				unsigned long rezId;
-				{
-					int nameLength = (int)strlen(rezName);
-					int i;
-					for (i = 0; i < nameLength; ++i)
-					{
-						if ((rezName[i] < '0') || (rezName[i] > '9')) break;
-					}
-					if (i < nameLength)
-					{
-						rezId = nextIDNumToUse_;
-						++nextIDNumToUse_;
-					}
-					else
-					{
-						rezId = atol(rezName);
-					}
-				}
+	return retFlag;
+#else
+	char path[kRezEmulationMaxPath];
+	unsigned long pathLength = (unsigned long)strlen(paramPath);
+	if (pathLength + 2 > kRezEmulationMaxPath) return false;
+	strcpy(path, paramPath);
+	if ((pathLength == 0) || (path[pathLength-1] != '/')) path[pathLength++] = '/';
+	path[pathLength] = '\0';
 
-				unsigned long rezTypeId;
-				if (strlen(ext) > 5)
-				{
-					strncat(rezName, ext, _MAX_FNAME+1+_MAX_EXT);
-					fname[_MAX_FNAME] = '\0';
-					rezTypeId = 0;
-				}
-				else
-				{
-					char sExt[5];
-					if (strlen(ext) > 0)
-					{
-						strcpy(sExt, &ext[1]);
-						_strupr(sExt);
-						rezTypeId = StrToType(sExt);
-					}
-					else
-					{
-						rezTypeId = 0;
-					}
-				}
+	int dirFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirFd < 0) return false;
 
-				char sType[5];
-				TypeToStr(rezTypeId, sType);
+	struct stat st;
+	if (fstat(dirFd, &st) != 0)
+	{
+		close(dirFd);
+		return false;
+	}
+	RezEmulationDirId dirId = { st.st_dev, st.st_ino, nullptr };
 
-				RezType* rezType = rezDir->GetOrMakeType(rezTypeId);
-				assert(rezType != nullptr);
+	bool retFlag = ReadEmulationDirectoryAt(rezFileEmulation, rezDir, dirFd, &dirId, path, pathLength, overwriteItems);
+	close(dirFd);
+	return retFlag;
+#endif
+}
 
-				RezItem* rezItem;
-				rezItem = rezDir->GetRez(rezName, rezTypeId);
-				if (rezItem == nullptr)
-				{
-					rezItem = rezDir->CreateRezInternal(rezId, rezName, rezType, nullptr);
-				}
-				else
-				{
-					if (overwriteItems)
-					{
-						rezDir->RemoveRezInternal(rezType, rezItem);
-						rezItem = rezDir->CreateRezInternal(rezId, rezName, rezType, nullptr);
-					}
-					else
-					{
-						rezItem = nullptr;
-					}
-				}
+#if !defined(_WIN32)
+#if defined(__linux__) && defined(SYS_getdents64)
+// what getdents64 fills its buffer with (glibc only has a wrapper for it from 2.30 on)
+struct RezLinuxDirent64
+{
+	unsigned long long d_ino;
+	long long          d_off;
+	unsigned short     d_reclen;
+	unsigned char      d_type;
+	char               d_name[1];
+};
+#endif
+
+// Walks a directory through its descriptor, entries are looked at and subdirectories opened relative to it
+// so the kernel never walks the whole path again. path holds the directory's own path (ending in '/') up
+// to pathLength, names are appended in place and only files copy it out, to be opened later. An entry that
+// can't be read doesn't stop the walk, but the result is false.
+bool RezMgr::ReadEmulationDirectoryAt(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, int dirFd, const RezEmulationDirId* dirId,
+									  char* path, unsigned long pathLength, bool overwriteItems)
+{
+#if defined(__linux__) && defined(SYS_getdents64)
+	// a big buffer gets a directory of thousands of files in a handful of calls
+	char* buffer;
+	LT_MEM_TRACK_ALLOC(buffer = new char[kRezEmulationDirBufferSize], LT_MEM_TYPE_MISC);
+	assert(buffer != nullptr);
+	if (buffer == nullptr) return false;
 
-				if (rezItem != nullptr)
-				{
-					rezItem->SetTime((unsigned long)fileInfo.time_write);
-					rezItem->size_ = fileInfo.size;
-					rezItem->rezFile_ = new RezFileSingleFile(this, fileName, rezFileEmulation);
-					assert(rezItem->rezFile_ != nullptr);
-				}
+	bool retFlag = true;
+	long bytes;
+	while ((bytes = syscall(SYS_getdents64, dirFd, buffer, kRezEmulationDirBufferSize)) > 0)
+	{
+		long offset = 0;
+		while (offset < bytes)
+		{
+			RezLinuxDirent64* entry = (RezLinuxDirent64*)(buffer + offset);
+			offset += entry->d_reclen;
+			if (!ReadEmulationEntry(rezFileEmulation, rezDir, dirFd, dirId, entry->d_name, entry->d_type, path, pathLength, overwriteItems)) retFlag = false;
+		}
+	}
+
+	LT_MEM_TRACK_FREE(delete [] buffer);
+	return retFlag && (bytes == 0);
+#else
+	// fdopendir takes over the descriptor it is given, so give it its own
+	int readFd = dup(dirFd);
+	if (readFd < 0) return false;
+	DIR* dir = fdopendir(readFd);
+	if (dir == nullptr)
+	{
+		close(readFd);
+		return false;
+	}
+
+	bool retFlag = true;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (!ReadEmulationEntry(rezFileEmulation, rezDir, dirFd, dirId, entry->d_name, entry->d_type, path, pathLength, overwriteItems)) retFlag = false;
+	}
+
+	closedir(dir);
+	return retFlag;
+#endif
+}
+
+bool RezMgr::ReadEmulationEntry(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, int dirFd, const RezEmulationDirId* dirId,
+								const char* name, unsigned char type, char* path, unsigned long pathLength, bool overwriteItems)
+{
+	if ((name[0] == '.') && ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))) return true;
+
+	unsigned long nameLength = (unsigned long)strlen(name);
+	if (pathLength + nameLength + 2 > kRezEmulationMaxPath)
+	{
+		assert(false && "path too long for directory emulation");
+		return false;
+	}
+
+	// directories and plain files say what they are, only anything else (links, or file systems that
+	// don't fill in the type) needs a stat to find out, files need one anyway for their size and time
+	struct stat st;
+	bool isDir = (type == DT_DIR);
+	if (!isDir)
+	{
+		// a file deleted since the directory was listed just isn't there
+		if (fstatat(dirFd, name, &st, 0) != 0) return (errno == ENOENT);
+		isDir = S_ISDIR(st.st_mode);
+	}
+
+	if (isDir)
+	{
+		int subDirFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (subDirFd < 0) return (errno == ENOENT);
+
+		// a link back up to a directory that is already being read would go round for ever
+		struct stat dirSt;
+		if (fstat(subDirFd, &dirSt) != 0)
+		{
+			close(subDirFd);
+			return false;
+		}
+		for (const RezEmulationDirId* it = dirId; it != nullptr; it = it->parent)
+		{
+			if ((it->dev == dirSt.st_dev) && (it->ino == dirSt.st_ino))
+			{
+				close(subDirFd);
+				return true;
 			}
-		} while (_findnext(findHandle, &fileInfo) == 0);
+		}
+		RezEmulationDirId subDirId = { dirSt.st_dev, dirSt.st_ino, dirId };
 
-		_findclose(findHandle);
+		char baseName[kRezEmulationMaxPath];
+		strcpy(baseName, name);
+		if (!lowerCaseUsed_) RezStrUpr(baseName);
+
+		RezDir* newDir = rezDir->GetDir(baseName);
+		if (newDir == nullptr) newDir = rezDir->CreateDir(baseName);
+		if (newDir == nullptr)
+		{
+			assert(false);
+			close(subDirFd);
+			return false;
+		}
+
+		memcpy(path + pathLength, name, nameLength);
+		path[pathLength + nameLength] = '/';
+		path[pathLength + nameLength + 1] = '\0';
+
+		bool retFlag = ReadEmulationDirectoryAt(rezFileEmulation, newDir, subDirFd, &subDirId, path, pathLength + nameLength + 1, overwriteItems);
+		close(subDirFd);
+		path[pathLength] = '\0';
+		return retFlag;
+	}
+
+	if (!S_ISREG(st.st_mode)) return true;
+
+	memcpy(path + pathLength, name, nameLength + 1);
+	bool retFlag = AddEmulationFile(rezFileEmulation, rezDir, path, name, (RezPos)st.st_size, (unsigned long)st.st_mtime, overwriteItems);
+	path[pathLength] = '\0';
+	return retFlag;
+}
+#endif
+
+// adds a loose file found by ReadEmulationDirectory as an item in rezDir, name is the file's name
+// without its path (the extension becomes the type) and fileName is the whole path to open it with
+bool RezMgr::AddEmulationFile(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, const char* fileName,
+							  const char* name, RezPos size, unsigned long time, bool overwriteItems)
+{
+	// split the name at the last dot into the item's name and its extension
+	const char* dot = strrchr(name, '.');
+	size_t nameLength = (dot != nullptr) ? (size_t)(dot - name) : strlen(name);
+	const char* ext = (dot != nullptr) ? dot : "";
+
+	char rezName[kRezEmulationMaxPath];
+	if (nameLength + strlen(ext) + 1 > kRezEmulationMaxPath)
+	{
+		assert(false && "file name too long for directory emulation");
+		return false;
+	}
+	memcpy(rezName, name, nameLength);
+	rezName[nameLength] = '\0';
+	RezStrUpr(rezName);
+
+	// figure out the ID for this file (if name is all digits use it as ID number, otherwise
+	// assign a number)
+	unsigned long rezId;
+	{
+		int i;
+		for (i = 0; i < (int)nameLength; ++i)
+		{
+			if ((rezName[i] < '0') || (rezName[i] > '9')) break;
+		}
+		if (i < (int)nameLength)
+		{
+			rezId = nextIDNumToUse_;
+			++nextIDNumToUse_;
+		}
+		else
+		{
+			rezId = atol(rezName);
+		}
+	}
+
+	// extensions too long to be a type stay part of the name
+	unsigned long rezTypeId;
+	if (strlen(ext) > 5)
+	{
+		strcat(rezName, ext);
+		rezTypeId = 0;
+	}
+	else
+	{
+		char sExt[5];
+		if (strlen(ext) > 0)
+		{
+			strcpy(sExt, &ext[1]);
+			RezStrUpr(sExt);
+			rezTypeId = StrToType(sExt);
+		}
+		else
+		{
+			rezTypeId = 0;
+		}
+	}
+
+	RezType* rezType = rezDir->GetOrMakeType(rezTypeId);
+	assert(rezType != nullptr);
+
+	RezItem* rezItem;
+	rezItem = rezDir->GetRez(rezName, rezTypeId);
+	if (rezItem == nullptr)
+	{
+		rezItem = rezDir->CreateRezInternal(rezId, rezName, rezType, nullptr);
+	}
+	else
+	{
+		if (overwriteItems)
+		{
+			rezDir->RemoveRezInternal(rezType, rezItem);
+			rezItem = rezDir->CreateRezInternal(rezId, rezName, rezType, nullptr);
+		}
+		else
+		{
+			rezItem = nullptr;
+		}
+	}
+
+	if (rezItem != nullptr)
+	{
+		rezItem->SetTime(time);
+		rezItem->size_ = size;
+		rezItem->storedSize_ = size;
+		rezItem->rezFile_ = new RezFileSingleFile(this, fileName, rezFileEmulation);
+		assert(rezItem->rezFile_ != nullptr);
+	}
+	return true;
+}
+
+bool RezMgr::Close(bool compact)
+{
+	assert(fileOpened_);
+	bool retVal;
+
+	// nothing may still be reading into items we are about to delete
+	WaitForAsyncLoads();
+
+	bool flushed = readOnly_ || Flush();
+
+	retVal = primaryRezFile_->Close() && flushed;
+
+	// only the primary file is ever written to
+	primaryRezFile_->GetWriteStats(&closedWriteStats_);
+
+	rezFilesList_.Delete(primaryRezFile_);
+	--numRezFiles_;
+	delete primaryRezFile_;
+	primaryRezFile_ = nullptr;
+
+	BaseRezFile* rezFile;
+	while ((rezFile = rezFilesList_.GetFirst()) != nullptr)
+	{
+		rezFile->Close();
+		rezFilesList_.Delete(rezFile);
+		--numRezFiles_;
+		delete rezFile;
+	}
+
+	if (blockCache_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete blockCache_);
+		blockCache_ = nullptr;
+	}
+
+	FreeDictionaries();
+	storedData_.clear();
+	storedDataByHash_.clear();
+
+	if (indexBuffer_ != nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] indexBuffer_);
+		indexBuffer_ = nullptr;
+	}
+	index_ = nullptr;
+	dirsRead_ = true;
+
+	if (rootDir_ != nullptr)
+	{
+		delete rootDir_;
+		rootDir_ = nullptr;
+	}
+	if (filename_ != nullptr)
+	{
+		delete [] filename_;
+		filename_ = nullptr;
+	}
+
+	fileOpened_ = false;
+	return retVal;
+}
+
+bool RezMgr::WaitForAsyncLoads()
+{
+	std::unique_lock<std::mutex> lock(asyncMutex_);
+	while (numAsyncLoads_ > 0) asyncLoadsDone_.wait(lock);
+	return true;
+}
+
+bool RezMgr::LoadBatch(RezItem** rezItems, unsigned long numItems, unsigned long* numReads)
+{
+	assert((rezItems != nullptr) || (numItems == 0));
+
+	bool retFlag = true;
+	unsigned long reads = 0;
+
+	// pick out the items that actually need reading, anything already in memory, empty, or in a
+	// mapped file is loaded straight away without touching the disk (as are items patched from two files)
+	RezItem** toRead;
+	LT_MEM_TRACK_ALLOC(toRead = new RezItem*[numItems + 1], LT_MEM_TYPE_MISC);
+	if (toRead == nullptr) return false;
+
+	unsigned long numToRead = 0;
+	for (unsigned long i = 0; i < numItems; ++i)
+	{
+		RezItem* rezItem = rezItems[i];
+		assert(rezItem != nullptr);
+		assert(rezItem->parentDir_ != nullptr);
+		assert(rezItem->rezFile_ != nullptr);
+
+		if (rezItem->IsLoaded() || (rezItem->size_ == 0)) continue;
+		if (rezItem->rezFile_->IsMapped() || (rezItem->deltaData_ != nullptr))
+		{
+			if (rezItem->Load() == nullptr) retFlag = false;
+			continue;
+		}
+		toRead[numToRead++] = rezItem;
+	}
+
+	std::sort(toRead, toRead + numToRead, [](RezItem* a, RezItem* b) -> bool
+	{
+		if (a->rezFile_ != b->rezFile_) return (a->rezFile_ < b->rezFile_);
+		return (a->filePos_ < b->filePos_);
+	});
+
+	unsigned long first = 0;
+	while (first < numToRead)
+	{
+		// grow the run while the next item is in the same file and close enough to merge
+		BaseRezFile* rezFile = toRead[first]->rezFile_;
+		RezPos runPos = toRead[first]->filePos_;
+		RezPos runEnd = runPos + toRead[first]->storedSize_;
+		unsigned long last = first + 1;
+		while (last < numToRead)
+		{
+			RezItem* next = toRead[last];
+			RezPos nextEnd = next->filePos_ + next->storedSize_;
+			if (next->rezFile_ != rezFile) break;
+			if (next->filePos_ > runEnd + batchReadGap_) break;
+			if (((nextEnd > runEnd) ? nextEnd : runEnd) - runPos > batchReadMaxSize_) break;
+			if (nextEnd > runEnd) runEnd = nextEnd;
+			++last;
+		}
+
+		// a run of one item reads straight into its own buffer, anything longer goes through a scratch buffer
+		if (last - first == 1)
+		{
+			if (toRead[first]->Load() == nullptr) retFlag = false;
+			++reads;
+		}
+		else
+		{
+			unsigned long runSize = (unsigned long)(runEnd - runPos);
+			unsigned char* buf;
+			LT_MEM_TRACK_ALLOC(buf = new unsigned char[runSize], LT_MEM_TYPE_MISC);
+			assert(buf != nullptr);
+
+			++reads;
+			if ((buf == nullptr) || (rezFile->Read(runPos, 0, runSize, buf) != runSize))
+			{
+				retFlag = false;
+			}
+			else
+			{
+				for (unsigned long i = first; i < last; ++i)
+				{
+					RezItem* rezItem = toRead[i];
+					if (rezItem->data_ != nullptr) continue;
+
+					LT_MEM_TRACK_ALLOC(rezItem->data_ = new unsigned char[(size_t)rezItem->size_], LT_MEM_TYPE_MISC);
+					assert(rezItem->data_ != nullptr);
+					if (rezItem->data_ == nullptr)
+					{
+						retFlag = false;
+						continue;
+					}
+					// compressed items are decompressed straight out of the scratch buffer
+					const unsigned char* stored = buf + (size_t)(rezItem->filePos_ - runPos);
+					if (!rezItem->DecompressStored(stored, rezItem->data_) || !rezItem->VerifyLoaded(rezItem->data_))
+					{
+						LT_MEM_TRACK_FREE(delete [] rezItem->data_);
+						rezItem->data_ = nullptr;
+						retFlag = false;
+					}
+				}
+			}
+
+			if (buf != nullptr) LT_MEM_TRACK_FREE(delete [] buf);
+		}
+
+		first = last;
+	}
+
+	LT_MEM_TRACK_FREE(delete [] toRead);
+
+	if (numReads != nullptr) *numReads = reads;
+	return retFlag;
+}
+
+bool RezMgr::ReadV(RezItemRead* reads, unsigned long numReads, unsigned long* numFileReads)
+{
+	assert((reads != nullptr) || (numReads == 0));
+
+	bool retFlag = true;
+	unsigned long fileReads = 0;
+
+	// pieces of items already in memory are copied straight away, the rest are turned into file reads
+	RezPendingRead* pending;
+	LT_MEM_TRACK_ALLOC(pending = new RezPendingRead[numReads + 1], LT_MEM_TYPE_MISC);
+	if (pending == nullptr) return false;
+
+	// items that have to be loaded whole for their pieces are unloaded again once they have been copied out
+	std::vector<RezItem*> loaded;
+
+	unsigned long numPending = 0;
+	for (unsigned long i = 0; i < numReads; ++i)
+	{
+		RezItem* rezItem = reads[i].rezItem;
+		assert(rezItem != nullptr);
+		assert(rezItem->rezFile_ != nullptr);
+		assert(reads[i].data != nullptr);
+		assert(reads[i].offset + reads[i].length <= rezItem->size_);
+
+		if (reads[i].length <= 0) continue;
+		if (reads[i].offset + reads[i].length > rezItem->size_)
+		{
+			retFlag = false;
+			continue;
+		}
+
+		// chunked items decompress just the chunks the piece overlaps, items compressed whole (or patched) are loaded
+		unsigned char* memoryData = rezItem->GetMemoryData();
+		if ((memoryData == nullptr) && rezItem->IsCompressed() && !rezItem->MustLoadWhole())
+		{
+			if (!rezItem->ReadChunks((unsigned char*)reads[i].data, reads[i].offset, reads[i].length)) retFlag = false;
+			continue;
+		}
+		if ((memoryData == nullptr) && rezItem->MustLoadWhole())
+		{
+			memoryData = rezItem->Load();
+			if (memoryData == nullptr)
+			{
+				retFlag = false;
+				continue;
+			}
+			loaded.push_back(rezItem);
+		}
+		if (memoryData != nullptr)
+		{
+			memcpy(reads[i].data, memoryData + (size_t)reads[i].offset, reads[i].length);
+			continue;
+		}
+
+		RezPendingRead* read = &pending[numPending++];
+		read->rezFile   = rezItem->rezFile_;
+		read->read.pos  = rezItem->filePos_ + reads[i].offset;
+		read->read.size = reads[i].length;
+		read->read.data = reads[i].data;
+	}
+
+	for (size_t i = 0; i < loaded.size(); ++i) loaded[i]->UnLoad();
+
+	std::sort(pending, pending + numPending, [](const RezPendingRead& a, const RezPendingRead& b) -> bool
+	{
+		if (a.rezFile != b.rezFile) return (a.rezFile < b.rezFile);
+		return (a.read.pos < b.read.pos);
+	});
+
+	// each file gets its own pieces in one go, in file order
+	RezFileRead* fileRead;
+	LT_MEM_TRACK_ALLOC(fileRead = new RezFileRead[numPending + 1], LT_MEM_TYPE_MISC);
+	if (fileRead == nullptr)
+	{
+		LT_MEM_TRACK_FREE(delete [] pending);
+		return false;
+	}
+	for (unsigned long i = 0; i < numPending; ++i) fileRead[i] = pending[i].read;
+
+	unsigned long first = 0;
+	while (first < numPending)
+	{
+		BaseRezFile* rezFile = pending[first].rezFile;
+		unsigned long last = first + 1;
+		while ((last < numPending) && (pending[last].rezFile == rezFile)) ++last;
+
+		if (!rezFile->ReadV(fileRead + first, last - first, batchReadGap_, &fileReads)) retFlag = false;
+		first = last;
+	}
+
+	LT_MEM_TRACK_FREE(delete [] fileRead);
+	LT_MEM_TRACK_FREE(delete [] pending);
+
+	if (numFileReads != nullptr) *numFileReads = fileReads;
+	return retFlag;
+}
+
+void RezMgr::GetHandleCacheStats(RezHandleCacheStats* stats)
+{
+	assert(stats != nullptr);
+
+	memset(stats, 0, sizeof(RezHandleCacheStats));
+	BaseRezFile* rezFile = rezFilesList_.GetFirst();
+	while (rezFile != nullptr)
+	{
+		rezFile->GetHandleCacheStats(stats);
+		rezFile = rezFile->Next();
+	}
+}
+
+void RezMgr::SetReadAhead(unsigned long minWindow, unsigned long maxWindow)
+{
+	readAheadMinWindow_ = minWindow;
+	readAheadMaxWindow_ = maxWindow;
+
+	if ((maxWindow > 0) && (fileAccess_ == RezFileAccessMapped)) fileAccess_ = RezFileAccessStdio;
+}
+
+void RezMgr::GetReadAheadStats(RezReadAheadStats* stats)
+{
+	assert(stats != nullptr);
+
+	memset(stats, 0, sizeof(RezReadAheadStats));
+	BaseRezFile* rezFile = rezFilesList_.GetFirst();
+	while (rezFile != nullptr)
+	{
+		rezFile->GetReadAheadStats(stats);
+		rezFile = rezFile->Next();
+	}
+}
+
+void RezMgr::GetWriteStats(RezWriteStats* stats)
+{
+	assert(stats != nullptr);
+
+	memcpy(stats, &closedWriteStats_, sizeof(RezWriteStats));
+	BaseRezFile* rezFile = rezFilesList_.GetFirst();
+	while (rezFile != nullptr)
+	{
+		rezFile->GetWriteStats(stats);
+		rezFile = rezFile->Next();
+	}
+
+	stats->bytesDeduplicated = bytesDeduplicated_;
+	stats->numDeduplicated   = numDeduplicated_;
+	stats->bytesPadding      = bytesPadding_;
+	stats->numAligned        = numAligned_;
+}
+
+void RezMgr::SetItemAlignment(unsigned long itemSize, unsigned long boundary)
+{
+	assert((boundary > 0) && ((boundary & (boundary - 1)) == 0));
+	if ((boundary == 0) || ((boundary & (boundary - 1)) != 0)) return;
+
+	alignItemSize_ = itemSize;
+	alignBoundary_ = boundary;
+}
+
+void RezMgr::GetChecksumStats(RezChecksumStats* stats)
+{
+	assert(stats != nullptr);
+
+	std::lock_guard<std::mutex> lock(checksumMutex_);
+	memcpy(stats, &checksumStats_, sizeof(RezChecksumStats));
+}
+
+void RezMgr::SetBlockCache(unsigned long budget, unsigned long blockSize)
+{
+	blockCacheBudget_    = budget;
+	blockCacheBlockSize_ = blockSize;
+
+	if ((budget > 0) && (fileAccess_ == RezFileAccessMapped)) fileAccess_ = RezFileAccessStdio;
+}
+
+bool RezMgr::GetBlockCacheStats(RezBlockCacheStats* stats)
+{
+	assert(stats != nullptr);
+
+	if (blockCache_ == nullptr) return false;
+	blockCache_->GetStats(stats);
+	return true;
+}
+
+void RezMgr::BeginAsyncLoad()
+{
+	std::lock_guard<std::mutex> lock(asyncMutex_);
+	++numAsyncLoads_;
+}
+
+void RezMgr::EndAsyncLoad()
+{
+	{
+		std::lock_guard<std::mutex> lock(asyncMutex_);
+		--numAsyncLoads_;
+	}
+	asyncLoadsDone_.notify_all();
+}
+
+RezDir* RezMgr::GetRootDir()
+{
+	assert(fileOpened_);
+	if (index_ != nullptr) ReadIndexedDirs();
+	return rootDir_;
+}
+
+unsigned long RezMgr::StrToType(const char* s)
+{
+	assert(s != nullptr);
+	if (s == nullptr) return 0;
+
+	unsigned long rezTypeId = 0;
+	unsigned char* p = (unsigned char*)&rezTypeId;
+
+	int length = (int)strlen(s);
+
+	if (length > 0) p[length-1] = s[0];
+	if (length > 1) p[length-2] = s[1];
+	if (length > 2) p[length-3] = s[2];
+	if (length > 3) p[length-4] = s[3];
+	
+	return rezTypeId;
+}
+
+void RezMgr::TypeToStr(unsigned long rezTypeId, char* sType)
+{
+	assert(sType != nullptr);
+	if (sType == nullptr) return;
+	unsigned char* pType = (unsigned char*)&rezTypeId;
+	int length = 0;
+
+	if (pType[3] != '\0') length = 4;
+	else if (pType[2] != '\0') length = 3;
+	else if (pType[1] != '\0') length = 2;
+	else if (pType[0] != '\0') length = 1;
+
+	if (length > 0) sType[0] = pType[length-1];
+	if (length > 1) sType[1] = pType[length-2];
+	if (length > 2) sType[2] = pType[length-3];
+	if (length > 3) sType[3] = pType[length-4];
+
+	sType[length] = '\0';
+}
+
+void* RezMgr::Alloc(unsigned long numBytes)
+{
+	assert(false);
+	return nullptr;
+}
+
+void RezMgr::Free(void* p)
+{
+	assert(false);
+}
+
+bool RezMgr::DiskError()
+{
+	return false;
+}
+
+bool RezMgr::VerifyFileOpen()
+{
+	bool retVal = true;
+	BaseRezFile* rezFile = rezFilesList_.GetFirst();
+	while (rezFile != nullptr)
+	{
+		if (rezFile->VerifyFileOpen() == false) retVal = false;
+		rezFile = rezFile->Next();
+	}
+	return retVal;
+}
+
+void RezMgr::SetHashTableBins(unsigned int nByNameNumHashBins, unsigned int nByIDNumHashBins,
+                              unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins)
+{
+	byNameNumHashBins_ = nByNameNumHashBins;
+	byIDNumHashBins_   = nByIDNumHashBins;
+	dirNumHashBins_    = nDirNumHashBins;
+	typeNumHashBins_   = nTypeNumHashBins;
+}
+
+bool RezMgr::Flush()
+{
+	assert(readOnly_ != true);
+
+	if (readOnly_)
+		return false;
+
+	std::lock_guard<std::mutex> lock(saveMutex_);
+
+	// save the next write pos for the header information
+	RezPos saveWritePos = nextWritePos_;
+
+	// write out all of the directories, compressed items, checksums and deltas need the extra records only version 2 has
+	// (as does the path index, which only goes with version 2 directories)
+	bool pathIndex = pathIndex_ && (headerSize_ >= sizeof(FileMainHeaderStructV3));
+	unsigned long version = (fileFormatVersion_ >= 2) ? 2 : 1;
+	if ((version == 1) && (hasCompressedItems_ || hasChecksums_ || hasDeltas_ || pathIndex))
+	{
+		version = 2;
+		assert(headerSize_ >= sizeof(FileMainHeaderStructV2));
+		if (headerSize_ < sizeof(FileMainHeaderStructV2)) return false;
+	}
+	// a directory block that didn't make it to the file must not end up in the header
+	if (!rootDir_->WriteAllDirs(primaryRezFile_, &rootDirPos_, &rootDirSize_, version)) return false;
+
+	// version 1 can't hold positions past 4 GB, if the file got that big write the directories again
+	// over the ones just written as version 2 instead
+	if ((version == 1) && (nextWritePos_ > REZ_MAX_V1_POS))
+	{
+		nextWritePos_ = saveWritePos;
+
+		// files made before version 2 existed may have data right after the smaller header
+		assert(headerSize_ >= sizeof(FileMainHeaderStructV2));
+		if (headerSize_ < sizeof(FileMainHeaderStructV2)) return false;
+
+		version = 2;
+		if (!rootDir_->WriteAllDirs(primaryRezFile_, &rootDirPos_, &rootDirSize_, version)) return false;
+	}
+
+	// the path index goes after the directories, a file with one is version 3
+	RezPos indexPos = 0;
+	RezPos indexSize = 0;
+	if (pathIndex && !WriteIndex(&indexPos, &indexSize)) return false;
+	if (indexSize > 0) version = 3;
+	fileFormatVersion_ = version;
+
+	// fill out the permant parts of the header (the version 2 and 3 layouts are the same up to FileFormatVersion)
+	FileMainHeaderStructV3 header;
+	header.CR1 = 0x0d;
+	header.CR2 = 0x0d;
+	header.CR3 = 0x0d;
+	header.LF1 = 0x0a;
+	header.LF2 = 0x0a;
+	header.LF3 = 0x0a;
+	header.EOF1 = 0x1a;
+	
+	memset(header.FileType, ' ', RezMgrUserTitleSize);
+	if (version >= 3) strcpy(header.FileType, "RezMgr Version 3 Copyright (C) 1995 MONOLITH INC.");
+	else if (version >= 2) strcpy(header.FileType, "RezMgr Version 2 Copyright (C) 1995 MONOLITH INC.");
+	else strcpy(header.FileType, "RezMgr Version 1 Copyright (C) 1995 MONOLITH INC.");
+	header.FileType[strlen(header.FileType)] = ' ';
+	
+	memset(header.UserTitle, ' ', RezMgrUserTitleSize);
+	if (userTitle_[0] != '\0') memcpy(header.UserTitle, userTitle_, strlen(userTitle_));
+
+	header.FileFormatVersion      = version;
+	header.RootDirPos             = rootDirPos_;
+	header.RootDirSize            = rootDirSize_;
+	header.RootDirTime            = rootDirTime_;
+	header.NextWritePos           = saveWritePos;
+	header.Time                   = lastTimeModified_;
+	header.LargestKeyAry          = largestKeyArray_;
+	header.LargestDirNameSize     = largestDirNameSize_;
+	header.LargestRezNameSize     = largestRezNameSize_;
+	header.LargestCommentSize     = largestCommentSize_;
+	header.IsSorted               = isSorted_;
+	header.IndexPos               = indexPos;
+	header.IndexSize              = indexSize;
+
+	if (version >= 3)
+	{
+		primaryRezFile_->Write(0, 0, sizeof(header), &header);
+	}
+	else if (version >= 2)
+	{
+		// the version 2 header is the version 3 one without the path index on the end
+		primaryRezFile_->Write(0, 0, sizeof(FileMainHeaderStructV2), &header);
+	}
+	else
+	{
+		FileMainHeaderStruct headerV1;
+		memcpy(&headerV1, &header, offsetof(FileMainHeaderStruct, FileFormatVersion));
+		headerV1.FileFormatVersion    = version;
+		headerV1.RootDirPos           = (unsigned int)header.RootDirPos;
+		headerV1.RootDirSize          = (unsigned int)header.RootDirSize;
+		headerV1.RootDirTime          = header.RootDirTime;
+		headerV1.NextWritePos         = (unsigned int)header.NextWritePos;
+		headerV1.Time                 = header.Time;
+		headerV1.LargestKeyAry        = header.LargestKeyAry;
+		headerV1.LargestDirNameSize   = header.LargestDirNameSize;
+		headerV1.LargestRezNameSize   = header.LargestRezNameSize;
+		headerV1.LargestCommentSize   = header.LargestCommentSize;
+		headerV1.IsSorted             = header.IsSorted;
+		primaryRezFile_->Write(0, 0, sizeof(headerV1), &headerV1);
+	}
+
+	// waits for anything still being written in the background
+	return primaryRezFile_->Flush();
+}
+
+bool RezMgr::WriteIndex(RezPos* pos, RezPos* size)
+{
+	*pos = 0;
+	*size = 0;
+
+	// every directory, each one before the ones in it, and every item in them with its path from the root
+	std::vector<RezDir*> dirs;
+	std::vector<unsigned long> dirParents;
+	std::vector<unsigned long> dirNames;
+	std::vector<std::string> dirPaths;
+	std::vector<RezItem*> items;
+	std::vector<unsigned long> itemDirs;
+	std::vector<unsigned long> itemPaths;
+	std::vector<unsigned long long> hashes;
+	std::vector<char> strings;
+
+	dirs.push_back(rootDir_);
+	dirParents.push_back(kRezIndexNoParent);
+	dirPaths.push_back("");
+	for (unsigned long i = 0; i < dirs.size(); ++i)
+	{
+		RezDir* rezDir = dirs[i];
+		std::string dirPath = dirPaths[i];
+
+		const char* dirName = (rezDir->dirName_ != nullptr) ? rezDir->dirName_ : "";
+		dirNames.push_back((unsigned long)strings.size());
+		strings.insert(strings.end(), dirName, dirName + strlen(dirName) + 1);
+
+		RezDirHash* it = rezDir->hashTableSubDirs_.GetFirst();
+		while (it != nullptr)
+		{
+			RezDir* subDir = it->GetRezDir();
+			assert(subDir != nullptr);
+			dirs.push_back(subDir);
+			dirParents.push_back(i);
+			dirPaths.push_back(dirPath + ((subDir->dirName_ != nullptr) ? subDir->dirName_ : "") + "\\");
+			it = it->Next();
+		}
+
+		RezTypeHash* typeIt = rezDir->hashTableTypes_.GetFirst();
+		while (typeIt != nullptr)
+		{
+			assert(typeIt->GetRezType() != nullptr);
+			unsigned long typeId = typeIt->GetRezType()->GetType();
+			RezItemHashByName* item = typeIt->GetRezType()->hashTableByName_.GetFirst();
+			while (item != nullptr)
+			{
+				RezItem* rezItem = item->GetRezItem();
+				assert(rezItem != nullptr);
+
+				std::string path = dirPath + ((rezItem->name_ != nullptr) ? rezItem->name_ : "");
+				items.push_back(rezItem);
+				itemDirs.push_back(i);
+				itemPaths.push_back((unsigned long)strings.size());
+				hashes.push_back(RezIndexHash(path.c_str(), path.length(), typeId));
+				strings.insert(strings.end(), path.c_str(), path.c_str() + path.length() + 1);
+
+				item = item->Next();
+			}
+			typeIt = typeIt->Next();
+		}
+	}
+
+	// offsets in the index are 32 bits, and two paths that only differ in case can't both be in the perfect hash,
+	// either way the file goes without one
+	if ((strings.size() > 0xffffffff) || (items.size() > 0xffffffff)) return true;
+
+	unsigned long numDirs = (unsigned long)dirs.size();
+	unsigned long numItems = (unsigned long)items.size();
+	unsigned long numBuckets = RezIndexNumBuckets(numItems);
+	std::vector<unsigned int> buckets(numBuckets);
+	std::vector<unsigned long> slots(numItems + 1);
+	if (!RezIndexBuild((numItems > 0) ? &hashes[0] : nullptr, numItems, &buckets[0], &slots[0])) return true;
+
+	FileRezIndexHeader header;
+	header.Magic         = kRezIndexMagic;
+	header.NumItems      = numItems;
+	header.NumDirs       = numDirs;
+	header.NumBuckets    = numBuckets;
+	header.DirsOffset    = sizeof(header);
+	header.ItemsOffset   = header.DirsOffset + (unsigned long long)numDirs * sizeof(FileRezIndexDir);
+	header.BucketsOffset = header.ItemsOffset + (unsigned long long)numItems * sizeof(FileRezIndexItem);
+	header.StringsOffset = header.BucketsOffset + (unsigned long long)numBuckets * sizeof(unsigned int);
+	header.StringsSize   = strings.size();
+
+	RezPos indexSize = header.StringsOffset + header.StringsSize;
+	if (!RezFitsInMemory(indexSize) || (indexSize > kRezMaxTransfer)) return true;
+
+	// built in memory and written out in one go like a directory block
+	unsigned char* index;
+	LT_MEM_TRACK_ALLOC(index = new unsigned char[(size_t)indexSize], LT_MEM_TYPE_MISC);
+	assert(index != nullptr);
+	if (index == nullptr) return false;
+	memset(index, 0, (size_t)indexSize);
+	memcpy(index, &header, sizeof(header));
+
+	FileRezIndexDir* indexDirs = (FileRezIndexDir*)(index + header.DirsOffset);
+	for (unsigned long i = 0; i < numDirs; ++i)
+	{
+		indexDirs[i].Pos    = (i == 0) ? rootDirPos_ : dirs[i]->dirPos_;
+		indexDirs[i].Size   = (i == 0) ? rootDirSize_ : dirs[i]->dirSize_;
+		indexDirs[i].Time   = (i == 0) ? rootDirTime_ : dirs[i]->lastTimeModified_;
+		indexDirs[i].Parent = dirParents[i];
+		indexDirs[i].Name   = dirNames[i];
+	}
+
+	// each item goes in its slot of the perfect hash
+	FileRezIndexItem* indexItems = (FileRezIndexItem*)(index + header.ItemsOffset);
+	for (unsigned long i = 0; i < numItems; ++i)
+	{
+		RezItem* rezItem = items[i];
+		FileRezIndexItem* entry = &indexItems[slots[i]];
+		entry->Pos             = rezItem->filePos_;
+		entry->StoredSize      = rezItem->storedSize_;
+		entry->Size            = rezItem->size_;
+		entry->DeltaSize       = rezItem->hasDelta_ ? rezItem->deltaTargetSize_ : 0;
+		entry->DeltaBaseSize   = rezItem->hasDelta_ ? rezItem->deltaBaseSize_ : 0;
+		entry->DeltaBaseCrc32c = rezItem->hasDelta_ ? rezItem->deltaBaseChecksum_ : 0;
+		entry->Time            = rezItem->time_;
+		entry->Type            = rezItem->type_->GetType();
+		entry->Dir             = itemDirs[i];
+		entry->Path            = itemPaths[i];
+		entry->PathLength      = (unsigned int)strlen(&strings[itemPaths[i]]);
+		entry->NameLength      = (unsigned int)DirEntryNameSize(rezItem->name_) - 1;
+		entry->Codec           = rezItem->codec_;
+		entry->ChunkSize       = rezItem->chunkSize_;
+		entry->DictionaryId    = rezItem->dictionaryId_;
+		entry->Checksum        = rezItem->checksum_;
+		entry->Flags           = (rezItem->hasChecksum_ ? kRezIndexChecksum : 0) | (rezItem->hasDelta_ ? kRezIndexDelta : 0);
+	}
+
+	memcpy(index + header.BucketsOffset, &buckets[0], numBuckets * sizeof(unsigned int));
+	if (!strings.empty()) memcpy(index + header.StringsOffset, &strings[0], strings.size());
+
+	// the gap up to the 8 byte boundary is zeroed so the index goes out right after the directories
+	*pos = (nextWritePos_ + 7) & ~(RezPos)7;
+	bool retFlag = RezWriteZeros(primaryRezFile_, nextWritePos_, *pos - nextWritePos_) &&
+				   (primaryRezFile_->Write(*pos, 0, (unsigned long)indexSize, index) == indexSize);
+	LT_MEM_TRACK_FREE(delete [] index);
+	if (!retFlag) return false;
+
+	*size = indexSize;
+	nextWritePos_ = *pos + indexSize;
+	return true;
+}
+
+bool RezMgr::SetPathIndex(bool pathIndex)
+{
+	// a file made before version 3 existed may have data right after the smaller header
+	if (pathIndex && fileOpened_ && !readOnly_ && (headerSize_ < sizeof(FileMainHeaderStructV3))) return false;
+
+	pathIndex_ = pathIndex;
+	return true;
+}
+
+bool RezMgr::SetFileFormatVersion(unsigned long version)
+{
+	assert((version == 1) || (version == 2));
+	if ((version != 1) && (version != 2)) return false;
+
+	// a file made before version 2 existed may have no room for the bigger header
+	if ((version == 2) && (headerSize_ < sizeof(FileMainHeaderStructV2))) return false;
+
+	fileFormatVersion_ = version;
+	return true;
+}
+
+bool RezMgr::SetCompression(unsigned long typeId, RezCodec codec, int level, unsigned long chunkSize)
+{
+	for (unsigned long i = 0; i < numCompression_; ++i)
+	{
+		if (compression_[i].typeId == typeId)
+		{
+			compression_[i].codec     = codec;
+			compression_[i].level     = level;
+			compression_[i].chunkSize = chunkSize;
+			return true;
+		}
+	}
+
+	assert(numCompression_ < kRezMaxCompressionTypes);
+	if (numCompression_ >= kRezMaxCompressionTypes) return false;
+
+	compression_[numCompression_].typeId    = typeId;
+	compression_[numCompression_].codec     = codec;
+	compression_[numCompression_].level     = level;
+	compression_[numCompression_].chunkSize = chunkSize;
+	++numCompression_;
+	return true;
+}
+
+void RezMgr::GetCompression(unsigned long typeId, RezCodec* codec, int* level, unsigned long* chunkSize)
+{
+	assert(codec != nullptr);
+	assert(level != nullptr);
+	assert(chunkSize != nullptr);
+
+	// dictionaries have to be read before anything can be decompressed
+	if (typeId == dictionaryTypeId_)
+	{
+		*codec     = RezCodecNone;
+		*level     = 0;
+		*chunkSize = 0;
+		return;
+	}
+
+	for (unsigned long i = 0; i < numCompression_; ++i)
+	{
+		if (compression_[i].typeId == typeId)
+		{
+			*codec     = compression_[i].codec;
+			*level     = compression_[i].level;
+			*chunkSize = compression_[i].chunkSize;
+			return;
+		}
 	}
 
-	return true;
+	*codec     = defaultCodec_;
+	*level     = defaultLevel_;
+	*chunkSize = defaultChunkSize_;
 }
 
-bool RezMgr::Close(bool compact)
+bool RezMgr::SetDictionary(unsigned long typeId, const void* dict, unsigned long dictSize)
 {
 	assert(fileOpened_);
-	bool retVal;
-
-	if (!readOnly_) Flush();
+	assert(!readOnly_);
+	assert(dict != nullptr);
+	assert(typeId != dictionaryTypeId_);
+	if (!fileOpened_ || readOnly_ || (dictSize == 0) || (dictSize > kRezDictionaryMaxSize) || (typeId == dictionaryTypeId_)) return false;
 
-	retVal = primaryRezFile_->Close();
-
-	rezFilesList_.Delete(primaryRezFile_);
-	--numRezFiles_;
-	delete primaryRezFile_;
-	primaryRezFile_ = nullptr;
+	unsigned int id = RezDictionaryId(dict, dictSize);
 
-	BaseRezFile* rezFile;
-	while ((rezFile = rezFilesList_.GetFirst()) != nullptr)
+	// keep a copy so items saved from now on don't have to read it back
 	{
-		rezFile->Close();
-		rezFilesList_.Delete(rezFile);
-		--numRezFiles_;
-		delete rezFile;
+		std::lock_guard<std::mutex> lock(dictionaryMutex_);
+
+		unsigned long i;
+		for (i = 0; i < numDictionaries_; ++i)
+		{
+			if (dictionaries_[i].id == id) break;
+		}
+		if (i == numDictionaries_)
+		{
+			assert(numDictionaries_ < kRezMaxDictionaries);
+			if (numDictionaries_ >= kRezMaxDictionaries) return false;
+
+			unsigned char* data;
+			LT_MEM_TRACK_ALLOC(data = new unsigned char[dictSize], LT_MEM_TYPE_MISC);
+			assert(data != nullptr);
+			if (data == nullptr) return false;
+			memcpy(data, dict, dictSize);
+
+			dictionaries_[numDictionaries_].id   = id;
+			dictionaries_[numDictionaries_].data = data;
+			dictionaries_[numDictionaries_].size = dictSize;
+			++numDictionaries_;
+		}
 	}
 
-	if (rootDir_ != nullptr)
+	// the same dictionary set for several types (or saved by an earlier run) is only kept once
+	char name[16];
+	RezDictionaryName(id, name);
+	if (rootDir_->GetRez(name, dictionaryTypeId_) == nullptr)
 	{
-		delete rootDir_;
-		rootDir_ = nullptr;
+		RezItem* item = rootDir_->CreateRez(0, name, dictionaryTypeId_);
+		if (item == nullptr) return false;
+
+		unsigned char* data = item->Create(dictSize);
+		if (data == nullptr) return false;
+		memcpy(data, dict, dictSize);
+
+		bool saved = item->Save();
+		item->UnLoad();
+		if (!saved) return false;
 	}
-	if (filename_ != nullptr)
+
+	for (unsigned long i = 0; i < numTypeDictionaries_; ++i)
 	{
-		delete [] filename_;
-		filename_ = nullptr;
+		if (typeDictionaries_[i].typeId == typeId)
+		{
+			typeDictionaries_[i].dictionaryId = id;
+			return true;
+		}
 	}
 
-	fileOpened_ = false;
-	return retVal;
+	assert(numTypeDictionaries_ < kRezMaxCompressionTypes);
+	if (numTypeDictionaries_ >= kRezMaxCompressionTypes) return false;
+
+	typeDictionaries_[numTypeDictionaries_].typeId       = typeId;
+	typeDictionaries_[numTypeDictionaries_].dictionaryId = id;
+	++numTypeDictionaries_;
+	return true;
 }
 
-RezDir* RezMgr::GetRootDir()
+unsigned int RezMgr::GetDictionaryId(unsigned long typeId)
 {
-	assert(fileOpened_);
-	return rootDir_;
+	for (unsigned long i = 0; i < numTypeDictionaries_; ++i)
+	{
+		if (typeDictionaries_[i].typeId == typeId) return typeDictionaries_[i].dictionaryId;
+	}
+	return 0;
 }
 
-unsigned long RezMgr::StrToType(const char* s)
+bool RezMgr::GetDictionary(unsigned int id, const unsigned char** data, unsigned long* size)
 {
-	assert(s != nullptr);
-	if (s == nullptr) return 0;
+	assert(data != nullptr);
+	assert(size != nullptr);
 
-	unsigned long rezTypeId = 0;
-	unsigned char* p = (unsigned char*)&rezTypeId;
+	// items in several threads may need the same dictionary the first time, only one reads it in
+	std::lock_guard<std::mutex> lock(dictionaryMutex_);
 
-	int length = (int)strlen(s);
+	for (unsigned long i = 0; i < numDictionaries_; ++i)
+	{
+		if (dictionaries_[i].id == id)
+		{
+			*data = dictionaries_[i].data;
+			*size = dictionaries_[i].size;
+			return true;
+		}
+	}
 
-	if (length > 0) p[length-1] = s[0];
-	if (length > 1) p[length-2] = s[1];
-	if (length > 2) p[length-3] = s[2];
-	if (length > 3) p[length-4] = s[3];
-	
-	return rezTypeId;
-}
+	assert(numDictionaries_ < kRezMaxDictionaries);
+	if ((numDictionaries_ >= kRezMaxDictionaries) || (rootDir_ == nullptr)) return false;
 
-void RezMgr::TypeToStr(unsigned long rezTypeId, char* sType)
-{
-	assert(sType != nullptr);
-	if (sType == nullptr) return;
-	unsigned char* pType = (unsigned char*)&rezTypeId;
-	int length = 0;
+	char name[16];
+	RezDictionaryName(id, name);
+	RezItem* item = GetRezFromPath(name, dictionaryTypeId_);
+	assert(item != nullptr);
+	if ((item == nullptr) || item->IsCompressed() || (item->GetSize() == 0) || (item->GetSize() > kRezDictionaryMaxSize)) return false;
 
-	if (pType[3] != '\0') length = 4;
-	else if (pType[2] != '\0') length = 3;
-	else if (pType[1] != '\0') length = 2;
-	else if (pType[0] != '\0') length = 1;
+	unsigned long dictSize = (unsigned long)item->GetSize();
+	unsigned char* dict;
+	LT_MEM_TRACK_ALLOC(dict = new unsigned char[dictSize], LT_MEM_TYPE_MISC);
+	assert(dict != nullptr);
+	if (dict == nullptr) return false;
 
-	if (length > 0) sType[0] = pType[length-1];
-	if (length > 1) sType[1] = pType[length-2];
-	if (length > 2) sType[2] = pType[length-3];
-	if (length > 3) sType[3] = pType[length-4];
+	// a dictionary that isn't the one the items were compressed against would turn them into garbage
+	if (!item->Get(dict) || (RezDictionaryId(dict, dictSize) != id))
+	{
+		assert(false);
+		LT_MEM_TRACK_FREE(delete [] dict);
+		return false;
+	}
 
-	sType[length] = '\0';
-}
+	dictionaries_[numDictionaries_].id   = id;
+	dictionaries_[numDictionaries_].data = dict;
+	dictionaries_[numDictionaries_].size = dictSize;
+	++numDictionaries_;
 
-void* RezMgr::Alloc(unsigned long numBytes)
-{
-	assert(false);
-	return nullptr;
+	*data = dict;
+	*size = dictSize;
+	return true;
 }
 
-void RezMgr::Free(void* p)
+void RezMgr::FreeDictionaries()
 {
-	assert(false);
+	std::lock_guard<std::mutex> lock(dictionaryMutex_);
+
+	for (unsigned long i = 0; i < numDictionaries_; ++i)
+	{
+		LT_MEM_TRACK_FREE(delete [] dictionaries_[i].data);
+	}
+	numDictionaries_ = 0;
+	numTypeDictionaries_ = 0;
 }
 
-bool RezMgr::DiskError()
+void RezMgr::AddStoredData(RezPos filePos, RezPos size)
 {
-	return false;
+	assert(filePos != 0);
+	if (readOnly_) return;
+
+	RezStoredData& data = storedData_[filePos];
+	if (data.numItems == 0)
+	{
+		data.size   = size;
+		data.hash   = 0;
+		data.hashed = false;
+	}
+	++data.numItems;
 }
 
-bool RezMgr::VerifyFileOpen()
+void RezMgr::ReleaseStoredData(RezPos filePos)
 {
-	bool retVal = true;
-	BaseRezFile* rezFile = rezFilesList_.GetFirst();
-	while (rezFile != nullptr)
+	std::unordered_map<RezPos, RezStoredData>::iterator it = storedData_.find(filePos);
+	if (it == storedData_.end()) return;
+
+	assert(it->second.numItems > 0);
+	if (--it->second.numItems > 0) return;
+
+	// nothing uses the bytes any more so they may be written over
+	if (it->second.hashed)
 	{
-		if (rezFile->VerifyFileOpen() == false) retVal = false;
-		rezFile = rezFile->Next();
+		std::unordered_map<unsigned long long, RezPos>::iterator byHash = storedDataByHash_.find(it->second.hash);
+		if ((byHash != storedDataByHash_.end()) && (byHash->second == filePos)) storedDataByHash_.erase(byHash);
 	}
-	return retVal;
+	storedData_.erase(it);
 }
 
-void RezMgr::SetHashTableBins(unsigned int nByNameNumHashBins, unsigned int nByIDNumHashBins,
-                              unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins)
+bool RezMgr::IsStoredDataInUse(RezPos filePos)
 {
-	byNameNumHashBins_ = nByNameNumHashBins;
-	byIDNumHashBins_   = nByIDNumHashBins;
-	dirNumHashBins_    = nDirNumHashBins;
-	typeNumHashBins_   = nTypeNumHashBins;
+	return (storedData_.find(filePos) != storedData_.end());
 }
 
-bool RezMgr::Flush()
+RezPos RezMgr::FindStoredData(unsigned long long hash, const unsigned char* data, RezPos size)
 {
-	assert(readOnly_ != true);
+	std::unordered_map<unsigned long long, RezPos>::iterator byHash = storedDataByHash_.find(hash);
+	if (byHash == storedDataByHash_.end()) return 0;
 
-	if (readOnly_)
-		return false;
+	std::unordered_map<RezPos, RezStoredData>::iterator it = storedData_.find(byHash->second);
+	if ((it == storedData_.end()) || (it->second.size != size)) return 0;
 
-	// save the next write pos for the header information
-	unsigned long saveWritePos = nextWritePos_;
+	// the hash only says where to look, the bytes in the file have to be the same
+	unsigned long bufSize = (size > kRezChunkReadSize) ? kRezChunkReadSize : (unsigned long)size;
+	unsigned char* buf;
+	LT_MEM_TRACK_ALLOC(buf = new unsigned char[bufSize], LT_MEM_TYPE_MISC);
+	assert(buf != nullptr);
+	if (buf == nullptr) return 0;
 
-	// write out all of the directories
-	rootDir_->WriteAllDirs(primaryRezFile_, &rootDirPos_, &rootDirSize_);
+	bool same = true;
+	for (RezPos offset = 0; same && (offset < size); offset += bufSize)
+	{
+		unsigned long length = ((size - offset) > bufSize) ? bufSize : (unsigned long)(size - offset);
+		same = (primaryRezFile_->Read(byHash->second, offset, length, buf) == length) && (memcmp(buf, data + (size_t)offset, length) == 0);
+	}
 
-	// fill out the permant parts of the header
-	FileMainHeaderStruct header;
-	header.CR1 = 0x0d;
-	header.CR2 = 0x0d;
-	header.CR3 = 0x0d;
-	header.LF1 = 0x0a;
-	header.LF2 = 0x0a;
-	header.LF3 = 0x0a;
-	header.EOF1 = 0x1a;
-	
-	memset(header.FileType, ' ', RezMgrUserTitleSize);
-	strcpy(header.FileType, "RezMgr Version 1 Copyright (C) 1995 MONOLITH INC.");
-	header.FileType[strlen(header.FileType)] = ' ';
-	
-	memset(header.UserTitle, ' ', RezMgrUserTitleSize);
-	if (userTitle_[0] != '\0') memcpy(header.UserTitle, userTitle_, strlen(userTitle_));
+	LT_MEM_TRACK_FREE(delete [] buf);
+	return same ? byHash->second : 0;
+}
 
-	header.FileFormatVersion      = 1;
-	header.RootDirPos             = rootDirPos_;
-	header.RootDirSize            = rootDirSize_;
-	header.RootDirTime            = rootDirTime_;
-	header.NextWritePos           = saveWritePos;
-	header.Time                   = lastTimeModified_;
-	header.LargestKeyAry          = largestKeyArray_;
-	header.LargestDirNameSize     = largestDirNameSize_;
-	header.LargestRezNameSize     = largestRezNameSize_;
-	header.LargestCommentSize     = largestCommentSize_;
+void RezMgr::SetStoredDataHash(RezPos filePos, unsigned long long hash)
+{
+	std::unordered_map<RezPos, RezStoredData>::iterator it = storedData_.find(filePos);
+	assert(it != storedData_.end());
+	if ((it == storedData_.end()) || it->second.hashed) return;
+
+	// the first data with a hash is the one later duplicates share
+	it->second.hash   = hash;
+	it->second.hashed = true;
+	if (storedDataByHash_.find(hash) == storedDataByHash_.end()) storedDataByHash_[hash] = filePos;
+}
 
-	primaryRezFile_->Write(0, 0, sizeof(header), &header);
-	primaryRezFile_->Flush();
+bool RezMgr::ReserveSpace(RezPos numBytes)
+{
+	assert(readOnly_ != true);
+	if (readOnly_ || !fileOpened_) return false;
+
+	// the skipped bytes are never written so file systems that support sparse files leave a hole
+	nextWritePos_ += numBytes;
+	isSorted_ = false;
 	return true;
 }
 
-bool RezDir::WriteAllDirs(BaseRezFile* rezFile, unsigned long* pos, unsigned long* size)
+bool RezDir::WriteAllDirs(BaseRezFile* rezFile, RezPos* pos, RezPos* size, unsigned long version)
 {
 	bool retFlag = true;
 
@@ -1622,7 +4382,7 @@ bool RezDir::WriteAllDirs(BaseRezFile* rezFile, unsigned long* pos, unsigned lon
 	{
 		RezDir* rezDir = it->GetRezDir();
 		assert(rezDir != nullptr);
-		if (!rezDir->WriteAllDirs(rezFile, &rezDir->dirPos_, &rezDir->dirSize_))
+		if (!rezDir->WriteAllDirs(rezFile, &rezDir->dirPos_, &rezDir->dirSize_, version))
 		{
 			retFlag = false;
 			break;
@@ -1632,20 +4392,69 @@ bool RezDir::WriteAllDirs(BaseRezFile* rezFile, unsigned long* pos, unsigned lon
 
 	// now write out our own directory block
 	*pos = rezMgr_->nextWritePos_;
-	if (!WriteDirBlock(rezFile, rezMgr_->nextWritePos_, size)) retFlag = false;
+	if (!WriteDirBlock(rezFile, rezMgr_->nextWritePos_, size, version)) retFlag = false;
 	else rezMgr_->nextWritePos_ += *size;
 
 	return retFlag;
 }
 
-bool RezDir::WriteDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long* size)
+bool RezDir::WriteDirBlock(BaseRezFile* rezFile, RezPos pos, RezPos* size, unsigned long version)
 {
 	assert(pos > 0);
-	unsigned long curPos = pos;
+
+	// each entry is a packed FileDirEntryHeader cut off after the part of the union it uses
 	FileDirEntryHeader header;
-	unsigned char zero = 0;
+	size_t dirHeaderSize = offsetof(FileDirEntryHeader, Dir) + ((version >= 2) ? sizeof(header.DirV2) : sizeof(header.Dir));
+	size_t rezHeaderSize = offsetof(FileDirEntryHeader, Rez) + ((version >= 2) ? sizeof(header.RezV2) : sizeof(header.Rez));
+	size_t compressionExtraSize = sizeof(FileRezExtraHeader) + sizeof(FileRezExtraCompression);
+	size_t chunksExtraSize = sizeof(FileRezExtraHeader) + sizeof(FileRezExtraChunks);
+	size_t dictionaryExtraSize = sizeof(FileRezExtraHeader) + sizeof(FileRezExtraDictionary);
+	size_t checksumExtraSize = sizeof(FileRezExtraHeader) + sizeof(FileRezExtraChecksum);
+	size_t deltaExtraSize = sizeof(FileRezExtraHeader) + sizeof(FileRezExtraDelta);
+
+	// work out the size of the block first so it can be built in memory and written out in one go
+	size_t blockSize = 0;
+	{
+		RezDirHash* it = hashTableSubDirs_.GetFirst();
+		while (it != nullptr)
+		{
+			assert(it->GetRezDir() != nullptr);
+			blockSize += dirHeaderSize + DirEntryNameSize(it->GetRezDir()->dirName_);
+			it = it->Next();
+		}
+	}
+	{
+		RezTypeHash* it = hashTableTypes_.GetFirst();
+		while (it != nullptr)
+		{
+			assert(it->GetRezType() != nullptr);
+			RezItemHashByName* item = it->GetRezType()->hashTableByName_.GetFirst();
+			while (item != nullptr)
+			{
+				assert(item->GetRezItem() != nullptr);
+				blockSize += rezHeaderSize + DirEntryNameSize(item->GetRezItem()->name_) + 1;   // the comment is always empty
+				if ((version >= 2) && item->GetRezItem()->IsCompressed()) blockSize += compressionExtraSize;
+				if ((version >= 2) && (item->GetRezItem()->chunkSize_ > 0)) blockSize += chunksExtraSize;
+				if ((version >= 2) && (item->GetRezItem()->dictionaryId_ != 0)) blockSize += dictionaryExtraSize;
+				if ((version >= 2) && item->GetRezItem()->hasChecksum_) blockSize += checksumExtraSize;
+				if ((version >= 2) && item->GetRezItem()->hasDelta_) blockSize += deltaExtraSize;
+				item = item->Next();
+			}
+			it = it->Next();
+		}
+	}
 
-	// write all dir hash table contents out ot file
+	*size = blockSize;
+	if (blockSize == 0) return true;
+
+	unsigned char* block;
+	LT_MEM_TRACK_ALLOC(block = new unsigned char[blockSize], LT_MEM_TYPE_MISC);
+	assert(block != nullptr);
+	if (block == nullptr) return false;
+
+	unsigned char* curr = block;
+
+	// all dir hash table contents
 	{
 		header.Type = DirectoryEntry;
 		RezDirHash* it = hashTableSubDirs_.GetFirst();
@@ -1654,23 +4463,26 @@ bool RezDir::WriteDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned lon
 			RezDir* rezDir = it->GetRezDir();
 			assert(rezDir != nullptr);
 
-			header.Dir.Pos  = rezDir->dirPos_;
-			header.Dir.Size = rezDir->dirSize_;
-			header.Dir.Time = rezDir->lastTimeModified_;
-
-			curPos += rezFile->Write(curPos, 0, sizeof(header.Type), &header.Type);
-			curPos += rezFile->Write(curPos, 0, sizeof(header.Dir.Pos), &header.Dir.Pos);
-			curPos += rezFile->Write(curPos, 0, sizeof(header.Dir.Size), &header.Dir.Size);
-			curPos += rezFile->Write(curPos, 0, sizeof(header.Dir.Time), &header.Dir.Time);
-
-			if (rezDir->dirName_ == nullptr) curPos += rezFile->Write(curPos, 0, sizeof(zero), &zero);
-			else curPos += rezFile->Write(curPos, 0, (unsigned long)strlen(rezDir->dirName_)+1, rezDir->dirName_);
+			if (version >= 2)
+			{
+				header.DirV2.Pos  = rezDir->dirPos_;
+				header.DirV2.Size = rezDir->dirSize_;
+				header.DirV2.Time = rezDir->lastTimeModified_;
+			}
+			else
+			{
+				header.Dir.Pos  = (unsigned int)rezDir->dirPos_;
+				header.Dir.Size = (unsigned int)rezDir->dirSize_;
+				header.Dir.Time = rezDir->lastTimeModified_;
+			}
+			DirEntryAppend(curr, &header, dirHeaderSize);
+			DirEntryAppendName(curr, rezDir->dirName_);
 
 			it = it->Next();
 		}
 	}
 
-	// write all type hash table contents
+	// all type hash table contents
 	{
 		header.Type = ResourceEntry;
 		RezTypeHash* it = hashTableTypes_.GetFirst();
@@ -1685,33 +4497,104 @@ bool RezDir::WriteDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned lon
 				RezItem* rezItem = item->GetRezItem();
 				assert(rezItem != nullptr);
 
-				header.Rez.Pos     = rezItem->filePos_;
-				header.Rez.Size    = rezItem->size_;
-				header.Rez.Time    = rezItem->time_;
-				header.Rez.ID      = 0;
-				header.Rez.Type    = it->GetRezType()->GetType();
-				header.Rez.NumKeys = 0;
-
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Type), &header.Type);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.Pos), &header.Rez.Pos);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.Size), &header.Rez.Size);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.Time), &header.Rez.Time);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.ID), &header.Rez.ID);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.Type), &header.Rez.Type);
-				curPos += rezFile->Write(curPos, 0, sizeof(header.Rez.NumKeys), &header.Rez.NumKeys);
-				if (rezItem->name_ == nullptr) curPos += rezFile->Write(curPos, 0, sizeof(zero), &zero);
-				else curPos += rezFile->Write(curPos, 0, (unsigned long)strlen(rezItem->name_)+1, rezItem->name_);
-				curPos += rezFile->Write(curPos, 0, sizeof(zero), &zero);
+				// version 1 has nowhere to say an item is compressed or a delta or keep its checksum, Flush always uses version 2 for those
+				assert((version >= 2) || (!rezItem->IsCompressed() && !rezItem->hasChecksum_ && !rezItem->hasDelta_));
+
+				if (version >= 2)
+				{
+					header.RezV2.Pos       = rezItem->filePos_;
+					header.RezV2.Size      = rezItem->storedSize_;
+					header.RezV2.Time      = rezItem->time_;
+					header.RezV2.ID        = 0;
+					header.RezV2.Type      = it->GetRezType()->GetType();
+					header.RezV2.NumKeys   = 0;
+					header.RezV2.ExtraSize = rezItem->IsCompressed() ? (unsigned int)compressionExtraSize : 0;
+					if (rezItem->chunkSize_ > 0) header.RezV2.ExtraSize += (unsigned int)chunksExtraSize;
+					if (rezItem->dictionaryId_ != 0) header.RezV2.ExtraSize += (unsigned int)dictionaryExtraSize;
+					if (rezItem->hasChecksum_) header.RezV2.ExtraSize += (unsigned int)checksumExtraSize;
+					if (rezItem->hasDelta_) header.RezV2.ExtraSize += (unsigned int)deltaExtraSize;
+				}
+				else
+				{
+					header.Rez.Pos     = (unsigned int)rezItem->filePos_;
+					header.Rez.Size    = (unsigned int)rezItem->size_;
+					header.Rez.Time    = rezItem->time_;
+					header.Rez.ID      = 0;
+					header.Rez.Type    = it->GetRezType()->GetType();
+					header.Rez.NumKeys = 0;
+				}
+				DirEntryAppend(curr, &header, rezHeaderSize);
+				if ((version >= 2) && rezItem->IsCompressed())
+				{
+					FileRezExtraHeader extra;
+					extra.Tag  = kRezExtraCompression;
+					extra.Size = sizeof(FileRezExtraCompression);
+					DirEntryAppend(curr, &extra, sizeof(extra));
+
+					FileRezExtraCompression compression;
+					compression.Codec = rezItem->codec_;
+					compression.Size  = rezItem->size_;
+					DirEntryAppend(curr, &compression, sizeof(compression));
+				}
+				if ((version >= 2) && (rezItem->chunkSize_ > 0))
+				{
+					FileRezExtraHeader extra;
+					extra.Tag  = kRezExtraChunks;
+					extra.Size = sizeof(FileRezExtraChunks);
+					DirEntryAppend(curr, &extra, sizeof(extra));
+
+					FileRezExtraChunks chunks;
+					chunks.ChunkSize = rezItem->chunkSize_;
+					DirEntryAppend(curr, &chunks, sizeof(chunks));
+				}
+				if ((version >= 2) && (rezItem->dictionaryId_ != 0))
+				{
+					FileRezExtraHeader extra;
+					extra.Tag  = kRezExtraDictionary;
+					extra.Size = sizeof(FileRezExtraDictionary);
+					DirEntryAppend(curr, &extra, sizeof(extra));
+
+					FileRezExtraDictionary dictionary;
+					dictionary.Id = rezItem->dictionaryId_;
+					DirEntryAppend(curr, &dictionary, sizeof(dictionary));
+				}
+				if ((version >= 2) && rezItem->hasChecksum_)
+				{
+					FileRezExtraHeader extra;
+					extra.Tag  = kRezExtraChecksum;
+					extra.Size = sizeof(FileRezExtraChecksum);
+					DirEntryAppend(curr, &extra, sizeof(extra));
+
+					FileRezExtraChecksum checksum;
+					checksum.Crc32c = rezItem->checksum_;
+					DirEntryAppend(curr, &checksum, sizeof(checksum));
+				}
+				if ((version >= 2) && rezItem->hasDelta_)
+				{
+					FileRezExtraHeader extra;
+					extra.Tag  = kRezExtraDelta;
+					extra.Size = sizeof(FileRezExtraDelta);
+					DirEntryAppend(curr, &extra, sizeof(extra));
+
+					FileRezExtraDelta delta;
+					delta.Size       = rezItem->deltaTargetSize_;
+					delta.BaseSize   = rezItem->deltaBaseSize_;
+					delta.BaseCrc32c = rezItem->deltaBaseChecksum_;
+					DirEntryAppend(curr, &delta, sizeof(delta));
+				}
+				DirEntryAppendName(curr, rezItem->name_);
+				*curr++ = '\0';
 
 				item = item->Next();
 			}
 			it = it->Next();
 		}
 	}
+	assert(curr == block + blockSize);
 
-	rezMgr_->nextWritePos_ = curPos;
-	*size = curPos - pos;
-	return true;
+	bool ret = RezWriteFully(rezFile, pos, blockSize, block);
+	LT_MEM_TRACK_FREE(delete [] block);
+	return ret;
 }
 
 unsigned long RezMgr::GetCurTime()
@@ -1884,11 +4767,15 @@ RezItem* RezDir::GetRezFromPath(const char* path, unsigned long rezTypeId)
 
 RezItem* RezMgr::GetRezFromPath(const char* path, unsigned long rezTypeId)
 {
+	RezItem* rezItem;
+	if ((index_ != nullptr) && GetRezFromIndex(path, false, rezTypeId, &rezItem)) return rezItem;
 	return GetRootDir()->GetRezFromPath(path, rezTypeId);
 }
 
 RezItem* RezMgr::GetRezFromDosPath(const char* path)
 {
+	RezItem* rezItem;
+	if ((index_ != nullptr) && GetRezFromIndex(path, true, 0, &rezItem)) return rezItem;
 	return GetRootDir()->GetRezFromDosPath(path);
 }
 
@@ -1897,6 +4784,199 @@ RezDir* RezMgr::GetDirFromPath(const char* path)
 	return GetRootDir()->GetDirFromPath(path);
 }
 
+// true if length bytes at offset are all inside an index of indexSize bytes
+static bool IndexPartFits(unsigned long long offset, unsigned long long length, RezPos indexSize)
+{
+	return (offset <= indexSize) && (length <= indexSize - offset) && ((offset & 7) == 0);
+}
+
+bool RezMgr::OpenIndex(RezPos pos, RezPos size)
+{
+	if ((size < sizeof(FileRezIndexHeader)) || !RezFitsInMemory(size) || (size > kRezMaxTransfer)) return false;
+
+	RezPos fileSize = primaryRezFile_->GetFileSize();
+	if ((fileSize > 0) && ((pos > fileSize) || (size > fileSize - pos))) return false;
+
+	// a mapped file is used where it is, anything else is read in with one read
+	const unsigned char* index = primaryRezFile_->MapData(pos, 0, (unsigned long)size);
+	if (index == nullptr)
+	{
+		LT_MEM_TRACK_ALLOC(indexBuffer_ = new unsigned char[(size_t)size], LT_MEM_TYPE_MISC);
+		assert(indexBuffer_ != nullptr);
+		if (indexBuffer_ == nullptr) return false;
+		if (!RezReadFully(primaryRezFile_, pos, size, indexBuffer_, false))
+		{
+			LT_MEM_TRACK_FREE(delete [] indexBuffer_);
+			indexBuffer_ = nullptr;
+			return false;
+		}
+		index = indexBuffer_;
+	}
+
+	// only the layout is checked here, each entry is checked when it is used so opening doesn't touch them
+	const FileRezIndexHeader* header = (const FileRezIndexHeader*)index;
+	bool valid = (header->Magic == kRezIndexMagic) && (header->NumDirs > 0) &&
+				 (header->NumBuckets == RezIndexNumBuckets(header->NumItems)) &&
+				 IndexPartFits(header->DirsOffset, (unsigned long long)header->NumDirs * sizeof(FileRezIndexDir), size) &&
+				 IndexPartFits(header->ItemsOffset, (unsigned long long)header->NumItems * sizeof(FileRezIndexItem), size) &&
+				 IndexPartFits(header->BucketsOffset, (unsigned long long)header->NumBuckets * sizeof(unsigned int), size) &&
+				 (header->StringsOffset <= size) && (header->StringsSize > 0) && (header->StringsSize <= size - header->StringsOffset) &&
+				 (index[header->StringsOffset + header->StringsSize - 1] == '\0');
+	assert(valid);
+	if (!valid)
+	{
+		if (indexBuffer_ != nullptr) LT_MEM_TRACK_FREE(delete [] indexBuffer_);
+		indexBuffer_ = nullptr;
+		return false;
+	}
+
+	index_ = index;
+	dirsRead_ = false;
+	return true;
+}
+
+void RezMgr::ReadIndexedDirs()
+{
+	std::lock_guard<std::mutex> lock(indexMutex_);
+	if (dirsRead_) return;
+
+	// the directories and items already looked up are kept and the rest are read in around them
+	rootDir_->ReadAllDirs(primaryRezFile_, rootDirPos_, rootDirSize_, fileFormatVersion_, false);
+	dirsRead_ = true;
+}
+
+bool RezMgr::GetRezFromIndex(const char* path, bool dosName, unsigned long rezTypeId, RezItem** rezItem)
+{
+	assert(path != nullptr);
+	assert(index_ != nullptr);
+
+	std::lock_guard<std::mutex> lock(indexMutex_);
+	if (dirsRead_) return false;
+
+	// split the path up the same way RezDir::GetRezFromPath and GetDirFromPath do
+	*rezItem = nullptr;
+	int len = (int)strlen(path);
+	if (len >= 1023) return true;
+	if ((len > 1) && !rootDir_->IsGoodChar(path[0]))
+	{
+		path = &path[1];
+		--len;
+	}
+
+	int i = len - 1;
+	while ((i >= 0) && rootDir_->IsGoodChar(path[i])) --i;
+
+	const char* rezName = &path[i+1];
+	char fname[kRezDosNameSize];
+	if (dosName)
+	{
+		rezTypeId = RezSplitDosName(this, rezName, fname);
+		rezName = fname;
+	}
+
+	// the key is the directory names joined by '\\' then the name, each directory name is a run of good
+	// characters and whatever comes between them separates them
+	char key[1024 + kRezDosNameSize];
+	int keyLength = 0;
+	if (i > 1)
+	{
+		int j = rootDir_->IsGoodChar(path[0]) ? 0 : 1;
+		if (!rootDir_->IsGoodChar(path[j])) return true;
+
+		while (j < i)
+		{
+			while ((j < i) && rootDir_->IsGoodChar(path[j])) key[keyLength++] = path[j++];
+			while ((j < i) && !rootDir_->IsGoodChar(path[j])) ++j;
+			key[keyLength++] = '\\';
+		}
+	}
+	int nameLength = (int)strlen(rezName);
+	memcpy(&key[keyLength], rezName, nameLength + 1);
+	keyLength += nameLength;
+
+	// the perfect hash sends any path to some item, it is only this one if the path and type match
+	const FileRezIndexHeader* header = (const FileRezIndexHeader*)index_;
+	if (header->NumItems == 0) return true;
+
+	unsigned long slot = RezIndexSlot(RezIndexHash(key, keyLength, rezTypeId), (const unsigned int*)(index_ + header->BucketsOffset),
+									  header->NumBuckets, header->NumItems);
+	const FileRezIndexItem* entry = (const FileRezIndexItem*)(index_ + header->ItemsOffset) + slot;
+	const char* strings = (const char*)(index_ + header->StringsOffset);
+	if ((entry->Path > header->StringsSize) || (entry->PathLength >= header->StringsSize - entry->Path) ||
+		(entry->NameLength > entry->PathLength) || (entry->Dir >= header->NumDirs))
+	{
+		assert(false);
+		return false;
+	}
+	if ((entry->Type != rezTypeId) || (entry->PathLength != (unsigned int)keyLength)) return true;
+	if ((lowerCaseUsed_ ? strncmp(&strings[entry->Path], key, keyLength) : _strnicmp(&strings[entry->Path], key, keyLength)) != 0) return true;
+
+	RezDir* rezDir = GetIndexDir(entry->Dir);
+	if (rezDir == nullptr) return false;
+
+	// the item may have been looked up before
+	const char* name = &strings[entry->Path + entry->PathLength - entry->NameLength];
+	RezType* rezType = rezDir->GetOrMakeType(entry->Type);
+	if (rezType == nullptr) return false;
+	*rezItem = rezType->hashTableByName_.Find(name, !lowerCaseUsed_);
+	if (*rezItem != nullptr) return true;
+
+	RezItem* newItem = AllocateRezItem();
+	assert(newItem != nullptr);
+	if (newItem == nullptr) return false;
+
+	newItem->InitRezItem(rezDir, name, 0, rezType, nullptr, entry->Size, entry->Pos, entry->Time, 0, nullptr, primaryRezFile_);
+	newItem->storedSize_ = entry->StoredSize;
+	newItem->codec_ = (RezCodec)entry->Codec;
+	newItem->chunkSize_ = (entry->Codec != RezCodecNone) ? entry->ChunkSize : 0;
+	newItem->dictionaryId_ = (entry->Codec != RezCodecNone) ? entry->DictionaryId : 0;
+	newItem->checksum_ = entry->Checksum;
+	newItem->hasChecksum_ = ((entry->Flags & kRezIndexChecksum) != 0);
+	newItem->hasDelta_ = ((entry->Flags & kRezIndexDelta) != 0);
+	if (newItem->hasDelta_)
+	{
+		newItem->deltaTargetSize_ = entry->DeltaSize;
+		newItem->deltaBaseSize_ = entry->DeltaBaseSize;
+		newItem->deltaBaseChecksum_ = entry->DeltaBaseCrc32c;
+	}
+	if (newItem->codec_ != RezCodecNone) hasCompressedItems_ = true;
+	if (newItem->hasChecksum_) hasChecksums_ = true;
+	if (newItem->hasDelta_) hasDeltas_ = true;
+
+	rezType->hashTableByName_.Insert(&newItem->hashByName_);
+	*rezItem = newItem;
+	return true;
+}
+
+RezDir* RezMgr::GetIndexDir(unsigned long dirEntry)
+{
+	if (dirEntry == 0) return rootDir_;
+
+	// every directory comes after the one it is in, which also stops a bad index going round in circles
+	const FileRezIndexHeader* header = (const FileRezIndexHeader*)index_;
+	const FileRezIndexDir* entry = (const FileRezIndexDir*)(index_ + header->DirsOffset) + dirEntry;
+	if ((entry->Parent >= dirEntry) || (entry->Name >= header->StringsSize))
+	{
+		assert(false);
+		return nullptr;
+	}
+
+	RezDir* parentDir = GetIndexDir(entry->Parent);
+	if (parentDir == nullptr) return nullptr;
+
+	const char* dirName = (const char*)(index_ + header->StringsOffset + entry->Name);
+	RezDir* rezDir = parentDir->hashTableSubDirs_.Find(dirName, !lowerCaseUsed_);
+	if (rezDir == nullptr)
+	{
+		LT_MEM_TRACK_ALLOC(rezDir = new RezDir(this, parentDir, dirName, entry->Pos, entry->Size, entry->Time, dirNumHashBins_, typeNumHashBins_), LT_MEM_TYPE_MISC);
+		assert(rezDir != nullptr);
+		if (rezDir == nullptr) return nullptr;
+
+		parentDir->hashTableSubDirs_.Insert(&rezDir->hashElementDir_);
+	}
+	return rezDir;
+}
+
 bool RezMgr::Reset()
 {
 	if (!IsOpen()) return false;
@@ -1913,7 +4993,11 @@ bool RezMgr::IsDirectory(const char* filename)
 	result = stat(filename, &buf);
 	if (result != 0) return false;
 
+#if defined(_WIN32)
 	return ((buf.st_mode & _S_IFDIR) == _S_IFDIR);
+#else
+	return S_ISDIR(buf.st_mode);
+#endif
 }
 
 RezItem* RezMgr::AllocateRezItem()
@@ -2,14 +2,66 @@
 
 #include "RezFile.hpp"
 #include "RezHash.hpp"
+#include "RezBlockCache.hpp"
+#include "RezCompress.hpp"
+#include "RezChecksum.hpp"
+#include "RezDelta.hpp"
+
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
 
 namespace JupiterEx { namespace RezMgr {
 
 #define RezMgrUserTitleSize  60
+#define kRezStreamDefaultChunkSize  (256 * 1024)
+#define kRezMaxCompressionTypes     32
+#define kRezMaxDictionaries         32
+#define kRezDictionaryTypeName      "DICT"   // type of the items dictionaries are kept in, see RezMgr::SetDictionary
+#define kRezDefaultItemAlignment    4096     // a page, see RezMgr::SetItemAlignment
+
+// low level file class RezMgr uses for the rez files it opens
+enum RezFileAccess
+{
+	RezFileAccessStdio      = 0,   // RezFile, buffered stdio reads into heap memory
+	RezFileAccessMapped     = 1,   // RezFileMapped, read only files are mapped and items are loaded without copying
+	RezFileAccessPositional = 2,   // RezFilePositional, no shared seek position so items can be read from many threads
+	RezFileAccessAsync      = 3,   // RezFileAsync, positional file that also keeps many RezItem::LoadAsync reads in flight
+};
 
 class RezType;
 class RezDir;
 class RezMgr;
+class RezItem;
+class RezItemStream;
+
+// one piece of an item for RezItem::ReadV and RezMgr::ReadV
+struct RezItemRead
+{
+	RezItem* rezItem;          // item to read from (RezItem::ReadV fills this in)
+	RezPos offset;             // offset in the item of the first byte
+	unsigned long length;      // bytes wanted
+	void* data;                // where they go
+};
+
+// how often loading an item checks its data against the checksum saved with it, see RezMgr::SetChecksumVerify
+enum RezChecksumVerify
+{
+	RezChecksumVerifyNone      = 0,   // never
+	RezChecksumVerifyFirstLoad = 1,   // the first time each item is loaded after the file is opened
+	RezChecksumVerifyAlways    = 2,   // every time an item's data is read in (or mapped) to be loaded
+};
+
+// checksum counters, RezMgr::GetChecksumStats adds up everything checked since the RezMgr was made
+struct RezChecksumStats
+{
+	unsigned long long bytesVerified;   // bytes whose checksum was worked out and compared
+	unsigned long numVerified;          // items checked
+	unsigned long numFailed;            // items whose data didn't match its checksum
+};
+
+// called when RezItem::LoadAsync finishes, data is nullptr if the load failed
+typedef void (*RezLoadCallback)(RezItem* rezItem, unsigned char* data, void* userData);
 
 // -----------------------------------------------------------------------------------------
 // RezItem
@@ -19,7 +71,15 @@ class RezItem
 public:
 	const char* GetName() { return name_; }
 	unsigned long GetType();
-	unsigned long GetSize() { return size_; }
+	RezPos GetSize() { return size_; }
+	RezPos GetStoredSize() { return storedSize_; }   // bytes the data takes up in the rez file, less than GetSize if it is compressed
+	RezCodec GetCodec() { return codec_; }
+	bool IsCompressed() { return (codec_ != RezCodecNone); }
+	unsigned long GetChunkSize() { return chunkSize_; }   // size of each separately compressed chunk, 0 if the data is compressed whole
+	unsigned int GetDictionaryId() { return dictionaryId_; }   // RezDictionaryId of the dictionary the data is compressed against, 0 if none
+	bool HasChecksum() { return hasChecksum_; }                 // true if a checksum of the data was saved with it, see RezMgr::SetChecksums
+	unsigned int GetChecksum() { return checksum_; }            // RezCrc32c of the (uncompressed) data
+	bool IsDelta() { return hasDelta_ || (deltaData_ != nullptr); }   // true if the data is saved as a delta from an item of another rez file, see SaveDelta
 	const char* GetPath(char* buf, unsigned long bufSize);
 	const char* GetDir();
 	RezDir* GetParentDir() { return parentDir_; }
@@ -27,17 +87,28 @@ public:
 
 	bool Get(unsigned char* bytes);
 	bool Get(void* bytes) { return Get((unsigned char*)bytes); }
-	bool Get(unsigned char* bytes, unsigned long startOffset, unsigned long length);
-	bool Get(void* bytes, unsigned long startOffset, unsigned long length) { return Get((unsigned char*)bytes, startOffset, length); }
+	bool Get(unsigned char* bytes, RezPos startOffset, unsigned long length);
+	bool Get(void* bytes, RezPos startOffset, unsigned long length) { return Get((unsigned char*)bytes, startOffset, length); }
 
+	// the data may be a copy on write view of a mapped file rather than memory of its own, changing it is fine
+	// but the changes last until the file is closed, not just until UnLoad
 	unsigned char* Load();
 	bool UnLoad();
 	bool IsLoaded();
 
-	unsigned long GetSeekPos() { return currPos_; }
-	bool Seek(unsigned long offset);
-	unsigned long Read(unsigned char* bytes, unsigned long length, unsigned long seekPos = REZ_SEEKPOS_ERROR);
-	unsigned long Read(void* bytes, unsigned long length, unsigned long seekPos = REZ_SEEKPOS_ERROR) { return Read((void*)bytes, length, seekPos); }
+	// starts loading the data and returns at once, callback is called with the same pointer Load would return
+	// (from a reader thread if the file is a RezFileAsync), don't touch the item until it has been called.
+	// The callback may start more loads, they never wait for room in the queue on a reader thread.
+	bool LoadAsync(RezLoadCallback callback, void* userData);
+
+	RezPos GetSeekPos() { return currPos_; }
+	bool Seek(RezPos offset);
+	unsigned long Read(unsigned char* bytes, unsigned long length, RezPos seekPos = REZ_SEEKPOS_ERROR);
+	unsigned long Read(void* bytes, unsigned long length, RezPos seekPos = REZ_SEEKPOS_ERROR) { return Read((unsigned char*)bytes, length, seekPos); }
+	unsigned long ReadDirect(unsigned char* bytes, unsigned long length, RezPos seekPos = REZ_SEEKPOS_ERROR);  // Read that skips the page cache whatever the item's size
+	bool ReadV(RezItemRead* reads, unsigned long numReads);               // Fills several buffers from pieces of this item at once, see RezMgr::ReadV
+	bool CopyToFile(const char* filename, RezCopyStats* stats = nullptr);  // Writes the data to a new file without loading it, see BaseRezFile::CopyToFile
+	bool VerifyChecksum();                                                // Reads all of the data through and checks it against its checksum, true if it matches or there is none
 	bool EndOfRes();
 	char GetChar();
 
@@ -45,22 +116,45 @@ public:
 
 	// functions that can be used to gain direct read access to the rez file (DANGER!!!!!)
 	const char* DirectRead_GetFullRezName();
-	unsigned long DirectRead_GetFileOffset() { return filePos_; }
+	RezPos DirectRead_GetFileOffset() { return filePos_; }
 
-	unsigned char* Create(unsigned long size);
+	unsigned char* Create(RezPos size);
 	bool Save();
 
+	// Saves data (size bytes) as a delta from base, an item in the rez file this one is to patch, so only what changed
+	// takes up room. When the patch is opened over that file with RezMgr::OpenAdditional the item replaces base
+	// (whatever overwriteItems says) and Load puts the data back together from the two, until then Load just returns
+	// the delta. Returns false, leaving the item as it was, if base is empty or can't be loaded or the delta would be
+	// no smaller than the data itself.
+	bool SaveDelta(RezItem* base, const unsigned char* data, RezPos size);
+
 private:
 	RezItem();
 
 	void InitRezItem(RezDir* parentDir, const char* name, unsigned long id, RezType* type, const char* desc,
-					 unsigned long size, unsigned long filePos, unsigned long time, unsigned long numKeys,
+					 RezPos size, RezPos filePos, unsigned long time, unsigned long numKeys,
 					 unsigned long* keyArray, BaseRezFile* rezFile);
 	void TermRezItem();
+	static void OnAsyncLoadDone(void* userData, unsigned long bytesRead);
+	unsigned long ReadData(unsigned char* bytes, unsigned long length, RezPos seekPos, bool direct);
+	bool UseDirectIO();
+	unsigned char* GetMemoryData();  // the item's data if it is already in memory, otherwise nullptr
+	bool ReadCompressed(unsigned char* bytes);  // decompresses all of a compressed item into bytes
+	bool ReadChunks(unsigned char* bytes, RezPos startOffset, unsigned long length);  // decompresses just the chunks a range overlaps
+	bool DecompressStored(const unsigned char* stored, unsigned char* bytes);  // decompresses all of the stored data already in memory
+	unsigned char* LoadPatched();  // puts the data of an item that replaced its base from a patch back together
+	bool Decompress(RezCodec codec, const unsigned char* src, size_t srcSize, unsigned char* dst, size_t dstSize);  // RezDecompress with the item's dictionary
+	bool LoadChunkIndex();
+	bool MustVerify();                             // true if RezMgr::SetChecksumVerify asks for the item to be checked when it is loaded
+	bool VerifyLoaded(const unsigned char* data);  // checks data just loaded if it must be
+	bool CountVerified(unsigned int checksum);     // compares a checksum worked out for the item and counts it in the RezMgr's stats
+	const unsigned char* GetStoredData(RezPos storedOffset, unsigned long length);  // stored bytes if the directory is loaded or the file mapped
+	bool MustLoadWhole() { return ((codec_ != RezCodecNone) && (chunkSize_ == 0)) || (deltaData_ != nullptr); }
 
 	friend class RezType;
 	friend class RezDir;
 	friend class RezMgr;
+	friend class RezItemStream;
 
 	void MarkCurTime();             // Mark the current modification time as now for this resource
 
@@ -68,13 +162,70 @@ private:
 	char*              name_;
 	RezType*           type_;
 	unsigned long      time_;       // The last time the data in the resource was updated (does not include keys or description)
-	unsigned long      size_;       // The size in bytes of the data in this resource
+	RezPos             size_;       // The size in bytes of the data in this resource
+	RezPos             storedSize_; // The size in bytes of the data in the resource file (the same as size_ unless it is compressed)
+	RezCodec           codec_;      // How the data is stored in the resource file
+	unsigned long      chunkSize_;  // If not 0 the data is compressed in chunks of this many bytes that follow an index of where each starts
+	RezPos*            chunkIndex_; // Where each chunk starts in the stored data and where the last one ends (read in the first time it is needed)
+	unsigned int       dictionaryId_; // If not 0 the data is compressed against the dictionary with this RezDictionaryId
+	unsigned int       checksum_;   // RezCrc32c of the data if hasChecksum_ is TRUE
+	bool               hasChecksum_;
+	bool               checksumVerified_; // If TRUE the data has been checked against checksum_ since the file was opened
+	bool               hasDelta_;   // If TRUE the data is a delta from another item (see SaveDelta) that hasn't been applied
+	RezPos             deltaTargetSize_;   // Size of the data once the delta is applied
+	RezPos             deltaBaseSize_;     // Size of the item the delta is from
+	unsigned int       deltaBaseChecksum_; // RezCrc32c of that item's data
+	RezItem*           deltaData_;  // If not NULL this item replaced deltaBase_ from a patch and its data is the delta in this item put
+	RezItem*           deltaBase_;  // together with deltaBase_'s data (neither is in a directory, this item deletes them)
 	RezDir*            parentDir_;  // Pointer to the directory struct in memory that this resource is in
-	unsigned long      filePos_;    // File position in the resource file for this resources data (note, this is relative to dataPos_ in the directory)
-	unsigned long      currPos_;    // Current seek position within this resource
+	RezPos             filePos_;    // File position in the resource file for this resources data (note, this is relative to dataPos_ in the directory)
+	RezPos             currPos_;    // Current seek position within this resource
 	RezItemHashByName  hashByName_; // Hash element for by name hash table
 	BaseRezFile*       rezFile_;    // Pointer to class that controls the base low level resource file that is associated with this resource
 	unsigned char*     data_;       // Pointer to the data for this resource (if NULL then not in memory)
+	bool               dataMapped_; // If TRUE data_ points into a mapped file and must not be deleted
+};
+
+// -----------------------------------------------------------------------------------------
+// RezItemStream
+
+// Walks the data of one RezItem a chunk at a time through a buffer that is reused for every chunk, so
+// items far too big to Load can still be read through in one pass. Each stream has its own position and
+// never touches the item's seek position, so any number of streams can read the same item at once.
+// Items that are already in memory (or in a mapped file) are handed out in place without copying.
+// A compressed item that isn't chunked (see RezMgr::SetCompression) is loaded the first time the stream reads it.
+// The item must not be UnLoaded, re-Created or Saved while a stream over it is in use.
+class RezItemStream
+{
+public:
+	RezItemStream(RezItem* rezItem, unsigned long chunkSize = kRezStreamDefaultChunkSize);
+	~RezItemStream();
+
+	// returns the next piece of the item (at most chunkSize bytes) and sets length to its size, the pointer
+	// is good until the next call on this stream, returns nullptr at the end of the item or on a read error
+	const unsigned char* NextChunk(unsigned long* length);
+
+	unsigned long Read(void* bytes, unsigned long length);   // copies the next length bytes, returns the number copied
+	bool Seek(RezPos offset);
+	RezPos Tell() { return chunkPos_ + chunkUsed_; }
+	bool EndOfStream();
+	bool Failed() { return failed_; }                        // true once a read from the file has failed
+
+private:
+	RezItemStream(const RezItemStream&);              // not copyable
+	RezItemStream& operator=(const RezItemStream&);
+
+	bool FillChunk();
+
+private:
+	RezItem*             rezItem_;
+	unsigned long        chunkSize_;
+	unsigned char*       buffer_;       // chunks read from the file go here, allocated on first use
+	const unsigned char* chunk_;        // the current chunk, either in buffer_ or in the item's memory
+	RezPos               chunkPos_;     // offset in the item of the current chunk
+	unsigned long        chunkLength_;  // bytes in the current chunk
+	unsigned long        chunkUsed_;    // bytes of the current chunk already handed out
+	bool                 failed_;
 };
 
 //------------------------------------------------------------------------------------------
@@ -135,29 +286,30 @@ public:
 	unsigned long GetTime() { return lastTimeModified_; }
 
 private:
-	RezDir(RezMgr* rezMgr, RezDir* parentDir, const char* dirName, unsigned long dirPos,
-		unsigned long dirSize, unsigned long time, unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins);
+	RezDir(RezMgr* rezMgr, RezDir* parentDir, const char* dirName, RezPos dirPos,
+		RezPos dirSize, unsigned long time, unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins);
 	~RezDir();
 
 	friend class RezItem;
 	friend class RezType;
 	friend class RezMgr;
 
-	bool     ReadAllDirs(BaseRezFile* rezFile, unsigned long pos, unsigned long size, bool overwriteItems);  // Recursivly read all directories in this dir into memory
-	bool     ReadDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long size, bool overwriteItems); // Reads in directory block for this directory
+	bool     ReadAllDirs(BaseRezFile* rezFile, RezPos pos, RezPos size, unsigned long version, bool overwriteItems);  // Recursivly read all directories in this dir into memory
+	bool     ReadDirBlock(BaseRezFile* rezFile, RezPos pos, RezPos size, unsigned long version, bool overwriteItems); // Reads in directory block for this directory
 	RezType* GetOrMakeType(unsigned long typeId);                                                            // Gets the type if it exists, creates it if it does not
 	bool     IsGoodChar(char c);                                                                             // Determines if the given character is non-white space and non-seperator
 	RezItem* CreateRezInternal(unsigned long rezId, const char* rezName, RezType* rezType, BaseRezFile* rezFile);
 	bool     RemoveRezInternal(RezType* rezType, RezItem* rezItem);
-	bool WriteAllDirs(BaseRezFile* rezFile, unsigned long* pos, unsigned long* size);
-	bool WriteDirBlock(BaseRezFile* rezFile, unsigned long pos, unsigned long* size);
+	void     DetachRezInternal(RezType* rezType, RezItem* rezItem);                                         // Takes the item out of the directory without deleting it
+	bool WriteAllDirs(BaseRezFile* rezFile, RezPos* pos, RezPos* size, unsigned long version);
+	bool WriteDirBlock(BaseRezFile* rezFile, RezPos pos, RezPos* size, unsigned long version);
 
 private:
 	char* dirName_;
-	unsigned long dirPos_;                // Position in directory data block in file
-	unsigned long dirSize_;               // Size of the directory data block
-	unsigned long itemsPos_;              // Position of resource items data for this directory
-	unsigned long itemsSize_;             // Size of resource items data for this directory
+	RezPos dirPos_;                       // Position in directory data block in file
+	RezPos dirSize_;                      // Size of the directory data block
+	RezPos itemsPos_;                     // Position of resource items data for this directory
+	RezPos itemsSize_;                    // Size of resource items data for this directory
 	unsigned long lastTimeModified_;      // The last time that the data in a resource file in this directory was modified (does not include data in sub directories)
 	RezMgr* rezMgr_;                      
 	RezDir* parentDir_;
@@ -177,8 +329,12 @@ public:
 	RezMgr(const char* filename, bool readOnly = true, bool createNew = false);
 	~RezMgr();
 
+	// filename may also be a directory, read only, its files become the items (see SetMaxOpenFilesInEmulatedDir), if
+	// any of them or of its subdirectories can't be read the open returns false with whatever could be read in place
 	bool Open(const char* filename, bool readOnly = true, bool createNew = false);  // Open the current resource file
 	bool OpenAdditional(const char* filename, bool overwriteItems = false);         // Open an additional resource file (the file is ReadOnly and not New by definition)
+	bool OpenMemory(const void* data, RezPos size);                                 // Open a resource file image already in memory (ReadOnly, data is not copied and must stay until Close)
+	bool OpenMemory(RezMemoryImage* image, bool readOnly = false, bool createNew = true);  // Open a resource file kept in image, which the caller owns and keeps after Close
 	bool Close(bool compact = false);                                               // Closes the current resource file (if compact is true also compacts the resource file)
 	RezDir* GetRootDir();                                                           // Returns the root directory in the resource file
 	bool IsOpen() { return fileOpened_; }                                           // Returns true if resource file is open, false if not
@@ -186,6 +342,20 @@ public:
 	unsigned long GetTime() { return lastTimeModified_; }                           // Last time anything in resource file was modified
 	bool Reset();
 	bool IsSorted() { return isSorted_; }
+	bool WaitForAsyncLoads();                                                       // Blocks until every RezItem::LoadAsync started so far has called back
+
+	// Loads a whole set of items at once, the reads are sorted by file position and items that are next to
+	// (or within SetBatchReadGap bytes of) each other are read with one large read and scattered into the
+	// items, numReads (if not null) gets the number of reads actually issued. Returns false if any item failed to load.
+	bool LoadBatch(RezItem** rezItems, unsigned long numItems, unsigned long* numReads = nullptr);
+
+	// Fills each caller buffer from a piece of an item (any number of pieces of any number of items) without
+	// loading the items, the pieces are sorted by file position and pieces next to (or within SetBatchReadGap
+	// bytes of) each other are read with one vectored read where the file supports it. Items compressed whole or
+	// patched can only be read loaded, they are loaded for the call and unloaded again (unless they were already
+	// loaded). numFileReads (if not null) gets the number of reads actually issued. Returns false if any piece
+	// could not be read.
+	bool ReadV(RezItemRead* reads, unsigned long numReads, unsigned long* numFileReads = nullptr);
 
 	RezItem* GetRezFromPath(const char* path, unsigned long typeId);
 	RezItem* GetRezFromDosPath(const char* path);
@@ -212,6 +382,107 @@ public:
 	void SetHashTableBins(unsigned int nByNameNumHashBins, unsigned int nByIDNumHashBins,
 						  unsigned int nDirNumHashBins, unsigned int nTypeNumHashBins);
 
+	// choose how rez files are accessed (should call set right after constructor but before open)
+	// defaults to RezFileAccessMapped, files that can't be mapped or are opened for writing fall back to RezFileAccessStdio
+	// (SetReadAhead and SetBlockCache switch it away from RezFileAccessMapped, call this afterwards to pick another)
+	void SetFileAccess(RezFileAccess fileAccess) { fileAccess_ = fileAccess; }
+	RezFileAccess GetFileAccess() { return fileAccess_; }
+
+	// control how LoadBatch merges reads, gaps of up to maxGap bytes between items are read and thrown away
+	// rather than paying for another read, and no single merged read is larger than maxReadSize
+	void SetBatchReadGap(unsigned long maxGap, unsigned long maxReadSize) { batchReadGap_ = maxGap; batchReadMaxSize_ = maxReadSize; }
+
+	// turn on background read-ahead for read only files (should call set right after constructor but before open), the
+	// window starts at minWindow bytes and adapts between the two, a maxWindow of 0 turns it off (the default)
+	// mapped files have nothing to read ahead into, so turning it on switches RezFileAccessMapped to RezFileAccessStdio
+	void SetReadAhead(unsigned long minWindow, unsigned long maxWindow);
+	void GetReadAheadStats(RezReadAheadStats* stats);   // totals over every open rez file
+	void GetHandleCacheStats(RezHandleCacheStats* stats); // totals over every emulated directory (see SetMaxOpenFilesInEmulatedDir)
+
+	// keep up to budget bytes of read only rez files in memory in blocks of blockSize bytes, shared by all items
+	// (should call set right after constructor but before open), a budget of 0 turns it off (the default)
+	// mapped files are already cached by the OS, so turning it on switches RezFileAccessMapped to RezFileAccessStdio
+	void SetBlockCache(unsigned long budget, unsigned long blockSize = kRezBlockCacheDefaultBlockSize);
+	bool GetBlockCacheStats(RezBlockCacheStats* stats);  // returns false if there is no block cache
+
+	// items of at least itemSize bytes in a read only rez file are loaded and read past the page cache so streaming
+	// them doesn't push everything else out of it, 0 turns it off (the default), see also RezItem::ReadDirect
+	void SetDirectIOThreshold(unsigned long itemSize) { directIOThreshold_ = itemSize; }
+
+	// writes to files opened for writing are collected in a buffer of bufferSize bytes while they follow on from
+	// each other and go to the disk together (should call set right after constructor but before open), 0 turns it off
+	void SetWriteCombine(unsigned long bufferSize) { writeCombineSize_ = bufferSize; }
+	void GetWriteStats(RezWriteStats* stats);   // totals over every rez file opened so far, so what Close writes is counted too
+
+	// RezItem::Save looks for the same stored bytes among the items saved since the file was opened and points the item
+	// at them instead of writing them again, so identical files in different directories take up space once, off by default.
+	// Items that share data are never written over in place, saving one again puts its new data at the end of the file.
+	// GetWriteStats reports the bytes that didn't need writing.
+	void SetDeduplicate(bool deduplicate) { deduplicate_ = deduplicate; }
+
+	// RezItem::Save starts the stored data of items of at least itemSize bytes on a multiple of boundary (a power of 2)
+	// in the file, so mapping one or reading it past the page cache doesn't touch pages of the items around it. The gap
+	// before each one is filled with zeroes, GetWriteStats reports how many so a threshold can be picked for each file.
+	// Items that are written over in place or share data stay where they are, an itemSize of 0 turns it off (the default).
+	void SetItemAlignment(unsigned long itemSize, unsigned long boundary = kRezDefaultItemAlignment);
+
+	// Flush also writes a path index after the directories, fixed size entries for every item and directory, their names
+	// and a perfect hash of the items' full paths, laid out to be used where it is in the mapped file. A read only RezMgr
+	// opening a file with one reads just the header and the index, GetRezFromPath and GetRezFromDosPath find items through
+	// it and the rest of the directories are read in the first time something needs all of them (GetRootDir, GetDirFromPath
+	// or OpenAdditional). Files with a path index are written as version 3 of the file format, which code from before it
+	// can't open, and opening one for writing keeps it. Off by default, returns false for a file made before version 3
+	// existed that has no room for the bigger header. Items whose paths only differ in case leave the file without one.
+	bool SetPathIndex(bool pathIndex);
+
+	// read only files with a path index are opened from it (see SetPathIndex), on by default (should call set right after
+	// constructor but before open). Until the rest of the directories are read in the directory an item looked up through
+	// the index is in only holds the items and directories looked up so far.
+	void SetOpenFromIndex(bool openFromIndex) { openFromIndex_ = openFromIndex; }
+
+	// RezItem::Save works out a CRC-32C of each item's data and keeps it in the directory, off by default. The checksum
+	// is of the uncompressed data so it also catches a bad decompression. Items with checksums need version 2 of the
+	// file format so a file that has any is written as version 2.
+	void SetChecksums(bool checksums) { checksums_ = checksums; }
+
+	// RezItem::Load, LoadAsync and LoadBatch check items that have a checksum before handing out their data and fail
+	// (return nullptr) if it doesn't match, either just the first time each item is loaded or every time, off by default.
+	// Reading part of an item with Get, Read or ReadV is never checked, RezItem::VerifyChecksum checks an item on demand.
+	void SetChecksumVerify(RezChecksumVerify verify) { checksumVerify_ = verify; }
+	RezChecksumVerify GetChecksumVerify() { return checksumVerify_; }
+	void GetChecksumStats(RezChecksumStats* stats);
+
+	// RezItem::Save copies the data into a queue and returns, a background thread writes it out in the order the
+	// items were saved (should call set right after constructor but before open), once maxQueued bytes are waiting
+	// Save blocks until the writer catches up, 0 turns it off (the default).  Save may be called from several
+	// threads for different items either way (as may RezItem::Create, RezDir::CreateRez and RezDir::CreateDir, but
+	// not the lookups), Close waits for everything queued and reports any failed write.
+	void SetBackgroundSave(unsigned long maxQueued) { backgroundSaveQueue_ = maxQueued; }
+
+	// file format written by Flush, 1 has 32 bit positions and 2 has 64 bit positions (should call set after open, opening
+	// an existing file picks up its version), a version 1 file that grows past 4 GB is written as version 2 anyway,
+	// returns false for a file made before version 2 existed that has no room for the bigger header. Version 3 is
+	// version 2 with a path index and is only written by SetPathIndex.
+	bool SetFileFormatVersion(unsigned long version);
+	unsigned long GetFileFormatVersion() { return fileFormatVersion_; }
+
+	// items of typeId saved from now on are compressed with codec at level (1 is fastest, kRezCompressMaxLevel is smallest),
+	// SetDefaultCompression does the same for every type not given its own setting, RezCodecNone turns it off (the default).
+	// Items bigger than chunkSize are compressed in chunks of that size so reading part of one only decompresses the chunks
+	// it overlaps, smaller chunks make small reads cheaper and compress less well, 0 compresses every item whole.
+	// Items that don't get any smaller are stored as is and GetSize, Load and Get always see the uncompressed data.
+	// Compressed items need version 2 of the file format so a file that has any is written as version 2.
+	bool SetCompression(unsigned long typeId, RezCodec codec, int level = kRezCompressDefaultLevel, unsigned long chunkSize = kRezCompressDefaultChunkSize);
+	void SetDefaultCompression(RezCodec codec, int level = kRezCompressDefaultLevel, unsigned long chunkSize = kRezCompressDefaultChunkSize)
+		{ defaultCodec_ = codec; defaultLevel_ = level; defaultChunkSize_ = chunkSize; }
+
+	// items of typeId saved from now on are compressed against dict, data typical of them that matches can refer back into
+	// (see RezTrainDictionary), so even small items that hardly compress on their own get a lot smaller. The dictionary
+	// (at most kRezDictionaryMaxSize bytes) is saved in the root directory as an item of type kRezDictionaryTypeName named
+	// after its RezDictionaryId, and a RezMgr reading the file reads each dictionary in once, the first time an item needs it.
+	// Call after opening the file for writing, the type must still be set up for compression with SetCompression or SetDefaultCompression.
+	bool SetDictionary(unsigned long typeId, const void* dict, unsigned long dictSize);
+
 	// functions that user should not typically use
 	void ForceIsSortedFlag(bool flag) { isSorted_ = flag; }
 	void SetMaxOpenFilesInEmulatedDir(int numFiles) { maxOpenFilesInEmulatedDir_ = numFiles; }
@@ -226,6 +497,11 @@ private:
 	friend class RezDir;
 	friend class RezType;
 	friend class RezItem;
+	friend class RezMgrTestHook;   // lets the tests reach ReserveSpace, defined by them and nowhere in the engine
+
+	// skip numBytes of the file without writing them, file systems with sparse files leave the gap as a hole.
+	// Only the tests use it, to put items past 4 GB without writing 4 GB.
+	bool ReserveSpace(RezPos numBytes);
 
 	class RezItemChunk : public Common::BaseListItem<RezItemChunk>
 	{
@@ -237,13 +513,71 @@ private:
 	{
 	};
 
+	struct RezCompression
+	{
+		unsigned long typeId;
+		RezCodec codec;
+		int level;
+		unsigned long chunkSize;
+	};
+
+	struct RezTypeDictionary
+	{
+		unsigned long typeId;
+		unsigned int dictionaryId;
+	};
+
+	struct RezDictionary
+	{
+		unsigned int id;
+		unsigned char* data;
+		unsigned long size;
+	};
+
+	// data in the primary file of one or more items, only kept track of while the file is open for writing
+	struct RezStoredData
+	{
+		unsigned long numItems;      // items whose data this is
+		RezPos size;
+		unsigned long long hash;     // hash of the bytes, only known for data saved since the file was opened
+		bool hashed;
+	};
+
 	RezItem* AllocateRezItem();
 	void DeAllocateRezItem(RezItem* item);
 
 	unsigned long GetCurTime();
 	bool IsDirectory(const char* filename);
+	BaseRezFile* OpenRezFile(const char* filename, bool readOnly, bool createNew);
+	bool OpenMemoryFile(RezFileMemory* rezFile, bool readOnly, bool createNew);
+	bool OpenPrimary(BaseRezFile* rezFile, bool createNew);
+	void BeginAsyncLoad();
+	void EndAsyncLoad();
 	bool ReadEmulationDirectory(RezFileDirectoryEmulation* rezFileEmulation, RezDir* dir, const char* paramPath, bool overwriteItems);
+#if !defined(_WIN32)
+	struct RezEmulationDirId;   // a directory on the way down to the one being read
+	bool ReadEmulationDirectoryAt(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, int dirFd, const RezEmulationDirId* dirId,
+								  char* path, unsigned long pathLength, bool overwriteItems);
+	bool ReadEmulationEntry(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, int dirFd, const RezEmulationDirId* dirId,
+							const char* name, unsigned char type, char* path, unsigned long pathLength, bool overwriteItems);
+#endif
+	bool AddEmulationFile(RezFileDirectoryEmulation* rezFileEmulation, RezDir* rezDir, const char* fileName,
+						  const char* name, RezPos size, unsigned long time, bool overwriteItems);
 	bool Flush();
+	bool WriteIndex(RezPos* pos, RezPos* size);   // writes the path index at nextWritePos_, size is 0 if the paths didn't make one
+	bool OpenIndex(RezPos pos, RezPos size);      // maps or reads in the path index of the primary file, false if it is no good
+	void ReadIndexedDirs();                       // reads in the directories of a file opened from its path index if they aren't yet
+	bool GetRezFromIndex(const char* path, bool dosName, unsigned long typeId, RezItem** rezItem);  // false if the index can't say
+	RezDir* GetIndexDir(unsigned long dirEntry);  // the directory for an entry of the path index, made if it isn't there yet
+	void GetCompression(unsigned long typeId, RezCodec* codec, int* level, unsigned long* chunkSize);
+	unsigned int GetDictionaryId(unsigned long typeId);
+	bool GetDictionary(unsigned int id, const unsigned char** data, unsigned long* size);  // reads the dictionary in if this is the first time it is needed
+	void FreeDictionaries();
+	void AddStoredData(RezPos filePos, RezPos size);
+	void ReleaseStoredData(RezPos filePos);
+	bool IsStoredDataInUse(RezPos filePos);
+	RezPos FindStoredData(unsigned long long hash, const unsigned char* data, RezPos size);  // file position of the same bytes, 0 if none
+	void SetStoredDataHash(RezPos filePos, unsigned long long hash);
 
 private:
 	char* dirSeparators_;           // Separator characters between directories (if NULL(default) use built in method)
@@ -255,17 +589,68 @@ private:
 	bool renumberIDCollisions_;     // If TRUE then ID's of resources that collide will simply be re-numbered
 	unsigned long nextIDNumToUse_;  // Next ID number to use for allocating collisions and assigning to directories
 	int maxOpenFilesInEmulatedDir_; // Maximum number of files that can be open at one time in a emulated fir
+	RezFileAccess fileAccess_;      // Low level file class to use for rez files
+	std::mutex asyncMutex_;         // Guards numAsyncLoads_ and items being filled in by finished asynchronous loads
+	std::condition_variable asyncLoadsDone_;
+	unsigned long numAsyncLoads_;   // Number of RezItem::LoadAsync calls that have not called back yet
+	unsigned long batchReadGap_;    // Largest gap between items LoadBatch will read through to merge two reads
+	unsigned long batchReadMaxSize_; // Largest single read LoadBatch will merge items into
+	unsigned long readAheadMinWindow_; // Smallest read-ahead window, see SetReadAhead
+	unsigned long readAheadMaxWindow_; // Largest read-ahead window, 0 if read-ahead is off
+	RezBlockCache* blockCache_;     // Block cache shared by all the rez files, created when the first file is opened
+	unsigned long blockCacheBudget_; // Bytes the block cache may use, 0 if there is no block cache
+	unsigned long blockCacheBlockSize_;
+	unsigned long directIOThreshold_; // Items at least this big are read with BaseRezFile::ReadDirect, 0 if off
+	unsigned long writeCombineSize_; // Size of the write combining buffer for files opened for writing, 0 if off
+	RezWriteStats closedWriteStats_; // Write counters of files that have been closed
+	unsigned long backgroundSaveQueue_; // Most bytes RezItem::Save may have waiting for the background writer, 0 if off
+	std::mutex saveMutex_;          // Guards nextWritePos_ while items are saved
+	RezCompression compression_[kRezMaxCompressionTypes]; // Compression for item types set with SetCompression
+	unsigned long numCompression_;  // Number of entries used in compression_
+	RezCodec defaultCodec_;         // Compression for types not in compression_
+	int defaultLevel_;
+	unsigned long defaultChunkSize_;
+	std::mutex chunkIndexMutex_;    // Guards chunk indexes of compressed items being read in
+	RezTypeDictionary typeDictionaries_[kRezMaxCompressionTypes]; // Dictionaries for item types set with SetDictionary
+	unsigned long numTypeDictionaries_;
+	RezDictionary dictionaries_[kRezMaxDictionaries]; // Dictionaries read in or set so far, kept until Close
+	unsigned long numDictionaries_;
+	unsigned long dictionaryTypeId_; // Type of the items dictionaries are kept in
+	std::mutex dictionaryMutex_;    // Guards dictionaries_ while dictionaries are read in
+	bool deduplicate_;              // If TRUE Save shares data that is already in the file, see SetDeduplicate
+	std::unordered_map<RezPos, RezStoredData> storedData_;  // Item data in the primary file by position (guarded by saveMutex_)
+	std::unordered_map<unsigned long long, RezPos> storedDataByHash_;  // Positions in storedData_ by hash of the bytes
+	unsigned long long bytesDeduplicated_; // Bytes Save didn't have to write
+	unsigned long numDeduplicated_; // Items saved without writing their data
+	unsigned long alignItemSize_;   // Items at least this big are started on alignBoundary_, 0 if off
+	unsigned long alignBoundary_;
+	unsigned long long bytesPadding_; // Zeroes written in front of aligned items
+	unsigned long numAligned_;      // Items started on alignBoundary_
+	bool checksums_;                // If TRUE Save works out a checksum of each item, see SetChecksums
+	RezChecksumVerify checksumVerify_; // When loading checks the checksum
+	RezChecksumStats checksumStats_; // Guarded by checksumMutex_ since asynchronous loads finish on other threads
+	std::mutex checksumMutex_;
+	bool pathIndex_;                // If TRUE Flush writes a path index, see SetPathIndex
+	bool openFromIndex_;            // If TRUE read only files with a path index are opened from it
 
 	// MOST OF THE REST OF THE VARIABLES BELOW ONLY APPLY TO THE FIRST RESOURCE FILE IN THE rezFilesList_ LIST
-	unsigned long rootDirPos_;           // The seek position in the file where the root directory is located
-	unsigned long rootDirSize_;          // The size of the root directory
+	RezPos        rootDirPos_;           // The seek position in the file where the root directory is located
+	RezPos        rootDirSize_;          // The size of the root directory
 	unsigned long rootDirTime_;          // The last time the root dir was modified
-	unsigned long nextWritePos_;         // The next position int he file to write data out to
+	RezPos        nextWritePos_;         // The next position int he file to write data out to
 	bool          readOnly_;             // If TRUE then the resource file is only opsned for reading
 	RezDir*       rootDir_;              // Pointer to the root directory structure in the resource
 	unsigned long lastTimeModified_;     // The last time that any data in any resource in this resource file was modified (does not include key values and descriptions)
 	bool          mustReWriteDirs_;      // If TRUE we must write out the directories on close
-	unsigned long fileFormatVersion_;    // the file format version number, only 1 is possible here right now
+	unsigned long fileFormatVersion_;    // the file format version number, 1 (32 bit positions), 2 (64 bit positions) or 3 (2 with a path index)
+	bool          hasCompressedItems_;   // If TRUE some item in the file is compressed so it must be written as version 2
+	bool          hasChecksums_;         // If TRUE some item in the file has a checksum so it must be written as version 2
+	bool          hasDeltas_;            // If TRUE some item in the file is a delta so it must be written as version 2
+	RezPos        headerSize_;           // Bytes at the start of the file before any item or directory, the room for the main header
+	const unsigned char* index_;         // The path index if the file was opened from it, nullptr if not
+	unsigned char* indexBuffer_;         // What index_ points to if the file isn't mapped
+	bool          dirsRead_;             // If TRUE all of the directories have been read in, guarded by indexMutex_
+	std::mutex    indexMutex_;           // Guards the directories while items are looked up through index_
 	unsigned long largestKeyArray_;      // Size of the largest key array in the resource file
 	unsigned long largestDirNameSize_;   // Size of the largest directory name in the resource file (including 0 terminator)
 	unsigned long largestRezNameSize_;   // Size of the largest resource name in the resource file (includding 0 terminator)
@@ -10,11 +10,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <chrono>
+#include <map>
+#include <vector>
 
 #define LithTechUserTitle "LithTech Resource File"
 #define kMaxStr 2048
 #define zprintf printf
 
+#define kDictSampleMaxSize   (16 * 1024)        // only files up to this size are used to train dictionaries
+#define kDictSamplesMaxSize  (8 * 1024 * 1024)  // and only this much of each type
+#define kDictMinSamples      8                  // types with fewer small files don't get a dictionary
+
 namespace JupiterEx { namespace RezMgr {
 
 // if we are running the special LithRez version
@@ -29,9 +36,24 @@ long g_DirCount = 0;
 long g_RezCount = 0;
 long g_ErrCount = 0;
 long g_WarnCount = 0;
+long g_NoChecksumCount = 0;
+long g_SameCount = 0;
+long g_DeltaCount = 0;
+long g_RemovedCount = 0;
+unsigned long long g_ChangedBytes = 0;
+unsigned long long g_PatchBytes = 0;
 bool g_LowerCaseUsed = false;
 bool g_ExitOnDiskError = false;
 
+RezCopyStats g_CopyStats;
+
+// small files of one type that a dictionary is trained on
+struct DictSamples
+{
+	std::vector<unsigned char> data;
+	std::vector<size_t> sizes;
+};
+
 class ZMgrRezMgr : public RezMgr
 {
 public:
@@ -95,53 +117,33 @@ static void ExtractDir(RezDir* rezDir, const char* paramPath)
 		char sType[5];
 		g_Mgr->TypeToStr(rezType->GetType(), sType);
 
+		// dictionaries are part of how the file is stored, not something that was put in it
+		if (strcmp(sType, kRezDictionaryTypeName) == 0)
+		{
+			rezType = rezDir->GetNextType(rezType);
+			continue;
+		}
+
 		// search through all resource of this type
 		RezItem* rezItem = rezDir->GetFirstItem(rezType);
 		while (rezItem != nullptr)
 		{
-			// read in item data from resource
-			unsigned char* pData = nullptr;
-			if (rezItem->GetSize() > 0) pData = rezItem->Load();
-			if ((pData != nullptr) || (rezItem->GetSize() == 0))
-			{
-				// figure out file name and path for data file
-				char sFileName[kMaxStr];
-				strcpy(sFileName, sPath);
-				strcat(sFileName, rezItem->GetName());
-				strcat(sFileName, ".");
-				strcat(sFileName, sType);
+			// figure out file name and path for data file
+			char sFileName[kMaxStr];
+			strcpy(sFileName, sPath);
+			strcat(sFileName, rezItem->GetName());
+			strcat(sFileName, ".");
+			strcat(sFileName, sType);
 
-				if (g_Verbose) zprintf("Extracting: Type = %-4s Name = %-12s Size = %-8i\n", sType, rezItem->GetName(), (int)rezItem->GetSize());
-			
-				g_RezCount++;
-
-				FILE* fp = fopen(sFileName, "wb");
-				if (fp != NULL)
-				{
-					if (rezItem->GetSize() > 0)
-					{
-						if (fwrite(pData, rezItem->GetSize(), 1, fp) != 1)
-						{
-							zprintf("ERROR! Unable to write file: %s\n", sFileName);
-							g_ErrCount++;
-						}
-					}
+			if (g_Verbose) zprintf("Extracting: Type = %-4s Name = %-12s Size = %-8i\n", sType, rezItem->GetName(), (int)rezItem->GetSize());
 
-					fclose(fp);
-				}
-				else
-				{
-					zprintf("ERROR! Unable to create file: %s\n", sFileName);
-					g_ErrCount++;
-				}
+			g_RezCount++;
 
-				rezItem->UnLoad();
-			}
-			else
+			// the data goes from the rez file to the new file without being loaded (in the kernel where it can)
+			if (!rezItem->CopyToFile(sFileName, &g_CopyStats))
 			{
-				zprintf("ERROR! Unable to load resource. Name = %s\n", rezItem->GetName());
+				zprintf("ERROR! Unable to extract resource %s to file: %s\n", rezItem->GetName(), sFileName);
 				g_ErrCount++;
-				continue;
 			}
 
 			rezItem = rezDir->GetNextItem(rezItem);
@@ -190,7 +192,18 @@ static void ViewDir(RezDir* pDir, const char* sParamPath)
 		RezItem* pItem = pDir->GetFirstItem(pType);
 		while (pItem != nullptr)
 		{
-			zprintf("  Type = %-4s Name = %-12s Size = %-8i\n", sType, pItem->GetName(), (int)pItem->GetSize());
+			if (pItem->IsDelta())
+			{
+				zprintf("  Type = %-4s Name = %-12s Size = %-8i Stored = %i (delta)\n", sType, pItem->GetName(), (int)pItem->GetSize(), (int)pItem->GetStoredSize());
+			}
+			else if (pItem->IsCompressed())
+			{
+				zprintf("  Type = %-4s Name = %-12s Size = %-8i Stored = %i\n", sType, pItem->GetName(), (int)pItem->GetSize(), (int)pItem->GetStoredSize());
+			}
+			else
+			{
+				zprintf("  Type = %-4s Name = %-12s Size = %-8i\n", sType, pItem->GetName(), (int)pItem->GetSize());
+			}
 
 			g_RezCount++;
 
@@ -215,6 +228,210 @@ static void ViewDir(RezDir* pDir, const char* sParamPath)
 	}
 }
 
+// Checks every resource in a directory (and those below it) against the checksum saved with it
+static void TestDir(RezDir* pDir, const char* sParamPath)
+{
+	assert(pDir != nullptr);
+	assert(sParamPath != nullptr);
+
+	g_DirCount++;
+
+	// figure out the path to this dir with added backslash
+	char sPath[kMaxStr];
+	strcpy(sPath, sParamPath);
+	if ((sPath[0] == '\0') || (sPath[strlen(sPath)-1] != '\\')) strcat(sPath, "\\");
+
+	RezType* pType = pDir->GetFirstType();
+	while (pType != nullptr)
+	{
+		char sType[5];
+		g_Mgr->TypeToStr(pType->GetType(), sType);
+
+		RezItem* pItem = pDir->GetFirstItem(pType);
+		while (pItem != nullptr)
+		{
+			if (!pItem->HasChecksum())
+			{
+				g_NoChecksumCount++;
+			}
+			else if (!pItem->VerifyChecksum())
+			{
+				zprintf("ERROR! %s%s.%s does not match its checksum\n", sPath, pItem->GetName(), sType);
+				g_ErrCount++;
+			}
+			else if (g_Verbose)
+			{
+				zprintf("%s%s.%s OK\n", sPath, pItem->GetName(), sType);
+			}
+
+			g_RezCount++;
+
+			pItem = pDir->GetNextItem(pItem);
+		}
+
+		pType = pDir->GetNextType(pType);
+	}
+
+	RezDir* pLoopDir = pDir->GetFirstSubDir();
+	while (pLoopDir != nullptr)
+	{
+		char sDir[kMaxStr];
+		strcpy(sDir, sPath);
+		strcat(sDir, pLoopDir->GetDirName());
+
+		TestDir(pLoopDir, sDir);
+
+		pLoopDir = pDir->GetNextSubDir(pLoopDir);
+	}
+}
+
+// Puts everything in a directory of the new rez file (and those below it) that isn't the same in the old one into the
+// patch, resources that changed are saved as deltas from the old ones where that makes them smaller
+static void PatchDir(RezDir* pPatchDir, RezDir* pNewDir, RezDir* pOldDir, const char* sParamPath)
+{
+	assert(pPatchDir != nullptr);
+	assert(pNewDir != nullptr);
+	assert(sParamPath != nullptr);
+
+	g_DirCount++;
+
+	char sPath[kMaxStr];
+	strcpy(sPath, sParamPath);
+	if ((sPath[0] == '\0') || (sPath[strlen(sPath)-1] != '\\')) strcat(sPath, "\\");
+
+	RezType* pType = pNewDir->GetFirstType();
+	while (pType != nullptr)
+	{
+		char sType[5];
+		g_Mgr->TypeToStr(pType->GetType(), sType);
+
+		// dictionaries belong to the file they are in, the patch gets its own if it is compressed with them
+		if (strcmp(sType, kRezDictionaryTypeName) == 0)
+		{
+			pType = pNewDir->GetNextType(pType);
+			continue;
+		}
+
+		RezItem* pItem = pNewDir->GetFirstItem(pType);
+		while (pItem != nullptr)
+		{
+			g_RezCount++;
+
+			RezItem* pOldItem = (pOldDir != nullptr) ? pOldDir->GetRez(pItem->GetName(), pType->GetType()) : nullptr;
+			RezPos nSize = pItem->GetSize();
+			const unsigned char* pData = (nSize > 0) ? pItem->Load() : nullptr;
+			if ((nSize > 0) && (pData == nullptr))
+			{
+				zprintf("ERROR! Unable to load %s%s.%s\n", sPath, pItem->GetName(), sType);
+				g_ErrCount++;
+				pItem = pNewDir->GetNextItem(pItem);
+				continue;
+			}
+
+			// resources that haven't changed are left to the old file
+			if ((pOldItem != nullptr) && (pOldItem->GetSize() == nSize))
+			{
+				const unsigned char* pOldData = (nSize > 0) ? pOldItem->Load() : nullptr;
+				bool bSame = (nSize == 0) || ((pOldData != nullptr) && (memcmp(pOldData, pData, (size_t)nSize) == 0));
+				if (bSame)
+				{
+					g_SameCount++;
+					pItem->UnLoad();
+					pItem = pNewDir->GetNextItem(pItem);
+					continue;
+				}
+			}
+
+			RezItem* pPatchItem = pPatchDir->CreateRez(0, pItem->GetName(), pType->GetType());
+			if (pPatchItem == nullptr)
+			{
+				zprintf("ERROR! Unable to create resource %s%s.%s\n", sPath, pItem->GetName(), sType);
+				g_ErrCount++;
+				pItem->UnLoad();
+				pItem = pNewDir->GetNextItem(pItem);
+				continue;
+			}
+			pPatchItem->SetTime(pItem->GetTime());
+			g_ChangedBytes += nSize;
+
+			// anything the delta wouldn't make smaller (and anything new) goes in whole
+			bool bSaved;
+			if ((pOldItem != nullptr) && pPatchItem->SaveDelta(pOldItem, pData, nSize))
+			{
+				g_DeltaCount++;
+				bSaved = true;
+				if (g_Verbose) zprintf("Delta: Type = %-4s Name = %-12s Size = %-8i Stored = %i\n", sType, pItem->GetName(), (int)nSize, (int)pPatchItem->GetStoredSize());
+			}
+			else
+			{
+				unsigned char* pPatchData = pPatchItem->Create(nSize);
+				if (nSize > 0) memcpy(pPatchData, pData, (size_t)nSize);
+				bSaved = pPatchItem->Save();
+				if (g_Verbose) zprintf("%s Type = %-4s Name = %-12s Size = %-8i\n", (pOldItem != nullptr) ? "Whole:" : "New:  ", sType, pItem->GetName(), (int)nSize);
+			}
+			if (!bSaved)
+			{
+				zprintf("ERROR! Unable to save resource %s%s.%s\n", sPath, pItem->GetName(), sType);
+				g_ErrCount++;
+			}
+			g_PatchBytes += pPatchItem->GetStoredSize();
+
+			pPatchItem->UnLoad();
+			pItem->UnLoad();
+			if (pOldItem != nullptr) pOldItem->UnLoad();
+
+			pItem = pNewDir->GetNextItem(pItem);
+		}
+
+		pType = pNewDir->GetNextType(pType);
+	}
+
+	// a patch can only add and replace, anything that is gone from the new file stays in the old one
+	if (pOldDir != nullptr)
+	{
+		RezType* pOldType = pOldDir->GetFirstType();
+		while (pOldType != nullptr)
+		{
+			char sType[5];
+			g_Mgr->TypeToStr(pOldType->GetType(), sType);
+
+			RezItem* pOldItem = pOldDir->GetFirstItem(pOldType);
+			while (pOldItem != nullptr)
+			{
+				if ((strcmp(sType, kRezDictionaryTypeName) != 0) && (pNewDir->GetRez(pOldItem->GetName(), pOldType->GetType()) == nullptr))
+				{
+					if (g_Verbose) zprintf("WARNING! %s%s.%s is not in the new file but a patch can't remove it\n", sPath, pOldItem->GetName(), sType);
+					g_RemovedCount++;
+				}
+				pOldItem = pOldDir->GetNextItem(pOldItem);
+			}
+			pOldType = pOldDir->GetNextType(pOldType);
+		}
+	}
+
+	RezDir* pLoopDir = pNewDir->GetFirstSubDir();
+	while (pLoopDir != nullptr)
+	{
+		RezDir* pPatchSubDir = pPatchDir->GetDir(pLoopDir->GetDirName());
+		if (pPatchSubDir == nullptr) pPatchSubDir = pPatchDir->CreateDir(pLoopDir->GetDirName());
+		if (pPatchSubDir == nullptr)
+		{
+			zprintf("ERROR! Unable to create directory. Name = %s\n", pLoopDir->GetDirName());
+			g_ErrCount++;
+		}
+		else
+		{
+			char sDir[kMaxStr];
+			strcpy(sDir, sPath);
+			strcat(sDir, pLoopDir->GetDirName());
+
+			PatchDir(pPatchSubDir, pLoopDir, (pOldDir != nullptr) ? pOldDir->GetDir(pLoopDir->GetDirName()) : nullptr, sDir);
+		}
+
+		pLoopDir = pNewDir->GetNextSubDir(pLoopDir);
+	}
+}
+
 // Transfers a directory full of files into the resource file
 static void TransferDir(RezDir* pDir, const char* sParamPath, const char* sExts)
 {
@@ -613,12 +830,216 @@ static void FreshenDir(RezDir* pDir, const char* sParamPath)
 	}
 }
 
+// Collects the small files in a directory (and its subdirectories) to train dictionaries on
+static void CollectDictSamples(const char* sParamPath, const char* sExts, std::map<unsigned long, DictSamples>* pSamples)
+{
+	assert(sParamPath != nullptr);
+	assert(pSamples != nullptr);
+	_finddata_t fileinfo;
+
+	char sPath[kMaxStr];
+	strcpy(sPath, sParamPath);
+	if (sPath[strlen(sPath)-1] != '\\') strcat(sPath, "\\");
+
+	char sFindPath[kMaxStr];
+	strcpy(sFindPath, sPath);
+	strcat(sFindPath, "*.*");
+
+	long nFindHandle = _findfirst(sFindPath, &fileinfo);
+	if (nFindHandle < 0) return;
+
+	do
+	{
+		if ((strcmp(fileinfo.name, ".") == 0) || (strcmp(fileinfo.name, "..") == 0)) continue;
+
+		char sFileName[kMaxStr];
+		strcpy(sFileName, sPath);
+		strcat(sFileName, fileinfo.name);
+
+		if ((fileinfo.attrib & _A_SUBDIR) == _A_SUBDIR)
+		{
+			CollectDictSamples(sFileName, sExts, pSamples);
+			continue;
+		}
+		if ((fileinfo.size <= 0) || (fileinfo.size > kDictSampleMaxSize)) continue;
+
+		// the same extension checks TransferDir makes, files it would give no type are left out
+		char drive[_MAX_DRIVE+1];
+		char dir[_MAX_DIR+1];
+		char fname[_MAX_FNAME+1];
+		char ext[_MAX_EXT+1];
+		_splitpath(sFileName, drive, dir, fname, ext);
+
+		char extCheck[_MAX_EXT+2] = "*";
+		strcat(extCheck, ext);
+		if (!ExtCheck(sExts, extCheck) || (strlen(ext) < 2) || (strlen(ext) > 5)) continue;
+
+		char sExt[5];
+		strcpy(sExt, &ext[1]);
+		_strupr(sExt);
+
+		DictSamples& samples = (*pSamples)[g_Mgr->StrToType(sExt)];
+		if (samples.data.size() + fileinfo.size > kDictSamplesMaxSize) continue;
+
+		FILE* fp = fopen(sFileName, "rb");
+		if (fp == nullptr) continue;
+
+		size_t nOffset = samples.data.size();
+		samples.data.resize(nOffset + fileinfo.size);
+		if (fread(&samples.data[nOffset], fileinfo.size, 1, fp) == 1)
+		{
+			samples.sizes.push_back(fileinfo.size);
+		}
+		else
+		{
+			samples.data.resize(nOffset);
+		}
+		fclose(fp);
+	} while (_findnext(nFindHandle, &fileinfo) == 0);
+
+	_findclose(nFindHandle);
+}
+
+// Trains a dictionary for each type with enough small files so they compress well even though each one is small
+static void TrainDictionaries(RezMgr* pMgr, const char* sParamPath, const char* sExts)
+{
+	std::map<unsigned long, DictSamples> samples;
+	CollectDictSamples(sParamPath, sExts, &samples);
+
+	unsigned char dict[kRezDictionaryDefaultSize];
+	for (std::map<unsigned long, DictSamples>::iterator it = samples.begin(); it != samples.end(); ++it)
+	{
+		if (it->second.sizes.size() < kDictMinSamples) continue;
+
+		size_t nDictSize = RezTrainDictionary(&it->second.data[0], &it->second.sizes[0], it->second.sizes.size(), dict, sizeof(dict));
+		if (nDictSize == 0) continue;
+
+		char sType[5];
+		pMgr->TypeToStr(it->first, sType);
+		if (!pMgr->SetDictionary(it->first, dict, (unsigned long)nDictSize))
+		{
+			zprintf("ERROR! Unable to save dictionary for type %s\n", sType);
+			g_ErrCount++;
+			continue;
+		}
+
+		if (g_Verbose) zprintf("Trained %i byte dictionary for type %s from %i files\n", (int)nDictSize, sType, (int)it->second.sizes.size());
+	}
+}
+
+// Reports the data that didn't need writing because it was already in the file
+static void NotifyDeduplicated(RezMgr* pMgr)
+{
+	RezWriteStats stats;
+	pMgr->GetWriteStats(&stats);
+	if (stats.numDeduplicated > 0)
+	{
+		zprintf("%i duplicate resources share data, %.1f MB not written\n", (int)stats.numDeduplicated, (double)stats.bytesDeduplicated / (1024.0 * 1024.0));
+	}
+}
+
+// Reports the zeroes written to start big items on a boundary, against all of the data written
+static void NotifyAligned(RezMgr* pMgr)
+{
+	RezWriteStats stats;
+	pMgr->GetWriteStats(&stats);
+	if (stats.numAligned > 0)
+	{
+		zprintf("%i resources aligned, %.1f KB of padding (%.2f%% of the file)\n", (int)stats.numAligned, (double)stats.bytesPadding / 1024.0,
+				(stats.bytesWritten > 0) ? (double)stats.bytesPadding * 100.0 / (double)stats.bytesWritten : 0.0);
+	}
+}
+
 static void NotifyErrWarn()
 {
 	if (g_ErrCount > 0) zprintf("\n%i ERRORS HAVE OCCURED!!!\n", g_ErrCount);
 	if (g_WarnCount > 0) zprintf("\n%i WARNINGS HAVE OCCURED!!!\n", g_WarnCount);
 }
 
+// Sets up compression from a list like "DAT:9;TXT:1;*:1", each entry is an extension (or * for every
+// other type) and a level from 1 (fastest) to 9 (smallest), level 0 stores that type uncompressed
+static bool SetCompression(RezMgr* pMgr, const char* sCompression)
+{
+	const unsigned int SpecSize = 255;
+	char szCompression[SpecSize+1];
+	strncpy(szCompression, sCompression, SpecSize);
+	szCompression[SpecSize] = '\0';
+
+	char *p = strtok(szCompression, ";");
+	while (p)
+	{
+		char* sLevel = strchr(p, ':');
+		int nLevel = (sLevel != nullptr) ? atoi(sLevel+1) : kRezCompressDefaultLevel;
+		if (sLevel != nullptr) *sLevel = '\0';
+
+		if ((nLevel < 0) || (nLevel > kRezCompressMaxLevel) || (strlen(p) == 0) || (strlen(p) > 4))
+		{
+			zprintf("ERROR! Bad compression setting %s\n", p);
+			g_ErrCount++;
+			return false;
+		}
+
+		RezCodec codec = (nLevel > 0) ? RezCodecLZ4 : RezCodecNone;
+		if (strcmp(p, "*") == 0)
+		{
+			pMgr->SetDefaultCompression(codec, nLevel);
+		}
+		else
+		{
+			_strupr(p);
+			if (!pMgr->SetCompression(pMgr->StrToType(p), codec, nLevel))
+			{
+				zprintf("ERROR! Too many compression settings\n");
+				g_ErrCount++;
+				return false;
+			}
+		}
+
+		p = strtok(NULL, ";");
+	}
+
+	return true;
+}
+
+// a size like 64, 64K or 1M
+static unsigned long ParseSize(const char* s, const char** sEnd)
+{
+	char* p;
+	unsigned long nSize = strtoul(s, &p, 10);
+	if (toupper(*p) == 'K')
+	{
+		nSize *= 1024;
+		++p;
+	}
+	else if (toupper(*p) == 'M')
+	{
+		nSize *= 1024 * 1024;
+		++p;
+	}
+	*sEnd = p;
+	return nSize;
+}
+
+// Sets up item alignment from "size[:boundary]", resources of at least size bytes start on a multiple of
+// boundary (4K if it is left out) in the file
+static bool SetAlignment(RezMgr* pMgr, const char* sAlignment)
+{
+	const char* p;
+	unsigned long nSize = ParseSize(sAlignment, &p);
+	unsigned long nBoundary = kRezDefaultItemAlignment;
+	if (*p == ':') nBoundary = ParseSize(p + 1, &p);
+
+	if ((*p != '\0') || (nBoundary == 0) || ((nBoundary & (nBoundary - 1)) != 0))
+	{
+		zprintf("ERROR! Bad alignment setting %s\n", sAlignment);
+		g_ErrCount++;
+		return false;
+	}
+
+	pMgr->SetItemAlignment(nSize, nBoundary);
+	return true;
+}
+
 static bool CheckLithHeader(RezMgr* pMgr)
 {
 	// if the LithRez flag is not set then don't even check we are OK
@@ -663,7 +1084,31 @@ bool IsCommandSet(char cFlag, const char* pszCommand)
 	return false;
 }
 
-int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir, bool bLithRez, const char* sFilespec)
+// Turns on the path index if the command asks for it, a file made before there were any may have no room for one
+static void SetPathIndex(RezMgr* pMgr, const char* sCmd, const char* sRezFile)
+{
+	if (IsCommandSet('H', sCmd) && !pMgr->SetPathIndex(true))
+	{
+		zprintf("WARNING! No room for a path index in %s, it is left without one.\n", sRezFile);
+		g_WarnCount++;
+	}
+}
+
+// Saves a checksum with every file if the command asks for it, that makes the file version 2 which older readers can't open
+static void SetChecksums(RezMgr* pMgr, const char* sCmd)
+{
+	if (IsCommandSet('K', sCmd)) pMgr->SetChecksums(true);
+}
+
+// Stores identical files in different directories only once if the command asks for it, every file that hashes the
+// same as one already stored is read back to make sure
+static void SetDeduplicate(RezMgr* pMgr, const char* sCmd)
+{
+	if (IsCommandSet('U', sCmd)) pMgr->SetDeduplicate(true);
+}
+
+int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir, bool bLithRez, const char* sFilespec,
+				const char* sCompression, const char* sOldRezFile, const char* sAlignment)
 {
 	assert(sCmd != nullptr);
 	assert(sRezFile != nullptr);
@@ -675,6 +1120,12 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 	g_RezCount        = 0;
 	g_ErrCount        = 0;
 	g_WarnCount       = 0;
+	g_NoChecksumCount = 0;
+	g_SameCount       = 0;
+	g_DeltaCount      = 0;
+	g_RemovedCount    = 0;
+	g_ChangedBytes    = 0;
+	g_PatchBytes      = 0;
 	g_LowerCaseUsed   = false;
 	g_IsLithRez       = bLithRez;
 
@@ -689,6 +1140,8 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 	if (IsCommandSet('C', sCmd)) Command = 'C';
 	if (IsCommandSet('F', sCmd)) Command = 'F';
 	if (IsCommandSet('S', sCmd)) Command = 'S';
+	if (IsCommandSet('T', sCmd)) Command = 'T';
+	if (IsCommandSet('P', sCmd)) Command = 'P';
 
 	switch (Command)
 	{
@@ -710,10 +1163,19 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 			RezDir* pDir = Mgr.GetRootDir();
 			zprintf("\nExtracting rez file %s to directory %s\n", sRezFile, sTargetDir);
 
+			memset(&g_CopyStats, 0, sizeof(g_CopyStats));
+			std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
 			ExtractDir(pDir, sTargetDir);
 
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			double megabytes = (double)g_CopyStats.bytesCopied / (1024.0 * 1024.0);
+			double kernelPercent = (g_CopyStats.bytesCopied > 0) ? (100.0 * (double)g_CopyStats.bytesKernelCopied / (double)g_CopyStats.bytesCopied) : 0.0;
+
 			if (g_Verbose) zprintf("\n");
 			zprintf("Finished extracting %i directories %i resources\n", g_DirCount, g_RezCount);
+			zprintf("Copied %.1f MB in %.2f seconds (%.1f MB/s, %.0f%% copied by the kernel)\n",
+					megabytes, seconds, (seconds > 0.0) ? (megabytes / seconds) : 0.0, kernelPercent);
 
 			NotifyErrWarn();
 			Mgr.Close();
@@ -742,6 +1204,111 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 		}
 		break;
 
+	case 'T': // test
+		{
+			ZMgrRezMgr Mgr;
+			if (!Mgr.Open(sRezFile))
+			{
+				zprintf("\nFailed to open file %s\n", sRezFile);
+				g_ErrCount++;
+				break;
+			}
+			g_Mgr = &Mgr;
+
+			if (!CheckLithHeader(g_Mgr)) break;
+
+			zprintf("\nTesting rez file %s\n", sRezFile);
+
+			std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+			TestDir(Mgr.GetRootDir(), "");
+
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			RezChecksumStats stats;
+			Mgr.GetChecksumStats(&stats);
+			double megabytes = (double)stats.bytesVerified / (1024.0 * 1024.0);
+
+			if (g_Verbose) zprintf("\n");
+			zprintf("Finished testing %ld directories %ld resources\n", g_DirCount, g_RezCount);
+			zprintf("Checked %.1f MB in %.2f seconds (%.1f MB/s)\n", megabytes, seconds, (seconds > 0.0) ? (megabytes / seconds) : 0.0);
+			if (g_NoChecksumCount > 0) zprintf("%ld resources have no checksum and were not checked\n", g_NoChecksumCount);
+
+			NotifyErrWarn();
+			Mgr.Close();
+		}
+		break;
+
+	case 'P': // patch
+		{
+			if ((sTargetDir == nullptr) || (sOldRezFile == nullptr))
+			{
+				zprintf("ERROR! Old or new rez file missing.\n");
+				g_ErrCount++;
+				return 0;
+			}
+
+			ZMgrRezMgr OldMgr;
+			if (!OldMgr.Open(sOldRezFile))
+			{
+				zprintf("\nFailed to open file %s\n", sOldRezFile);
+				g_ErrCount++;
+				break;
+			}
+			ZMgrRezMgr NewMgr;
+			if (!NewMgr.Open(sTargetDir))
+			{
+				zprintf("\nFailed to open file %s\n", sTargetDir);
+				g_ErrCount++;
+				OldMgr.Close();
+				break;
+			}
+			if (!CheckLithHeader(&OldMgr) || !CheckLithHeader(&NewMgr))
+			{
+				NewMgr.Close();
+				OldMgr.Close();
+				break;
+			}
+
+			ZMgrRezMgr Mgr;
+			if (!Mgr.Open(sRezFile, false, true))
+			{
+				NewMgr.Close();
+				OldMgr.Close();
+				return 0;
+			}
+			g_Mgr = &Mgr;
+
+			if (g_IsLithRez)
+			{
+				g_Mgr->SetUserTitle(LithTechUserTitle);
+			}
+			SetChecksums(g_Mgr, sCmd);
+
+			if ((sCompression != nullptr) && !SetCompression(g_Mgr, sCompression))
+			{
+				Mgr.Close();
+				NewMgr.Close();
+				OldMgr.Close();
+				return 0;
+			}
+
+			zprintf("\nCreating patch %s from %s to %s\n", sRezFile, sOldRezFile, sTargetDir);
+
+			PatchDir(Mgr.GetRootDir(), NewMgr.GetRootDir(), OldMgr.GetRootDir(), "");
+
+			if (g_Verbose) zprintf("\n");
+			zprintf("Finished patching %ld directories %ld resources\n", g_DirCount, g_RezCount);
+			zprintf("%ld resources changed (%ld saved as deltas), %ld unchanged\n", g_RezCount - g_SameCount, g_DeltaCount, g_SameCount);
+			zprintf("Patch holds %.1f MB of changed resources in %.1f MB\n", (double)g_ChangedBytes / (1024.0 * 1024.0), (double)g_PatchBytes / (1024.0 * 1024.0));
+			if (g_RemovedCount > 0) zprintf("%ld resources are gone from the new file but a patch can't remove them\n", g_RemovedCount);
+
+			NotifyErrWarn();
+			Mgr.Close();
+			NewMgr.Close();
+			OldMgr.Close();
+		}
+		break;
+
 	case 'C': // create
 		{
 			if (sTargetDir == nullptr)
@@ -763,14 +1330,33 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 				g_Mgr->SetUserTitle(LithTechUserTitle);
 			}
 
+			SetDeduplicate(g_Mgr, sCmd);
+			SetChecksums(g_Mgr, sCmd);
+
+			if ((sCompression != nullptr) && !SetCompression(g_Mgr, sCompression))
+			{
+				Mgr.Close();
+				return 0;
+			}
+			if ((sAlignment != nullptr) && !SetAlignment(g_Mgr, sAlignment))
+			{
+				Mgr.Close();
+				return 0;
+			}
+			SetPathIndex(g_Mgr, sCmd, sRezFile);
+
 			RezDir* pDir = Mgr.GetRootDir();
 
 			zprintf("\nCreating rez file %s from directory %s\n", sRezFile, sTargetDir);
 
+			if (IsCommandSet('D', sCmd)) TrainDictionaries(g_Mgr, sTargetDir, sFilespec);
+
 			TransferDir(pDir, sTargetDir, sFilespec);
 
 			if (g_Verbose) zprintf("\n");
 			zprintf("Finished creating %i directories %i resources\n", g_DirCount, g_RezCount);
+			NotifyDeduplicated(g_Mgr);
+			NotifyAligned(g_Mgr);
 
 			Mgr.ForceIsSortedFlag(true);
 			NotifyErrWarn();
@@ -794,6 +1380,11 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 			g_Mgr = &Mgr;
 
 			if (!CheckLithHeader(g_Mgr)) break;
+			if ((sCompression != nullptr) && !SetCompression(g_Mgr, sCompression)) break;
+			if ((sAlignment != nullptr) && !SetAlignment(g_Mgr, sAlignment)) break;
+			SetPathIndex(g_Mgr, sCmd, sRezFile);
+			SetDeduplicate(g_Mgr, sCmd);
+			SetChecksums(g_Mgr, sCmd);
 
 			RezDir* pDir = Mgr.GetRootDir();
 
@@ -803,6 +1394,8 @@ int RezCompiler(const char* sCmd, const char* sRezFile, const char* sTargetDir,
 
 			if (g_Verbose) zprintf("\n");
 			zprintf("Finished freshening %i directories %i resources\n", g_DirCount, g_RezCount);
+			NotifyDeduplicated(g_Mgr);
+			NotifyAligned(g_Mgr);
 
 			NotifyErrWarn();
 			Mgr.Close();
@@ -19,15 +19,25 @@ bool IsCommandSet(char flag, const char* command);
 // f - freshen
 // s - sort
 // i - information
+// t - test every resource against its checksum
+// p - patch, make rezFilename hold what changed from oldRezFile to the rez file targetDir names (see RezItem::SaveDelta)
 // v - Verbose
 // z - Warn zero len
 // l - Lower case ok
+// d - train a dictionary for each compressed type out of its small files (with create)
+// h - write a path index so the file opens without reading its directories (with create or freshen, see RezMgr::SetPathIndex)
 //
 // so strings can look like cl, cv, c, etc.
 //
 // rezFilename is the filename of the Rez file that will be created
 // targetDir is the name of the root directory of the resource hierarcky
+// compression is how items are compressed when creating, freshening or patching, a list like "DAT:9;TXT:1;*:1" of
+// extensions (* for every other type) and levels from 1 (fastest) to 9 (smallest), 0 for none (the default)
+// oldRezFile is the rez file a patch is made against
+// alignment is "size[:boundary]" (sizes in bytes or with a K or M after them), when creating or freshening resources of
+// at least size bytes start on a multiple of boundary (4K if left out) in the file, see RezMgr::SetItemAlignment
 int RezCompiler(const char* cmdLine, const char* rezFilename, const char* targetDir = nullptr,
-				bool isLithRez = false, const char* fileSpec = "*.*");
+				bool isLithRez = false, const char* fileSpec = "*.*", const char* compression = nullptr,
+				const char* oldRezFile = nullptr, const char* alignment = nullptr);
 
 }}
\ No newline at end of file
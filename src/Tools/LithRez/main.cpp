@@ -41,16 +41,43 @@ void DisplayHelp()
 {
 	printf("\nLITHREZ 1.10 (Apr-12-2004) Copyright (C) 2004 Touchdown Entertainment, Inc.\n");
 	printf("\nUsage: LITHREZ <commands> <rez file name> [parameters]\n");
-	printf("\nCommands: c <rez file name> <root directory to read> [extension[;]] - Create");
+	printf("\nCommands: c <rez file name> <root directory to read> [extension[;]] [type:level[;]] [size[:boundary]] - Create");
 	printf("\n          v <rez file name>                          - View");
 	printf("\n          x <rez file name> <directory to output to> - Extract");
+	printf("\n          t <rez file name>                          - Test checksums");
+	printf("\n          p <rez file name> <old rez file> <new rez file> [type:level[;]] - Patch");
 	printf("\nOptions:  v                                          - Verbose");
 	printf("\n          z                                          - Warn zero len");
-	printf("\n          l                                          - Lower case ok\n");
+	printf("\n          l                                          - Lower case ok");
+	printf("\n          d                                          - Train dictionaries (create)");
+	printf("\n          h                                          - Path index (create, freshen)");
+	printf("\n          k                                          - Checksums (create, freshen, patch)");
+	printf("\n          u                                          - Store duplicate files once (create, freshen)\n");
 	printf("\nExample: LithRez.exe cv foo.rez c:\\foo *.ltb;*.dat;*.dtx");
 	printf("\n         (sould create rez file foo.rez from the contenst of the");
 	printf("\n          directory \"c:\\foo\" where files with extensions ltb dat and");
-	printf("\n          dtx are added, the verbose option would be turned on)\n\n");
+	printf("\n          dtx are added, the verbose option would be turned on)");
+	printf("\n         LithRez.exe c foo.rez c:\\foo *.* DAT:9;TXT:1;*:1");
+	printf("\n         (compresses dat files as small as possible, txt files and");
+	printf("\n          everything else as fast as possible, level 0 leaves a type alone)");
+	printf("\n         LithRez.exe cd foo.rez c:\\foo *.* TXT:9");
+	printf("\n         (also trains a dictionary on the small txt files so each one");
+	printf("\n          compresses well on its own)");
+	printf("\n         LithRez.exe c foo.rez c:\\foo *.* *:0 64K:4K");
+	printf("\n         (starts every file of 64 KB or more on a 4 KB page so it can be");
+	printf("\n          mapped or read past the cache on its own, and reports the padding)");
+	printf("\n         LithRez.exe ch foo.rez c:\\foo");
+	printf("\n         (also writes a path index, opening foo.rez read only then reads");
+	printf("\n          just that and finds files by path without reading every directory)");
+	printf("\n         LithRez.exe ck foo.rez c:\\foo");
+	printf("\n         (also saves a checksum of every file so t can test them, the");
+	printf("\n          file is then version 2 and older readers can't open it)");
+	printf("\n         LithRez.exe cu foo.rez c:\\foo");
+	printf("\n         (files with the same contents in different directories share one");
+	printf("\n          copy of the data, and the space saved is reported)");
+	printf("\n         LithRez.exe p patch.rez foo.rez newfoo.rez");
+	printf("\n         (makes patch.rez hold just what changed from foo.rez to newfoo.rez,");
+	printf("\n          the game opens it over foo.rez with OpenAdditional)\n\n");
 }
 
 int main(int argc, char *argv[], char *envp[])
@@ -67,20 +94,37 @@ int main(int argc, char *argv[], char *envp[])
 		DisplayHelp();
 		return 1;
 	}
+	if ((argc < 5) && IsCommandSet('P', argv[1]))
+	{
+		DisplayHelp();
+		return 1;
+	}
 
 	char sRezFile[kMaxStr];
 	strcpy(sRezFile, argv[2]);
 	_strupr(sRezFile);
 	char sExt[] = "*.*";
 
-	if (argc < 5)
+	if (IsCommandSet('P', argv[1]))
+	{
+		int nNumItems = RezCompiler(argv[1], argv[2], argv[4], true, sExt, (argc < 6) ? nullptr : argv[5], argv[3]);
+	}
+	else if (argc < 5)
 	{
 		int nNumItems = RezCompiler(argv[1], argv[2], argv[3], true, sExt);
 	}
-	else
+	else if (argc < 6)
 	{
 		int nNumItems = RezCompiler(argv[1], argv[2], argv[3], true, argv[4]);
 	}
+	else if (argc < 7)
+	{
+		int nNumItems = RezCompiler(argv[1], argv[2], argv[3], true, argv[4], argv[5]);
+	}
+	else
+	{
+		int nNumItems = RezCompiler(argv[1], argv[2], argv[3], true, argv[4], argv[5], nullptr, argv[6]);
+	}
 
 	printf("Rez File Size = %lu\n", GetFileSize(sRezFile));
 	return 0;